@@ -0,0 +1,47 @@
+// Replacements for the global operator new and delete that count every heap allocation, so that benchmarks can report allocations per
+// operation.  They live in a file of their own so that the compiler doesn't inline them into the code being measured
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long long> g_allocations(0);
+
+void *operator new(size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+long long GetAllocationCount()
+{
+	return g_allocations.load();
+}
@@ -0,0 +1,1625 @@
+// Micro-benchmarks for the engine's CPU hot paths: spline evaluation and lookup, track generation, the matrix stack, the camera,
+// vertex buffer building, text layout and render queue sorting.  Nothing here makes an OpenGL call, so it runs without a window or a GL context.
+//
+// Usage: Benchmark [--filter text] [--min-time seconds] [--font file.ttf] [--out report.json] [--check]
+//
+// Setting up some benchmarks also checks that the code timed gives the same results as the code it replaced; if a check fails, nothing
+// is timed and the exit status is 1.  --check runs the checks only.
+//
+// Each benchmark is run until it has taken at least --min-time seconds (default 0.5) in total, split over several repetitions, and the
+// median repetition is reported.  The JSON report lists the benchmarks sorted by name, with a fixed set of fields printed in a fixed
+// format, so reports from different builds can be compared line by line:
+//   ns_per_op          time per operation
+//   allocs_per_op      heap allocations (operator new calls) per operation
+//   items_per_second   throughput, in the items each benchmark names (points, characters, vertices...)
+//   bytes_per_second   throughput in bytes, where the benchmark moves data
+//   counters           other measurements, such as sample counts or thread speedups
+
+#include "../Common.h"
+#include "../CatmullRom.h"
+#include "../Camera.h"
+#include "../MatrixStack.h"
+#include "../VertexBufferObject.h"
+#include "../FreeTypeFont.h"
+#include "../ParallelFor.h"
+#include "../RenderQueue.h"
+#include "../ShaderPreprocessor.h"
+#include "../Shaders.h"
+#include "../TrackFile.h"
+#include "../TrackSpatialIndex.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#ifdef _MSC_VER
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+
+// Number of heap allocations made so far, counted by the operator new in AllocationCounter.cpp
+long long GetAllocationCount();
+
+
+// Keep the compiler from optimising away a result that is never used
+template <typename T> inline void KeepResult(const T &value)
+{
+#ifdef _MSC_VER
+	static volatile const void *pSink;
+	pSink = &value;
+#else
+	__asm__ __volatile__("" : : "g"(&value) : "memory");
+#endif
+}
+
+static double Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// A benchmark runs its operation iIterations times.  Work per operation is given by itemsPerOp and bytesPerOp, for the throughput figures
+struct Benchmark
+{
+	string name;
+	std::function<void(long long iIterations)> run;
+	double itemsPerOp;
+	double bytesPerOp;
+	vector<pair<string, double> > counters = {};	// Optional, so may be left out of an initialiser
+};
+
+struct BenchmarkResult
+{
+	string name;
+	long long iterations;
+	double nsPerOp;
+	double allocsPerOp;
+	double itemsPerSecond;
+	double bytesPerSecond;
+	vector<pair<string, double> > counters;
+};
+
+static const int REPETITIONS = 5;
+
+// Double the iteration count until one repetition takes a fair share of the time budget, then time REPETITIONS repetitions of that
+// many iterations and keep the median
+static BenchmarkResult RunBenchmark(const Benchmark &benchmark, double fMinTime)
+{
+	double fRepetitionTime = fMinTime / REPETITIONS;
+	long long iIterations = 1;
+	for (;;) {
+		double fStart = Now();
+		benchmark.run(iIterations);
+		double fElapsed = Now() - fStart;
+		if (fElapsed >= fRepetitionTime || iIterations >= (1LL << 40))
+			break;
+		// Aim a little past the target, so the loop usually ends on the next pass
+		double fScale = fElapsed > 0.0 ? 1.4 * fRepetitionTime / fElapsed : 1000.0;
+		fScale = fScale < 2.0 ? 2.0 : (fScale > 1000.0 ? 1000.0 : fScale);
+		iIterations = (long long) (iIterations * fScale);
+	}
+
+	vector<double> times;
+	long long iAllocations = 0;
+	for (int i = 0; i < REPETITIONS; i++) {
+		long long iAllocationsBefore = GetAllocationCount();
+		double fStart = Now();
+		benchmark.run(iIterations);
+		times.push_back(Now() - fStart);
+		iAllocations += GetAllocationCount() - iAllocationsBefore;
+	}
+	std::sort(times.begin(), times.end());
+	double fMedian = times[REPETITIONS / 2];
+
+	BenchmarkResult result;
+	result.name = benchmark.name;
+	result.iterations = iIterations;
+	result.nsPerOp = fMedian * 1e9 / iIterations;
+	result.allocsPerOp = (double) iAllocations / ((double) iIterations * REPETITIONS);
+	result.itemsPerSecond = benchmark.itemsPerOp * iIterations / fMedian;
+	result.bytesPerSecond = benchmark.bytesPerOp * iIterations / fMedian;
+	result.counters = benchmark.counters;
+	return result;
+}
+
+
+// Tracks for the spline benchmarks
+
+// A closed wavy loop of iNumPoints control points, about 5 units apart, with hills and banked up vectors
+static vector<glm::vec3> MakeLoop(int iNumPoints, vector<glm::vec3> &upVectors)
+{
+	vector<glm::vec3> points(iNumPoints);
+	upVectors.resize(iNumPoints);
+	float fRadius = 5.0f * iNumPoints / (2.0f * (float) M_PI);
+	for (int i = 0; i < iNumPoints; i++) {
+		float a = 2.0f * (float) M_PI * i / iNumPoints;
+		float r = fRadius * (1.0f + 0.05f * sin(a * 7.0f));
+		points[i] = glm::vec3(r * cos(a), 20.0f * sin(a * 11.0f), r * sin(a));
+		upVectors[i] = glm::normalize(glm::vec3(0.2f * cos(a * 5.0f), 1.0f, 0.0f));
+	}
+	return points;
+}
+
+// Control points can only be given to CCatmullRom as a file, so write them to a scratch one.  %.9g keeps every float exactly
+static bool LoadPoints(CCatmullRom &track, const vector<glm::vec3> &points, const vector<glm::vec3> &upVectors)
+{
+	const char *filename = "benchmark_track.txt";
+	FILE *fp;
+	fopen_s(&fp, filename, "wt");
+	if (!fp)
+		return false;
+	for (int i = 0; i < (int) points.size(); i++)
+		fprintf(fp, "%.9g %.9g %.9g %.9g %.9g %.9g\n", points[i].x, points[i].y, points[i].z, upVectors[i].x, upVectors[i].y, upVectors[i].z);
+	fclose(fp);
+
+	bool bLoaded = track.LoadControlPoints(filename);
+	remove(filename);
+	return bLoaded;
+}
+
+static bool LoadLoop(CCatmullRom &track, int iNumPoints)
+{
+	vector<glm::vec3> upVectors;
+	vector<glm::vec3> points = MakeLoop(iNumPoints, upVectors);
+	return LoadPoints(track, points, upVectors);
+}
+
+// Tracks are shared between benchmarks, and only built once: a 1M point track takes a few seconds
+static std::shared_ptr<CCatmullRom> GetLoop(int iNumPoints)
+{
+	static std::map<int, std::shared_ptr<CCatmullRom> > tracks;
+	std::shared_ptr<CCatmullRom> &track = tracks[iNumPoints];
+	if (!track) {
+		track = std::make_shared<CCatmullRom>();
+		if (!LoadLoop(*track, iNumPoints)) {
+			fprintf(stderr, "Cannot create a %d point track\n", iNumPoints);
+			exit(1);
+		}
+		track->ComputeCentreline();
+		track->ComputeOffsetCurves();
+	}
+	return track;
+}
+
+// Random distances along a track, and the same distances sorted, as vehicles spread around a circuit would be
+static vector<float> RandomDistances(float fLength, int iCount, bool bSorted)
+{
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> distribution(0.0f, fLength);
+	vector<float> distances(iCount);
+	for (int i = 0; i < iCount; i++)
+		distances[i] = distribution(random);
+	if (bSorted)
+		std::sort(distances.begin(), distances.end());
+	return distances;
+}
+
+static string SizeName(int n)
+{
+	char name[32];
+	if (n >= 1000000 && n % 1000000 == 0)
+		sprintf_s(name, "%dM", n / 1000000);
+	else if (n >= 1000 && n % 1000 == 0)
+		sprintf_s(name, "%dk", n / 1000);
+	else
+		sprintf_s(name, "%d", n);
+	return name;
+}
+
+
+// Benchmark definitions.  Objects the benchmarks use are created up front and shared through std::shared_ptr, so that setup isn't timed. 
+// Setup is skipped for groups that --filter leaves out
+
+static string g_filter;
+
+static bool IsWanted(const string &name)
+{
+	return g_filter.empty() || name.find(g_filter) != string::npos;
+}
+
+// Checks that fast paths give the same answers as the code they replaced.  They run as the benchmarks are set up, and any failure makes
+// the run fail, as there's no point timing code that's wrong
+static int g_checks = 0, g_checkFailures = 0;
+
+static bool Check(bool bPassed, const string &what)
+{
+	g_checks++;
+	if (!bPassed) {
+		g_checkFailures++;
+		fprintf(stderr, "Check failed: %s\n", what.c_str());
+	}
+	return bPassed;
+}
+
+// How far apart two floats are, in units in the last place: 0 if they are the same (counting -0 and +0 as the same), 1 if they are
+// neighbours
+static long long UlpDistance(float a, float b)
+{
+	int ia, ib;
+	memcpy(&ia, &a, sizeof(ia));
+	memcpy(&ib, &b, sizeof(ib));
+	// Map the sign and magnitude bit patterns onto a line, so that neighbouring floats are neighbouring integers
+	long long la = ia < 0 ? -(long long) (ia & 0x7fffffff) : ia;
+	long long lb = ib < 0 ? -(long long) (ib & 0x7fffffff) : ib;
+	return la > lb ? la - lb : lb - la;
+}
+
+// The SSE and AVX kernels do the same multiplies and adds as the reference, in the same order, so must match it exactly
+static const long long INTERPOLATE_BATCH_TOLERANCE = 0;	// ULPs
+
+// Every segment of a 1000 point loop, one with denormal control points and one with all four the same, each evaluated at the ends and
+// just inside them, at denormal parameters, and at random ones, with counts that leave each kernel a remainder for its scalar tail
+static void CheckInterpolateBatch()
+{
+	vector<float> t;
+	float edges[] = { 0.0f, -0.0f, 1.0f, nextafterf(1.0f, 0.0f), nextafterf(0.0f, 1.0f), 1e-40f, -1e-40f, FLT_MIN, nextafterf(FLT_MIN, 0.0f),
+					  0.5f, 1.0f - FLT_EPSILON, 1e-20f };
+	t.insert(t.end(), edges, edges + sizeof(edges) / sizeof(edges[0]));
+	std::mt19937 random(99);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	while (t.size() < 61)
+		t.push_back(distribution(random));
+
+	vector<glm::vec3> upVectors;
+	vector<glm::vec3> points = MakeLoop(1000, upVectors);
+	points.push_back(glm::vec3(1e-39f, -2e-39f, 3e-40f));
+	points.push_back(glm::vec3(-1e-38f, 5e-39f, 0.0f));
+	points.push_back(glm::vec3(2e-39f, 1e-45f, -7e-39f));
+	points.push_back(glm::vec3(4e-40f, -1e-39f, 1e-38f));
+	for (int i = 0; i < 4; i++)
+		points.push_back(glm::vec3(3.0f, -4.0f, 5.0f));
+
+	int iNumPoints = (int) points.size();
+	vector<float> reference(3 * t.size()), output(3 * t.size());
+	bool bAVX = true;
+	int iFailures = 0;
+	for (int j = 0; j + 3 < iNumPoints && iFailures < 10; j++) {
+		int iCount = j < (int) t.size() ? j + 1 : (int) t.size();
+		float *rx = &reference[0], *ry = rx + t.size(), *rz = ry + t.size();
+		float *x = &output[0], *y = x + t.size(), *z = y + t.size();
+		CCatmullRom::InterpolateBatchReference(points[j], points[j + 1], points[j + 2], points[j + 3], t.data(), iCount, rx, ry, rz);
+		for (int k = 0; k < 2; k++) {
+			std::fill(output.begin(), output.end(), -1.0f);
+			if (k == 0)
+				CCatmullRom::InterpolateBatchWithSSE(points[j], points[j + 1], points[j + 2], points[j + 3], t.data(), iCount, x, y, z);
+			else if (!CCatmullRom::InterpolateBatchWithAVX(points[j], points[j + 1], points[j + 2], points[j + 3], t.data(), iCount, x, y, z)) {
+				bAVX = false;
+				continue;
+			}
+			long long iWorst = 0;
+			int iWorstAt = 0;
+			for (int i = 0; i < iCount; i++) {
+				long long d = std::max(UlpDistance(x[i], rx[i]), std::max(UlpDistance(y[i], ry[i]), UlpDistance(z[i], rz[i])));
+				if (d > iWorst) {
+					iWorst = d;
+					iWorstAt = i;
+				}
+			}
+			char what[160];
+			sprintf_s(what, "InterpolateBatch (%s) on segment %d is within %lld ULPs of the reference (%lld at t = %g)", k == 0 ? "SSE" : "AVX", 
+				j, INTERPOLATE_BATCH_TOLERANCE, iWorst, t[iWorstAt]);
+			if (!Check(iWorst <= INTERPOLATE_BATCH_TOLERANCE, what))
+				iFailures++;
+		}
+	}
+	if (!bAVX)
+		fprintf(stderr, "AVX isn't supported here, so only the SSE kernel was checked\n");
+}
+
+static void AddInterpolateBenchmarks(vector<Benchmark> &benchmarks)
+{
+	if (!IsWanted("CatmullRom/InterpolateBatch/256") && !IsWanted("CatmullRom/InterpolateBatchReference/256"))
+		return;
+	CheckInterpolateBatch();
+
+	static const int NUM_PARAMETERS = 256;
+	auto t = std::make_shared<vector<float> >(NUM_PARAMETERS);
+	auto output = std::make_shared<vector<float> >(3 * NUM_PARAMETERS);
+	for (int i = 0; i < NUM_PARAMETERS; i++)
+		(*t)[i] = (i + 0.5f) / NUM_PARAMETERS;
+
+	auto points = std::make_shared<vector<glm::vec3> >();
+	points->push_back(glm::vec3(0, 0, 0));
+	points->push_back(glm::vec3(10, 2, 1));
+	points->push_back(glm::vec3(20, -1, 5));
+	points->push_back(glm::vec3(30, 0, 12));
+
+	Benchmark batch = { "CatmullRom/InterpolateBatch/256", [=](long long iIterations) {
+		vector<glm::vec3> &p = *points;
+		float *x = output->data(), *y = x + NUM_PARAMETERS, *z = y + NUM_PARAMETERS;
+		for (long long i = 0; i < iIterations; i++) {
+			CCatmullRom::InterpolateBatch(p[0], p[1], p[2], p[3], t->data(), NUM_PARAMETERS, x, y, z);
+			KeepResult(*output);
+		}
+	}, (double) NUM_PARAMETERS, 0.0 };
+	benchmarks.push_back(batch);
+
+	Benchmark reference = { "CatmullRom/InterpolateBatchReference/256", [=](long long iIterations) {
+		vector<glm::vec3> &p = *points;
+		float *x = output->data(), *y = x + NUM_PARAMETERS, *z = y + NUM_PARAMETERS;
+		for (long long i = 0; i < iIterations; i++) {
+			CCatmullRom::InterpolateBatchReference(p[0], p[1], p[2], p[3], t->data(), NUM_PARAMETERS, x, y, z);
+			KeepResult(*output);
+		}
+	}, (double) NUM_PARAMETERS, 0.0 };
+	benchmarks.push_back(reference);
+}
+
+// The parts of CCatmullRom the segment lookup benchmarks need, which aren't in its public interface
+struct CatmullRomAccess
+{
+	static int FindSegment(CCatmullRom &track, float fLength, int iHint = -1) { return track.FindSegment(fLength, iHint); }
+
+	// The first segment containing fLength, by scanning the lengths in order: the lookup FindSegment replaced
+	static int FindSegmentLinear(const CCatmullRom &track, float fLength)
+	{
+		const vector<float> &distances = track.m_distances;
+		for (int i = 0; i < (int) distances.size() - 1; i++) {
+			if (fLength >= distances[i] && fLength < distances[i + 1])
+				return i;
+		}
+		return -1;
+	}
+};
+
+// The segment lookup, by binary search and from a hint, must find the segment the linear scan does: at random distances, and at each 
+// step of a walk across the start line, where the hint wraps round.  The scan is slow on big tracks, so there it is only run on some
+static void CheckFindSegment(CCatmullRom &track, const vector<float> &randomDistances, float fStep, const string &suffix)
+{
+	static const int NUM_STEPS = 20000;
+	float fLength = track.GetLength();
+	int iScanEvery = track.GetNumControlPoints() > 100000 ? 64 : 1;
+	int iFailures = 0;
+	for (int i = 0; i < (int) randomDistances.size() && iFailures < 10; i++) {
+		float d = randomDistances[i];
+		if (i % iScanEvery == 0 && !Check(CatmullRomAccess::FindSegment(track, d) == CatmullRomAccess::FindSegmentLinear(track, d), 
+			"FindSegment" + suffix + " finds the segment the scan does at " + std::to_string(d)))
+			iFailures++;
+	}
+
+	int iHint = -1;
+	float d = fLength - fStep * NUM_STEPS / 2;
+	for (int i = 0; i < NUM_STEPS && iFailures < 10; i++) {
+		int iSearch = CatmullRomAccess::FindSegment(track, d);
+		iHint = CatmullRomAccess::FindSegment(track, d, iHint);
+		bool bScan = i % iScanEvery == 0;
+		if (!Check(iHint == iSearch && (!bScan || iSearch == CatmullRomAccess::FindSegmentLinear(track, d)), 
+			"hinted FindSegment" + suffix + " finds the segment the search and the scan do at " + std::to_string(d)))
+			iFailures++;
+		d += fStep;
+		if (d >= fLength)
+			d -= fLength;
+	}
+}
+
+// The closest segment to p by testing every one, with the same arithmetic as CTrackSpatialIndex, so the distances found must match exactly
+static int FindClosestSegmentLinear(const vector<glm::vec3> &points, const glm::vec3 &p, float &distanceSquared)
+{
+	int n = (int) points.size();
+	int iBest = -1;
+	distanceSquared = FLT_MAX;
+	for (int i = 0; i < n; i++) {
+		glm::vec3 ab = points[(i + 1) % n] - points[i];
+		float fLengthSquared = glm::dot(ab, ab);
+		float t = fLengthSquared > 0.0f ? glm::clamp(glm::dot(p - points[i], ab) / fLengthSquared, 0.0f, 1.0f) : 0.0f;
+		glm::vec3 d = points[i] + t * ab - p;
+		if (glm::dot(d, d) < distanceSquared) {
+			iBest = i;
+			distanceSquared = glm::dot(d, d);
+		}
+	}
+	return iBest;
+}
+
+// Check one query against the scan: with no hint, with the right segment's neighbour as the hint, and with a stale hint from the far side 
+// of the loop.  Where two segments are equally close (at a shared end point) either may be returned, so only the distance has to match
+static int CheckClosestSegment(const CTrackSpatialIndex &index, const vector<glm::vec3> &points, const glm::vec3 &p, const string &what)
+{
+	int n = (int) points.size();
+	float fExpected;
+	int iExpected = FindClosestSegmentLinear(points, p, fExpected);
+	int hints[] = { -1, (iExpected + 1) % n, (iExpected + n / 2) % n };
+	const char *hintNames[] = { "no hint", "a hint beside it", "a stale hint" };
+	int iFailures = 0;
+	for (int h = 0; h < 3; h++) {
+		float t, fDistanceSquared;
+		int i = index.FindClosestSegment(p, t, fDistanceSquared, hints[h]);
+		glm::vec3 d = i < 0 ? glm::vec3(FLT_MAX) : glm::mix(points[i], points[(i + 1) % n], t) - p;
+		char where[128];
+		sprintf_s(where, " at (%g, %g, %g) with %s", p.x, p.y, p.z, hintNames[h]);
+		if (!Check(i >= 0 && fDistanceSquared == fExpected && fabs(glm::dot(d, d) - fExpected) <= 1e-3f * (1.0f + fExpected), 
+			"FindClosestSegment finds a segment as close as the scan does" + what + where))
+			iFailures++;
+	}
+	return iFailures;
+}
+
+// The grid search, from scratch and from a hint, must find a segment as close as the scan does: for points scattered over and beyond the 
+// grid, points beside the track, and points on and either side of cell edges, where a ring search that stops too early goes wrong.  Then 
+// again after Update has replaced a run of segments with a longer one
+static void CheckFindClosestSegment()
+{
+	static const int NUM_QUERIES = 2000;
+	std::shared_ptr<CCatmullRom> track = GetLoop(1000);
+	float fLength = track->GetLength();
+	vector<glm::vec3> points;
+	for (float d = 0.0f; d < fLength; d += 2.5f) {
+		glm::vec3 p, up;
+		track->Sample(d, p, up);
+		points.push_back(p);
+	}
+	float fCellSize = (float) CCatmullRom::TRACK_WIDTH;
+	CTrackSpatialIndex index;
+	index.Build(points, fCellSize);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	int iFirst = (int) points.size() / 3;
+	int iFailures = 0;
+	for (int pass = 0; pass < 2 && iFailures < 10; pass++) {
+		glm::vec3 boundsMin = points[0], boundsMax = points[0];
+		for (int i = 1; i < (int) points.size(); i++) {
+			boundsMin = glm::min(boundsMin, points[i]);
+			boundsMax = glm::max(boundsMax, points[i]);
+		}
+		string what = pass == 0 ? "" : " after Update";
+		for (int i = 0; i < NUM_QUERIES && iFailures < 10; i++) {
+			glm::vec3 margin(100.0f, 30.0f, 100.0f);
+			glm::vec3 scattered = boundsMin - margin + glm::vec3(unit(random), unit(random), unit(random)) * (boundsMax - boundsMin + 2.0f * margin);
+			iFailures += CheckClosestSegment(index, points, scattered, what);
+
+			int j = (int) (unit(random) * (points.size() - 1));
+			glm::vec3 beside = points[j] + glm::vec3(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f) * 2.0f * fCellSize;
+			iFailures += CheckClosestSegment(index, points, beside, what);
+
+			// Snap the point beside the track onto the nearest cell edge in x, then just either side of it
+			float fEdge = boundsMin.x + floor((beside.x - boundsMin.x) / fCellSize + 0.5f) * fCellSize;
+			for (int k = -1; k <= 1; k++) {
+				glm::vec3 onEdge(fEdge + k * 1e-3f, beside.y, beside.z);
+				iFailures += CheckClosestSegment(index, points, onEdge, what);
+			}
+		}
+
+		// Close round the run an edit replaces, and the renumbered segments after it
+		for (int j = iFirst - 5; j < iFirst + 40 && iFailures < 10; j++) {
+			for (int k = 0; k < 8; k++) {
+				glm::vec3 offset = glm::vec3(sin(k * 0.8f), 0.5f * k - 2.0f, cos(k * 0.8f)) * (0.3f * k);
+				iFailures += CheckClosestSegment(index, points, points[j] + offset, what);
+			}
+		}
+
+		// Replace segments [iFirst, iFirst + 20) with 31 new ones, bowed out sideways, as a control point edit does
+		if (pass == 0) {
+			vector<glm::vec3> run;
+			for (int i = 1; i <= 30; i++)
+				run.push_back(glm::mix(points[iFirst], points[iFirst + 20], i / 31.0f) + glm::vec3(0.0f, 0.0f, 8.0f * sin(i * (float) M_PI / 31.0f)));
+			points.erase(points.begin() + iFirst + 1, points.begin() + iFirst + 20);
+			points.insert(points.begin() + iFirst + 1, run.begin(), run.end());
+			index.Update(points, fCellSize, iFirst, iFirst + 20, iFirst + 31);
+		}
+	}
+}
+
+// Equal steps in distance must give equal steps along the curve, to the 0.02% the arc length parameterisation was measured at, and the 
+// chords must add up to the length.  Steps of about 2.5 units are used, as a car moves in a frame or two: the chord falls short of the arc 
+// by k^2 h^2 / 24 of the step h for curvature k, which grows with longer steps, and the distances given to Sample are floats, only as 
+// precise as the spacing of floats near the track length, which dominates with shorter ones.  So each step may also be out by two of 
+// those spacings (at 0.01 unit steps, the spacing is only good to about 1%)
+static const float ARC_LENGTH_SPACING_TOLERANCE = 2e-4f;	// Fraction of the step, besides the rounding of the distances
+static const float ARC_LENGTH_TOTAL_TOLERANCE = 1e-4f;		// Fraction of the length
+
+static void CheckArcLengthSpacing()
+{
+	for (int k = 0; k < 2; k++) {
+		CCatmullRom track;
+		if (k == 1 && !LoadLoop(track, 1000))
+			continue;
+		track.ComputeCentreline();
+		string name = k == 0 ? "the built-in track" : "the 1000 point loop";
+
+		float fLength = track.GetLength();
+		int iNumSteps = (int) (fLength / 2.5f);
+		double fStep = (double) fLength / iNumSteps, fTotal = 0.0, fMaxDeviation = 0.0;
+		glm::vec3 p, previous, up;
+		int iSegment = -1;
+		track.Sample(0.0f, previous, up, iSegment);
+		for (int i = 1; i <= iNumSteps; i++) {
+			track.Sample((float) (i * fStep), p, up, iSegment);
+			double fChord = glm::length(p - previous);
+			fTotal += fChord;
+			fMaxDeviation = max(fMaxDeviation, fabs(fChord - fStep) / fStep);
+			previous = p;
+		}
+		double fTolerance = ARC_LENGTH_SPACING_TOLERANCE + 2.0 * (nextafterf(fLength, FLT_MAX) - fLength) / fStep;
+		Check(fMaxDeviation <= fTolerance, "equal steps along " + name + " are equal along the curve: the chords are within " + 
+			std::to_string(fMaxDeviation) + " of a step");
+		Check(fabs(fTotal - fLength) <= ARC_LENGTH_TOTAL_TOLERANCE * fLength, "the chords along " + name + " add up to its length");
+	}
+}
+
+// Sample and SampleFrame on tracks of increasing size: random distances with no hint, and steady motion along the track with a hint. 
+// The segment lookup on its own is timed the same two ways, and by the linear scan it replaced as a baseline
+static void AddSampleBenchmarks(vector<Benchmark> &benchmarks)
+{
+	static const int NUM_DISTANCES = 4096;
+	int sizes[] = { 1000, 100000, 1000000 };
+	for (int k = 0; k < 3; k++) {
+		string suffix = "/" + SizeName(sizes[k]);
+		bool bProject = k == 1;
+		if (!IsWanted("CatmullRom/Sample/random" + suffix) && !IsWanted("CatmullRom/Sample/hinted" + suffix) &&
+			!IsWanted("CatmullRom/SampleFrame/random" + suffix) && !IsWanted("CatmullRom/FindSegment/scan" + suffix) &&
+			!IsWanted("CatmullRom/FindSegment/search" + suffix) && !IsWanted("CatmullRom/FindSegment/hinted" + suffix) &&
+			!(bProject && (IsWanted("CatmullRom/Project/cold" + suffix) || IsWanted("CatmullRom/Project/hinted" + suffix))))
+			continue;
+
+		std::shared_ptr<CCatmullRom> track = GetLoop(sizes[k]);
+		if (k == 0)
+			CheckArcLengthSpacing();
+		float fLength = track->GetLength();
+		auto randomDistances = std::make_shared<vector<float> >(RandomDistances(fLength, NUM_DISTANCES, false));
+		CheckFindSegment(*track, *randomDistances, 0.37f, suffix);
+
+		Benchmark scan = { "CatmullRom/FindSegment/scan" + suffix, [=](long long iIterations) {
+			for (long long i = 0; i < iIterations; i++) {
+				int j = CatmullRomAccess::FindSegmentLinear(*track, (*randomDistances)[i % NUM_DISTANCES]);
+				KeepResult(j);
+			}
+		}, 1.0, 0.0 };
+		benchmarks.push_back(scan);
+
+		Benchmark search = { "CatmullRom/FindSegment/search" + suffix, [=](long long iIterations) {
+			for (long long i = 0; i < iIterations; i++) {
+				int j = CatmullRomAccess::FindSegment(*track, (*randomDistances)[i % NUM_DISTANCES]);
+				KeepResult(j);
+			}
+		}, 1.0, 0.0 };
+		benchmarks.push_back(search);
+
+		Benchmark hintedSearch = { "CatmullRom/FindSegment/hinted" + suffix, [=](long long iIterations) {
+			int iHint = -1;
+			float d = 0.0f;
+			for (long long i = 0; i < iIterations; i++) {
+				iHint = CatmullRomAccess::FindSegment(*track, d, iHint);
+				KeepResult(iHint);
+				d += 0.37f;
+				if (d >= fLength)
+					d -= fLength;
+			}
+		}, 1.0, 0.0 };
+		benchmarks.push_back(hintedSearch);
+
+		Benchmark random = { "CatmullRom/Sample/random" + suffix, [=](long long iIterations) {
+			glm::vec3 p, up;
+			for (long long i = 0; i < iIterations; i++) {
+				track->Sample((*randomDistances)[i % NUM_DISTANCES], p, up);
+				KeepResult(p);
+			}
+		}, 1.0, 0.0 };
+		benchmarks.push_back(random);
+
+		Benchmark hinted = { "CatmullRom/Sample/hinted" + suffix, [=](long long iIterations) {
+			glm::vec3 p, up;
+			int iHint = 0;
+			float fStep = 0.37f;
+			float d = 0.0f;
+			for (long long i = 0; i < iIterations; i++) {
+				track->Sample(d, p, up, iHint);
+				KeepResult(p);
+				d += fStep;
+				if (d >= fLength)
+					d -= fLength;
+			}
+		}, 1.0, 0.0 };
+		benchmarks.push_back(hinted);
+
+		Benchmark frame = { "CatmullRom/SampleFrame/random" + suffix, [=](long long iIterations) {
+			glm::vec3 p, T, N, B;
+			for (long long i = 0; i < iIterations; i++) {
+				track->SampleFrame((*randomDistances)[i % NUM_DISTANCES], p, T, N, B);
+				KeepResult(p);
+			}
+		}, 1.0, 0.0 };
+		benchmarks.push_back(frame);
+
+		// Closest point queries from points beside the track: scattered all round it with no hint, and a car driving along it, passing 
+		// last frame's segment as the hint.  The hinted query must find a point as close as the cold one
+		if (bProject) {
+			CheckFindClosestSegment();
+			auto scattered = std::make_shared<vector<glm::vec3> >(NUM_DISTANCES);
+			auto driving = std::make_shared<vector<glm::vec3> >(NUM_DISTANCES);
+			for (int i = 0; i < NUM_DISTANCES; i++) {
+				glm::vec3 p, T, N, B;
+				float fOffset = 0.5f * ((i % 17) - 8);
+				track->SampleFrame((*randomDistances)[i], p, T, N, B);
+				(*scattered)[i] = p + N * fOffset + B;
+				track->SampleFrame(0.37f * i, p, T, N, B);
+				(*driving)[i] = p + N * fOffset + B;
+			}
+			TrackProjection cold, hinted;
+			hinted.segment = -1;
+			int iFailures = 0;
+			for (int i = 0; i < NUM_DISTANCES && iFailures < 10; i++) {
+				const glm::vec3 &p = (*driving)[i];
+				bool bFound = track->Project(p, cold) && track->Project(p, hinted, hinted.segment);
+				if (!Check(bFound && fabs(glm::length(p - cold.point) - glm::length(p - hinted.point)) <= 1e-4f, 
+					"hinted Project" + suffix + " finds a point as close as the cold one at step " + std::to_string(i)))
+					iFailures++;
+			}
+			Benchmark project = { "CatmullRom/Project/cold" + suffix, [=](long long iIterations) {
+				TrackProjection projection;
+				for (long long i = 0; i < iIterations; i++) {
+					track->Project((*scattered)[i % NUM_DISTANCES], projection);
+					KeepResult(projection);
+				}
+			}, 1.0, 0.0 };
+			benchmarks.push_back(project);
+
+			Benchmark projectHinted = { "CatmullRom/Project/hinted" + suffix, [=](long long iIterations) {
+				TrackProjection projection;
+				projection.segment = -1;
+				for (long long i = 0; i < iIterations; i++) {
+					track->Project((*driving)[i % NUM_DISTANCES], projection, projection.segment);
+					KeepResult(projection);
+				}
+			}, 1.0, 0.0 };
+			benchmarks.push_back(projectHinted);
+		}
+	}
+}
+
+// SampleBatch does the same arithmetic as SampleFrame, so must give exactly the same position, tangent and up for every distance: sorted, 
+// in random order, with several agents on each sample, past the first lap and negative, on one thread and on several, and with the 
+// tangent or up arrays left out
+static void CheckSampleBatch(CCatmullRom &track)
+{
+	static const int NUM_AGENTS = 20000;
+	float fLength = track.GetLength();
+	vector<float> distances = RandomDistances(fLength, NUM_AGENTS, true);
+	vector<float> random = RandomDistances(fLength, NUM_AGENTS, false);
+	distances.insert(distances.end(), random.begin(), random.end());
+	for (int i = 0; i < 1000; i++)
+		distances.push_back(random[i] + fLength * ((i % 7) - 3));
+	distances.push_back(0.0f);
+	distances.push_back(fLength);
+	int iCount = (int) distances.size();
+
+	vector<float> output(9 * iCount);
+	float *pOut = output.data();
+	TrackSamples full = { pOut, pOut + iCount, pOut + 2 * iCount, pOut + 3 * iCount, pOut + 4 * iCount, pOut + 5 * iCount, 
+						  pOut + 6 * iCount, pOut + 7 * iCount, pOut + 8 * iCount };
+	TrackSamples noUp = full, noTangent = full;
+	noUp.upX = noUp.upY = noUp.upZ = NULL;
+	noTangent.tX = noTangent.tY = noTangent.tZ = NULL;
+	const TrackSamples *layouts[] = { &full, &full, &noUp, &noTangent };
+	int threads[] = { 1, 4, 1, 1 };
+	const char *names[] = { "on one thread", "on four threads", "without up vectors", "without tangents" };
+
+	for (int j = 0; j < 4; j++) {
+		const TrackSamples &out = *layouts[j];
+		fill(output.begin(), output.end(), -1.0f);
+		track.SampleBatch(distances.data(), iCount, out, threads[j]);
+		int iFailures = 0;
+		for (int k = 0; k < iCount && iFailures < 10; k++) {
+			float d = distances[k] < 0.0f ? distances[k] - floor(distances[k] / fLength) * fLength : distances[k];
+			glm::vec3 p, T, N, B;
+			track.SampleFrame(d, p, T, N, B);
+			bool bSame = out.x[k] == p.x && out.y[k] == p.y && out.z[k] == p.z;
+			if (out.tX != NULL)
+				bSame = bSame && out.tX[k] == T.x && out.tY[k] == T.y && out.tZ[k] == T.z;
+			if (out.upX != NULL)
+				bSame = bSame && out.upX[k] == B.x && out.upY[k] == B.y && out.upZ[k] == B.z;
+			if (!Check(bSame, string("SampleBatch ") + names[j] + " gives the frame SampleFrame does at " + std::to_string(distances[k])))
+				iFailures++;
+		}
+	}
+}
+
+// SampleBatch for 100k vehicles spread around a track, sorted (the fast case) and in random order, then sorted at each thread count
+static void AddSampleBatchBenchmarks(vector<Benchmark> &benchmarks)
+{
+	static const int NUM_AGENTS = 100000;
+	if (!IsWanted("CatmullRom/SampleBatch/sorted/100k") && !IsWanted("CatmullRom/SampleBatch/random/100k"))
+		return;
+	std::shared_ptr<CCatmullRom> track = GetLoop(10000);
+	CheckSampleBatch(*track);
+
+	auto output = std::make_shared<vector<float> >(9 * NUM_AGENTS);
+	for (int k = 0; k < 2; k++) {
+		bool bSorted = k == 0;
+		auto distances = std::make_shared<vector<float> >(RandomDistances(track->GetLength(), NUM_AGENTS, bSorted));
+		Benchmark batch = { string("CatmullRom/SampleBatch/") + (bSorted ? "sorted" : "random") + "/100k", [=](long long iIterations) {
+			float *pOut = output->data();
+			TrackSamples samples = { pOut, pOut + NUM_AGENTS, pOut + 2 * NUM_AGENTS, pOut + 3 * NUM_AGENTS, pOut + 4 * NUM_AGENTS,
+									 pOut + 5 * NUM_AGENTS, pOut + 6 * NUM_AGENTS, pOut + 7 * NUM_AGENTS, pOut + 8 * NUM_AGENTS };
+			for (long long i = 0; i < iIterations; i++) {
+				track->SampleBatch(distances->data(), NUM_AGENTS, samples, 1);
+				KeepResult(*output);
+			}
+		}, (double) NUM_AGENTS, 0.0 };
+		benchmarks.push_back(batch);
+
+		if (!bSorted)
+			continue;
+		for (int iNumThreads = 1; iNumThreads <= GetDefaultThreadCount(); iNumThreads *= 2) {
+			Benchmark threaded = { "CatmullRom/SampleBatch/sorted/100k/threads:" + SizeName(iNumThreads), [=](long long iIterations) {
+				float *pOut = output->data();
+				TrackSamples samples = { pOut, pOut + NUM_AGENTS, pOut + 2 * NUM_AGENTS, pOut + 3 * NUM_AGENTS, pOut + 4 * NUM_AGENTS,
+										 pOut + 5 * NUM_AGENTS, pOut + 6 * NUM_AGENTS, pOut + 7 * NUM_AGENTS, pOut + 8 * NUM_AGENTS };
+				for (long long i = 0; i < iIterations; i++) {
+					track->SampleBatch(distances->data(), NUM_AGENTS, samples, iNumThreads);
+					KeepResult(*output);
+				}
+			}, (double) NUM_AGENTS, 0.0 };
+			threaded.counters.push_back(make_pair(string("threads"), (double) iNumThreads));
+			benchmarks.push_back(threaded);
+		}
+	}
+}
+
+// Each thread of ComputeOffsetCurves and BuildTrackVertices writes only its own samples, so the track vertices must be the same bit for 
+// bit at any thread count, including counts that don't divide the samples evenly and more threads than cores
+static void CheckThreadCounts()
+{
+	CCatmullRom track;
+	if (!Check(LoadLoop(track, 10000), "the 10k track loads"))
+		return;
+	track.ComputeCentreline();
+	track.ComputeOffsetCurves(1);
+	vector<float> expected;
+	track.BuildTrackVertices(expected, 1);
+
+	int threadCounts[] = { 2, 3, 4, 7, 16, 0 };
+	for (int k = 0; k < 6; k++) {
+		int iNumThreads = threadCounts[k];
+		string threads = iNumThreads > 0 ? std::to_string(iNumThreads) : "one per core";
+		vector<float> vertices;
+		track.ComputeOffsetCurves(iNumThreads);
+		track.BuildTrackVertices(vertices, 1);
+		Check(vertices.size() == expected.size() && memcmp(vertices.data(), expected.data(), vertices.size() * sizeof(float)) == 0, 
+			"ComputeOffsetCurves on " + threads + " threads gives the offset curves one thread does");
+		track.BuildTrackVertices(vertices, iNumThreads);
+		Check(vertices.size() == expected.size() && memcmp(vertices.data(), expected.data(), vertices.size() * sizeof(float)) == 0, 
+			"BuildTrackVertices on " + threads + " threads gives the vertices one thread does");
+	}
+}
+
+// Track generation: adaptive tessellation of the built-in track and of a large synthetic one, and the track mesh at each thread count
+static void AddTrackBuildBenchmarks(vector<Benchmark> &benchmarks)
+{
+	if (IsWanted("CatmullRom/BuildTrack"))
+		CheckThreadCounts();
+
+	for (int k = 0; k < 2; k++) {
+		string name = string("CatmullRom/BuildTrack/") + (k == 0 ? "builtin" : "10k");
+		if (!IsWanted(name))
+			continue;
+		// A track of its own, as building it again changes it
+		auto track = std::make_shared<CCatmullRom>();
+		if (k == 1 && !LoadLoop(*track, 10000))
+			continue;
+		track->ComputeCentreline();
+		track->ComputeOffsetCurves(1);
+		int iNumTriangles = track->GetNumTriangles();
+
+		Benchmark build = { name, [=](long long iIterations) {
+			for (long long i = 0; i < iIterations; i++) {
+				track->ComputeCentreline();
+				track->ComputeOffsetCurves(1);
+			}
+		}, (double) iNumTriangles / 2, 0.0 };
+		build.counters.push_back(make_pair(string("samples"), (double) iNumTriangles / 2));
+		build.counters.push_back(make_pair(string("triangles"), (double) iNumTriangles));
+		benchmarks.push_back(build);
+	}
+
+	if (!IsWanted("CatmullRom/BuildTrackVertices/1M/threads:"))
+		return;
+	std::shared_ptr<CCatmullRom> track = GetLoop(1000000);
+	int iNumSamples = track->GetNumTriangles() / 2;
+	auto trackData = std::make_shared<vector<float> >();
+	for (int iNumThreads = 1; iNumThreads <= GetDefaultThreadCount(); iNumThreads *= 2) {
+		Benchmark vertices = { "CatmullRom/BuildTrackVertices/1M/threads:" + SizeName(iNumThreads), [=](long long iIterations) {
+			for (long long i = 0; i < iIterations; i++) {
+				track->BuildTrackVertices(*trackData, iNumThreads);
+				KeepResult(*trackData);
+			}
+		}, (double) iNumSamples, (double) iNumSamples * 16 * sizeof(float) };
+		vertices.counters.push_back(make_pair(string("samples"), (double) iNumSamples));
+		vertices.counters.push_back(make_pair(string("threads"), (double) iNumThreads));
+		benchmarks.push_back(vertices);
+	}
+}
+
+// An edit re-tessellates only the segments next to the edited point, and keeps the other samples as they were, so it must give the same 
+// centreline as building the edited track from scratch.  Positions, tangents and distances only differ by rounding.  Binormals differ 
+// more: a full build spreads the twist left around the loop along the whole loop, where an edit keeps the old frames and spreads the 
+// change in twist it makes along the new samples.  The edits below change it by up to 0.09 radians between them
+static const float EDIT_POSITION_TOLERANCE = 1e-3f;		// World units
+static const float EDIT_LENGTH_TOLERANCE = 1e-5f;		// Fraction of the track length
+static const float EDIT_TANGENT_TOLERANCE = 1e-3f;		// Radians
+static const float EDIT_BINORMAL_TOLERANCE = 0.15f;		// Radians
+
+// Compare a track with one built from scratch from the same control points, by the number of samples, the length, and the point and 
+// frame at even steps along it
+static void CompareWithRebuild(CCatmullRom &track, const vector<glm::vec3> &points, const vector<glm::vec3> &upVectors, const string &what)
+{
+	CCatmullRom rebuilt;
+	if (!Check(LoadPoints(rebuilt, points, upVectors), what + ": the edited control points load"))
+		return;
+	rebuilt.ComputeCentreline();
+	rebuilt.ComputeOffsetCurves();
+
+	Check(track.GetNumControlPoints() == rebuilt.GetNumControlPoints(), what + " leaves the control points a rebuild has");
+	Check(track.GetNumTriangles() == rebuilt.GetNumTriangles(), what + " gives the samples a rebuild does (" + 
+		std::to_string(track.GetNumTriangles() / 2) + " against " + std::to_string(rebuilt.GetNumTriangles() / 2) + ")");
+	float fLength = rebuilt.GetLength();
+	Check(fabs(track.GetLength() - fLength) <= EDIT_LENGTH_TOLERANCE * fLength, what + " gives the length a rebuild does (" + 
+		std::to_string(track.GetLength()) + " against " + std::to_string(fLength) + ")");
+
+	static const int NUM_STEPS = 5000;
+	float fWorstPosition = 0.0f, fWorstTangent = 0.0f, fWorstBinormal = 0.0f;
+	for (int i = 0; i < NUM_STEPS; i++) {
+		float d = fLength * i / NUM_STEPS;
+		glm::vec3 p, T, N, B, pRebuilt, TRebuilt, NRebuilt, BRebuilt;
+		track.SampleFrame(d, p, T, N, B);
+		rebuilt.SampleFrame(d, pRebuilt, TRebuilt, NRebuilt, BRebuilt);
+		fWorstPosition = std::max(fWorstPosition, glm::distance(p, pRebuilt));
+		fWorstTangent = std::max(fWorstTangent, acos(glm::clamp(glm::dot(T, TRebuilt), -1.0f, 1.0f)));
+		fWorstBinormal = std::max(fWorstBinormal, acos(glm::clamp(glm::dot(B, BRebuilt), -1.0f, 1.0f)));
+	}
+	Check(fWorstPosition <= EDIT_POSITION_TOLERANCE, what + " puts the centreline where a rebuild does (out by " + std::to_string(fWorstPosition) + ")");
+	Check(fWorstTangent <= EDIT_TANGENT_TOLERANCE, what + " gives the tangents a rebuild does (out by " + std::to_string(fWorstTangent) + " radians)");
+	Check(fWorstBinormal <= EDIT_BINORMAL_TOLERANCE, what + " gives the binormals a rebuild does, allowing for twist (out by " + 
+		std::to_string(fWorstBinormal) + " radians)");
+}
+
+// Moves, inserts and deletes in the middle of a loop, next to the start (where the new samples wrap round and the whole track is 
+// indexed again) and next to the end, each checked against a rebuild.  The edits are made to the control point lists here too, to give 
+// the rebuild its points.  An edit only writes the track vertices from its new samples on, so those before must come out the same, 
+// texture coordinates and all, even though the length changes.  Then an insert on a track loaded from a track file, which has to recover 
+// its samples' parameters first
+static void CheckEditControlPoints()
+{
+	vector<glm::vec3> upVectors;
+	vector<glm::vec3> points = MakeLoop(200, upVectors);
+	CCatmullRom track;
+	if (!Check(LoadPoints(track, points, upVectors), "the loop to edit loads"))
+		return;
+	track.ComputeCentreline();
+	track.ComputeOffsetCurves();
+
+	struct Edit
+	{
+		char type;		// 'm'ove, 'i'nsert or 'd'elete
+		int k;
+		glm::vec3 offset;
+	};
+	Edit edits[] = { { 'm', 100, glm::vec3(3.0f, 2.0f, -4.0f) }, { 'i', 50, glm::vec3(0.5f, 1.0f, 1.5f) }, { 'd', 120, glm::vec3(0.0f) },
+					 { 'm', 1, glm::vec3(-2.0f, 3.0f, 1.0f) }, { 'i', 200, glm::vec3(1.0f, -1.0f, 0.0f) }, { 'd', 198, glm::vec3(0.0f) },
+					 { 'm', 150, glm::vec3(0.0f, 8.0f, 0.0f) } };
+	for (int e = 0; e < (int) (sizeof(edits) / sizeof(edits[0])); e++) {
+		const Edit &edit = edits[e];
+		int M = (int) points.size(), k = edit.k;
+		string what;
+		vector<float> before, after;
+		track.BuildTrackVertices(before, 1);
+		if (edit.type == 'm') {
+			points[k] += edit.offset;
+			track.MoveControlPoint(k, points[k]);
+			what = "moving point " + std::to_string(k);
+		} else if (edit.type == 'i') {
+			glm::vec3 p = 0.5f * (points[k - 1] + points[k % M]) + edit.offset;
+			upVectors.insert(upVectors.begin() + k, glm::normalize(upVectors[k - 1] + upVectors[k % M]));
+			points.insert(points.begin() + k, p);
+			track.InsertControlPoint(k, p);
+			what = "inserting point " + std::to_string(k);
+		} else {
+			upVectors.erase(upVectors.begin() + k);
+			points.erase(points.begin() + k);
+			track.DeleteControlPoint(k);
+			what = "deleting point " + std::to_string(k);
+		}
+		CompareWithRebuild(track, points, upVectors, what);
+
+		// The samples of the first fifth of the segments are well before the segments an edit away from the start re-tessellates
+		if (k >= M / 2 && k + 2 < M) {
+			track.BuildTrackVertices(after, 1);
+			size_t iNumFloats = before.size() / 5 / 16 * 16;
+			Check(after.size() >= iNumFloats && std::equal(before.begin(), before.begin() + iNumFloats, after.begin()), 
+				what + " leaves the track vertices before it as they were");
+		}
+	}
+
+	const char *filename = "benchmark_track.trk";
+	CCatmullRom loaded;
+	if (Check(track.SaveTrack(filename, false) && loaded.LoadTrack(filename), "the edited loop saves and loads as a track file")) {
+		loaded.ComputeCentreline();
+		loaded.ComputeOffsetCurves();
+		glm::vec3 p = 0.5f * (points[79] + points[80]) + glm::vec3(1.0f, 0.5f, -1.0f);
+		upVectors.insert(upVectors.begin() + 80, glm::normalize(upVectors[79] + upVectors[80]));
+		points.insert(points.begin() + 80, p);
+		loaded.InsertControlPoint(80, p);
+		CompareWithRebuild(loaded, points, upVectors, "inserting point 80 in a loaded track");
+	}
+	remove(filename);
+}
+
+// Moving a control point of a 10k point loop back and forth, which re-tessellates four segments each time
+static void AddTrackEditBenchmarks(vector<Benchmark> &benchmarks)
+{
+	if (!IsWanted("CatmullRom/MoveControlPoint/10k"))
+		return;
+	CheckEditControlPoints();
+
+	auto track = std::make_shared<CCatmullRom>();
+	if (!LoadLoop(*track, 10000))
+		return;
+	track->ComputeCentreline();
+	track->ComputeOffsetCurves();
+	glm::vec3 p = track->GetControlPoint(5000);
+
+	Benchmark move = { "CatmullRom/MoveControlPoint/10k", [=](long long iIterations) {
+		for (long long i = 0; i < iIterations; i++)
+			track->MoveControlPoint(5000, p + glm::vec3(0.0f, (i & 1) ? 2.0f : 0.0f, 0.0f));
+	}, 1.0, 0.0 };
+	benchmarks.push_back(move);
+}
+
+// Read or write a whole file as bytes, to damage track files in the checks below
+static vector<unsigned char> ReadBytes(const char *filename)
+{
+	vector<unsigned char> bytes;
+	FILE *fp;
+	fopen_s(&fp, filename, "rb");
+	if (!fp)
+		return bytes;
+	unsigned char buffer[65536];
+	size_t iRead;
+	while ((iRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		bytes.insert(bytes.end(), buffer, buffer + iRead);
+	fclose(fp);
+	return bytes;
+}
+
+static bool WriteBytes(const char *filename, const unsigned char *pData, size_t size)
+{
+	FILE *fp;
+	fopen_s(&fp, filename, "wb");
+	if (!fp)
+		return false;
+	bool bOk = size == 0 || fwrite(pData, size, 1, fp) == 1;
+	fclose(fp);
+	return bOk;
+}
+
+// A track saved and loaded again must save to the same bytes, tables, mesh and all, and its stored mesh must be the one BuildTrackVertices 
+// makes.  Files that are truncated or have a damaged header must be refused.  Files whose hash doesn't match the control points, or whose 
+// tables don't agree in size, must load only their control points, so the tables are computed again -- even though they were zeroed here.  
+// CTrackFile::Open reports each file it refuses, so these print errors as they pass
+static void CheckTrackFile()
+{
+	const char *filename = "benchmark_track.trk", *copyname = "benchmark_track_copy.trk";
+	vector<glm::vec3> upVectors;
+	vector<glm::vec3> points = MakeLoop(1000, upVectors);
+	CCatmullRom track;
+	if (!Check(LoadPoints(track, points, upVectors), "the 1000 point track loads"))
+		return;
+	track.ComputeCentreline();
+	track.ComputeOffsetCurves();
+	if (!Check(track.SaveTrack(filename), "the track saves as a track file"))
+		return;
+	vector<unsigned char> saved = ReadBytes(filename);
+
+	vector<float> mesh;
+	track.BuildTrackVertices(mesh);
+	CTrackFile file;
+	const float *pMesh;
+	unsigned int iMeshCount = 0;
+	Check(file.Open(filename) && file.GetSection(TRACK_MESH, pMesh, iMeshCount) && iMeshCount == mesh.size() 
+		&& memcmp(pMesh, mesh.data(), mesh.size() * sizeof(float)) == 0, "the track file holds the track mesh as built");
+	file.Close();
+
+	CCatmullRom loaded;
+	if (Check(loaded.LoadTrack(filename), "the track file loads")) {
+		loaded.ComputeCentreline();
+		loaded.ComputeOffsetCurves();
+		Check(loaded.SaveTrack(copyname) && ReadBytes(copyname) == saved, "a loaded track saves to the same bytes it was loaded from");
+	}
+
+	// Truncated: inside the last section, inside the tables, and inside the header
+	size_t truncatedSizes[] = { saved.size() - 1, saved.size() / 2, sizeof(TrackFileHeader) - 1, 0 };
+	for (int i = 0; i < 4; i++) {
+		CCatmullRom damaged;
+		WriteBytes(copyname, saved.data(), truncatedSizes[i]);
+		Check(!file.Open(copyname) && !damaged.LoadTrack(copyname), "a track file cut to " + std::to_string(truncatedSizes[i]) + " bytes is refused");
+	}
+
+	// Damaged headers
+	const char *headerDamage[] = { "a wrong magic number", "a wrong version", "a misaligned section", "a section past the end", 
+								   "a section over the header" };
+	for (int i = 0; i < 5; i++) {
+		vector<unsigned char> bytes = saved;
+		TrackFileHeader *pHeader = (TrackFileHeader *) bytes.data();
+		if (i == 0)
+			pHeader->magic[0] = 'X';
+		else if (i == 1)
+			pHeader->version++;
+		else if (i == 2)
+			pHeader->sectionOffset[TRACK_CENTRELINE_POINTS] += 4;
+		else if (i == 3)
+			pHeader->sectionOffset[TRACK_CENTRELINE_POINTS] = (unsigned int) saved.size();
+		else
+			pHeader->sectionOffset[TRACK_CENTRELINE_POINTS] = 0;
+		CCatmullRom damaged;
+		WriteBytes(copyname, bytes.data(), bytes.size());
+		Check(!file.Open(copyname) && !damaged.LoadTrack(copyname), string("a track file with ") + headerDamage[i] + " is refused");
+	}
+
+	// Tables that mustn't be trusted: a stale hash, a control point changed after the tables were made, and a table of the wrong length.  
+	// The centreline distances are zeroed in each, so a loader that used them would build a different track
+	const char *tableDamage[] = { "a stale hash", "a changed control point", "a short table" };
+	for (int i = 0; i < 3; i++) {
+		vector<unsigned char> bytes = saved;
+		TrackFileHeader *pHeader = (TrackFileHeader *) bytes.data();
+		memset(&bytes[pHeader->sectionOffset[TRACK_CENTRELINE_DISTANCES]], 0, pHeader->sectionSize[TRACK_CENTRELINE_DISTANCES]);
+		vector<glm::vec3> expectedPoints = points;
+		if (i == 0)
+			pHeader->inputHash ^= 1;
+		else if (i == 1)
+			((glm::vec3 *) &bytes[pHeader->sectionOffset[TRACK_CONTROL_POINTS]])[10].y += 5.0f;
+		else
+			pHeader->sectionSize[TRACK_CENTRELINE_NORMALS] -= sizeof(glm::vec3);
+		if (i == 1)
+			expectedPoints[10].y += 5.0f;
+
+		CCatmullRom damaged, expected;
+		WriteBytes(copyname, bytes.data(), bytes.size());
+		if (!Check(damaged.LoadTrack(copyname), string("a track file with ") + tableDamage[i] + " still loads its control points") || 
+			!Check(LoadPoints(expected, expectedPoints, upVectors), "the 1000 point track loads"))
+			continue;
+		damaged.ComputeCentreline();
+		damaged.ComputeOffsetCurves();
+		expected.ComputeCentreline();
+		expected.ComputeOffsetCurves();
+		vector<float> damagedMesh, expectedMesh;
+		damaged.BuildTrackVertices(damagedMesh);
+		expected.BuildTrackVertices(expectedMesh);
+		Check(damaged.GetNumControlPoints() == (int) expectedPoints.size() && damaged.GetControlPoint(10) == expectedPoints[10] 
+			&& damaged.GetLength() == expected.GetLength() && damagedMesh == expectedMesh, 
+			string("a track file with ") + tableDamage[i] + " has its tables computed again");
+	}
+
+	remove(filename);
+	remove(copyname);
+}
+
+static const char *TRACK_FILE_10K = "benchmark_track_10k.trk";
+
+static void RemoveTrackFile10k()
+{
+	remove(TRACK_FILE_10K);
+}
+
+// Loading a 10k point track from a track file, against building it from the control points (CatmullRom/BuildTrack/10k).  The file is 
+// kept until the benchmarks have run
+static void AddTrackFileBenchmarks(vector<Benchmark> &benchmarks)
+{
+	if (!IsWanted("CatmullRom/LoadTrack/10k"))
+		return;
+	CheckTrackFile();
+
+	const char *filename = TRACK_FILE_10K;
+	CCatmullRom source;
+	if (!LoadLoop(source, 10000))
+		return;
+	source.ComputeCentreline();
+	source.ComputeOffsetCurves(1);
+	if (!source.SaveTrack(filename))
+		return;
+	atexit(RemoveTrackFile10k);
+	int iNumSamples = source.GetNumTriangles() / 2;
+
+	Benchmark load = { "CatmullRom/LoadTrack/10k", [=](long long iIterations) {
+		for (long long i = 0; i < iIterations; i++) {
+			CCatmullRom track;
+			track.LoadTrack(filename);
+			track.ComputeCentreline();
+			track.ComputeOffsetCurves(1);
+			KeepResult(track);
+		}
+	}, (double) iNumSamples, 0.0 };
+	load.counters.push_back(make_pair(string("samples"), (double) iNumSamples));
+	benchmarks.push_back(load);
+}
+
+// The matrix work Game::Render does per object: push, a transform chain, the normal matrix, pop
+static void AddMatrixBenchmarks(vector<Benchmark> &benchmarks)
+{
+	auto camera = std::make_shared<CCamera>();
+	camera->Set(glm::vec3(0.0f, 10.0f, 100.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	Benchmark chain = { "MatrixStack/PushTranslateRotateScalePop", [=](long long iIterations) {
+		glutil::MatrixStack modelViewMatrixStack;
+		modelViewMatrixStack.SetIdentity();
+		modelViewMatrixStack.LookAt(camera->GetPosition(), camera->GetView(), camera->GetUpVector());
+		for (long long i = 0; i < iIterations; i++) {
+			modelViewMatrixStack.Push();
+				modelViewMatrixStack.Translate(glm::vec3(0.0f, 10.0f, (float) (i & 63)));
+				modelViewMatrixStack.Rotate(glm::vec3(0.0f, 1.0f, 0.0f), 30.0f);
+				modelViewMatrixStack.Scale(5.0f);
+				KeepResult(modelViewMatrixStack.Top());
+			modelViewMatrixStack.Pop();
+		}
+	}, 1.0, 0.0 };
+	benchmarks.push_back(chain);
+
+	Benchmark nested = { "MatrixStack/NestedChain/depth:8", [=](long long iIterations) {
+		glutil::MatrixStack modelViewMatrixStack;
+		modelViewMatrixStack.SetIdentity();
+		for (long long i = 0; i < iIterations; i++) {
+			for (int j = 0; j < 8; j++) {
+				modelViewMatrixStack.Push();
+				modelViewMatrixStack.Translate(glm::vec3(1.0f, 0.0f, 0.0f));
+				modelViewMatrixStack.RotateY(10.0f);
+			}
+			KeepResult(modelViewMatrixStack.Top());
+			for (int j = 0; j < 8; j++)
+				modelViewMatrixStack.Pop();
+		}
+	}, 8.0, 0.0 };
+	benchmarks.push_back(nested);
+
+	Benchmark view = { "Camera/GetViewMatrix", [=](long long iIterations) {
+		for (long long i = 0; i < iIterations; i++) {
+			glm::mat4 viewMatrix = camera->GetViewMatrix();
+			KeepResult(viewMatrix);
+		}
+	}, 1.0, 0.0 };
+	benchmarks.push_back(view);
+
+	Benchmark normal = { "Camera/ComputeNormalMatrix", [=](long long iIterations) {
+		glm::mat4 modelView = glm::scale(glm::rotate(camera->GetViewMatrix(), 30.0f, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(5.0f));
+		for (long long i = 0; i < iIterations; i++) {
+			glm::mat3 normalMatrix = camera->ComputeNormalMatrix(modelView);
+			KeepResult(normalMatrix);
+		}
+	}, 1.0, 0.0 };
+	benchmarks.push_back(normal);
+}
+
+// Building a vertex buffer the way the meshes do: a fresh buffer filled with 1024 vertices, one attribute at a time
+static void AddVertexBufferBenchmarks(vector<Benchmark> &benchmarks)
+{
+	static const int NUM_VERTICES = 1024;
+	int sizes[] = { 8, 32 };
+	for (int k = 0; k < 2; k++) {
+		int iSize = sizes[k];
+		Benchmark append = { "VertexBufferObject/AddData/" + SizeName(iSize) + "B", [=](long long iIterations) {
+			BYTE attribute[32] = { 0 };
+			for (long long i = 0; i < iIterations; i++) {
+				CVertexBufferObject vbo;
+				for (int j = 0; j < NUM_VERTICES; j++)
+					vbo.AddData(attribute, iSize);
+				KeepResult(vbo);
+			}
+		}, (double) NUM_VERTICES, (double) NUM_VERTICES * iSize };
+		benchmarks.push_back(append);
+	}
+}
+
+// Shader files for the preprocessor checks, written to a scratch directory.  main.vert includes a guarded file twice, a second file with 
+// the same guard, a #pragma once file twice, and a file with a #version and a main of its own, of which only the include part goes in
+static const char *SHADER_DIRECTORY = "benchmark_shaders";
+static const char *SHADER_FILES[][2] = {
+	{ "guard.glsl", "#ifndef GUARD_GLSL\n#define GUARD_GLSL\n#include_part\nfloat guarded() { return 1.0; }\n#endif\n" },
+	{ "guard_copy.glsl", "\n#ifndef GUARD_GLSL\n#define GUARD_GLSL\n#include_part\nfloat guardedCopy() { return 2.0; }\n#endif\n\n" },
+	{ "once.glsl", "#pragma once\n#include_part\nfloat once() { return 3.0; }\n" },
+	{ "parts.glsl", "#version 330 core\n#include_part\nfloat part();\n#definition_part\nfloat part() { return 4.0; }\nvoid main() {}\n" },
+	{ "main.vert", "#version 330 core\n#include \"guard.glsl\"\n#include \"guard.glsl\"\n#include \"guard_copy.glsl\"\n#include \"once.glsl\"\n"
+				   "#include \"once.glsl\"\n#include \"parts.glsl\"\nvoid main() {}\n" },
+	{ "noversion.vert", "#include \"once.glsl\"\nvoid main() {}\n" },
+	{ "malformed.vert", "#version 330 core\n\n#include once.glsl\nvoid main() {}\n" },
+	{ "missing.vert", "#version 330 core\n#include \"nothere.glsl\"\n" },
+	{ "recursive.vert", "#include \"recursive.vert\"\n" },
+};
+static const int NUM_SHADER_FILES = sizeof(SHADER_FILES) / sizeof(SHADER_FILES[0]);
+
+static string ShaderPath(const char *sName)
+{
+	return string(SHADER_DIRECTORY) + "/" + sName;
+}
+
+static void RemoveShaderFiles()
+{
+	for (int i = 0; i < NUM_SHADER_FILES; i++)
+		remove(ShaderPath(SHADER_FILES[i][0]).c_str());
+	remove(SHADER_DIRECTORY);
+}
+
+// Each directive must come out as documented, with the defines straight after #version and a #line back to the file's numbering, and 
+// the includes found beside the including file.  Bad includes must fail, naming the file and line.  A second pass must find every file 
+// in the cache, and a file written since (same size, new time) must be read again, and only that file
+static void CheckShaderPreprocessor()
+{
+	CreateDirectoryA(SHADER_DIRECTORY, NULL);
+	for (int i = 0; i < NUM_SHADER_FILES; i++) {
+		string sPath = ShaderPath(SHADER_FILES[i][0]);
+		if (!Check(WriteBytes(sPath.c_str(), (const unsigned char *) SHADER_FILES[i][1], strlen(SHADER_FILES[i][1])), "can write " + sPath))
+			return;
+	}
+	CShaderPreprocessor::ClearCache();
+
+	vector<string> defines;
+	defines.push_back("FIRST");
+	defines.push_back("SECOND 2");
+	string sResult, sError;
+	vector<ShaderSourceStamp> stamps;
+	int iReads = CShaderPreprocessor::GetReads(), iHits = CShaderPreprocessor::GetCacheHits();
+	bool bOk = CShaderPreprocessor::Process(ShaderPath("main.vert"), defines, sResult, stamps, sError);
+	Check(bOk && sResult == "#version 330 core\n#define FIRST\n#define SECOND 2\n#line 2\n"
+		"#ifndef GUARD_GLSL\n#define GUARD_GLSL\nfloat guarded() { return 1.0; }\n#endif\n"
+		"float once() { return 3.0; }\nfloat part();\nvoid main() {}\n", "the preprocessor follows each directive in main.vert: " + sError);
+	Check(stamps.size() == 4 && stamps[0].sFile == ShaderPath("main.vert") && stamps[1].sFile == ShaderPath("guard.glsl") && 
+		stamps[2].sFile == ShaderPath("once.glsl") && stamps[3].sFile == ShaderPath("parts.glsl"), "main.vert is stamped with the files it used");
+	Check(CShaderPreprocessor::GetReads() - iReads == 5 && CShaderPreprocessor::GetCacheHits() == iHits, 
+		"the first pass reads each of main.vert's 5 files once");
+	Check(!CShaderPreprocessor::HasChanged(stamps), "main.vert's files haven't changed");
+
+	bOk = CShaderPreprocessor::Process(ShaderPath("noversion.vert"), defines, sResult, stamps, sError);
+	Check(bOk && sResult == "#define FIRST\n#define SECOND 2\nfloat once() { return 3.0; }\nvoid main() {}\n", 
+		"without #version, the defines go first with no #line: " + sError);
+
+	const char *failures[][2] = { { "malformed.vert", "Malformed #include on line 3 of " }, { "missing.vert", "Cannot read " }, 
+								  { "recursive.vert", "#include nested too deeply in " } };
+	const char *failedFiles[] = { "malformed.vert", "nothere.glsl", "recursive.vert" };
+	for (int i = 0; i < 3; i++) {
+		bOk = CShaderPreprocessor::Process(ShaderPath(failures[i][0]), defines, sResult, stamps, sError);
+		Check(!bOk && sError == failures[i][1] + ShaderPath(failedFiles[i]), string(failures[i][0]) + " fails, saying why: " + sError);
+	}
+
+	// Unchanged files come from the cache
+	iReads = CShaderPreprocessor::GetReads();
+	iHits = CShaderPreprocessor::GetCacheHits();
+	bOk = CShaderPreprocessor::Process(ShaderPath("main.vert"), defines, sResult, stamps, sError);
+	Check(bOk && CShaderPreprocessor::GetReads() == iReads && CShaderPreprocessor::GetCacheHits() - iHits == 5, 
+		"the second pass finds all 5 files in the cache");
+
+	// Rewrite once.glsl with the same size, and set its time back, as saving an edit in the same second might, so only the time tells
+	const char *sEdited = "#pragma once\n#include_part\nfloat once() { return 5.0; }\n";
+	string sOncePath = ShaderPath("once.glsl");
+	WriteBytes(sOncePath.c_str(), (const unsigned char *) sEdited, strlen(sEdited));
+#ifdef _MSC_VER
+	struct _utimbuf times = { 1000000000, 1000000000 };
+	_utime(sOncePath.c_str(), &times);
+#else
+	struct utimbuf times = { 1000000000, 1000000000 };
+	utime(sOncePath.c_str(), &times);
+#endif
+	Check(CShaderPreprocessor::HasChanged(stamps), "main.vert's files have changed once once.glsl is written");
+	iReads = CShaderPreprocessor::GetReads();
+	iHits = CShaderPreprocessor::GetCacheHits();
+	bOk = CShaderPreprocessor::Process(ShaderPath("main.vert"), defines, sResult, stamps, sError);
+	Check(bOk && CShaderPreprocessor::GetReads() - iReads == 1 && CShaderPreprocessor::GetCacheHits() - iHits == 4 && 
+		sResult.find("return 5.0") != string::npos, "after once.glsl is written, only it is read again, and its new text is used");
+	Check(!CShaderPreprocessor::HasChanged(stamps), "the new stamps match the files");
+}
+
+// Preprocessing main.vert above with its files in the cache, as reloading a program that hasn't changed does.  The files are kept until 
+// the benchmarks have run
+static void AddShaderPreprocessorBenchmarks(vector<Benchmark> &benchmarks)
+{
+	if (!IsWanted("ShaderPreprocessor/Process/cached"))
+		return;
+	CheckShaderPreprocessor();
+	atexit(RemoveShaderFiles);
+
+	Benchmark process = { "ShaderPreprocessor/Process/cached", [](long long iIterations) {
+		vector<string> defines(1, "FIRST");
+		string sResult, sError;
+		vector<ShaderSourceStamp> stamps;
+		for (long long i = 0; i < iIterations; i++) {
+			CShaderPreprocessor::Process(ShaderPath("main.vert"), defines, sResult, stamps, sError);
+			KeepResult(sResult);
+		}
+	}, 1.0, 0.0 };
+	benchmarks.push_back(process);
+}
+
+// The sort key, made from the layout CRenderQueue documents, for checking the order the queue draws in against std::stable_sort
+static unsigned long long RenderQueueKey(const DrawPacket &packet, float fFar)
+{
+	unsigned long long program = packet.pProgram != NULL ? packet.pProgram->GetProgramID() & 0xFF : 0;
+	float fDepth = glm::clamp(-packet.modelViewMatrix[3][2] / fFar, 0.0f, 1.0f);
+	unsigned long long depth = (unsigned long long) (fDepth * 65535.0f);
+	unsigned long long ids[3] = { (unsigned long long) packet.material & 0xFFF, packet.texture & 0xFFF, packet.vao & 0xFFF };
+	if (packet.pass == PASS_TRANSPARENT)
+		return ((unsigned long long) packet.pass << 60) | ((0xFFFF - depth) << 44) | (program << 36) | (ids[0] << 24) | (ids[1] << 12) | ids[2];
+	return ((unsigned long long) packet.pass << 60) | (program << 52) | (ids[0] << 40) | (ids[1] << 28) | (ids[2] << 16) | depth;
+}
+
+// The radix sort must draw packets in the order a stable sort on the documented key gives: by pass, then grouped by state with opaque 
+// packets front to back, transparent ones back to front, and packets with equal keys in the order they were submitted.  The scene mixes 
+// all four passes, repeats packets so keys are equal, and has VAO names past the 12 bits the key keeps.  Sorted, it must change each kind 
+// of state less often than it does in submission order
+static void CheckRenderQueueSort()
+{
+	static const int NUM_PACKETS = 2000;
+	CShaderProgram program;
+	vector<DrawPacket> packets(NUM_PACKETS);
+	std::mt19937 random(4321);
+	for (int i = 0; i < NUM_PACKETS; i++) {
+		DrawPacket &packet = packets[i];
+		if (i % 7 == 6) {
+			packet = packets[i - 1];
+			continue;
+		}
+		int iMesh = random() % 64;
+		packet.pass = i % 10 == 0 ? PASS_TRANSPARENT : (i % 97 == 0 ? PASS_BACKGROUND : (i % 89 == 0 ? PASS_OVERLAY : PASS_OPAQUE));
+		packet.pProgram = &program;
+		packet.material = iMesh % 16;
+		packet.texture = 1 + iMesh % 32;
+		packet.vao = (i % 50 == 0 ? 4096 : 1) + iMesh;
+		packet.count = 36;
+		packet.modelViewMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -(float) (random() % 4000)));
+	}
+
+	CRenderQueue queue;
+	RenderQueueStats stats[2];
+	vector<int> order;
+	for (int iSorted = 0; iSorted < 2; iSorted++) {
+		for (int i = 0; i < NUM_PACKETS; i++)
+			queue.Submit(packets[i]);
+		stats[iSorted] = queue.CountStateChanges(iSorted == 1, &order);
+	}
+
+	vector<int> expected(NUM_PACKETS);
+	for (int i = 0; i < NUM_PACKETS; i++)
+		expected[i] = i;
+	std::stable_sort(expected.begin(), expected.end(), [&](int a, int b) { 
+		return RenderQueueKey(packets[a], 5000.0f) < RenderQueueKey(packets[b], 5000.0f); 
+	});
+	Check(order == expected, "the render queue draws in the order a stable sort on the key gives");
+
+	bool bPassesInOrder = true, bBackToFront = true;
+	for (int i = 1; i < NUM_PACKETS; i++) {
+		const DrawPacket &previous = packets[order[i - 1]], &packet = packets[order[i]];
+		bPassesInOrder = bPassesInOrder && previous.pass <= packet.pass;
+		if (previous.pass == PASS_TRANSPARENT && packet.pass == PASS_TRANSPARENT)
+			bBackToFront = bBackToFront && previous.modelViewMatrix[3][2] <= packet.modelViewMatrix[3][2];
+	}
+	Check(bPassesInOrder, "the render queue draws the passes in order");
+	Check(bBackToFront, "the render queue draws transparent packets back to front");
+
+	Check(stats[1].packets == NUM_PACKETS && stats[1].materialChanges < stats[0].materialChanges && 
+		stats[1].textureChanges < stats[0].textureChanges && stats[1].vaoChanges < stats[0].vaoChanges, 
+		"sorting the render queue changes materials (" + std::to_string(stats[0].materialChanges) + " to " + 
+		std::to_string(stats[1].materialChanges) + "), textures (" + std::to_string(stats[0].textureChanges) + " to " + 
+		std::to_string(stats[1].textureChanges) + ") and VAOs (" + std::to_string(stats[0].vaoChanges) + " to " + 
+		std::to_string(stats[1].vaoChanges) + ") less often");
+}
+
+// A frame's worth of draw packets through the render queue: submitting, sorting and working out the state changes, without the GL 
+// calls.  The scene has one program, as the game does, and copies of 64 meshes (each with its own VAO, one of 32 textures and one of 16
+// materials) scattered in depth, submitted in random order.  The counters compare the state changes the sorted order makes with those of submission order
+static void AddRenderQueueBenchmarks(vector<Benchmark> &benchmarks)
+{
+	if (IsWanted("RenderQueue/SubmitSort/"))
+		CheckRenderQueueSort();
+
+	auto program = std::make_shared<CShaderProgram>();
+	int sizes[] = { 100, 1000, 10000 };
+	for (int k = 0; k < 3; k++) {
+		int iNumPackets = sizes[k];
+		string name = "RenderQueue/SubmitSort/" + SizeName(iNumPackets);
+		if (!IsWanted(name))
+			continue;
+
+		auto packets = std::make_shared<vector<DrawPacket> >(iNumPackets);
+		std::mt19937 random(1234);
+		for (int i = 0; i < iNumPackets; i++) {
+			DrawPacket &packet = (*packets)[i];
+			packet.pProgram = program.get();
+			int iMesh = random() % 64;
+			packet.material = iMesh % 16;
+			packet.texture = 1 + iMesh % 32;
+			packet.vao = 1 + iMesh;
+			packet.count = 36;
+			packet.modelViewMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -(float) (random() % 4000)));
+		}
+
+		auto queue = std::make_shared<CRenderQueue>();
+		RenderQueueStats stats[2];
+		for (int iSorted = 0; iSorted < 2; iSorted++) {
+			for (int i = 0; i < iNumPackets; i++)
+				queue->Submit((*packets)[i]);
+			stats[iSorted] = queue->CountStateChanges(iSorted == 1);
+		}
+
+		Benchmark submit = { name, [=](long long iIterations) {
+			for (long long i = 0; i < iIterations; i++) {
+				for (int j = 0; j < iNumPackets; j++)
+					queue->Submit((*packets)[j]);
+				RenderQueueStats result = queue->CountStateChanges(true);
+				KeepResult(result);
+			}
+		}, (double) iNumPackets, 0.0 };
+		for (int iSorted = 0; iSorted < 2; iSorted++) {
+			string suffix = iSorted == 1 ? "_sorted" : "_unsorted";
+			submit.counters.push_back(make_pair("material_changes" + suffix, (double) stats[iSorted].materialChanges));
+			submit.counters.push_back(make_pair("texture_changes" + suffix, (double) stats[iSorted].textureChanges));
+			submit.counters.push_back(make_pair("vao_changes" + suffix, (double) stats[iSorted].vaoChanges));
+		}
+		benchmarks.push_back(submit);
+	}
+}
+
+// Text layout with the glyph metrics only.  Needs a font file; the benchmarks are skipped if none is found
+static void AddFontBenchmarks(vector<Benchmark> &benchmarks, const string &fontFile)
+{
+	if (!IsWanted("FreeTypeFont/"))
+		return;
+
+	vector<string> candidates;
+	if (!fontFile.empty())
+		candidates.push_back(fontFile);
+	candidates.push_back("/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf");
+	candidates.push_back("/usr/share/fonts/TTF/DejaVuSans.ttf");
+	candidates.push_back("/usr/share/fonts/dejavu/DejaVuSans.ttf");
+	candidates.push_back("C:\\Windows\\Fonts\\arial.ttf");
+
+	string path;
+	for (int i = 0; i < (int) candidates.size() && path.empty(); i++) {
+		FILE *fp;
+		fopen_s(&fp, candidates[i].c_str(), "rb");
+		if (fp) {
+			fclose(fp);
+			path = candidates[i];
+		}
+	}
+	auto font = std::make_shared<CFreeTypeFont>();
+	if (path.empty() || !font->LoadFont(path, 32, false)) {
+		fprintf(stderr, "No font found; skipping the text layout benchmarks (use --font)\n");
+		return;
+	}
+
+	auto fps = std::make_shared<string>("FPS: 60");
+	auto paragraph = std::make_shared<string>();
+	for (int i = 0; i < 8; i++)
+		*paragraph += "The quick brown fox jumps over the lazy dog, 0123456789 times.\n";
+
+	Benchmark layoutShort = { "FreeTypeFont/Layout/fps", [=](long long iIterations) {
+		vector<FontGlyph> glyphs;
+		for (long long i = 0; i < iIterations; i++) {
+			font->Layout(*fps, 20, 580, 20, glyphs);
+			KeepResult(glyphs);
+		}
+	}, (double) fps->size(), 0.0 };
+	benchmarks.push_back(layoutShort);
+
+	Benchmark layoutLong = { "FreeTypeFont/Layout/paragraph", [=](long long iIterations) {
+		vector<FontGlyph> glyphs;
+		for (long long i = 0; i < iIterations; i++) {
+			font->Layout(*paragraph, 20, 580, 20, glyphs);
+			KeepResult(glyphs);
+		}
+	}, (double) paragraph->size(), 0.0 };
+	benchmarks.push_back(layoutLong);
+
+	Benchmark width = { "FreeTypeFont/GetTextWidth/paragraph", [=](long long iIterations) {
+		for (long long i = 0; i < iIterations; i++) {
+			int iWidth = font->GetTextWidth(*paragraph, 20);
+			KeepResult(iWidth);
+		}
+	}, (double) paragraph->size(), 0.0 };
+	benchmarks.push_back(width);
+}
+
+
+// Write the results as JSON, with every number in a fixed format
+static void WriteReport(FILE *fp, const vector<BenchmarkResult> &results, double fMinTime)
+{
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"format\": 1,\n");
+	fprintf(fp, "  \"min_time\": %.3f,\n", fMinTime);
+	fprintf(fp, "  \"repetitions\": %d,\n", REPETITIONS);
+	fprintf(fp, "  \"threads\": %d,\n", GetDefaultThreadCount());
+	fprintf(fp, "  \"benchmarks\": [\n");
+	for (int i = 0; i < (int) results.size(); i++) {
+		const BenchmarkResult &result = results[i];
+		fprintf(fp, "    {\"name\": \"%s\", \"iterations\": %lld, \"ns_per_op\": %.3f, \"allocs_per_op\": %.3f, \"items_per_second\": %.1f, \"bytes_per_second\": %.1f, \"counters\": {",
+			result.name.c_str(), result.iterations, result.nsPerOp, result.allocsPerOp, result.itemsPerSecond, result.bytesPerSecond);
+		for (int j = 0; j < (int) result.counters.size(); j++)
+			fprintf(fp, "%s\"%s\": %.3f", j > 0 ? ", " : "", result.counters[j].first.c_str(), result.counters[j].second);
+		fprintf(fp, "}}%s\n", i + 1 < (int) results.size() ? "," : "");
+	}
+	fprintf(fp, "  ]\n");
+	fprintf(fp, "}\n");
+}
+
+int main(int argc, char **argv)
+{
+	string fontFile, outFile;
+	double fMinTime = 0.5;
+	bool bCheckOnly = false;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--filter" && i + 1 < argc)
+			g_filter = argv[++i];
+		else if (arg == "--min-time" && i + 1 < argc)
+			fMinTime = atof(argv[++i]);
+		else if (arg == "--font" && i + 1 < argc)
+			fontFile = argv[++i];
+		else if (arg == "--out" && i + 1 < argc)
+			outFile = argv[++i];
+		else if (arg == "--check")
+			bCheckOnly = true;
+		else {
+			fprintf(stderr, "Usage: %s [--filter text] [--min-time seconds] [--font file.ttf] [--out report.json] [--check]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	vector<Benchmark> benchmarks;
+	AddInterpolateBenchmarks(benchmarks);
+	AddSampleBenchmarks(benchmarks);
+	AddSampleBatchBenchmarks(benchmarks);
+	AddTrackBuildBenchmarks(benchmarks);
+	AddTrackEditBenchmarks(benchmarks);
+	AddTrackFileBenchmarks(benchmarks);
+	AddMatrixBenchmarks(benchmarks);
+	AddVertexBufferBenchmarks(benchmarks);
+	AddShaderPreprocessorBenchmarks(benchmarks);
+	AddRenderQueueBenchmarks(benchmarks);
+	AddFontBenchmarks(benchmarks, fontFile);
+
+	if (g_checkFailures > 0) {
+		fprintf(stderr, "%d of %d checks failed\n", g_checkFailures, g_checks);
+		return 1;
+	}
+	if (bCheckOnly) {
+		fprintf(stderr, "%d checks passed\n", g_checks);
+		return 0;
+	}
+
+	std::sort(benchmarks.begin(), benchmarks.end(), [](const Benchmark &a, const Benchmark &b) { return a.name < b.name; });
+
+	vector<BenchmarkResult> results;
+	double fSingleThreadRate = 0.0;
+	for (int i = 0; i < (int) benchmarks.size(); i++) {
+		if (!IsWanted(benchmarks[i].name))
+			continue;
+		fprintf(stderr, "%s\n", benchmarks[i].name.c_str());
+		results.push_back(RunBenchmark(benchmarks[i], fMinTime));
+
+		// Benchmarks with a thread count report their speedup over one thread, which sorts first
+		BenchmarkResult &result = results.back();
+		for (int j = 0; j < (int) result.counters.size(); j++) {
+			if (result.counters[j].first != "threads")
+				continue;
+			if (result.counters[j].second == 1.0)
+				fSingleThreadRate = result.itemsPerSecond;
+			if (fSingleThreadRate > 0.0)
+				result.counters.push_back(make_pair(string("speedup"), result.itemsPerSecond / fSingleThreadRate));
+			break;
+		}
+	}
+
+	FILE *fp = stdout;
+	if (!outFile.empty()) {
+		fopen_s(&fp, outFile.c_str(), "wt");
+		if (!fp) {
+			fprintf(stderr, "Cannot write %s\n", outFile.c_str());
+			return 1;
+		}
+	}
+	WriteReport(fp, results, fMinTime);
+	if (fp != stdout)
+		fclose(fp);
+	return 0;
+}
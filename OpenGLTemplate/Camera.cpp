@@ -1,5 +1,5 @@
-#include "camera.h"
-#include "gamewindow.h"
+#include "Camera.h"
+#include "GameWindow.h"
 
 // Constructor for camera -- initialise with some default values
 CCamera::CCamera()
@@ -196,4 +196,3 @@ glm::mat3 CCamera::ComputeNormalMatrix(const glm::mat4 &modelViewMatrix)
 {
 	return glm::transpose(glm::inverse(glm::mat3(modelViewMatrix)));
 }
-
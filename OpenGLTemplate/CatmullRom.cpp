@@ -1,12 +1,41 @@
 #include "CatmullRom.h"
+#include "GLState.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <algorithm>
+#include <immintrin.h>
+#include "ParallelFor.h"
+
+// MSVC compiles AVX intrinsics anywhere; GCC and Clang need the functions that use them marked, so that the rest of the file still runs 
+// on machines without AVX
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX
+#else
+#include <cpuid.h>
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
 
 
 
 CCatmullRom::CCatmullRom()
 {
 	m_vertexCount = 0;
+	m_numVisibleChunks = 0;
+	m_chordTolerance = 0.05f;
+	m_maxTurnAngle = 0.05f;
+	m_maxSampleSpacing = 50.0f;
+	m_lodDistance = 0.0f;
+	m_sampleIndexBuffer = 0;
+	m_pairIndexBuffer = 0;
+	m_scratchBuffer = 0;
+	m_scratchCapacity = 0;
+	m_uploadedChunkIndices = 0;
+	m_chunkIndexCapacity = 0;
+	m_bTablesLoaded = false;
+	m_bucketLength = 1.0f;
+	m_vaoCentreline = m_vaoLeftOffsetCurve = m_vaoRightOffsetCurve = m_vaoTrack = 0;
+	m_vboCentreline = m_vboLeftOffsetCurve = m_vboRightOffsetCurve = m_vboTrack = 0;
 }
 
 CCatmullRom::~CCatmullRom()
@@ -27,6 +56,206 @@ glm::vec3 CCatmullRom::Interpolate(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2,
 
 }
 
+// The cubic a + b*t + c*t^2 + d*t^3 of a segment, evaluated by the batch kernels in Horner form
+struct SegmentCoefficients
+{
+	glm::vec3 a, b, c, d;
+};
+
+static SegmentCoefficients GetSegmentCoefficients(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3)
+{
+	SegmentCoefficients k;
+	k.a = p1;
+	k.b = 0.5f * (-p0 + p2);
+	k.c = 0.5f * (2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3);
+	k.d = 0.5f * (-p0 + 3.0f*p1 - 3.0f*p2 + p3);
+	return k;
+}
+
+// Scalar batch kernel.  The SIMD kernels below perform exactly the same sequence of multiplies and adds (no fused multiply-add), 
+// so their results are bit-identical to this one
+static void InterpolateBatchScalar(const SegmentCoefficients &k, const float *t, int iStart, int iCount, float *x, float *y, float *z)
+{
+	for (int i = iStart; i < iCount; i++) {
+		float u = t[i];
+		x[i] = k.a.x + u * (k.b.x + u * (k.c.x + u * k.d.x));
+		y[i] = k.a.y + u * (k.b.y + u * (k.c.y + u * k.d.y));
+		z[i] = k.a.z + u * (k.b.z + u * (k.c.z + u * k.d.z));
+	}
+}
+
+// SSE batch kernel: four parameters per iteration
+static void InterpolateBatchSSE(const SegmentCoefficients &k, const float *t, int iStart, int iCount, float *x, float *y, float *z)
+{
+	__m128 ax = _mm_set1_ps(k.a.x), bx = _mm_set1_ps(k.b.x), cx = _mm_set1_ps(k.c.x), dx = _mm_set1_ps(k.d.x);
+	__m128 ay = _mm_set1_ps(k.a.y), by = _mm_set1_ps(k.b.y), cy = _mm_set1_ps(k.c.y), dy = _mm_set1_ps(k.d.y);
+	__m128 az = _mm_set1_ps(k.a.z), bz = _mm_set1_ps(k.b.z), cz = _mm_set1_ps(k.c.z), dz = _mm_set1_ps(k.d.z);
+
+	int i = iStart;
+	for (; i + 4 <= iCount; i += 4) {
+		__m128 u = _mm_loadu_ps(t + i);
+		_mm_storeu_ps(x + i, _mm_add_ps(ax, _mm_mul_ps(u, _mm_add_ps(bx, _mm_mul_ps(u, _mm_add_ps(cx, _mm_mul_ps(u, dx)))))));
+		_mm_storeu_ps(y + i, _mm_add_ps(ay, _mm_mul_ps(u, _mm_add_ps(by, _mm_mul_ps(u, _mm_add_ps(cy, _mm_mul_ps(u, dy)))))));
+		_mm_storeu_ps(z + i, _mm_add_ps(az, _mm_mul_ps(u, _mm_add_ps(bz, _mm_mul_ps(u, _mm_add_ps(cz, _mm_mul_ps(u, dz)))))));
+	}
+	InterpolateBatchScalar(k, t, i, iCount, x, y, z);
+}
+
+// AVX batch kernel: eight parameters per iteration
+TARGET_AVX static void InterpolateBatchAVX(const SegmentCoefficients &k, const float *t, int iStart, int iCount, float *x, float *y, float *z)
+{
+	__m256 ax = _mm256_set1_ps(k.a.x), bx = _mm256_set1_ps(k.b.x), cx = _mm256_set1_ps(k.c.x), dx = _mm256_set1_ps(k.d.x);
+	__m256 ay = _mm256_set1_ps(k.a.y), by = _mm256_set1_ps(k.b.y), cy = _mm256_set1_ps(k.c.y), dy = _mm256_set1_ps(k.d.y);
+	__m256 az = _mm256_set1_ps(k.a.z), bz = _mm256_set1_ps(k.b.z), cz = _mm256_set1_ps(k.c.z), dz = _mm256_set1_ps(k.d.z);
+
+	int i = iStart;
+	for (; i + 8 <= iCount; i += 8) {
+		__m256 u = _mm256_loadu_ps(t + i);
+		_mm256_storeu_ps(x + i, _mm256_add_ps(ax, _mm256_mul_ps(u, _mm256_add_ps(bx, _mm256_mul_ps(u, _mm256_add_ps(cx, _mm256_mul_ps(u, dx)))))));
+		_mm256_storeu_ps(y + i, _mm256_add_ps(ay, _mm256_mul_ps(u, _mm256_add_ps(by, _mm256_mul_ps(u, _mm256_add_ps(cy, _mm256_mul_ps(u, dy)))))));
+		_mm256_storeu_ps(z + i, _mm256_add_ps(az, _mm256_mul_ps(u, _mm256_add_ps(bz, _mm256_mul_ps(u, _mm256_add_ps(cz, _mm256_mul_ps(u, dz)))))));
+	}
+	_mm256_zeroupper();
+	InterpolateBatchSSE(k, t, i, iCount, x, y, z);
+}
+
+// Returns true if both the CPU and the operating system support AVX (the OS must save the upper halves of the ymm registers)
+static bool IsAVXSupported()
+{
+	unsigned int info[4];
+#ifdef _MSC_VER
+	__cpuid((int *) info, 1);
+#else
+	__cpuid(1, info[0], info[1], info[2], info[3]);
+#endif
+	bool bOSXSave = (info[2] & (1 << 27)) != 0;
+	bool bAVX = (info[2] & (1 << 28)) != 0;
+	if (!bOSXSave || !bAVX)
+		return false;
+#ifdef _MSC_VER
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0Low, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	unsigned long long xcr0 = xcr0Low;
+#endif
+	return (xcr0 & 0x6) == 0x6;
+}
+
+typedef void (*InterpolateBatchKernel)(const SegmentCoefficients &k, const float *t, int iStart, int iCount, float *x, float *y, float *z);
+
+// Pick the widest kernel the machine supports; SSE2 is always present on the platforms we build for
+static InterpolateBatchKernel SelectInterpolateBatchKernel()
+{
+	if (IsAVXSupported())
+		return InterpolateBatchAVX;
+	return InterpolateBatchSSE;
+}
+
+void CCatmullRom::InterpolateBatch(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, const float *t, int iCount, float *x, float *y, float *z)
+{
+	static InterpolateBatchKernel kernel = SelectInterpolateBatchKernel();
+	kernel(GetSegmentCoefficients(p0, p1, p2, p3), t, 0, iCount, x, y, z);
+}
+
+void CCatmullRom::InterpolateBatchReference(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, const float *t, int iCount, float *x, float *y, float *z)
+{
+	InterpolateBatchScalar(GetSegmentCoefficients(p0, p1, p2, p3), t, 0, iCount, x, y, z);
+}
+
+void CCatmullRom::InterpolateBatchWithSSE(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, const float *t, int iCount, float *x, float *y, float *z)
+{
+	InterpolateBatchSSE(GetSegmentCoefficients(p0, p1, p2, p3), t, 0, iCount, x, y, z);
+}
+
+bool CCatmullRom::InterpolateBatchWithAVX(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, const float *t, int iCount, float *x, float *y, float *z)
+{
+	static bool bAVX = IsAVXSupported();
+	if (!bAVX)
+		return false;
+	InterpolateBatchAVX(GetSegmentCoefficients(p0, p1, p2, p3), t, 0, iCount, x, y, z);
+	return true;
+}
+
+
+// Derivative of the Catmull Rom spline between p1 and p2 with respect to t -- its length is the speed along the curve
+glm::vec3 CCatmullRom::InterpolateDerivative(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, float t)
+{
+	glm::vec3 b = 0.5f * (-p0 + p2);
+	glm::vec3 c = 0.5f * (2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3);
+	glm::vec3 d = 0.5f * (-p0 + 3.0f*p1 - 3.0f*p2 + p3);
+
+	return b + 2.0f*c*t + 3.0f*d*t*t;
+}
+
+
+// Abscissae and weights of 5-point Gauss-Legendre quadrature on [-1, 1]
+static const int NUM_GAUSS_POINTS = 5;
+static const float gaussAbscissae[NUM_GAUSS_POINTS] = { 0.0f, -0.5384693101f, 0.5384693101f, -0.9061798459f, 0.9061798459f };
+static const float gaussWeights[NUM_GAUSS_POINTS] = { 0.5688888889f, 0.4786286705f, 0.4786286705f, 0.2369268851f, 0.2369268851f };
+
+// Get the indices of the four points along the (closed) control polygon that define segment j
+void CCatmullRom::GetSegmentIndices(int j, int &iPrev, int &iCur, int &iNext, int &iNextNext)
+{
+	int M = (int) m_controlPoints.size();
+	iPrev = ((j-1) + M) % M;
+	iCur = j;
+	iNext = (j + 1) % M;
+	iNextNext = (j + 2) % M;
+}
+
+// Integrate the speed along segment j from 0 to t using Gauss-Legendre quadrature
+float CCatmullRom::SegmentArcLength(int j, float t)
+{
+	int iPrev, iCur, iNext, iNextNext;
+	GetSegmentIndices(j, iPrev, iCur, iNext, iNextNext);
+
+	float fHalfT = 0.5f * t;
+	float fLength = 0.0f;
+	for (int i = 0; i < NUM_GAUSS_POINTS; i++) {
+		float u = fHalfT * (gaussAbscissae[i] + 1.0f);
+		fLength += gaussWeights[i] * glm::length(InterpolateDerivative(m_controlPoints[iPrev], m_controlPoints[iCur], m_controlPoints[iNext], m_controlPoints[iNextNext], u));
+	}
+
+	return fHalfT * fLength;
+}
+
+// Invert the arc length on segment j: find t in [0, 1] such that SegmentArcLength(j, t) == s.  Newton's method is used, falling back 
+// to bisection whenever a Newton step would leave the bracket known to contain the root
+float CCatmullRom::SegmentParameter(int j, float s)
+{
+	float fSegmentLength = m_distances[j + 1] - m_distances[j];
+	if (fSegmentLength <= 0.0f || s <= 0.0f)
+		return 0.0f;
+	if (s >= fSegmentLength)
+		return 1.0f;
+
+	int iPrev, iCur, iNext, iNextNext;
+	GetSegmentIndices(j, iPrev, iCur, iNext, iNextNext);
+
+	float fTolerance = 1e-6f * fSegmentLength;
+	float tLow = 0.0f, tHigh = 1.0f;
+	float t = s / fSegmentLength;
+	for (int iter = 0; iter < 16; iter++) {
+		float f = SegmentArcLength(j, t) - s;
+		if (fabs(f) < fTolerance)
+			break;
+
+		if (f > 0.0f)
+			tHigh = t;
+		else
+			tLow = t;
+
+		float fSpeed = glm::length(InterpolateDerivative(m_controlPoints[iPrev], m_controlPoints[iCur], m_controlPoints[iNext], m_controlPoints[iNextNext], t));
+		float tNext = fSpeed > 0.0f ? t - f / fSpeed : tLow;
+		if (tNext <= tLow || tNext >= tHigh)
+			tNext = 0.5f * (tLow + tHigh);
+		t = tNext;
+	}
+
+	return t;
+}
+
 
 void CCatmullRom::SetControlPoints()
 {
@@ -44,26 +273,209 @@ void CCatmullRom::SetControlPoints()
 }
 
 
-// Determine lengths along the control points, which is the set of control points forming the closed curve
+// Load control points (and optionally up vectors) from a text file, one point per line as "x y z" or "x y z ux uy uz".  Blank lines and 
+// lines starting with # are skipped.  Up vectors are only used if every point has one
+bool CCatmullRom::LoadControlPoints(const string &filename)
+{
+	FILE *fp;
+	fopen_s(&fp, filename.c_str(), "rt");
+	if (!fp) {
+		char message[1024];
+		sprintf_s(message, "Cannot load control points %s", filename.c_str());
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	m_controlPoints.clear();
+	m_controlUpVectors.clear();
+	bool bAllUpVectors = true;
+
+	char sLine[1024];
+	while (fgets(sLine, sizeof(sLine), fp)) {
+		glm::vec3 p, up;
+		int iRead = sscanf_s(sLine, "%f %f %f %f %f %f", &p.x, &p.y, &p.z, &up.x, &up.y, &up.z);
+		if (sLine[0] == '#' || iRead < 3)
+			continue;
+		m_controlPoints.push_back(p);
+		m_controlUpVectors.push_back(up);
+		bAllUpVectors = bAllUpVectors && iRead == 6;
+	}
+	fclose(fp);
+
+	if (!bAllUpVectors)
+		m_controlUpVectors.clear();
+	m_bTablesLoaded = false;
+
+	return m_controlPoints.size() >= 4;
+}
+
+// The tables in a track file are only valid for the control points, up vectors and settings they were built from.  Hashing these 
+// (and the file version) lets LoadTrack tell whether the stored tables can be used
+unsigned long long CCatmullRom::ComputeInputHash()
+{
+	float settings[5] = { m_chordTolerance, m_maxTurnAngle, m_maxSampleSpacing, (float) TRACK_WIDTH, (float) TEXTURE_LENGTH };
+	unsigned int iVersion = CTrackFile::VERSION;
+
+	unsigned long long hash = CTrackFile::Hash(&iVersion, sizeof(iVersion));
+	hash = CTrackFile::Hash(settings, sizeof(settings), hash);
+	hash = CTrackFile::Hash(m_controlPoints.data(), m_controlPoints.size() * sizeof(glm::vec3), hash);
+	hash = CTrackFile::Hash(m_controlUpVectors.data(), m_controlUpVectors.size() * sizeof(glm::vec3), hash);
+	return hash;
+}
+
+// Copy a section of the track file into a vector
+template <typename T> static bool ReadSection(CTrackFile &file, TrackFileSection section, vector<T> &data)
+{
+	const T *pData;
+	unsigned int iCount;
+	if (!file.GetSection(section, pData, iCount))
+		return false;
+	data.assign(pData, pData + iCount);
+	return true;
+}
+
+// Load a binary track file written by SaveTrack.  The control points are always taken from it.  If the stored hash matches the one 
+// computed from those control points and the current settings, the distance and frame tables and the offset curves are taken from the 
+// file as well, and CreateCentreline / CreateOffsetCurves / CreateTrack skip the work of computing them
+bool CCatmullRom::LoadTrack(const string &filename)
+{
+	m_bTablesLoaded = false;
+	if (!m_trackFile.Open(filename))
+		return false;
+
+	if (!ReadSection(m_trackFile, TRACK_CONTROL_POINTS, m_controlPoints) || !ReadSection(m_trackFile, TRACK_CONTROL_UP_VECTORS, m_controlUpVectors)) {
+		m_trackFile.Close();
+		return false;
+	}
+
+	if (m_trackFile.GetHeader().inputHash != ComputeInputHash()) {
+		// Stale tables: the control points are still good, and everything else is recomputed
+		m_trackFile.Close();
+		return true;
+	}
+
+	bool bOk = ReadSection(m_trackFile, TRACK_CONTROL_DISTANCES, m_distances)
+		&& ReadSection(m_trackFile, TRACK_CENTRELINE_POINTS, m_centrelinePoints)
+		&& ReadSection(m_trackFile, TRACK_CENTRELINE_UP_VECTORS, m_centrelineUpVectors)
+		&& ReadSection(m_trackFile, TRACK_CENTRELINE_DISTANCES, m_centrelineDistances)
+		&& ReadSection(m_trackFile, TRACK_CENTRELINE_TANGENTS, m_centrelineTangents)
+		&& ReadSection(m_trackFile, TRACK_CENTRELINE_NORMALS, m_centrelineNormals)
+		&& ReadSection(m_trackFile, TRACK_CENTRELINE_BINORMALS, m_centrelineBinormals)
+		&& ReadSection(m_trackFile, TRACK_LEFT_OFFSET_POINTS, m_leftOffsetPoints)
+		&& ReadSection(m_trackFile, TRACK_RIGHT_OFFSET_POINTS, m_rightOffsetPoints);
+
+	// Check the tables agree with each other before trusting them
+	size_t n = m_centrelinePoints.size();
+	m_bTablesLoaded = bOk && n > 0 && m_distances.size() == m_controlPoints.size() + 1
+		&& m_centrelineDistances.size() == n && m_centrelineTangents.size() == n && m_centrelineNormals.size() == n 
+		&& m_centrelineBinormals.size() == n && m_leftOffsetPoints.size() == n && m_rightOffsetPoints.size() == n
+		&& (m_centrelineUpVectors.empty() || m_centrelineUpVectors.size() == n);
+	if (m_bTablesLoaded)
+		BuildSampleLookup();
+	else
+		m_trackFile.Close();
+
+	return true;
+}
+
+// Save the control points and the tables computed from them (and, if bIncludeMesh, the track mesh) as a binary track file
+bool CCatmullRom::SaveTrack(const string &filename, bool bIncludeMesh)
+{
+	vector<float> trackdata;
+	if (bIncludeMesh)
+		BuildTrackVertices(trackdata);
+
+	const void *pSections[TRACK_NUM_SECTIONS];
+	unsigned int sectionSizes[TRACK_NUM_SECTIONS];
+	const vector<glm::vec3> *vectorSections[TRACK_NUM_SECTIONS] = { &m_controlPoints, &m_controlUpVectors, NULL, &m_centrelinePoints, 
+		&m_centrelineUpVectors, NULL, &m_centrelineTangents, &m_centrelineNormals, &m_centrelineBinormals, &m_leftOffsetPoints, &m_rightOffsetPoints, NULL };
+	for (int i = 0; i < TRACK_NUM_SECTIONS; i++) {
+		if (vectorSections[i] != NULL) {
+			pSections[i] = vectorSections[i]->data();
+			sectionSizes[i] = (unsigned int) (vectorSections[i]->size() * sizeof(glm::vec3));
+		}
+	}
+	pSections[TRACK_CONTROL_DISTANCES] = m_distances.data();
+	sectionSizes[TRACK_CONTROL_DISTANCES] = (unsigned int) (m_distances.size() * sizeof(float));
+	pSections[TRACK_CENTRELINE_DISTANCES] = m_centrelineDistances.data();
+	sectionSizes[TRACK_CENTRELINE_DISTANCES] = (unsigned int) (m_centrelineDistances.size() * sizeof(float));
+	pSections[TRACK_MESH] = trackdata.data();
+	sectionSizes[TRACK_MESH] = (unsigned int) (trackdata.size() * sizeof(float));
+
+	return CTrackFile::Write(filename, ComputeInputHash(), pSections, sectionSizes);
+}
+
+// Tessellate the control points in a text file and save the result as a binary track file
+bool CCatmullRom::ConvertTrack(const string &controlPointsFile, const string &trackFile)
+{
+	CCatmullRom track;
+	if (!track.LoadControlPoints(controlPointsFile))
+		return false;
+
+	track.AdaptivelySampleControlPoints();
+	track.ComputeOffsetCurves();
+	return track.SaveTrack(trackFile);
+}
+
+
+// Determine arc lengths along the curve at the control points, which is the set of control points forming the closed curve.  Each segment 
+// is integrated with Gauss-Legendre quadrature, so these are lengths along the spline itself rather than along the control polygon
 void CCatmullRom::ComputeLengthsAlongControlPoints()
 {
 	int M = (int) m_controlPoints.size();
 
+	m_distances.clear();
 	float fAccumulatedLength = 0.0f;
 	m_distances.push_back(fAccumulatedLength);
-	for (int i = 1; i < M; i++) {
-		fAccumulatedLength += glm::distance(m_controlPoints[i-1], m_controlPoints[i]);
+
+	// The last segment runs from the last point back to the first
+	for (int j = 0; j < M; j++) {
+		fAccumulatedLength += SegmentArcLength(j, 1.0f);
 		m_distances.push_back(fAccumulatedLength);
 	}
+}
 
-	// Get the distance from the last point to the first
-	fAccumulatedLength += glm::distance(m_controlPoints[M-1], m_controlPoints[0]);
-	m_distances.push_back(fAccumulatedLength);
+
+// Find the segment j of the control polygon for which m_distances[j] <= fLength < m_distances[j+1].  m_distances is sorted, so a binary 
+// search is used.  If iHint is a valid segment, it and the segment after it are tested first -- callers moving forward along the curve 
+// will nearly always hit one of these, making the lookup O(1)
+int CCatmullRom::FindSegment(float fLength, int iHint)
+{
+	int iNumSegments = (int) m_distances.size() - 1;
+	if (iNumSegments <= 0)
+		return -1;
+
+	if (iHint >= 0 && iHint < iNumSegments) {
+		if (fLength >= m_distances[iHint] && fLength < m_distances[iHint + 1])
+			return iHint;
+		int iNext = (iHint + 1) % iNumSegments;
+		if (fLength >= m_distances[iNext] && fLength < m_distances[iNext + 1])
+			return iNext;
+	}
+
+	// First distance strictly greater than fLength; the segment starts one before it.  Zero length segments are skipped automatically
+	int j = (int) (upper_bound(m_distances.begin(), m_distances.end(), fLength) - m_distances.begin()) - 1;
+	if (j < 0)
+		return -1;
+
+	// fLength may round to the total length; treat it as the end of the last segment
+	if (j >= iNumSegments)
+		j = iNumSegments - 1;
+
+	return j;
 }
 
 
-// Return the point (and upvector, if control upvectors provided) based on a distance d along the control polygon
+// Return the point (and upvector, if control upvectors provided) based on a distance d along the curve
 bool CCatmullRom::Sample(float d, glm::vec3 &p, glm::vec3 &up)
+{
+	int iSegment = -1;
+	return Sample(d, p, up, iSegment);
+}
+
+// Map a distance d along the curve to the segment containing it and the parameter t on that segment.  On entry, segment is a hint for the 
+// search (or -1); on return it holds the segment found
+bool CCatmullRom::FindSegmentParameter(float d, int &segment, float &t)
 {
 	if (d < 0)
 		return false;
@@ -75,30 +487,34 @@ bool CCatmullRom::Sample(float d, glm::vec3 &p, glm::vec3 &up)
 
 	float fTotalLength = m_distances[m_distances.size() - 1];
 
-	// The the current length along the control polygon; handle the case where we've looped around the track
+	// The the current length along the curve; handle the case where we've looped around the track
 	float fLength = d - (int) (d / fTotalLength) * fTotalLength;
 
 	// Find the current segment
-	int j = -1;
-	for (int i = 0; i < (int)m_distances.size()-1; i++) {
-		if (fLength >= m_distances[i] && fLength < m_distances[i + 1]) {
-			j = i; // found it!
-			break;
-		}
-	}
+	int j = FindSegment(fLength, segment);
 
 	if (j == -1)
 		return false;
 
-	// Interpolate on current segment -- get t
-	float fSegmentLength = m_distances[j + 1] - m_distances[j];
-	float t = (fLength - m_distances[j]) / fSegmentLength;
-	
+	segment = j;
+
+	// Interpolate on current segment -- get t by inverting the arc length, so that equal steps in d give equal steps along the curve
+	t = SegmentParameter(j, fLength - m_distances[j]);
+
+	return true;
+}
+
+// Return the point (and upvector, if control upvectors provided) based on a distance d along the curve.  The segment search starts 
+// from segmentHint, which is updated with the segment found; pass the same variable in every frame when moving steadily along the curve
+bool CCatmullRom::Sample(float d, glm::vec3 &p, glm::vec3 &up, int &segmentHint)
+{
+	float t;
+	if (!FindSegmentParameter(d, segmentHint, t))
+		return false;
+
 	// Get the indices of the four points along the control polygon for the current segment
-	int iPrev = ((j-1) + M) % M;
-	int iCur = j;
-	int iNext = (j + 1) % M;
-	int iNextNext = (j + 2) % M;
+	int iPrev, iCur, iNext, iNextNext;
+	GetSegmentIndices(segmentHint, iPrev, iCur, iNext, iNextNext);
 
 	// Interpolate to get the point (and upvector)
 	p = Interpolate(m_controlPoints[iPrev], m_controlPoints[iCur], m_controlPoints[iNext], m_controlPoints[iNextNext], t);
@@ -110,364 +526,1230 @@ bool CCatmullRom::Sample(float d, glm::vec3 &p, glm::vec3 &up)
 
 
 
-// Sample a set of control points using an open Catmull-Rom spline, to produce a set of iNumSamples that are (roughly) equally spaced
+// Sample a set of control points using a closed Catmull-Rom spline, to produce a set of iNumSamples that are equally spaced along the curve.
+// The arc length is integrated per segment, so a single pass gives uniform spacing and the control points are left untouched
 void CCatmullRom::UniformlySampleControlPoints(int numSamples)
 {
-	glm::vec3 p, up;
-
-	// Compute the lengths of each segment along the control polygon, and the total length
+	// Compute the arc length of each segment along the curve, and the total length
 	ComputeLengthsAlongControlPoints();
 	float fTotalLength = m_distances[m_distances.size() - 1];
 
-	// The spacing will be based on the control polygon
 	float fSpacing = fTotalLength / numSamples;
 
-	// Call PointAt to sample the spline, to generate the points
+	// Map every sample distance to a segment and parameter.  Samples move forward, so the segment hint makes each lookup O(1)
+	vector<int> segments(numSamples);
+	vector<float> params(numSamples);
+	int iSegment = -1;
 	for (int i = 0; i < numSamples; i++) {
-		Sample(i * fSpacing, p, up);
-		m_centrelinePoints.push_back(p);
-		if (m_controlUpVectors.size() > 0)
-			m_centrelineUpVectors.push_back(up);
-
+		float t = 0.0f;
+		FindSegmentParameter(i * fSpacing, iSegment, t);
+		segments[i] = iSegment;
+		params[i] = t;
 	}
 
+	SampleCentreline(segments, params);
+}
 
-	// Repeat once more for truly equidistant points
-	m_controlPoints = m_centrelinePoints;
-	m_controlUpVectors = m_centrelineUpVectors;
-	m_centrelinePoints.clear();
-	m_centrelineUpVectors.clear();
-	m_distances.clear();
+
+// Sample the control points adaptively: each segment is split recursively until every piece is within the chord error tolerance, turns 
+// through no more than the maximum angle, and is no longer than the maximum spacing.  Straights get few samples and hairpins many
+void CCatmullRom::AdaptivelySampleControlPoints()
+{
 	ComputeLengthsAlongControlPoints();
-	fTotalLength = m_distances[m_distances.size() - 1];
-	fSpacing = fTotalLength / numSamples;
-	for (int i = 0; i < numSamples; i++) {
-		Sample(i * fSpacing, p, up);
-		m_centrelinePoints.push_back(p);
-		if (m_controlUpVectors.size() > 0)
-			m_centrelineUpVectors.push_back(up);
+
+	vector<int> segments;
+	vector<float> params;
+	int M = (int) m_controlPoints.size();
+	for (int j = 0; j < M; j++) {
+		// Each segment contributes its start point; its end is the start of the next segment
+		SubdivideSegment(j, 0.0f, 1.0f, 0, params);
+		segments.resize(params.size(), j);
 	}
 
+	SampleCentreline(segments, params);
+}
+
+// Recursively split [t0, t1] on segment j, appending the parameters of the start of each accepted piece to params
+void CCatmullRom::SubdivideSegment(int j, float t0, float t1, int iDepth, vector<float> &params)
+{
+	const int MAX_DEPTH = 16;
+
+	int iPrev, iCur, iNext, iNextNext;
+	GetSegmentIndices(j, iPrev, iCur, iNext, iNextNext);
+	glm::vec3 &p0 = m_controlPoints[iPrev], &p1 = m_controlPoints[iCur], &p2 = m_controlPoints[iNext], &p3 = m_controlPoints[iNextNext];
+
+	float tMid = 0.5f * (t0 + t1);
+	glm::vec3 a = Interpolate(p0, p1, p2, p3, t0);
+	glm::vec3 b = Interpolate(p0, p1, p2, p3, t1);
+	glm::vec3 mid = Interpolate(p0, p1, p2, p3, tMid);
+
+	// Distance of the curve's midpoint from the chord, and the angle the tangent turns through
+	float fChordError = glm::length(mid - 0.5f * (a + b));
+	glm::vec3 T0 = InterpolateDerivative(p0, p1, p2, p3, t0);
+	glm::vec3 T1 = InterpolateDerivative(p0, p1, p2, p3, t1);
+	float fCosTurn = 1.0f;
+	if (glm::length(T0) > 0.0f && glm::length(T1) > 0.0f)
+		fCosTurn = glm::dot(glm::normalize(T0), glm::normalize(T1));
+
+	bool bFlat = fChordError <= m_chordTolerance && fCosTurn >= cos(m_maxTurnAngle) && glm::distance(a, b) <= m_maxSampleSpacing;
+	if (bFlat || iDepth >= MAX_DEPTH) {
+		params.push_back(t0);
+		return;
+	}
 
+	SubdivideSegment(j, t0, tMid, iDepth + 1, params);
+	SubdivideSegment(j, tMid, t1, iDepth + 1, params);
 }
 
+// Set the tolerances used by the adaptive tessellation: chord error (world units), the largest angle (radians) the track may turn through 
+// between two samples, and the largest distance between samples
+void CCatmullRom::SetTessellation(float chordTolerance, float maxTurnAngle, float maxSampleSpacing)
+{
+	m_chordTolerance = chordTolerance;
+	m_maxTurnAngle = maxTurnAngle;
+	m_maxSampleSpacing = maxSampleSpacing;
+}
 
+// Evaluate the centreline samples at the given (segment, parameter) pairs, which must be in order along the curve, then build their frames
+void CCatmullRom::SampleCentreline(const vector<int> &segments, const vector<float> &params)
+{
+	int numSamples = (int) segments.size();
+	m_centrelineSegments = segments;
+	m_centrelineParams = params;
+	m_centrelinePoints.resize(numSamples);
+	m_centrelineUpVectors.resize(m_controlUpVectors.size() == m_controlPoints.size() ? numSamples : 0);
+	m_centrelineTangents.resize(numSamples);
+	m_centrelineDistances.resize(numSamples);
+
+	EvaluateSamples(0, numSamples);
+	ComputeFrames();
+	BuildSampleLookup();
+}
 
-void CCatmullRom::CreateCentreline()
+// Evaluate the point, up vector, tangent and distance along the curve of samples [iBegin, iEnd) from their segments and parameters.  
+// Each run of samples lying on the same segment is evaluated with the batch (SIMD) evaluator into structure-of-arrays buffers
+void CCatmullRom::EvaluateSamples(int iBegin, int iEnd)
 {
-	// Call Set Control Points
-	SetControlPoints();
+	int numSamples = iEnd - iBegin;
+	bool bUpVectors = !m_centrelineUpVectors.empty();
+	const int *segments = &m_centrelineSegments[iBegin];
+	const float *params = &m_centrelineParams[iBegin];
+	vector<float> x(numSamples), y(numSamples), z(numSamples);
+	vector<float> upX, upY, upZ;
+	if (bUpVectors) {
+		upX.resize(numSamples);
+		upY.resize(numSamples);
+		upZ.resize(numSamples);
+	}
 
-	// Call UniformlySampleControlPoints with the number of samples required
-	UniformlySampleControlPoints(500);
+	int iRunStart = 0;
+	while (iRunStart < numSamples) {
+		int iRunEnd = iRunStart + 1;
+		while (iRunEnd < numSamples && segments[iRunEnd] == segments[iRunStart])
+			iRunEnd++;
+
+		int iPrev, iCur, iNext, iNextNext;
+		GetSegmentIndices(segments[iRunStart], iPrev, iCur, iNext, iNextNext);
+		int iCount = iRunEnd - iRunStart;
+		InterpolateBatch(m_controlPoints[iPrev], m_controlPoints[iCur], m_controlPoints[iNext], m_controlPoints[iNextNext],
+			&params[iRunStart], iCount, &x[iRunStart], &y[iRunStart], &z[iRunStart]);
+		if (bUpVectors)
+			InterpolateBatch(m_controlUpVectors[iPrev], m_controlUpVectors[iCur], m_controlUpVectors[iNext], m_controlUpVectors[iNextNext],
+				&params[iRunStart], iCount, &upX[iRunStart], &upY[iRunStart], &upZ[iRunStart]);
+
+		iRunStart = iRunEnd;
+	}
 
-	// Create a VAO called m_vaoCentreline and a VBO to get the points onto the graphics card
-	glGenVertexArrays(1, &m_vaoCentreline);
-	glBindVertexArray(m_vaoCentreline);
+	for (int k = 0; k < numSamples; k++) {
+		int i = iBegin + k;
+		m_centrelinePoints[i] = glm::vec3(x[k], y[k], z[k]);
+		if (bUpVectors)
+			m_centrelineUpVectors[i] = glm::normalize(glm::vec3(upX[k], upY[k], upZ[k]));
+
+		int j = segments[k];
+		int iPrev, iCur, iNext, iNextNext;
+		GetSegmentIndices(j, iPrev, iCur, iNext, iNextNext);
+		m_centrelineTangents[i] = glm::normalize(InterpolateDerivative(m_controlPoints[iPrev], m_controlPoints[iCur], m_controlPoints[iNext], m_controlPoints[iNextNext], params[k]));
+		m_centrelineDistances[i] = m_distances[j] + SegmentArcLength(j, params[k]);
+	}
+}
 
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-	std::vector<float> vertexData;
+// Build a rotation minimising frame at every centreline point using the double reflection method (Wang et al., "Computation of Rotation 
+// Minimizing Frames", 2008).  Unlike frames built from a fixed world up vector, these don't flip on vertical sections.  Because the track 
+// is closed, the frame transported around the loop generally comes back twisted; that twist is spread evenly along the length of the loop
+void CCatmullRom::ComputeFrames()
+{
+	int n = (int) m_centrelinePoints.size();
+	m_centrelineNormals.resize(n);
+	m_centrelineBinormals.resize(n);
+	if (n == 0)
+		return;
+
+	// Start with the binormal as close to the up vector (world up, or the first control upvector) as the tangent allows
+	glm::vec3 up = m_centrelineUpVectors.size() > 0 ? m_centrelineUpVectors[0] : glm::vec3(0, 1, 0);
+	glm::vec3 T0 = m_centrelineTangents[0];
+	glm::vec3 r = up - glm::dot(up, T0) * T0;
+	if (glm::length(r) < 1e-6f)
+		r = fabs(T0.x) < 0.9f ? glm::cross(T0, glm::vec3(1, 0, 0)) : glm::cross(T0, glm::vec3(0, 0, 1));
+	m_centrelineBinormals[0] = glm::normalize(r);
+
+	// Transport the binormal around the loop, including the final step back to the first point
+	glm::vec3 rEnd;
+	for (int i = 0; i < n; i++) {
+		int iNext = (i + 1) % n;
+		glm::vec3 rNext = TransportBinormal(i, iNext, m_centrelineBinormals[i]);
+
+		if (iNext == 0)
+			rEnd = rNext;
+		else
+			m_centrelineBinormals[iNext] = glm::normalize(rNext);
+	}
+
+	// Signed angle from the transported binormal back to the starting one, about the first tangent
+	glm::vec3 rStart = m_centrelineBinormals[0];
+	float fTwist = atan2(glm::dot(glm::cross(rEnd, rStart), T0), glm::dot(rEnd, rStart));
+
+	for (int i = 0; i < n; i++)
+		TwistFrame(i, fTwist * m_centrelineDistances[i] / m_distances.back());
+}
+
+// One step of the double reflection method: transport the binormal r at sample i to sample iNext
+glm::vec3 CCatmullRom::TransportBinormal(int i, int iNext, const glm::vec3 &r)
+{
+	// Reflect the frame in the plane bisecting the two points...
+	glm::vec3 v1 = m_centrelinePoints[iNext] - m_centrelinePoints[i];
+	float c1 = glm::dot(v1, v1);
+	glm::vec3 rL = r, tL = m_centrelineTangents[i];
+	if (c1 > 0.0f) {
+		rL = r - (2.0f / c1) * glm::dot(v1, r) * v1;
+		tL = tL - (2.0f / c1) * glm::dot(v1, tL) * v1;
+	}
+
+	// ... and then in the plane that maps the reflected tangent onto the next tangent
+	glm::vec3 v2 = m_centrelineTangents[iNext] - tL;
+	float c2 = glm::dot(v2, v2);
+	glm::vec3 rNext = rL;
+	if (c2 > 0.0f)
+		rNext = rL - (2.0f / c2) * glm::dot(v2, rL) * v2;
 
+	return rNext;
+}
 
-	glm::vec2 texCoord(0.0f, 0.0f);  // Simple texture coordinate for now
-	glm::vec3 normal(0.0f, 1.0f, 0.0f);  // Up-facing normal for now
+// Rotate the binormal of sample i about the tangent by fAngle (Rodrigues' formula, with B perpendicular to T), and set the normal from it
+void CCatmullRom::TwistFrame(int i, float fAngle)
+{
+	glm::vec3 T = m_centrelineTangents[i];
+	glm::vec3 B = m_centrelineBinormals[i] * cos(fAngle) + glm::cross(T, m_centrelineBinormals[i]) * sin(fAngle);
+	B = glm::normalize(B - glm::dot(B, T) * T);
+	m_centrelineBinormals[i] = B;
+	m_centrelineNormals[i] = glm::normalize(glm::cross(T, B));
+}
 
-	for (unsigned int i = 0; i < m_centrelinePoints.size(); i++) {
-		vertexData.push_back(m_centrelinePoints[i].x);
-		vertexData.push_back(m_centrelinePoints[i].y);
-		vertexData.push_back(m_centrelinePoints[i].z);
 
-		vertexData.push_back(texCoord.x);
-		vertexData.push_back(texCoord.y);
-		
-		vertexData.push_back(normal.x);
-		vertexData.push_back(normal.y);
-		vertexData.push_back(normal.z);
+// Return the point and frame at a distance d along the centreline by interpolating between the two nearest entries of the frame table.
+// The samples needn't be evenly spaced, so the entries are found with FindSample
+bool CCatmullRom::SampleFrame(float d, glm::vec3 &p, glm::vec3 &T, glm::vec3 &N, glm::vec3 &B)
+{
+	int n = (int) m_centrelinePoints.size();
+	if (d < 0 || n == 0 || (int) m_centrelineNormals.size() != n)
+		return false;
+
+	float fTotalLength = m_distances[m_distances.size() - 1];
+	float fLength = d - (int) (d / fTotalLength) * fTotalLength;
+
+	int i = FindSample(fLength);
+	int iNext = (i + 1) % n;
+	float fStart = m_centrelineDistances[i];
+	float fEnd = iNext == 0 ? fTotalLength : m_centrelineDistances[iNext];
+	float a = fEnd > fStart ? (fLength - fStart) / (fEnd - fStart) : 0.0f;
+
+	p = glm::mix(m_centrelinePoints[i], m_centrelinePoints[iNext], a);
+	T = glm::normalize(glm::mix(m_centrelineTangents[i], m_centrelineTangents[iNext], a));
+	B = glm::mix(m_centrelineBinormals[i], m_centrelineBinormals[iNext], a);
+	B = glm::normalize(B - glm::dot(B, T) * T);
+	N = glm::cross(T, B);
+
+	return true;
+}
+
+
+
+// Divide the length of the track into buckets, one per sample on average, and record the last sample starting at or before each bucket.  
+// FindSample then only has to search the samples within one bucket.  After an edit, the buckets before sample iFirstSample still hold, 
+// so the bucket length is kept and only the buckets from there on are filled in again
+void CCatmullRom::BuildSampleLookup(int iFirstSample)
+{
+	int n = (int) m_centrelinePoints.size();
+	if (n == 0) {
+		m_sampleBuckets.assign(1, 0);
+		return;
+	}
+	if (iFirstSample <= 0 || m_sampleBuckets.empty()) {
+		iFirstSample = 0;
+		m_bucketLength = m_distances.back() / n;
 	}
 
-	// Upload VBO
-	glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(float), vertexData.data(), GL_STATIC_DRAW);
+	// Enough buckets to reach the end of the track, and one more to end the last search range
+	int iNumBuckets = (int) (m_distances.back() / m_bucketLength) + 2;
+	int b = (int) (m_centrelineDistances[iFirstSample] / m_bucketLength);
+	int i = b < (int) m_sampleBuckets.size() ? min(m_sampleBuckets[b], iFirstSample) : 0;
+	m_sampleBuckets.resize(iNumBuckets);
+	for (; b < iNumBuckets; b++) {
+		while (i + 1 < n && m_centrelineDistances[i + 1] <= b * m_bucketLength)
+			i++;
+		m_sampleBuckets[b] = i;
+	}
+}
 
+// Find the sample i with m_centrelineDistances[i] <= fLength < m_centrelineDistances[i + 1], for 0 <= fLength < total length.  If iHint 
+// or the sample after it is the answer (as when stepping through increasing distances) no search is needed
+int CCatmullRom::FindSample(float fLength, int iHint) const
+{
+	int n = (int) m_centrelineDistances.size();
+	if (iHint >= 0 && iHint < n && m_centrelineDistances[iHint] <= fLength) {
+		if (iHint + 1 == n || fLength < m_centrelineDistances[iHint + 1])
+			return iHint;
+		if (iHint + 2 == n || fLength < m_centrelineDistances[iHint + 2])
+			return iHint + 1;
+	}
 
-	// Set vertex attribute locations
-	GLsizei stride = 2 * sizeof(glm::vec3) + sizeof(glm::vec2);
+	int iLastBucket = (int) m_sampleBuckets.size() - 2;
+	int b = (int) (fLength / m_bucketLength);
+	b = b < 0 ? 0 : (b > iLastBucket ? iLastBucket : b);
+	const float *pFirst = &m_centrelineDistances[m_sampleBuckets[b]];
+	const float *pLast = &m_centrelineDistances[0] + m_sampleBuckets[b + 1] + 1;
+	int i = (int) (upper_bound(pFirst, pLast, fLength) - &m_centrelineDistances[0]) - 1;
+	return i < 0 ? 0 : i;
+}
 
-	// Vertex positions
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+// Sample the frame table at iCount distances, like SampleFrame, writing structure-of-arrays output.  Each thread walks its share of d[] 
+// in order, using the previous sample found as the hint for the next, so sorted distances (such as a field of agents ordered by progress) 
+// need no searching at all.  Agents in a row on the same sample also share its interval and the differences to the next sample, which 
+// are only worked out when the sample changes.  Large batches are split across iNumThreads threads (0 = one per core)
+void CCatmullRom::SampleBatch(const float *d, int iCount, const TrackSamples &out, int iNumThreads)
+{
+	int n = (int) m_centrelinePoints.size();
+	if (n == 0 || (int) m_centrelineNormals.size() != n)
+		return;
+
+	float fTotalLength = m_distances.back();
+	bool bFrames = out.tX != NULL || out.upX != NULL;
+	ParallelFor(0, iCount, [&](int iBegin, int iEnd) {
+		int i = -1, iShared = -1;
+		float fStart = 0.0f, fSpan = 0.0f;
+		glm::vec3 p0, dp, T0, dT, B0, dB;
+		for (int k = iBegin; k < iEnd; k++) {
+			float fLength = d[k];
+			if (fLength < 0.0f || fLength >= fTotalLength)
+				fLength -= floor(fLength / fTotalLength) * fTotalLength;
+
+			i = FindSample(fLength, i);
+			if (i != iShared) {
+				iShared = i;
+				int iNext = i + 1 < n ? i + 1 : 0;
+				fStart = m_centrelineDistances[i];
+				fSpan = (iNext == 0 ? fTotalLength : m_centrelineDistances[iNext]) - fStart;
+				p0 = m_centrelinePoints[i];
+				dp = m_centrelinePoints[iNext] - p0;
+				if (bFrames) {
+					T0 = m_centrelineTangents[i];
+					dT = m_centrelineTangents[iNext] - T0;
+					B0 = m_centrelineBinormals[i];
+					dB = m_centrelineBinormals[iNext] - B0;
+				}
+			}
+			float a = fSpan > 0.0f ? (fLength - fStart) / fSpan : 0.0f;
+
+			glm::vec3 p = p0 + a * dp;
+			out.x[k] = p.x;
+			out.y[k] = p.y;
+			out.z[k] = p.z;
+			if (!bFrames)
+				continue;
+
+			glm::vec3 T = glm::normalize(T0 + a * dT);
+			if (out.tX != NULL) {
+				out.tX[k] = T.x;
+				out.tY[k] = T.y;
+				out.tZ[k] = T.z;
+			}
+			if (out.upX != NULL) {
+				glm::vec3 B = B0 + a * dB;
+				B = glm::normalize(B - glm::dot(B, T) * T);
+				out.upX[k] = B.x;
+				out.upY[k] = B.y;
+				out.upZ[k] = B.z;
+			}
+		}
+	}, iNumThreads, 4096);
+}
 
-	// Texture coordinates
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)sizeof(glm::vec3));
 
-	// Normal vectors
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,
-		(void*)(sizeof(glm::vec3) + sizeof(glm::vec2)));
+void CCatmullRom::CreateCentreline()
+{
+	ComputeCentreline();
+
+	// Create a VAO called m_vaoCentreline and a VBO to get the points onto the graphics card
+	vector<float> vertexData;
+	BuildPointVertices(m_centrelinePoints, vertexData);
+	CreateVAO(m_vaoCentreline, m_vboCentreline, vertexData.data(), vertexData.size());
+}
 
-	// Unbind the VAO
-	glBindVertexArray(0);
 
+void CCatmullRom::ComputeCentreline()
+{
+	// Call Set Control Points, unless a track has been loaded
+	if (m_controlPoints.empty())
+		SetControlPoints();
+
+	// Tessellate the curve, using more samples where it bends.  UniformlySampleControlPoints(n) gives n evenly spaced samples instead
+	if (!m_bTablesLoaded)
+		AdaptivelySampleControlPoints();
+
+	// Index the centreline segments for Project, with cells about the width of the track
+	m_spatialIndex.Build(m_centrelinePoints, (float) TRACK_WIDTH);
 }
 
 
-void CCatmullRom::CreateOffsetCurves()
+// Write one interleaved vertex (position, texture coordinate, normal) -- 8 floats -- at pVertex
+static inline void WriteVertex(float *pVertex, const glm::vec3 &p, const glm::vec2 &tex, const glm::vec3 &normal)
 {
-	// Compute the offset curves, one left, and one right.  Store the points in m_leftOffsetPoints and m_rightOffsetPoints respectively
-	float w = 20.0f;
+	pVertex[0] = p.x;
+	pVertex[1] = p.y;
+	pVertex[2] = p.z;
+	pVertex[3] = tex.x;
+	pVertex[4] = tex.y;
+	pVertex[5] = normal.x;
+	pVertex[6] = normal.y;
+	pVertex[7] = normal.z;
+}
 
-	m_leftOffsetPoints.clear();
-	m_rightOffsetPoints.clear();
+// Compute the offset curves, one left, and one right.  Store the points in m_leftOffsetPoints and m_rightOffsetPoints respectively.
+// The sideways direction comes from the frame table, and each sample is independent, so the samples are split across iNumThreads threads
+void CCatmullRom::ComputeOffsetCurves(int iNumThreads)
+{
+	int n = (int) m_centrelinePoints.size();
+
+	m_leftOffsetPoints.resize(n);
+	m_rightOffsetPoints.resize(n);
+
+	ParallelFor(0, n, [&](int iBegin, int iEnd) {
+		ComputeOffsetPoints(iBegin, iEnd);
+	}, iNumThreads);
+}
 
-	for (int i = 0; i < m_centrelinePoints.size(); ++i) {
+// Compute the offset curve points for samples [iBegin, iEnd)
+void CCatmullRom::ComputeOffsetPoints(int iBegin, int iEnd)
+{
+	float w = (float) TRACK_WIDTH;
+	for (int i = iBegin; i < iEnd; ++i) {
 		glm::vec3 p = m_centrelinePoints[i];
+		glm::vec3 N = m_centrelineNormals[i];
 
-		glm::vec3 pNext = m_centrelinePoints[(i + 1) % m_centrelinePoints.size()]; // Wraparound
+		m_leftOffsetPoints[i] = p - (w / 2) * N; // l offset
+		m_rightOffsetPoints[i] = p + (w / 2) * N; // r offset
+	}
+}
 
-		// TNB regen
-		glm::vec3 T = glm::normalize(pNext - p);
-		glm::vec3 N = glm::normalize(glm::cross(T, glm::vec3(0, 1, 0)));
-		glm::vec3 B = glm::normalize(glm::cross(N, T));
+// Fill vertexData with interleaved vertices for a set of points, as used for the centreline and offset curves.  The first point is repeated 
+// at the end, so the closed curve (or any chunk of it) can be drawn as a line strip
+void CCatmullRom::BuildPointVertices(const vector<glm::vec3> &points, vector<float> &vertexData, int iNumThreads)
+{
+	int n = (int) points.size();
 
-		glm::vec3 l = p - (w / 2) * N; // l offset
-		glm::vec3 r = p + (w / 2) * N; // r offset
+	vertexData.resize((n + 1) * 8);
+	float *pData = vertexData.data();
+	ParallelFor(0, n + 1, [&](int iBegin, int iEnd) {
+		WritePointVertices(points, pData + iBegin * 8, iBegin, iEnd);
+	}, iNumThreads);
+}
 
-		m_leftOffsetPoints.push_back(l);
-		m_rightOffsetPoints.push_back(r);
-	}
+// Write the vertices for points [iBegin, iEnd) to pData, where index n is the first point repeated
+void CCatmullRom::WritePointVertices(const vector<glm::vec3> &points, float *pData, int iBegin, int iEnd)
+{
+	glm::vec2 tex(0.0f, 0.0f);
+	glm::vec3 normal(0.0f, 1.0f, 0.0f);
+	int n = (int) points.size();
 
-	// Generate two VAOs called m_vaoLeftOffsetCurve and m_vaoRightOffsetCurve, each with a VBO, and get the offset curve points on the graphics card
-	// Note it is possible to only use one VAO / VBO with all the points instead.
+	for (int i = iBegin; i < iEnd; i++)
+		WriteVertex(pData + (i - iBegin) * 8, points[i < n ? i : 0], tex, normal);
+}
 
-	// Left offset
-	// Generate and bind vao
-	glGenVertexArrays(1, &m_vaoLeftOffsetCurve);
-	glBindVertexArray(m_vaoLeftOffsetCurve);
+// Fill trackdata with the interleaved triangle strip for the track: a left and a right vertex per sample, and then the first pair again 
+// to close the loop.  Every pair goes to a fixed place in the preallocated buffer, so the output is the same for any thread count
+void CCatmullRom::BuildTrackVertices(vector<float> &trackdata, int iNumThreads)
+{
+	int n = (int) m_leftOffsetPoints.size();
 
-	// Generate and bind vbo and then upload vertices
-	GLuint leftVBO;
-	glGenBuffers(1, &leftVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, leftVBO);
+	trackdata.resize((n + 1) * 2 * 8);
+	float *pData = trackdata.data();
+	ParallelFor(0, n + 1, [&](int iBegin, int iEnd) {
+		WriteTrackVertices(pData + iBegin * 16, iBegin, iEnd);
+	}, iNumThreads);
+}
 
-	std::vector<float> leftdata;
-	glm::vec2 tex(0.0f, 0.0f);
+// Write the left / right vertex pairs for samples [iBegin, iEnd) to pData.  The final pair (index n) repeats the first to close the loop, 
+// at the track's full length.  v is the distance along the track in texture lengths, so it doesn't depend on the total length, and an edit 
+// leaves it right for the vertices before the samples it adds
+void CCatmullRom::WriteTrackVertices(float *pData, int iBegin, int iEnd)
+{
 	glm::vec3 normal(0.0f, 1.0f, 0.0f);
+	int n = (int) m_leftOffsetPoints.size();
 
-	// Making the buffer content packed
-	for (const glm::vec3& point : m_leftOffsetPoints) {
-		// Pos
-		leftdata.push_back(point.x);
-		leftdata.push_back(point.y);
-		leftdata.push_back(point.z);
+	for (int i = iBegin; i < iEnd; ++i) {
+		int iPoint = i < n ? i : 0;
+		float v = (i < n ? m_centrelineDistances[i] : m_distances.back()) / TEXTURE_LENGTH;
 
-		// Tex
-		leftdata.push_back(tex.x);
-		leftdata.push_back(tex.y);
+		WriteVertex(pData + (2 * (i - iBegin)) * 8, m_leftOffsetPoints[iPoint], glm::vec2(0.0f, v), normal);
+		WriteVertex(pData + (2 * (i - iBegin) + 1) * 8, m_rightOffsetPoints[iPoint], glm::vec2(1.0f, v), normal);
+	}
+}
 
-		// Normal
-		leftdata.push_back(normal.x);
-		leftdata.push_back(normal.y);
-		leftdata.push_back(normal.z);
+// Allocate the bound array buffer a quarter larger than iSize bytes and fill the start of it, so that the track can grow by edits without 
+// the buffer being reallocated
+static void AllocateVertexBuffer(const void *pData, GLsizeiptr iSize)
+{
+	glBufferData(GL_ARRAY_BUFFER, iSize + iSize / 4, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, iSize, pData);
+}
+
+// Create a VAO with a VBO holding interleaved vertex data (position, texture coordinate, normal).  If the VAO already exists, its VBO is 
+// refilled instead, so building the track again doesn't leak buffers
+void CCatmullRom::CreateVAO(GLuint &vao, GLuint &vbo, const float *pVertexData, size_t iNumFloats)
+{
+	if (vao != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		AllocateVertexBuffer(pVertexData, iNumFloats * sizeof(float));
+		return;
 	}
 
-	glBufferData(GL_ARRAY_BUFFER, leftdata.size() * sizeof(float), leftdata.data(), GL_STATIC_DRAW);
+	glGenVertexArrays(1, &vao);
+	CGLState::BindVertexArray(vao);
+
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	AllocateVertexBuffer(pVertexData, iNumFloats * sizeof(float));
 	GLuint stride = 8 * sizeof(float);
 
-	// Attrib ptrs
 	// Pos
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0); //void* 0 no offset
 
 	// Tex
 	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3*sizeof(float))); //12 byte offset from stride
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float))); //12 byte offset from stride
 
 	// Normal
 	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(6*sizeof(float))); //24 byte offset from stride
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float))); //20 byte offset from stride
+
+	CGLState::BindVertexArray(0); // Unbind
+}
 
 
-	// Right offset
-	// Generate and bind vao
-	glGenVertexArrays(1, &m_vaoRightOffsetCurve);
-	glBindVertexArray(m_vaoRightOffsetCurve);
+void CCatmullRom::CreateOffsetCurves()
+{
+	if (!m_bTablesLoaded)
+		ComputeOffsetCurves();
 
-	// Generate and bind vbo and then upload vertices
-	GLuint rightVBO;
-	glGenBuffers(1, &rightVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, rightVBO);
+	// Generate two VAOs called m_vaoLeftOffsetCurve and m_vaoRightOffsetCurve, each with a VBO, and get the offset curve points on the graphics card
+	vector<float> vertexData;
+	BuildPointVertices(m_leftOffsetPoints, vertexData);
+	CreateVAO(m_vaoLeftOffsetCurve, m_vboLeftOffsetCurve, vertexData.data(), vertexData.size());
 
-	std::vector<float> rightdata;
+	BuildPointVertices(m_rightOffsetPoints, vertexData);
+	CreateVAO(m_vaoRightOffsetCurve, m_vboRightOffsetCurve, vertexData.data(), vertexData.size());
+}
 
-	// Making the buffer content packed
-	for (const glm::vec3& point : m_rightOffsetPoints) {
-		// Pos
-		rightdata.push_back(point.x);
-		rightdata.push_back(point.y);
-		rightdata.push_back(point.z);
 
-		// Tex
-		rightdata.push_back(tex.x);
-		rightdata.push_back(tex.y);
+void CCatmullRom::CreateTrack()
+{
+	// Generate a VAO called m_vaoTrack and a VBO to get the offset curve points on the graphics card.  A mesh stored in the track file is 
+	// uploaded straight from the mapped file
+	m_vertexCount = (m_leftOffsetPoints.size() + 1) * 2;
 
-		// Normal
-		rightdata.push_back(normal.x);
-		rightdata.push_back(normal.y);
-		rightdata.push_back(normal.z);
+	const float *pMesh = NULL;
+	unsigned int iNumFloats = 0;
+	if (m_bTablesLoaded && m_trackFile.GetSection(TRACK_MESH, pMesh, iNumFloats) && iNumFloats == m_vertexCount * 8) {
+		CreateVAO(m_vaoTrack, m_vboTrack, pMesh, iNumFloats);
+	} else {
+		vector<float> trackdata;
+		BuildTrackVertices(trackdata);
+		CreateVAO(m_vaoTrack, m_vboTrack, trackdata.data(), trackdata.size());
 	}
+	m_trackFile.Close();
 
-	glBufferData(GL_ARRAY_BUFFER, rightdata.size() * sizeof(float), rightdata.data(), GL_STATIC_DRAW);
+	BuildChunks();
+}
 
-	// Attrib ptrs
-	// Pos
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0); //void* 0 no offset
+// Free the VAOs and vertex buffers of the centreline, offset curves and track, and the index and scratch buffers shared by them
+void CCatmullRom::Release()
+{
+	GLuint vaos[] = { m_vaoCentreline, m_vaoLeftOffsetCurve, m_vaoRightOffsetCurve, m_vaoTrack };
+	GLuint buffers[] = { m_vboCentreline, m_vboLeftOffsetCurve, m_vboRightOffsetCurve, m_vboTrack, m_sampleIndexBuffer, m_pairIndexBuffer, 
+		m_scratchBuffer };
+
+	// Zero names are ignored by the deletes, so parts of the track that were never created don't matter
+	for (int i = 0; i < 4; i++)
+		CGLState::DeleteVertexArray(vaos[i]);
+	glDeleteBuffers(7, buffers);
+
+	m_vaoCentreline = m_vaoLeftOffsetCurve = m_vaoRightOffsetCurve = m_vaoTrack = 0;
+	m_vboCentreline = m_vboLeftOffsetCurve = m_vboRightOffsetCurve = m_vboTrack = 0;
+	m_sampleIndexBuffer = m_pairIndexBuffer = m_scratchBuffer = 0;
+	m_scratchCapacity = 0;
+	m_uploadedChunkIndices = 0;
+	m_chunkIndexCapacity = 0;
+}
 
-	// Tex
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float))); //12 byte offset from stride
 
-	// Normal
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float))); //24 byte offset from stride
-	
-	glBindVertexArray(0); // Unbind
+// Move control point k.  The segments it shapes are tessellated again, so the number of samples may change, as for an insert
+bool CCatmullRom::MoveControlPoint(int k, const glm::vec3 &p)
+{
+	if (k < 0 || k >= (int) m_controlPoints.size())
+		return false;
 
+	RecoverSampleParameters();
+	m_controlPoints[k] = p;
+	EditControlPoints(k, 0);
+	return true;
 }
 
+// Insert a control point before control point k, for k from 1 to the number of points (which adds it between the last and first points).  
+// Point 0 stays where it is, so the start of the track doesn't move.  With control upvectors, the new point's upvector is the average of 
+// its neighbours'
+bool CCatmullRom::InsertControlPoint(int k, const glm::vec3 &p)
+{
+	int M = (int) m_controlPoints.size();
+	if (k < 1 || k > M)
+		return false;
 
-void CCatmullRom::CreateTrack()
+	RecoverSampleParameters();
+	if ((int) m_controlUpVectors.size() == M)
+		m_controlUpVectors.insert(m_controlUpVectors.begin() + k, glm::normalize(m_controlUpVectors[k - 1] + m_controlUpVectors[k % M]));
+	m_controlPoints.insert(m_controlPoints.begin() + k, p);
+	EditControlPoints(k, 1);
+	return true;
+}
+
+// Delete control point k.  A closed Catmull-Rom spline needs at least four points.  Deleting point 0 moves the start of the track, so 
+// the whole track is rebuilt
+bool CCatmullRom::DeleteControlPoint(int k)
 {
-	
-	// Generate a VAO called m_vaoTrack and a VBO to get the offset curve points and indices on the graphics card
-	glGenVertexArrays(1, &m_vaoTrack);
-	glBindVertexArray(m_vaoTrack);
+	int M = (int) m_controlPoints.size();
+	if (k < 0 || k >= M || M <= 4)
+		return false;
+
+	RecoverSampleParameters();
+	if ((int) m_controlUpVectors.size() == M)
+		m_controlUpVectors.erase(m_controlUpVectors.begin() + k);
+	m_controlPoints.erase(m_controlPoints.begin() + k);
+	EditControlPoints(k, -1);
+	return true;
+}
+
+int CCatmullRom::GetNumControlPoints()
+{
+	return (int) m_controlPoints.size();
+}
+
+glm::vec3 CCatmullRom::GetControlPoint(int k)
+{
+	return m_controlPoints[k];
+}
+
+// Tables loaded from a track file don't store each sample's segment and parameter, so recover them from the distances.  This solves for
+// the parameters on the curve the distances were measured along, so it must be called before the control points are edited
+void CCatmullRom::RecoverSampleParameters()
+{
+	int n = (int) m_centrelinePoints.size();
+	if ((int) m_centrelineSegments.size() == n)
+		return;
+
+	m_centrelineSegments.resize(n);
+	m_centrelineParams.resize(n);
+	int iSegment = -1;
+	for (int i = 0; i < n; i++) {
+		FindSegmentParameter(m_centrelineDistances[i], iSegment, m_centrelineParams[i]);
+		m_centrelineSegments[i] = iSegment;
+	}
+}
+
+// Update the track after control point k has been moved (iDelta = 0), inserted (1) or deleted (-1).  A segment depends on four control 
+// points, so only segments k - 2 .. k + 1 change (one fewer on the side the count shrank).  Those are re-tessellated, and everything else is 
+// kept: samples are only copied (with their segment renumbered and their distance shifted), and their frames, offset curve points and 
+// vertices are left as they were.  The frames of the new samples are transported from the sample before them, and the twist left where 
+// they meet the sample after them is spread along them.  Only the new samples' vertices are written; the vertices after them are moved 
+// along within the buffers, and the chunks, sample lookup and spatial index are patched around the new samples.  If the edit changes 
+// the track's length, the track vertices after the new samples are written again rather than moved, as their texture coordinates follow 
+// the distance along the track.  An edit that re-tessellates segment 0 moves every sample, so then the frames, vertices and lookups are 
+// built again as a full build would.  A track without buffers only has its tables updated
+void CCatmullRom::EditControlPoints(int k, int iDelta)
+{
+	int M = (int) m_controlPoints.size();
+	int iOldM = M - iDelta;
+	int iOldN = (int) m_centrelinePoints.size();
+	int iNumNew = iDelta >= 0 ? 4 : 3;			// Affected segments, after the edit ...
+	int iNumOld = iDelta <= 0 ? 4 : 3;			// ... and before it
+	int jFirst = (k - 2 + M) % M;
+	m_bTablesLoaded = false;
+
+	if (iOldN == 0 || (iDelta < 0 && k == 0) || iNumNew >= M || iNumOld >= iOldM) {
+		RebuildTrack();
+		return;
+	}
+
+	// First sample of each old segment
+	vector<int> oldFirst(iOldM + 1, iOldN);
+	for (int i = iOldN - 1; i >= 0; i--)
+		oldFirst[m_centrelineSegments[i]] = i;
+	for (int j = iOldM - 1; j >= 0; j--)
+		if (oldFirst[j] > oldFirst[j + 1])
+			oldFirst[j] = oldFirst[j + 1];
+
+	// New segment lengths: affected segments are integrated again, the others are taken from the old table.  If the affected segments 
+	// don't wrap past the end, the segments before them start where they did, and their old distances are kept exactly
+	vector<float> oldDistances = m_distances;
+	m_distances.assign(M + 1, 0.0f);
+	for (int j = 0; j < M; j++) {
+		bool bAffected = (j - jFirst + M) % M < iNumNew;
+		int jOld = j < k ? j : j - iDelta;
+		float fLength = bAffected ? SegmentArcLength(j, 1.0f) : oldDistances[jOld + 1] - oldDistances[jOld];
+		m_distances[j + 1] = j < jFirst && jFirst < k ? oldDistances[j + 1] : m_distances[j] + fLength;
+	}
+
+	// The new list of samples.  source[i] is the old sample that new sample i is a copy of, or -1 for a new sample
+	vector<int> segments, source;
+	vector<float> params;
+	for (int j = 0; j < M; j++) {
+		int jOld = j < k ? j : j - iDelta;
+		if ((j - jFirst + M) % M < iNumNew) {
+			vector<float> newParams;
+			SubdivideSegment(j, 0.0f, 1.0f, 0, newParams);
+			params.insert(params.end(), newParams.begin(), newParams.end());
+			segments.resize(params.size(), j);
+			source.resize(params.size(), -1);
+		} else {
+			for (int i = oldFirst[jOld]; i < oldFirst[jOld + 1]; i++) {
+				segments.push_back(j);
+				params.push_back(m_centrelineParams[i]);
+				source.push_back(i);
+			}
+		}
+	}
+
+	// The affected segments must have been replaced by at least one sample, with at least one sample kept to anchor the frames
+	int n = (int) segments.size();
+	int iNumKept = n - (int) count(source.begin(), source.end(), -1);
+	if (iNumKept == n || iNumKept == 0) {
+		RebuildTrack();
+		return;
+	}
+
+	// Copy the kept samples across
+	bool bUpVectors = !m_centrelineUpVectors.empty();
+	vector<glm::vec3> points(n), ups(bUpVectors ? n : 0), tangents(n), normals(n), binormals(n), left(n), right(n);
+	vector<float> distances(n);
+	for (int i = 0; i < n; i++) {
+		int iOld = source[i];
+		if (iOld < 0)
+			continue;
+		points[i] = m_centrelinePoints[iOld];
+		if (bUpVectors)
+			ups[i] = m_centrelineUpVectors[iOld];
+		tangents[i] = m_centrelineTangents[iOld];
+		normals[i] = m_centrelineNormals[iOld];
+		binormals[i] = m_centrelineBinormals[iOld];
+		left[i] = m_leftOffsetPoints[iOld];
+		right[i] = m_rightOffsetPoints[iOld];
+		distances[i] = m_centrelineDistances[iOld] + (m_distances[segments[i]] - oldDistances[m_centrelineSegments[iOld]]);
+	}
+	m_centrelineSegments.swap(segments);
+	m_centrelineParams.swap(params);
+	m_centrelinePoints.swap(points);
+	m_centrelineUpVectors.swap(ups);
+	m_centrelineTangents.swap(tangents);
+	m_centrelineNormals.swap(normals);
+	m_centrelineBinormals.swap(binormals);
+	m_leftOffsetPoints.swap(left);
+	m_rightOffsetPoints.swap(right);
+	m_centrelineDistances.swap(distances);
+
+	// The new samples form one run, which may wrap past the end.  iStart is the kept sample before it, iEnd the kept sample after it
+	int iStart = 0;
+	while (!(source[iStart] >= 0 && source[(iStart + 1) % n] < 0))
+		iStart++;
+	int iEnd = (iStart + 1) % n;
+	while (source[iEnd] < 0)
+		iEnd = (iEnd + 1) % n;
+
+	for (int i = (iStart + 1) % n; i != iEnd; ) {
+		int iRunEnd = i < iEnd ? iEnd : n;
+		EvaluateSamples(i, iRunEnd);
+		i = iRunEnd % n;
+	}
+
+	m_vertexCount = (n + 1) * 2;
+	bool bBuffers = m_vboTrack != 0;
+	auto writeCentreline = [&](float *pData, int iBegin, int iEnd) { WritePointVertices(m_centrelinePoints, pData, iBegin, iEnd); };
+	auto writeLeft = [&](float *pData, int iBegin, int iEnd) { WritePointVertices(m_leftOffsetPoints, pData, iBegin, iEnd); };
+	auto writeRight = [&](float *pData, int iBegin, int iEnd) { WritePointVertices(m_rightOffsetPoints, pData, iBegin, iEnd); };
+	auto writeTrack = [&](float *pData, int iBegin, int iEnd) { WriteTrackVertices(pData, iBegin, iEnd); };
+
+	// If the run wraps past the end, sample 0 is new and every kept sample has moved, so nothing can be patched.  A full build starts its 
+	// frames at sample 0, so they are built again as it would, and every vertex is rewritten
+	if (source[0] < 0) {
+		ComputeFrames();
+		ComputeOffsetCurves();
+		if (bBuffers) {
+			UpdateVertices(m_vboCentreline, 8, 0, n + 1, iOldN + 1, writeCentreline);
+			UpdateVertices(m_vboLeftOffsetCurve, 8, 0, n + 1, iOldN + 1, writeLeft);
+			UpdateVertices(m_vboRightOffsetCurve, 8, 0, n + 1, iOldN + 1, writeRight);
+			UpdateVertices(m_vboTrack, 16, 0, n + 1, iOldN + 1, writeTrack);
+			BuildChunks();
+		}
+		BuildSampleLookup();
+		m_spatialIndex.Build(m_centrelinePoints, (float) TRACK_WIDTH);
+		return;
+	}
+
+	// Transport the frame from iStart across the new samples to iEnd, then spread the twist between the transported and existing frames at 
+	// iEnd along the new samples by distance
+	float fTotalLength = m_distances.back();
+	float fRunLength = fmod(m_centrelineDistances[iEnd] - m_centrelineDistances[iStart] + fTotalLength, fTotalLength);
+	glm::vec3 r = m_centrelineBinormals[iStart];
+	for (int i = iStart; i != iEnd; ) {
+		int iNext = (i + 1) % n;
+		r = glm::normalize(TransportBinormal(i, iNext, r));
+		if (iNext != iEnd)
+			m_centrelineBinormals[iNext] = r;
+		i = iNext;
+	}
+	glm::vec3 rEnd = m_centrelineBinormals[iEnd];
+	float fTwist = atan2(glm::dot(glm::cross(r, rEnd), m_centrelineTangents[iEnd]), glm::dot(r, rEnd));
+	for (int i = (iStart + 1) % n; i != iEnd; i = (i + 1) % n) {
+		float fFraction = fmod(m_centrelineDistances[i] - m_centrelineDistances[iStart] + fTotalLength, fTotalLength) / fRunLength;
+		TwistFrame(i, fTwist * fFraction);
+		ComputeOffsetPoints(i, i + 1);
+	}
+
+	// Otherwise the samples up to iStart are where they were, and those from iRunEnd on (counting the closing copy of sample 0 as n) 
+	// were at iRunEnd - iShift before the edit.  The track's are written to the end if their distances have changed
+	int iRunEnd = iEnd == 0 ? n : iEnd;
+	int iShift = n - iOldN;
+	int iTrackEnd = fTotalLength != oldDistances.back() ? n + 1 : iRunEnd;
+	if (bBuffers) {
+		UpdateVertices(m_vboCentreline, 8, iStart + 1, iRunEnd, iRunEnd - iShift, writeCentreline);
+		UpdateVertices(m_vboLeftOffsetCurve, 8, iStart + 1, iRunEnd, iRunEnd - iShift, writeLeft);
+		UpdateVertices(m_vboRightOffsetCurve, 8, iStart + 1, iRunEnd, iRunEnd - iShift, writeRight);
+		UpdateVertices(m_vboTrack, 16, iStart + 1, iTrackEnd, iTrackEnd - iShift, writeTrack);
+		PatchChunks(iStart, iRunEnd - iShift, iShift);
+	}
+	BuildSampleLookup(iStart);
+	m_spatialIndex.Update(m_centrelinePoints, (float) TRACK_WIDTH, iStart, iRunEnd - iShift, iRunEnd);
+}
+
+// Build the whole track again, for an edit that can't be applied locally.  Buffers are only made if the track already has them
+void CCatmullRom::RebuildTrack()
+{
+	if (m_vaoTrack == 0) {
+		ComputeCentreline();
+		ComputeOffsetCurves();
+		return;
+	}
+	CreateCentreline();
+	CreateOffsetCurves();
+	CreateTrack();
+}
+
+// Write samples [iBegin, iEnd) of a VBO holding iFloatsPerSample floats per sample (and a closing sample), using write(pData, iBegin, iEnd) 
+// to fill in the vertices.  The samples from iEnd to the closing sample are the ones that were at iOldEnd before the edit; if they have 
+// moved, they are copied along on the GPU rather than written again.  If the track has outgrown the buffer, it is reallocated with room 
+// to grow again, and filled from scratch
+void CCatmullRom::UpdateVertices(GLuint vbo, int iFloatsPerSample, int iBegin, int iEnd, int iOldEnd, const std::function<void(float *, int, int)> &write)
+{
+	int iNumSamples = (int) m_centrelinePoints.size() + 1;
+	GLsizeiptr iSampleSize = iFloatsPerSample * sizeof(float);
+	GLsizeiptr iSize = iNumSamples * iSampleSize;
+	vector<float> vertexData;
 
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	GLint iCapacity = 0;
+	glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &iCapacity);
+	if (iSize > iCapacity) {
+		vertexData.resize(iNumSamples * iFloatsPerSample);
+		write(vertexData.data(), 0, iNumSamples);
+		AllocateVertexBuffer(vertexData.data(), iSize);
+		return;
+	}
 
-	std::vector<float> trackdata;
-	glm::vec2 tex(0.0f, 0.0f);
-	glm::vec3 normal(0.0f, 1.0f, 0.0f);
+	// The old and new places of the moved samples overlap, so they go through the scratch buffer, which is kept between edits and only 
+	// grows when it is too small
+	GLsizeiptr iMovedSize = (iNumSamples - iEnd) * iSampleSize;
+	if (iOldEnd != iEnd && iMovedSize > 0) {
+		if (m_scratchBuffer == 0)
+			glGenBuffers(1, &m_scratchBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_scratchBuffer);
+		if (iMovedSize > m_scratchCapacity) {
+			m_scratchCapacity = iMovedSize + iMovedSize / 4;
+			glBufferData(GL_COPY_WRITE_BUFFER, m_scratchCapacity, NULL, GL_DYNAMIC_COPY);
+		}
+		glCopyBufferSubData(GL_ARRAY_BUFFER, GL_COPY_WRITE_BUFFER, iOldEnd * iSampleSize, 0, iMovedSize);
+		glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_ARRAY_BUFFER, 0, iEnd * iSampleSize, iMovedSize);
+	}
 
-	for (int i = 0; i < m_leftOffsetPoints.size(); ++i) {
-		glm::vec3 leftPoint = m_leftOffsetPoints[i];
-
-		trackdata.push_back(leftPoint.x);
-		trackdata.push_back(leftPoint.y);
-		trackdata.push_back(leftPoint.z);
-		trackdata.push_back(0.0f);  //u
-		trackdata.push_back(float(i) / m_leftOffsetPoints.size());  //v
-		trackdata.push_back(normal.x);
-		trackdata.push_back(normal.y);
-		trackdata.push_back(normal.z);
-
-		glm::vec3 rightPoint = m_rightOffsetPoints[i];
-
-		trackdata.push_back(rightPoint.x);
-		trackdata.push_back(rightPoint.y);
-		trackdata.push_back(rightPoint.z);
-		trackdata.push_back(1.0f);  //u
-		trackdata.push_back(float(i) / m_rightOffsetPoints.size());  //v
-		trackdata.push_back(rightPoint.x);
-		trackdata.push_back(rightPoint.y);
-		trackdata.push_back(rightPoint.z);
-	}
-
-	// First two points to close the loop
-	glm::vec3 leftPoint = m_leftOffsetPoints[0];
-
-	trackdata.push_back(leftPoint.x);
-	trackdata.push_back(leftPoint.y);
-	trackdata.push_back(leftPoint.z);
-	trackdata.push_back(0.0f);  //u
-	trackdata.push_back(0.0f);  //v
-	trackdata.push_back(normal.x);
-	trackdata.push_back(normal.y);
-	trackdata.push_back(normal.z);
-
-	glm::vec3 rightPoint = m_rightOffsetPoints[0];
-
-	trackdata.push_back(rightPoint.x);
-	trackdata.push_back(rightPoint.y);
-	trackdata.push_back(rightPoint.z);
-	trackdata.push_back(1.0f);  //u
-	trackdata.push_back(0.0f);  //v
-	trackdata.push_back(rightPoint.x);
-	trackdata.push_back(rightPoint.y);
-	trackdata.push_back(rightPoint.z);
-
-	glBufferData(GL_ARRAY_BUFFER, trackdata.size() * sizeof(float), trackdata.data(), GL_STATIC_DRAW);
-	GLuint stride = 8 * sizeof(float);
+	if (iEnd > iBegin) {
+		vertexData.resize((iEnd - iBegin) * iFloatsPerSample);
+		write(vertexData.data(), iBegin, iEnd);
+		glBufferSubData(GL_ARRAY_BUFFER, iBegin * iSampleSize, vertexData.size() * sizeof(float), vertexData.data());
+	}
+}
 
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
 
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+// Split the track into chunks roughly CHUNK_LENGTH long, each bounded by a box around its centreline and offset curve points, and build 
+// the index buffers used to draw them.  Every chunk has NUM_LOD_LEVELS index lists: level k keeps every 2^k-th sample of the chunk, plus 
+// its last sample so that neighbouring chunks still join up.  The lists count samples from the chunk's first sample, which is passed as 
+// the base vertex when drawing, so they only depend on the number of samples in the chunk, and chunks of the same size share them
+void CCatmullRom::BuildChunks()
+{
+	m_chunks.clear();
+	m_chunkIndices.clear();
+	m_chunkIndexLists.clear();
+	m_uploadedChunkIndices = 0;
+	m_chunkIndexCapacity = 0;
+	ChunkSamples(0, (int) m_centrelinePoints.size(), m_chunks);
+
+	// The element buffer binding is part of the VAO state, so bind the index buffers to each VAO in turn
+	if (m_sampleIndexBuffer == 0) {
+		glGenBuffers(1, &m_sampleIndexBuffer);
+		glGenBuffers(1, &m_pairIndexBuffer);
+	}
+	GLuint sampleVAOs[3] = { m_vaoCentreline, m_vaoLeftOffsetCurve, m_vaoRightOffsetCurve };
+	for (int i = 0; i < 3; i++) {
+		CGLState::BindVertexArray(sampleVAOs[i]);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_sampleIndexBuffer);
+	}
+	CGLState::BindVertexArray(m_vaoTrack);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_pairIndexBuffer);
+	CGLState::BindVertexArray(0);
 
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float)));
+	UploadChunkIndices();
+	ShowAllChunks();
+}
 
-	m_vertexCount = (m_leftOffsetPoints.size() + 1) * 2;
-	glBindVertexArray(0);
+// Split samples [iFirst, iLast] into chunks, appending them to chunks.  Sample n is the first sample again, closing the loop
+void CCatmullRom::ChunkSamples(int iFirst, int iLast, vector<TrackChunk> &chunks)
+{
+	int n = (int) m_centrelinePoints.size();
+
+	while (iFirst < iLast) {
+		TrackChunk chunk;
+		chunk.firstSample = iFirst;
+		chunk.lastSample = iFirst + 1;
+		while (chunk.lastSample < iLast && m_centrelineDistances[chunk.lastSample] - m_centrelineDistances[iFirst] < CHUNK_LENGTH)
+			chunk.lastSample++;
+
+		chunk.boundsMin = m_centrelinePoints[iFirst];
+		chunk.boundsMax = m_centrelinePoints[iFirst];
+		for (int i = iFirst; i <= chunk.lastSample; i++) {
+			int iPoint = i % n;
+			const glm::vec3 *points[3] = { &m_centrelinePoints[iPoint], &m_leftOffsetPoints[iPoint], &m_rightOffsetPoints[iPoint] };
+			for (int k = 0; k < 3; k++) {
+				chunk.boundsMin = glm::min(chunk.boundsMin, *points[k]);
+				chunk.boundsMax = glm::max(chunk.boundsMax, *points[k]);
+			}
+		}
+		SetChunkIndices(chunk);
+		chunks.push_back(chunk);
+		iFirst = chunk.lastSample;
+	}
+}
+
+// Point a chunk at the index lists for its number of samples, adding them to m_chunkIndices if no chunk that size has needed them yet
+void CCatmullRom::SetChunkIndices(TrackChunk &chunk)
+{
+	int iNumSamples = chunk.lastSample - chunk.firstSample;
+	if ((int) m_chunkIndexLists.size() <= iNumSamples * NUM_LOD_LEVELS)
+		m_chunkIndexLists.resize((iNumSamples + 1) * NUM_LOD_LEVELS, -1);
+
+	for (int iLevel = 0; iLevel < NUM_LOD_LEVELS; iLevel++) {
+		int iStep = 1 << iLevel;
+		int &iListFirst = m_chunkIndexLists[iNumSamples * NUM_LOD_LEVELS + iLevel];
+		if (iListFirst < 0) {
+			iListFirst = (int) m_chunkIndices.size();
+			for (int i = 0; i < iNumSamples; i += iStep)
+				m_chunkIndices.push_back(i);
+			m_chunkIndices.push_back(iNumSamples);
+		}
+		chunk.indexFirst[iLevel] = iListFirst;
+		chunk.indexCount[iLevel] = (iNumSamples + iStep - 1) / iStep + 1;
+	}
+}
+
+// Copy the index lists added since the last upload into the index buffers, as sample indices (for the centreline and offset curves) and 
+// as left / right pair indices (for the track).  If the lists have outgrown the buffers, they are reallocated a quarter larger than 
+// needed and filled from scratch
+void CCatmullRom::UploadChunkIndices()
+{
+	int iCount = (int) m_chunkIndices.size();
+	int iFirst = m_uploadedChunkIndices;
+	if (iFirst == iCount)
+		return;
+
+	if (iCount > m_chunkIndexCapacity) {
+		m_chunkIndexCapacity = iCount + iCount / 4;
+		iFirst = 0;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_sampleIndexBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, m_chunkIndexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_pairIndexBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, 2 * m_chunkIndexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+	}
+
+	vector<GLuint> pairIndices(2 * (iCount - iFirst));
+	for (int i = iFirst; i < iCount; i++) {
+		pairIndices[2 * (i - iFirst)] = 2 * m_chunkIndices[i];
+		pairIndices[2 * (i - iFirst) + 1] = 2 * m_chunkIndices[i] + 1;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_sampleIndexBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, iFirst * sizeof(GLuint), (iCount - iFirst) * sizeof(GLuint), &m_chunkIndices[iFirst]);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_pairIndexBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 2 * iFirst * sizeof(GLuint), pairIndices.size() * sizeof(GLuint), pairIndices.data());
+	m_uploadedChunkIndices = iCount;
+}
+
+// Chunk the track again after an edit replaced the samples between iFirst and iOldEnd, and moved the samples from iOldEnd on along by 
+// iShift.  Only the chunks holding replaced samples are split again, from the first sample of the first of them to the last sample of 
+// the last; the chunks after them keep their bounds and index lists, and only have their sample range moved
+void CCatmullRom::PatchChunks(int iFirst, int iOldEnd, int iShift)
+{
+	int iNumChunks = (int) m_chunks.size();
+	if (iNumChunks == 0)
+		return;
+
+	int c0 = 0;
+	while (c0 + 1 < iNumChunks && m_chunks[c0].lastSample <= iFirst)
+		c0++;
+	int c1 = c0;
+	while (c1 + 1 < iNumChunks && m_chunks[c1 + 1].firstSample < iOldEnd)
+		c1++;
+
+	vector<TrackChunk> chunks;
+	ChunkSamples(m_chunks[c0].firstSample, m_chunks[c1].lastSample + iShift, chunks);
+	for (int c = c1 + 1; c < iNumChunks; c++) {
+		m_chunks[c].firstSample += iShift;
+		m_chunks[c].lastSample += iShift;
+	}
+	m_chunks.erase(m_chunks.begin() + c0, m_chunks.begin() + c1 + 1);
+	m_chunks.insert(m_chunks.begin() + c0, chunks.begin(), chunks.end());
+
+	UploadChunkIndices();
+	ShowAllChunks();
+}
+
+// Add a chunk at a level of detail to the draw lists.  Points leave out the chunk's last sample, as it is the first sample of the next
+void CCatmullRom::AddVisibleChunk(const TrackChunk &chunk, int iLevel)
+{
+	int iFirst = chunk.indexFirst[iLevel], iCount = chunk.indexCount[iLevel];
+	m_sampleDrawOffsets.push_back((const void *) (iFirst * sizeof(GLuint)));
+	m_pointDrawCounts.push_back(iCount - 1);
+	m_stripDrawCounts.push_back(iCount);
+	m_sampleBaseVertices.push_back(chunk.firstSample);
+	m_pairDrawOffsets.push_back((const void *) (iFirst * 2 * sizeof(GLuint)));
+	m_pairDrawCounts.push_back(iCount * 2);
+	m_pairBaseVertices.push_back(2 * chunk.firstSample);
+}
+
+void CCatmullRom::ClearVisibleChunks()
+{
+	m_numVisibleChunks = 0;
+	m_sampleDrawOffsets.clear();
+	m_pointDrawCounts.clear();
+	m_stripDrawCounts.clear();
+	m_sampleBaseVertices.clear();
+	m_pairDrawOffsets.clear();
+	m_pairDrawCounts.clear();
+	m_pairBaseVertices.clear();
+}
+
+// Until CullChunks is called, everything is visible at full detail
+void CCatmullRom::ShowAllChunks()
+{
+	ClearVisibleChunks();
+	for (int i = 0; i < (int) m_chunks.size(); i++)
+		AddVisibleChunk(m_chunks[i], 0);
+	m_numVisibleChunks = (int) m_chunks.size();
+}
+
+// Set the distance from the camera beyond which chunks are drawn with half the samples; each doubling of the distance halves them again.
+// Zero (the default) turns level of detail off
+void CCatmullRom::SetLODDistance(float distance)
+{
+	m_lodDistance = distance;
+}
+
+// Test each chunk against the frustum and pick its level of detail from its distance to the camera, and add the visible chunks to the
+// draw lists, which are drawn with one glMultiDrawElementsBaseVertex call
+void CCatmullRom::CullChunks(const CFrustum &frustum, const glm::vec3 &cameraPosition)
+{
+	ClearVisibleChunks();
+
+	for (int i = 0; i < (int) m_chunks.size(); i++) {
+		const TrackChunk &chunk = m_chunks[i];
+		if (!frustum.IntersectsBox(chunk.boundsMin, chunk.boundsMax))
+			continue;
+
+		int iLevel = 0;
+		if (m_lodDistance > 0.0f) {
+			float fDistance = glm::distance(cameraPosition, 0.5f * (chunk.boundsMin + chunk.boundsMax));
+			for (float fThreshold = m_lodDistance; fDistance > fThreshold && iLevel < NUM_LOD_LEVELS - 1; fThreshold *= 2.0f)
+				iLevel++;
+		}
+
+		AddVisibleChunk(chunk, iLevel);
+		m_numVisibleChunks++;
+	}
+}
+
+int CCatmullRom::GetNumChunks()
+{
+	return (int) m_chunks.size();
+}
+
+int CCatmullRom::GetNumVisibleChunks()
+{
+	return m_numVisibleChunks;
+}
+
+// Number of triangles in the track at full detail
+int CCatmullRom::GetNumTriangles()
+{
+	return 2 * (int) m_leftOffsetPoints.size();
+}
+
+// Point a packet at the draw list CullChunks made for a primitive type and the number of vertices per sample (1, or 2 for the track)
+void CCatmullRom::SetDrawList(DrawPacket &packet, GLenum mode, int iVerticesPerSample)
+{
+	packet.mode = mode;
+	if (iVerticesPerSample == 2) {
+		packet.pOffsets = m_pairDrawOffsets.data();
+		packet.pCounts = m_pairDrawCounts.data();
+		packet.pBaseVertices = m_pairBaseVertices.data();
+	} else {
+		packet.pOffsets = m_sampleDrawOffsets.data();
+		packet.pCounts = mode == GL_POINTS ? m_pointDrawCounts.data() : m_stripDrawCounts.data();
+		packet.pBaseVertices = m_sampleBaseVertices.data();
+	}
+	packet.drawCount = m_numVisibleChunks;
+}
+
+// Draw the visible chunks from the bound VAO with one glMultiDrawElementsBaseVertex call.  Each sample index stands for iVerticesPerSample 
+// consecutive indices in the VAO's element buffer (1 for the curves, 2 for the track)
+void CCatmullRom::DrawVisibleRanges(GLenum mode, int iVerticesPerSample)
+{
+	if (m_numVisibleChunks == 0)
+		return;
 
+	DrawPacket packet;
+	SetDrawList(packet, mode, iVerticesPerSample);
+	glMultiDrawElementsBaseVertex(mode, (GLsizei *) packet.pCounts, GL_UNSIGNED_INT, (void **) packet.pOffsets, packet.drawCount, (GLint *) packet.pBaseVertices);
 }
 
 
 void CCatmullRom::RenderCentreline()
 {
 	// Bind the VAO m_vaoCentreline and render it
-	glBindVertexArray(m_vaoCentreline);
-	// Render the centreline as points
+	CGLState::BindVertexArray(m_vaoCentreline);
+	// Render the visible parts of the centreline as points
 	glPointSize(5.0f);
-	glDrawArrays(GL_POINTS, 0, m_centrelinePoints.size());
-	// Render the centreline as a line loop
+	DrawVisibleRanges(GL_POINTS, 1);
+	// Render them as a line loop
 	glLineWidth(2.0f);
-	glDrawArrays(GL_LINE_STRIP, 0, m_centrelinePoints.size());
+	DrawVisibleRanges(GL_LINE_STRIP, 1);
 
-	glBindVertexArray(0);
+	CGLState::BindVertexArray(0);
 
 }
 
 void CCatmullRom::RenderOffsetCurves()
 {
 	// Bind the VAO m_vaoLeftOffsetCurve and render it
-	glBindVertexArray(m_vaoLeftOffsetCurve);
+	CGLState::BindVertexArray(m_vaoLeftOffsetCurve);
 	glPointSize(3.0f);
-	glDrawArrays(GL_POINTS, 0, m_leftOffsetPoints.size());
+	DrawVisibleRanges(GL_POINTS, 1);
 
 	glLineWidth(1.5f);
-	glDrawArrays(GL_LINE_LOOP, 0, m_leftOffsetPoints.size());
+	DrawVisibleRanges(GL_LINE_STRIP, 1);
 
 	// Bind the VAO m_vaoRightOffsetCurve and render it
-	glBindVertexArray(m_vaoRightOffsetCurve);
+	CGLState::BindVertexArray(m_vaoRightOffsetCurve);
 	glPointSize(3.0f);
-	glDrawArrays(GL_POINTS, 0, m_rightOffsetPoints.size());
+	DrawVisibleRanges(GL_POINTS, 1);
 
 	glLineWidth(1.5f);
-	glDrawArrays(GL_LINE_LOOP, 0, m_rightOffsetPoints.size());
+	DrawVisibleRanges(GL_LINE_STRIP, 1);
 
-	glBindVertexArray(0);
+	CGLState::BindVertexArray(0);
 }
 
 
 void CCatmullRom::RenderTrack()
 {
 	// Bind the VAO m_vaoTrack and render it
-	glBindVertexArray(m_vaoTrack);
+	CGLState::BindVertexArray(m_vaoTrack);
 
-	glDisable(GL_CULL_FACE);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, m_vertexCount);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glEnable(GL_CULL_FACE);
+	CGLState::Disable(GL_CULL_FACE);
+	CGLState::PolygonMode(GL_LINE);
+	DrawVisibleRanges(GL_TRIANGLE_STRIP, 2);
+	CGLState::PolygonMode(GL_FILL);
+	CGLState::Enable(GL_CULL_FACE);
 
-	glBindVertexArray(0);
+	CGLState::BindVertexArray(0);
+}
+
+void CCatmullRom::SubmitCentreline(CRenderQueue &queue, DrawPacket packet)
+{
+	if (m_numVisibleChunks == 0)
+		return;
+
+	packet.vao = m_vaoCentreline;
+	packet.size = 5.0f;
+	SetDrawList(packet, GL_POINTS, 1);
+	queue.Submit(packet);
+
+	packet.size = 2.0f;
+	SetDrawList(packet, GL_LINE_STRIP, 1);
+	queue.Submit(packet);
+}
+
+void CCatmullRom::SubmitOffsetCurves(CRenderQueue &queue, DrawPacket packet)
+{
+	if (m_numVisibleChunks == 0)
+		return;
+
+	GLuint vaos[2] = { m_vaoLeftOffsetCurve, m_vaoRightOffsetCurve };
+	for (int i = 0; i < 2; i++) {
+		packet.vao = vaos[i];
+		packet.size = 3.0f;
+		SetDrawList(packet, GL_POINTS, 1);
+		queue.Submit(packet);
+
+		packet.size = 1.5f;
+		SetDrawList(packet, GL_LINE_STRIP, 1);
+		queue.Submit(packet);
+	}
+}
+
+// The track is drawn as a wireframe, seen from both sides
+void CCatmullRom::SubmitTrack(CRenderQueue &queue, DrawPacket packet)
+{
+	if (m_numVisibleChunks == 0)
+		return;
+
+	packet.vao = m_vaoTrack;
+	packet.state = (packet.state | STATE_WIREFRAME) & ~STATE_CULL_FACE;
+	SetDrawList(packet, GL_TRIANGLE_STRIP, 2);
+	queue.Submit(packet);
 }
 
 int CCatmullRom::CurrentLap(float d)
@@ -477,20 +1759,53 @@ int CCatmullRom::CurrentLap(float d)
 
 }
 
+float CCatmullRom::GetLength()
+{
+	return m_distances.empty() ? 0.0f : m_distances.back();
+}
+
+// Project a position onto the centreline using the spatial index, then measure its offsets along the frame at the closest point
+bool CCatmullRom::Project(const glm::vec3 &position, TrackProjection &result, int segmentHint) const
+{
+	float t, fDistanceSquared;
+	int i = m_spatialIndex.FindClosestSegment(position, t, fDistanceSquared, segmentHint);
+	if (i < 0)
+		return false;
+
+	int n = (int) m_centrelinePoints.size();
+	int iNext = (i + 1) % n;
+	float fStart = m_centrelineDistances[i];
+	float fEnd = iNext == 0 ? m_distances.back() : m_centrelineDistances[iNext];
+
+	result.segment = i;
+	result.distance = fStart + t * (fEnd - fStart);
+	result.point = glm::mix(m_centrelinePoints[i], m_centrelinePoints[iNext], t);
+
+	glm::vec3 N = glm::normalize(glm::mix(m_centrelineNormals[i], m_centrelineNormals[iNext], t));
+	glm::vec3 B = glm::normalize(glm::mix(m_centrelineBinormals[i], m_centrelineBinormals[iNext], t));
+	result.lateralOffset = glm::dot(position - result.point, N);
+	result.verticalOffset = glm::dot(position - result.point, B);
+
+	return true;
+}
+
 void CCatmullRom::CreatePath(glm::vec3& p0, glm::vec3& p1, glm::vec3& p2, glm::vec3& p3)
 {
 	// Use VAO to store state associated with vertices
 	glGenVertexArrays(1, &m_vao);
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 	// Create a VBO
 	CVertexBufferObject vbo;
 	vbo.Create();
 	vbo.Bind();
 	glm::vec2 texCoord(0.0f, 0.0f);
 	glm::vec3 normal(0.0f, 1.0f, 0.0f);
+	float t[100], x[100], y[100], z[100];
+	for (unsigned int i = 0; i < 100; i++)
+		t[i] = (float)i / 100.0f;
+	InterpolateBatch(p0, p1, p2, p3, t, 100, x, y, z);
 	for (unsigned int i = 0; i < 100; i++) {
-		float t = (float)i / 100.0f;
-		glm::vec3 v = Interpolate(p0, p1, p2, p3, t);
+		glm::vec3 v(x[i], y[i], z[i]);
 		vbo.AddData(&v, sizeof(glm::vec3));
 		vbo.AddData(&texCoord, sizeof(glm::vec2));
 		vbo.AddData(&normal, sizeof(glm::vec3));
@@ -513,10 +1828,10 @@ void CCatmullRom::CreatePath(glm::vec3& p0, glm::vec3& p1, glm::vec3& p2, glm::v
 
 void CCatmullRom::RenderPath()
 {
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 	glDrawArrays(GL_LINE_STRIP, 0, 100);
 	glLineWidth(5.0f);
-	glBindVertexArray(0);
+	CGLState::BindVertexArray(0);
 
 }
 
@@ -1,10 +1,33 @@
 #pragma once
 #include "Common.h"
-#include "vertexBufferObject.h"
-#include "vertexBufferObjectIndexed.h"
+#include <functional>
+#include "VertexBufferObject.h"
+#include "VertexBufferObjectIndexed.h"
 #include "Texture.h"
+#include "Frustum.h"
+#include "TrackFile.h"
+#include "TrackSpatialIndex.h"
+#include "RenderQueue.h"
 
 
+// Where a point is relative to the track, from CCatmullRom::Project
+struct TrackProjection
+{
+	int segment;			// Centreline segment (from sample segment to the next sample) closest to the point
+	float distance;			// Distance along the centreline of the closest point, in [0, total length)
+	float lateralOffset;	// Signed sideways offset from the centreline; positive to the right, |offset| > TRACK_WIDTH / 2 is off the track
+	float verticalOffset;	// Height above the track surface
+	glm::vec3 point;		// Closest point on the centreline
+};
+
+// Output arrays for CCatmullRom::SampleBatch, one element per distance.  The up and tangent arrays may be NULL if they aren't wanted
+struct TrackSamples
+{
+	float *x, *y, *z;			// Position on the centreline
+	float *upX, *upY, *upZ;		// Up (the frame's binormal)
+	float *tX, *tY, *tZ;		// Unit tangent
+};
+
 class CCatmullRom
 {
 public:
@@ -20,28 +43,160 @@ public:
 	void CreateTrack();
 	void RenderTrack();
 
+	void Release();			// Free the track's buffers on the GPU
+
+	// Render the visible parts through a render queue instead, after CullChunks.  packet gives the program, material and transform
+	void SubmitCentreline(CRenderQueue &queue, DrawPacket packet);
+	void SubmitOffsetCurves(CRenderQueue &queue, DrawPacket packet);
+	void SubmitTrack(CRenderQueue &queue, DrawPacket packet);
+
+	// Work out which chunks of the track can be seen, and at what level of detail; RenderCentreline, RenderOffsetCurves and RenderTrack 
+	// then only draw those
+	void CullChunks(const CFrustum &frustum, const glm::vec3 &cameraPosition);
+	void SetLODDistance(float distance);
+	int GetNumChunks();
+	int GetNumVisibleChunks();
+	int GetNumTriangles();
+
+	// Tolerances for the adaptive tessellation done by CreateCentreline; call before it
+	void SetTessellation(float chordTolerance, float maxTurnAngle, float maxSampleSpacing);
+
+	// Load a track instead of using the built-in control points; call before CreateCentreline.  LoadControlPoints reads a text file with 
+	// "x y z" or "x y z ux uy uz" on each line.  LoadTrack reads a binary track file: if it was built from the same control points and 
+	// settings, its tables and mesh are used as they are and nothing is recomputed
+	bool LoadControlPoints(const string &filename);
+	bool LoadTrack(const string &filename);
+	bool SaveTrack(const string &filename, bool bIncludeMesh = true);	// Call after CreateOffsetCurves
+
+	// Build a binary track file from a text file of control points.  Doesn't need an OpenGL context
+	static bool ConvertTrack(const string &controlPointsFile, const string &trackFile);
+
+	// Edit the track after CreateTrack.  Only the segments within reach of the edited point are tessellated again, and only their vertices 
+	// are written to the existing buffers.  A track built with ComputeCentreline / ComputeOffsetCurves, which has no buffers, only has its 
+	// tables updated
+	bool MoveControlPoint(int k, const glm::vec3 &p);
+	bool InsertControlPoint(int k, const glm::vec3 &p);		// Insert before point k, for 1 <= k <= GetNumControlPoints()
+	bool DeleteControlPoint(int k);
+	int GetNumControlPoints();
+	glm::vec3 GetControlPoint(int k);
+
+	// CPU side of CreateCentreline: tessellates the curve and builds the lookup tables, but creates no buffers, so doesn't need an OpenGL context
+	void ComputeCentreline();
+
+	// CPU side of CreateOffsetCurves / CreateTrack, split across iNumThreads threads (0 = one per core).  Output doesn't depend on the thread count
+	void ComputeOffsetCurves(int iNumThreads = 0);
+	void BuildTrackVertices(vector<float> &trackdata, int iNumThreads = 0);
+
 	void CreatePath(glm::vec3& p0, glm::vec3& p1, glm::vec3& p2, glm::vec3& p3);
 	void RenderPath();
 
 	int CurrentLap(float d); // Return the currvent lap (starting from 0) based on distance along the control curve.
+	float GetLength(); // Return the length of one lap of the control curve
+
+	// Find the closest point on the centreline to a world position.  Pass the segment returned for the same object last frame as 
+	// segmentHint, and the query costs O(1) amortised; -1 searches from scratch.  Thread safe, as it only reads the track
+	bool Project(const glm::vec3 &position, TrackProjection &result, int segmentHint = -1) const;
 
 	bool Sample(float d, glm::vec3 &p, glm::vec3 &up = _dummy_vector); // Return a point on the centreline based on a certain distance along the control curve.
+	bool Sample(float d, glm::vec3 &p, glm::vec3 &up, int &segmentHint); // As above, but starts the segment search at segmentHint and stores the segment found there
+
+	// Return the point and the rotation minimising frame (tangent, normal pointing sideways, binormal pointing up) at a distance d along the 
+	// centreline, interpolated from the frame table built with the centreline
+	bool SampleFrame(float d, glm::vec3 &p, glm::vec3 &T, glm::vec3 &N, glm::vec3 &B);
+
+	// SampleFrame for iCount distances d[] at once (any distance, including past the first lap), for large numbers of vehicles or ghosts. 
+	// Sorted distances are fastest.  Split across iNumThreads threads (0 = one per core)
+	void SampleBatch(const float *d, int iCount, const TrackSamples &out, int iNumThreads = 0);
+
+	// Evaluate the spline segment between p1 and p2 at iCount parameters t[], writing the points as structure-of-arrays into x[], y[] and z[].  
+	// Uses AVX or SSE when the CPU supports it; InterpolateBatchReference is the scalar version the SIMD kernels must match
+	static void InterpolateBatch(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, const float *t, int iCount, float *x, float *y, float *z);
+	static void InterpolateBatchReference(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, const float *t, int iCount, float *x, float *y, float *z);
+
+	// The SSE and AVX kernels InterpolateBatch chooses between, so each can be checked against the reference.  InterpolateBatchWithAVX 
+	// returns false, writing nothing, if the machine can't run AVX
+	static void InterpolateBatchWithSSE(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, const float *t, int iCount, float *x, float *y, float *z);
+	static bool InterpolateBatchWithAVX(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, const float *t, int iCount, float *x, float *y, float *z);
+
+	static const int CHUNK_LENGTH = 40;		// Approximate length of each chunk of track geometry
+	static const int NUM_LOD_LEVELS = 3;	// Levels of detail per chunk; level k draws every 2^k-th sample
+	static const int TRACK_WIDTH = 20;		// Distance between the offset curves
+	static const int TEXTURE_LENGTH = 20;	// Distance along the track over which its texture repeats
 
 private:
+	friend struct CatmullRomAccess;			// Lets the benchmarks time FindSegment and check it against a scan of m_distances
+
+	// A run of centreline samples [firstSample, lastSample] and its bounding box.  lastSample is the first sample of the next chunk, so that 
+	// neighbouring chunks join up.  All chunks share the same vertex and index buffers; indexFirst / indexCount give the chunk's index list 
+	// at each level of detail, which counts samples from firstSample
+	struct TrackChunk
+	{
+		int firstSample;
+		int lastSample;
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		int indexFirst[NUM_LOD_LEVELS];
+		int indexCount[NUM_LOD_LEVELS];
+	};
 
 	void SetControlPoints();
 	void ComputeLengthsAlongControlPoints();
+	bool FindSegmentParameter(float d, int &segment, float &t);	// Map a distance d to a segment (in: hint, out: result) and its parameter t
 	void UniformlySampleControlPoints(int numSamples);
+	void AdaptivelySampleControlPoints();
+	void SubdivideSegment(int j, float t0, float t1, int iDepth, vector<float> &params);
+	void SampleCentreline(const vector<int> &segments, const vector<float> &params);
+	void EvaluateSamples(int iBegin, int iEnd);
+	void ComputeFrames();
+	void BuildSampleLookup(int iFirstSample = 0);
+	int FindSample(float fLength, int iHint = -1) const;	// Sample at or before a distance along the centreline
+	glm::vec3 TransportBinormal(int i, int iNext, const glm::vec3 &r);
+	void TwistFrame(int i, float fAngle);
+	void ComputeOffsetPoints(int iBegin, int iEnd);
+	void RecoverSampleParameters();
+	void EditControlPoints(int k, int iDelta);
+	void RebuildTrack();
 	glm::vec3 Interpolate(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, float t);
-
-
-	vector<float> m_distances;
+	glm::vec3 InterpolateDerivative(glm::vec3 &p0, glm::vec3 &p1, glm::vec3 &p2, glm::vec3 &p3, float t);
+
+	void GetSegmentIndices(int j, int &iPrev, int &iCur, int &iNext, int &iNextNext);
+	float SegmentArcLength(int j, float t);			// Arc length of segment j from its start to parameter t
+	float SegmentParameter(int j, float s);			// Parameter t at which the arc length along segment j equals s
+
+	// The control polygon segment j with m_distances[j] <= fLength < m_distances[j+1], for fLength in [0, GetLength()), or -1, searching 
+	// from iHint (-1 for none)
+	int FindSegment(float fLength, int iHint = -1);
+
+	void BuildPointVertices(const vector<glm::vec3> &points, vector<float> &vertexData, int iNumThreads = 0);
+	void WritePointVertices(const vector<glm::vec3> &points, float *pData, int iBegin, int iEnd);
+	void WriteTrackVertices(float *pData, int iBegin, int iEnd);
+	void CreateVAO(GLuint &vao, GLuint &vbo, const float *pVertexData, size_t iNumFloats);
+	void UpdateVertices(GLuint vbo, int iFloatsPerSample, int iBegin, int iEnd, int iOldEnd, const std::function<void(float *, int, int)> &write);
+	unsigned long long ComputeInputHash();	// Hash of the control points, up vectors and tessellation settings
+
+	void BuildChunks();
+	void ChunkSamples(int iFirst, int iLast, vector<TrackChunk> &chunks);
+	void SetChunkIndices(TrackChunk &chunk);
+	void UploadChunkIndices();
+	void PatchChunks(int iFirst, int iOldEnd, int iShift);
+	void AddVisibleChunk(const TrackChunk &chunk, int iLevel);
+	void ClearVisibleChunks();
+	void ShowAllChunks();
+	void DrawVisibleRanges(GLenum mode, int iVerticesPerSample);
+	void SetDrawList(DrawPacket &packet, GLenum mode, int iVerticesPerSample);
+
+
+	vector<float> m_distances;				// Arc length along the curve at each control point; the last entry is the total length
 	CTexture m_texture;
 
 	GLuint m_vaoCentreline;
 	GLuint m_vaoLeftOffsetCurve;
 	GLuint m_vaoRightOffsetCurve;
 	GLuint m_vaoTrack;
+	GLuint m_vboCentreline;
+	GLuint m_vboLeftOffsetCurve;
+	GLuint m_vboRightOffsetCurve;
+	GLuint m_vboTrack;
 	GLuint m_vao;
 
 	static glm::vec3 _dummy_vector;
@@ -49,10 +204,50 @@ private:
 	vector<glm::vec3> m_controlUpVectors;	// Control upvectors, which are interpolated to produce the centreline upvectors
 	vector<glm::vec3> m_centrelinePoints;	// Centreline points
 	vector<glm::vec3> m_centrelineUpVectors;// Centreline upvectors
+	vector<float> m_centrelineDistances;	// Distance along the curve of each centreline point
+	vector<int> m_centrelineSegments;		// Segment and parameter each centreline point was evaluated at
+	vector<float> m_centrelineParams;
+	vector<int> m_sampleBuckets;			// Last sample at or before each multiple of m_bucketLength along the centreline, for FindSample
+	float m_bucketLength;
+	vector<glm::vec3> m_centrelineTangents;	// Unit tangent at each centreline point
+	vector<glm::vec3> m_centrelineNormals;	// Rotation minimising frame at each centreline point: normal (sideways) ...
+	vector<glm::vec3> m_centrelineBinormals;// ... and binormal (up)
 
 	vector<glm::vec3> m_leftOffsetPoints;	// Left offset curve points
 	vector<glm::vec3> m_rightOffsetPoints;	// Right offset curve points
 
+	CTrackSpatialIndex m_spatialIndex;		// Grid over the centreline segments, for Project
+
 
 	unsigned int m_vertexCount;				// Number of vertices in the track VBO
+
+	CTrackFile m_trackFile;					// Track file being loaded; kept mapped until CreateTrack has uploaded its mesh
+	bool m_bTablesLoaded;					// True if the centreline and offset curve tables came from the track file
+
+	float m_chordTolerance;					// Adaptive tessellation: largest distance between the curve and a chord
+	float m_maxTurnAngle;					// Adaptive tessellation: largest turn (radians) between neighbouring samples
+	float m_maxSampleSpacing;				// Adaptive tessellation: largest distance between neighbouring samples
+	float m_lodDistance;					// Camera distance at which chunks drop to the next level of detail (0 = off)
+
+	vector<TrackChunk> m_chunks;			// Track split into chunks for culling
+	vector<GLuint> m_chunkIndices;			// The chunks' index lists, each made once for every chunk size and level of detail in use
+	vector<int> m_chunkIndexLists;			// Start of the list in m_chunkIndices for chunks of m samples at each level, at m * NUM_LOD_LEVELS + level; -1 if not made
+	int m_uploadedChunkIndices;				// Indices of m_chunkIndices already in the index buffers ...
+	int m_chunkIndexCapacity;				// ... and the number the buffers have room for
+	GLuint m_sampleIndexBuffer;				// Chunk sample indices for each level of detail, shared by the centreline and offset curve VAOs
+	GLuint m_pairIndexBuffer;				// The same, as left / right vertex pairs for the track VAO
+	GLuint m_scratchBuffer;					// Staging buffer for vertices that an edit moves along within a VBO ...
+	GLsizeiptr m_scratchCapacity;			// ... and its size in bytes
+	int m_numVisibleChunks;
+
+	// glMultiDrawElementsBaseVertex arguments for the visible chunks, built by CullChunks: byte offsets of the chunks' sample index lists 
+	// (centreline and offset curves), their counts as points, which leave out the sample shared with the next chunk, and as line strips, 
+	// and their first samples; and the same for the left / right pair lists (the track).  Kept to avoid allocating every frame
+	vector<const void *> m_sampleDrawOffsets;
+	vector<GLsizei> m_pointDrawCounts;
+	vector<GLsizei> m_stripDrawCounts;
+	vector<GLint> m_sampleBaseVertices;
+	vector<const void *> m_pairDrawOffsets;
+	vector<GLsizei> m_pairDrawCounts;
+	vector<GLint> m_pairBaseVertices;
 };
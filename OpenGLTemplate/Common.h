@@ -10,7 +10,7 @@
 #include "./include/glm/gtx/rotate_vector.hpp"
 
 #include "include/gl/glew.h"
-#include <gl/gl.h>
+#include <GL/gl.h>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
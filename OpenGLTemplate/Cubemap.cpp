@@ -1,9 +1,10 @@
 #include "Common.h"
 
 #include "Cubemap.h"
+#include "GLState.h"
 
 
-#include "include\freeimage\FreeImage.h"
+#include "include/freeimage/FreeImage.h"
 #pragma comment(lib, "lib/FreeImage.lib")
 
 
@@ -60,9 +61,19 @@ bool CCubemap::LoadTexture(string filename, BYTE **bmpBytes, int &iWidth, int &i
 // Binds a texture for rendering
 void CCubemap::Bind(int iTextureUnit)
 {
-	glActiveTexture(GL_TEXTURE0+iTextureUnit);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiTexture);
-	glBindSampler(iTextureUnit, m_uiSampler);
+	CGLState::BindTexture(iTextureUnit, GL_TEXTURE_CUBE_MAP, m_uiTexture);
+	CGLState::BindSampler(iTextureUnit, m_uiSampler);
+}
+
+// The OpenGL names of the texture and its sampler, for binding them elsewhere (see CRenderQueue)
+GLuint CCubemap::GetTextureID()
+{
+	return m_uiTexture;
+}
+
+GLuint CCubemap::GetSamplerID()
+{
+	return m_uiSampler;
 }
 
 
@@ -73,7 +84,7 @@ void CCubemap::Create(string sPositiveX, string sNegativeX, string sPositiveY, s
 
 	// Generate an OpenGL texture ID for this texture
 	glGenTextures(1, &m_uiTexture);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiTexture);
+	CGLState::BindTexture(GL_TEXTURE_CUBE_MAP, m_uiTexture);
 
 	// Load the six sides
 	BYTE *pbImagePosX, *pbImageNegX, *pbImagePosY, *pbImageNegY, *pbImagePosZ, *pbImageNegZ;
@@ -116,6 +127,6 @@ void CCubemap::Create(string sPositiveX, string sNegativeX, string sPositiveY, s
 // Release resources
 void CCubemap::Release()
 {
-	glDeleteSamplers(1, &m_uiSampler);
-	glDeleteTextures(1, &m_uiTexture);
+	CGLState::DeleteSampler(m_uiSampler);
+	CGLState::DeleteTexture(m_uiTexture);
 }
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "Texture.h"
-#include "vertexBufferObject.h"
+#include "VertexBufferObject.h"
 #include "./include/glm/gtc/type_ptr.hpp"
 
 class CCubemap
@@ -11,6 +11,8 @@ public:
 	void Release();
 	bool LoadTexture(string filename, BYTE **bmpBytes, int &iWidth, int &iHeight);
 	void Bind(int iTextureUnit = 0);
+	GLuint GetTextureID();
+	GLuint GetSamplerID();
 
 
 private:
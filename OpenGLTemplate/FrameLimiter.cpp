@@ -0,0 +1,75 @@
+#include "FrameLimiter.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+CFrameLimiter::CFrameLimiter()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_frequency = (double) frequency.QuadPart;
+	m_nextFrame = 0.0;
+	m_sleepMargin = 2.0;
+	m_lastLateness = 0.0;
+
+#ifdef _WIN32
+	// Without this Sleep only wakes on the 15.6 ms system tick
+	timeBeginPeriod(1);
+#endif
+}
+
+CFrameLimiter::~CFrameLimiter()
+{
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+// Time in ms
+double CFrameLimiter::Now()
+{
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return (double) count.QuadPart * 1000.0 / m_frequency;
+}
+
+void CFrameLimiter::Wait(double frameRate)
+{
+	if (frameRate <= 0.0) {
+		m_nextFrame = 0.0;
+		m_lastLateness = 0.0;
+		return;
+	}
+
+	double period = 1000.0 / frameRate;
+	double now = Now();
+	if (m_nextFrame == 0.0)
+		m_nextFrame = now;
+	m_nextFrame += period;
+	if (now - m_nextFrame > period)
+		m_nextFrame = now;
+
+	// Sleep until the margin before the frame is due, and learn from how late the sleep wakes.  The margin grows straight away
+	// after a late wake, and shrinks slowly
+	double sleep = m_nextFrame - now - m_sleepMargin;
+	if (sleep > 0.0) {
+		std::this_thread::sleep_for(std::chrono::microseconds((long long) (sleep * 1000.0)));
+		double overshoot = Now() - now - sleep;
+		if (overshoot > m_sleepMargin)
+			m_sleepMargin = overshoot;
+		else
+			m_sleepMargin = 0.99 * m_sleepMargin + 0.01 * overshoot;
+		if (m_sleepMargin < 0.2)
+			m_sleepMargin = 0.2;
+	}
+
+	// Spin for the rest, letting other threads run
+	while ((now = Now()) < m_nextFrame)
+		std::this_thread::yield();
+	m_lastLateness = now - m_nextFrame;
+}
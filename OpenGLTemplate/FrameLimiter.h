@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Common.h"
+
+// Holds the game to a target frame rate without burning a core.  It sleeps for most of the wait, then spins for the last part, 
+// since sleeps can wake late (on Windows, by up to a ms even with the timer period set to 1 ms).  How long to leave for spinning comes 
+// from how late recent sleeps have woken, so it stays small where the OS timer is precise and grows where it isn't.  Frames are due at 
+// regular times rather than a period after the last one ended, so timing errors don't accumulate; after a long stall (more than a frame 
+// late) the schedule restarts rather than rushing frames out to catch up
+class CFrameLimiter
+{
+public:
+	CFrameLimiter();
+	~CFrameLimiter();
+
+	// Wait until the next frame is due at frameRate frames per second.  0 doesn't wait
+	void Wait(double frameRate);
+
+	// How late the last wait returned (ms), for checking frame pacing
+	double GetLastLateness() const { return m_lastLateness; }
+
+private:
+	double Now();
+
+	double m_frequency;
+	double m_nextFrame;		// ms, or 0 before the first frame
+	double m_sleepMargin;	// ms left for spinning at the end of each wait
+	double m_lastLateness;
+};
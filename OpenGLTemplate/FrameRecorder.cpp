@@ -0,0 +1,170 @@
+#include "FrameRecorder.h"
+
+#include <algorithm>
+
+CFrameRecorder::CFrameRecorder()
+{
+	m_hasTimerQueries = false;
+	m_frame = 0;
+	for (int i = 0; i < QUERY_FRAMES; i++)
+		m_queryFrames[i] = -1;
+}
+
+CFrameRecorder::~CFrameRecorder()
+{}
+
+// Create the timestamp queries, if the driver has them (they're core in OpenGL 3.3)
+void CFrameRecorder::Create(int iNumFrames)
+{
+	m_cpuTimes.reserve(iNumFrames);
+	m_gpuTimes.reserve(iNumFrames);
+
+	m_hasTimerQueries = false;
+	if (GLEW_VERSION_3_3 || GLEW_ARB_timer_query) {
+		GLint iBits = 0;
+		glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &iBits);
+		m_hasTimerQueries = iBits > 0;
+	}
+
+	if (m_hasTimerQueries)
+		glGenQueries(QUERY_FRAMES * 2, &m_queries[0][0]);
+}
+
+void CFrameRecorder::Release()
+{
+	if (m_hasTimerQueries)
+		glDeleteQueries(QUERY_FRAMES * 2, &m_queries[0][0]);
+	m_hasTimerQueries = false;
+}
+
+void CFrameRecorder::BeginFrame()
+{
+	if (m_hasTimerQueries) {
+		// The ring is only full if the GPU is QUERY_FRAMES frames behind, in which case this waits for the oldest one
+		int iSlot = m_frame % QUERY_FRAMES;
+		if (m_queryFrames[iSlot] >= 0)
+			ReadGPUTime(iSlot, true);
+		glQueryCounter(m_queries[iSlot][0], GL_TIMESTAMP);
+		m_queryFrames[iSlot] = m_frame;
+	}
+	m_gpuTimes.push_back(-1.0);
+
+	m_timer.Start();
+}
+
+void CFrameRecorder::EndRendering()
+{
+	if (m_hasTimerQueries)
+		glQueryCounter(m_queries[m_frame % QUERY_FRAMES][1], GL_TIMESTAMP);
+}
+
+// Record the CPU time, and pick up any GPU times that have arrived
+void CFrameRecorder::EndFrame()
+{
+	m_cpuTimes.push_back(m_timer.Elapsed());
+
+	if (m_hasTimerQueries) {
+		for (int i = 0; i < QUERY_FRAMES; i++) {
+			if (m_queryFrames[i] >= 0)
+				ReadGPUTime(i, false);
+		}
+	}
+	m_frame++;
+}
+
+// Read back the GPU time for the frame in a slot of the ring, if it's ready or if bWait is set, and free the slot
+void CFrameRecorder::ReadGPUTime(int iSlot, bool bWait)
+{
+	if (!bWait) {
+		GLint iAvailable = 0;
+		glGetQueryObjectiv(m_queries[iSlot][1], GL_QUERY_RESULT_AVAILABLE, &iAvailable);
+		if (!iAvailable)
+			return;
+	}
+
+	GLuint64 start, end;
+	glGetQueryObjectui64v(m_queries[iSlot][0], GL_QUERY_RESULT, &start);
+	glGetQueryObjectui64v(m_queries[iSlot][1], GL_QUERY_RESULT, &end);
+	m_gpuTimes[m_queryFrames[iSlot]] = (double) (end - start) / 1000000.0;
+	m_queryFrames[iSlot] = -1;
+}
+
+void CFrameRecorder::AddInfo(string name, string value)
+{
+	// Escape the few characters that can turn up in driver strings
+	string escaped;
+	for (int i = 0; i < (int) value.size(); i++) {
+		if (value[i] == '"' || value[i] == '\\')
+			escaped += '\\';
+		if ((unsigned char) value[i] >= 0x20)
+			escaped += value[i];
+	}
+	m_info.push_back("\"" + name + "\": \"" + escaped + "\"");
+}
+
+void CFrameRecorder::AddInfo(string name, double value)
+{
+	char sValue[64];
+	sprintf_s(sValue, "%.6g", value);
+	m_info.push_back("\"" + name + "\": " + sValue);
+}
+
+// Write "name": {"min": ..., "mean": ..., "p50": ..., ...} for a set of frame times, or null if there are none.  Percentiles are
+// nearest-rank, so each is the time of an actual frame
+static void WriteStatistics(FILE *fp, const char *name, vector<double> times, bool bLast)
+{
+	fprintf(fp, "  \"%s\": ", name);
+	if (times.empty()) {
+		fprintf(fp, "null%s\n", bLast ? "" : ",");
+		return;
+	}
+
+	sort(times.begin(), times.end());
+	double dSum = 0.0;
+	for (int i = 0; i < (int) times.size(); i++)
+		dSum += times[i];
+
+	const int iPercentiles[] = { 50, 95, 99 };
+	fprintf(fp, "{\"min\": %.4f, \"mean\": %.4f", times.front(), dSum / times.size());
+	for (int i = 0; i < 3; i++) {
+		int iRank = (int) ceil(iPercentiles[i] / 100.0 * times.size());
+		fprintf(fp, ", \"p%d\": %.4f", iPercentiles[i], times[iRank > 0 ? iRank - 1 : 0]);
+	}
+	fprintf(fp, ", \"max\": %.4f}%s\n", times.back(), bLast ? "" : ",");
+}
+
+bool CFrameRecorder::WriteReport(string filename)
+{
+	if (m_hasTimerQueries) {
+		for (int i = 0; i < QUERY_FRAMES; i++) {
+			if (m_queryFrames[i] >= 0)
+				ReadGPUTime(i, true);
+		}
+	}
+
+	vector<double> gpuTimes;
+	for (int i = 0; i < (int) m_gpuTimes.size(); i++) {
+		if (m_gpuTimes[i] >= 0.0)
+			gpuTimes.push_back(m_gpuTimes[i]);
+	}
+
+	FILE *fp;
+	if (fopen_s(&fp, filename.c_str(), "wt") != 0) {
+		char sErrorMessage[512];
+		sprintf_s(sErrorMessage, "Could not write %s", filename.c_str());
+		MessageBox(NULL, sErrorMessage, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"format\": 1,\n");
+	fprintf(fp, "  \"frames\": %d,\n", (int) m_cpuTimes.size());
+	for (int i = 0; i < (int) m_info.size(); i++)
+		fprintf(fp, "  %s,\n", m_info[i].c_str());
+	WriteStatistics(fp, "cpu_frame_ms", m_cpuTimes, false);
+	WriteStatistics(fp, "gpu_frame_ms", gpuTimes, true);
+	fprintf(fp, "}\n");
+	fclose(fp);
+
+	return true;
+}
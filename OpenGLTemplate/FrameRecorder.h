@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Common.h"
+#include "HighResolutionTimer.h"
+
+// Records how long each frame takes, on the CPU (wall clock, from the start of Update to after the buffers are swapped) and on the
+// GPU (timestamp queries either side of the frame's GL commands), and writes min/mean/percentile statistics as JSON.  GPU times
+// are read back a few frames late so the queries never stall the pipeline, and are left out if the driver has no timer queries
+class CFrameRecorder
+{
+public:
+	CFrameRecorder();
+	~CFrameRecorder();
+
+	// Call once with the GL context current, and expect about iNumFrames frames
+	void Create(int iNumFrames);
+	void Release();
+
+	void BeginFrame();		// Before Update
+	void EndRendering();	// After the last draw call, before SwapBuffers
+	void EndFrame();		// After SwapBuffers
+
+	int GetFrameCount() const { return (int) m_cpuTimes.size(); }
+
+	// Add a setting or a fact about the run to the report
+	void AddInfo(string name, string value);
+	void AddInfo(string name, double value);
+
+	// Wait for the outstanding GPU times and write the report
+	bool WriteReport(string filename);
+
+private:
+	enum { QUERY_FRAMES = 4 };	// Frames in flight before a GPU time is read back
+
+	void ReadGPUTime(int iSlot, bool bWait);
+
+	bool m_hasTimerQueries;
+	GLuint m_queries[QUERY_FRAMES][2];		// Start and end timestamps for a ring of frames
+	int m_queryFrames[QUERY_FRAMES];		// Frame each pair of queries belongs to, or -1 when free
+	int m_frame;
+
+	CHighResolutionTimer m_timer;
+	vector<double> m_cpuTimes;	// ms
+	vector<double> m_gpuTimes;	// ms, in frame order; -1 where a frame's time is missing
+	vector<string> m_info;		// "name": value
+};
@@ -1,11 +1,12 @@
 #include "FreeTypeFont.h"
-#include <minmax.h>
+#include "GLState.h"
 
 #pragma comment(lib, "lib/freetype.lib")
 
 CFreeTypeFont::CFreeTypeFont()
 {
 	m_isLoaded = false;
+	m_hasTextures = false;
 }
 CFreeTypeFont::~CFreeTypeFont()
 {}
@@ -15,18 +16,35 @@ CFreeTypeFont::~CFreeTypeFont()
 Name:	createChar
 
 Params:	iIndex - character index in Unicode.
+		bCreateTexture - false to load only
+		the metrics.
 
 Result:	Creates one single character (its
-		texture).
+		cell in the atlas).
 
 /*---------------------------------------------*/
 
 inline int next_p2(int n){int res = 1; while(res < n)res <<= 1; return res;}
 
-void CFreeTypeFont::CreateChar(int index)
+void CFreeTypeFont::CreateChar(int index, bool bCreateTexture)
 {
 	FT_Load_Glyph(m_ftFace, FT_Get_Char_Index(m_ftFace, index), FT_LOAD_DEFAULT);
 
+	// Calculate glyph data
+	m_advX[index] = m_ftFace->glyph->advance.x>>6;
+	m_bearingX[index] = m_ftFace->glyph->metrics.horiBearingX>>6;
+	m_charWidth[index] = m_ftFace->glyph->metrics.width>>6;
+
+	m_advY[index] = (m_ftFace->glyph->metrics.height - m_ftFace->glyph->metrics.horiBearingY)>>6;
+	m_bearingY[index] = m_ftFace->glyph->metrics.horiBearingY>>6;
+	m_charHeight[index] = m_ftFace->glyph->metrics.height>>6;
+
+	if (m_charHeight[index] > m_newLine)
+		m_newLine = m_charHeight[index];
+
+	if (!bCreateTexture)
+		return;
+
 	FT_Render_Glyph(m_ftFace->glyph, FT_RENDER_MODE_NORMAL);
 	FT_Bitmap* pBitmap = &m_ftFace->glyph->bitmap;
 
@@ -39,46 +57,76 @@ void CFreeTypeFont::CreateChar(int index)
 		for (int cw = 0; cw < iTW; cw++)
 			bData[ch*iTW+cw] = (ch >= iH || cw >= iW) ? 0 : pBitmap->buffer[(iH-ch-1)*iW+cw];
  
-	// And create a texture from it
-
-	m_charTextures[index].CreateFromData(bData, iTW, iTH, 8, GL_DEPTH_COMPONENT, false);
-	m_charTextures[index].SetSamplerObjectParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	m_charTextures[index].SetSamplerObjectParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	m_charTextures[index].SetSamplerObjectParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	m_charTextures[index].SetSamplerObjectParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	// Calculate glyph data
-	m_advX[index] = m_ftFace->glyph->advance.x>>6;
-	m_bearingX[index] = m_ftFace->glyph->metrics.horiBearingX>>6;
-	m_charWidth[index] = m_ftFace->glyph->metrics.width>>6;
-
-	m_advY[index] = (m_ftFace->glyph->metrics.height - m_ftFace->glyph->metrics.horiBearingY)>>6;
-	m_bearingY[index] = m_ftFace->glyph->metrics.horiBearingY>>6;
-	m_charHeight[index] = m_ftFace->glyph->metrics.height>>6;
+	AddToAtlas(index, bData, iTW, iTH);
+	delete[] bData;
+}
 
-	m_newLine = max(m_newLine, int(m_ftFace->glyph->metrics.height >> 6));
+// Pack a cell into the atlas, in rows filled left to right.  The cell gets a border of copies of its edge texels, so that linear 
+// filtering at its edges gives what clamping to the edge of a texture of its own would, rather than bleeding in its neighbours
+void CFreeTypeFont::AddToAtlas(int index, const GLubyte *pData, int width, int height)
+{
+	if (m_shelfX + width + 2 > ATLAS_WIDTH) {
+		m_shelfX = 0;
+		m_shelfY += m_shelfHeight;
+		m_shelfHeight = 0;
+	}
+	if (height + 2 > m_shelfHeight)
+		m_shelfHeight = height + 2;
+	if ((int) m_atlasData.size() < (m_shelfY + m_shelfHeight) * ATLAS_WIDTH)
+		m_atlasData.resize((m_shelfY + m_shelfHeight) * ATLAS_WIDTH, 0);
+
+	for (int ch = -1; ch <= height; ch++) {
+		int iRow = ch < 0 ? 0 : (ch < height ? ch : height - 1);
+		for (int cw = -1; cw <= width; cw++) {
+			int iColumn = cw < 0 ? 0 : (cw < width ? cw : width - 1);
+			m_atlasData[(m_shelfY + 1 + ch) * ATLAS_WIDTH + m_shelfX + 1 + cw] = pData[iRow * width + iColumn];
+		}
+	}
+	m_atlasX[index] = m_shelfX + 1;
+	m_atlasY[index] = m_shelfY + 1;
+	m_cellWidth[index] = width;
+	m_cellHeight[index] = height;
+	m_shelfX += width + 2;
+}
 
-	// Rendering data, texture coordinates are always the same, so now we waste a little memory
-	glm::vec2 vQuad[] =
+// Add two triangles covering (x0, y0) to (x1, y1) on screen, textured with the atlas from texel (u0, v0) to (u1, v1)
+void CFreeTypeFont::AddQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1)
+{
+	float fTexelWidth = 1.0f / m_atlas.GetWidth(), fTexelHeight = 1.0f / m_atlas.GetHeight();
+	glm::vec2 vCorners[] =
 	{
-		glm::vec2(0.0f, float(-m_advY[index]+iTH)),
-		glm::vec2(0.0f, float(-m_advY[index])),
-		glm::vec2(float(iTW), float(-m_advY[index]+iTH)),
-		glm::vec2(float(iTW), float(-m_advY[index]))
+		glm::vec2(x0, y1), glm::vec2(u0 * fTexelWidth, v1 * fTexelHeight),
+		glm::vec2(x0, y0), glm::vec2(u0 * fTexelWidth, v0 * fTexelHeight),
+		glm::vec2(x1, y1), glm::vec2(u1 * fTexelWidth, v1 * fTexelHeight),
+		glm::vec2(x1, y0), glm::vec2(u1 * fTexelWidth, v0 * fTexelHeight)
 	};
-	glm::vec2 vTexQuad[] = {glm::vec2(0.0f, 1.0f), glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 1.0f), glm::vec2(1.0f, 0.0f)};
-
-	// Add this char to VBO
-	for (int i = 0; i < 4; i++) {
-		m_vbo.AddData(&vQuad[i], sizeof(glm::vec2));
-		m_vbo.AddData(&vTexQuad[i], sizeof(glm::vec2));
-	}
-	delete[] bData;
+	int iOrder[] = {0, 1, 2, 2, 1, 3};
+	for (int i = 0; i < 6; i++)
+		m_vbo.AddData(&vCorners[iOrder[i] * 2], sizeof(glm::vec2) * 2);
+	m_numVertices += 6;
 }
 
+// Draw the quads added since the last call, in one draw call, in screen coordinates
+void CFreeTypeFont::DrawQuads()
+{
+	if (m_numVertices == 0)
+		return;
+
+	CGLState::BindVertexArray(m_vao);
+	m_vbo.Bind();
+	m_vbo.UploadDataToGPU(GL_STREAM_DRAW);
+	m_shaderProgram->SetUniform("sampler0", 0);
+	m_shaderProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1.0f));
+	m_atlas.Bind();
+	CGLState::Enable(GL_BLEND);
+	CGLState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArrays(GL_TRIANGLES, 0, m_numVertices);
+	CGLState::Disable(GL_BLEND);
+	m_numVertices = 0;
+}
 
 // Loads an entire font with the given path sFile and pixel size iPXSize
-bool CFreeTypeFont::LoadFont(string file, int ipixelSize)
+bool CFreeTypeFont::LoadFont(string file, int ipixelSize, bool bCreateTextures)
 {
 	BOOL bError = FT_Init_FreeType(&m_ftLib);
 	
@@ -91,20 +139,40 @@ bool CFreeTypeFont::LoadFont(string file, int ipixelSize)
 	}
 	FT_Set_Pixel_Sizes(m_ftFace, ipixelSize, ipixelSize);
 	m_loadedPixelSize = ipixelSize;
+	m_newLine = 0;
 
-	glGenVertexArrays(1, &m_vao);
-	glBindVertexArray(m_vao);
-	m_vbo.Create();
-	m_vbo.Bind();
+	m_shelfX = m_shelfY = m_shelfHeight = 0;
+	m_atlasData.clear();
 
 	for (int i = 0; i < 128; i++)
-		CreateChar(i);
+		CreateChar(i, bCreateTextures);
 	m_isLoaded = true;
+	m_hasTextures = bCreateTextures;
 
 	FT_Done_Face(m_ftFace);
 	FT_Done_FreeType(m_ftLib);
-	
-	m_vbo.UploadDataToGPU(GL_STATIC_DRAW);
+
+	if (!bCreateTextures)
+		return true;
+
+	// Slot BAR_INDEX, after the characters, is a white block for DrawBar
+	GLubyte white = 255;
+	AddToAtlas(BAR_INDEX, &white, 1, 1);
+
+	m_atlasData.resize(next_p2(m_shelfY + m_shelfHeight) * ATLAS_WIDTH, 0);
+	m_atlas.CreateFromData(&m_atlasData[0], ATLAS_WIDTH, (int) m_atlasData.size() / ATLAS_WIDTH, 8, GL_DEPTH_COMPONENT, false);
+	m_atlas.SetSamplerObjectParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	m_atlas.SetSamplerObjectParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	m_atlas.SetSamplerObjectParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	m_atlas.SetSamplerObjectParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	vector<GLubyte>().swap(m_atlasData);
+
+	// The buffer is filled when text is drawn
+	m_numVertices = 0;
+	glGenVertexArrays(1, &m_vao);
+	CGLState::BindVertexArray(m_vao);
+	m_vbo.Create();
+	m_vbo.Bind();
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2)*2, 0);
 	glEnableVertexAttribArray(1);
@@ -117,27 +185,24 @@ bool CFreeTypeFont::LoadSystemFont(string name, int ipixelSize)
 {
 	char buf[512]; GetWindowsDirectory(buf, 512);
 	string sPath = buf;
-	sPath += "\\Fonts\\";
+	sPath += "/Fonts/";
 	sPath += name;
 
 	return LoadFont(sPath, ipixelSize);
 }
 
 
-// Prints text at the specified location (x, y) with the given pixel size (iPXSize)
-void CFreeTypeFont::Print(string text, int x, int y, int pixelSize)
+// Lays out text at the specified location (x, y) with the given pixel size (iPXSize).  Only the first 128 characters are loaded, so 
+// others are skipped
+void CFreeTypeFont::Layout(const string &text, int x, int y, int pixelSize, vector<FontGlyph> &glyphs)
 {
+	glyphs.clear();
 	if(!m_isLoaded)
 		return;
 
-	glBindVertexArray(m_vao);
-	m_shaderProgram->SetUniform("sampler0", 0);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	int iCurX = x, iCurY = y;
 	if (pixelSize == -1)
 		pixelSize = m_loadedPixelSize;
-	float fScale = float(pixelSize) / float(m_loadedPixelSize);
 	for (int i = 0; i < (int) text.size(); i++) {
 		if (text[i] == '\n')
 		{
@@ -145,21 +210,41 @@ void CFreeTypeFont::Print(string text, int x, int y, int pixelSize)
 			iCurY -= m_newLine*pixelSize / m_loadedPixelSize;
 			continue;
 		}
-		int iIndex = int(text[i]);
+		int iIndex = (unsigned char) text[i];
+		if (iIndex >= 128)
+			continue;
 		iCurX += m_bearingX[iIndex] * pixelSize / m_loadedPixelSize;
 		if(text[i] != ' ')
 		{
-			m_charTextures[iIndex].Bind();
-			glm::mat4 mModelView = glm::translate(glm::mat4(1.0f), glm::vec3(float(iCurX), float(iCurY), 0.0f));
-			mModelView = glm::scale(mModelView, glm::vec3(fScale));
-			m_shaderProgram->SetUniform("matrices.modelViewMatrix", mModelView);
-			// Draw character
-			glDrawArrays(GL_TRIANGLE_STRIP, iIndex*4, 4);
+			FontGlyph glyph = { iIndex, iCurX, iCurY };
+			glyphs.push_back(glyph);
 		}
 
 		iCurX += (m_advX[iIndex] - m_bearingX[iIndex])*pixelSize / m_loadedPixelSize;
 	}
-	glDisable(GL_BLEND);
+}
+
+// Prints text at the specified location (x, y) with the given pixel size (iPXSize)
+void CFreeTypeFont::Print(string text, int x, int y, int pixelSize)
+{
+	if(!m_hasTextures)
+		return;
+
+	if (pixelSize == -1)
+		pixelSize = m_loadedPixelSize;
+	Layout(text, x, y, pixelSize, m_glyphs);
+
+	// Each character's cell, scaled to the pixel size, with its bottom advY below the baseline
+	float fScale = float(pixelSize) / float(m_loadedPixelSize);
+	for (int i = 0; i < (int) m_glyphs.size(); i++) {
+		const FontGlyph &glyph = m_glyphs[i];
+		int iIndex = glyph.index;
+		float fX = float(glyph.x), fY = float(glyph.y);
+		AddQuad(fX, fY - fScale * m_advY[iIndex], fX + fScale * m_cellWidth[iIndex], fY + fScale * (m_cellHeight[iIndex] - m_advY[iIndex]),
+			float(m_atlasX[iIndex]), float(m_atlasY[iIndex]),
+			float(m_atlasX[iIndex] + m_cellWidth[iIndex]), float(m_atlasY[iIndex] + m_cellHeight[iIndex]));
+	}
+	DrawQuads();
 }
 
 
@@ -174,13 +259,26 @@ void CFreeTypeFont::Render(int x, int y, int pixelSize, const char* text, ...)
 	Print(buf, x, y, pixelSize);
 }
 
-// Deletes all font textures
+// Draw a solid rectangle with its bottom left corner at (x, y), in the colour text would be
+void CFreeTypeFont::DrawBar(int x, int y, int width, int height)
+{
+	if (!m_hasTextures || width <= 0 || height <= 0)
+		return;
+
+	// Sampled at the centre of the white block's one texel, so filtering leaves it white
+	float fU = m_atlasX[BAR_INDEX] + 0.5f, fV = m_atlasY[BAR_INDEX] + 0.5f;
+	AddQuad(float(x), float(y), float(x + width), float(y + height), fU, fV, fU, fV);
+	DrawQuads();
+}
+
+// Deletes the font texture and buffer
 void CFreeTypeFont::ReleaseFont()
 {
-	for (int i = 0; i < 128; i++) 
-		m_charTextures[i].Release();
+	if (!m_hasTextures)
+		return;
+	m_atlas.Release();
 	m_vbo.Release();
-	glDeleteVertexArrays(1, &m_vao);
+	CGLState::DeleteVertexArray(m_vao);
 }
 
 // Gets the width of text
@@ -9,6 +9,13 @@
 #include "VertexBufferObject.h"
 
 
+// A character placed by CFreeTypeFont::Layout: the quad of character index, drawn at (x, y)
+struct FontGlyph
+{
+	int index;
+	int x, y;
+};
+
 // This class is a wrapper for FreeType fonts and their usage with OpenGL
 class CFreeTypeFont
 {
@@ -16,32 +23,51 @@ public:
 	CFreeTypeFont();
 	~CFreeTypeFont();
 
-	bool LoadFont(string file, int pixelSize);
+	// With bCreateTextures false only the glyph metrics are loaded, which is enough for Layout and GetTextWidth and needs no OpenGL context
+	bool LoadFont(string file, int pixelSize, bool bCreateTextures = true);
 	bool LoadSystemFont(string name, int pixelSize);
 
 	int GetTextWidth(string text, int pixelSize);
 
+	// Work out where each character of text goes when printed at (x, y), as Print does.  Spaces and newlines produce no glyph
+	void Layout(const string &text, int x, int y, int pixelSize, vector<FontGlyph> &glyphs);
+
 	void Print(string text, int x, int y, int pixelSize = -1);
 	void Render(int x, int y, int pixelSize, const char* text, ...);
 
+	// A filled rectangle, for bar charts alongside text
+	void DrawBar(int x, int y, int width, int height);
+
 	
 	void ReleaseFont();
 
 	void SetShaderProgram(CShaderProgram* shaderProgram);
 
 private:
-	void CreateChar(int index);
+	enum { BAR_INDEX = 128, ATLAS_WIDTH = 512 };
+
+	void CreateChar(int index, bool bCreateTexture);
+	void AddToAtlas(int index, const GLubyte *pData, int width, int height);
+	void AddQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1);
+	void DrawQuads();
 
-	CTexture m_charTextures[256];
+	CTexture m_atlas;					// Every character, and a white block for DrawBar, in one texture so a string is one draw
+	int m_atlasX[256], m_atlasY[256];	// Where each character's cell starts in the atlas, in texels
+	int m_cellWidth[256], m_cellHeight[256];
+	int m_shelfX, m_shelfY, m_shelfHeight;	// Packing the atlas, while loading
+	vector<GLubyte> m_atlasData;
 	int m_advX[256], m_advY[256];
 	int m_bearingX[256], m_bearingY[256];
 	int m_charWidth[256], m_charHeight[256];
 	int m_loadedPixelSize, m_newLine;
 
 	bool m_isLoaded;
+	bool m_hasTextures;
+	vector<FontGlyph> m_glyphs;		// Layout of the text being printed, kept to avoid allocating every call
 
 	UINT m_vao;
-	CVertexBufferObject m_vbo;
+	CVertexBufferObject m_vbo;		// Refilled with the quads of each string or bar drawn
+	int m_numVertices;
 
 	FT_Library m_ftLib;
 	FT_Face m_ftFace;
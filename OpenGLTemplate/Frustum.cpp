@@ -0,0 +1,54 @@
+#include "Frustum.h"
+
+CFrustum::CFrustum()
+{
+	for (int i = 0; i < 6; i++)
+		m_planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f); // Everything is inside until Set is called
+}
+
+CFrustum::~CFrustum()
+{}
+
+// Extract the frustum planes from the rows of the projection * view matrix (Gribb and Hartmann's method).  glm matrices are column major, 
+// so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+void CFrustum::Set(const glm::mat4 &m)
+{
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	m_planes[0] = row3 + row0;	// Left
+	m_planes[1] = row3 - row0;	// Right
+	m_planes[2] = row3 + row1;	// Bottom
+	m_planes[3] = row3 - row1;	// Top
+	m_planes[4] = row3 + row2;	// Near
+	m_planes[5] = row3 - row2;	// Far
+
+	for (int i = 0; i < 6; i++)
+		m_planes[i] /= glm::length(glm::vec3(m_planes[i]));
+}
+
+// Test an axis aligned box against each plane using the corner furthest along the plane normal -- if even that corner is behind a plane, 
+// the whole box is outside
+bool CFrustum::IntersectsBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+{
+	for (int i = 0; i < 6; i++) {
+		const glm::vec4 &plane = m_planes[i];
+		glm::vec3 corner(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+						 plane.y >= 0.0f ? boxMax.y : boxMin.y,
+						 plane.z >= 0.0f ? boxMax.z : boxMin.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+bool CFrustum::IntersectsSphere(const glm::vec3 &centre, float radius) const
+{
+	for (int i = 0; i < 6; i++) {
+		if (glm::dot(glm::vec3(m_planes[i]), centre) + m_planes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "./include/glm/gtc/type_ptr.hpp"
+#include "./include/glm/gtc/matrix_transform.hpp"
+
+// A view frustum, stored as six planes, used to cull geometry that can't be seen by the camera
+class CFrustum
+{
+public:
+	CFrustum();
+	~CFrustum();
+
+	// Extract the planes from a combined projection * view matrix; objects are then tested in world coordinates
+	void Set(const glm::mat4 &viewProjectionMatrix);
+
+	bool IntersectsBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;	// Returns false only if the box is entirely outside
+	bool IntersectsSphere(const glm::vec3 &centre, float radius) const;			// Returns false only if the sphere is entirely outside
+
+private:
+	glm::vec4 m_planes[6];		// Left, right, bottom, top, near, far; (a, b, c, d) with the normal (a, b, c) pointing inwards
+};
@@ -0,0 +1,270 @@
+#include "GLState.h"
+
+// Values the cache can't hold for real, meaning the state isn't known
+static const GLuint UNKNOWN_NAME = 0xFFFFFFFF;
+static const GLenum UNKNOWN_ENUM = 0xFFFFFFFF;
+static const int UNKNOWN_FLAG = -1;
+
+static const int MAX_TEXTURE_UNITS = 32;	// Units tracked; higher ones are always passed on
+static const int MAX_UNIFORM_BINDINGS = 16;	// Uniform buffer binding points tracked, likewise
+
+// Capabilities tracked by Enable and Disable
+enum
+{
+	CAPABILITY_BLEND,
+	CAPABILITY_DEPTH_TEST,
+	CAPABILITY_CULL_FACE,
+	NUM_CAPABILITIES
+};
+
+static struct
+{
+	GLuint program;
+	GLuint vao;
+	int activeUnit;
+	GLuint textures2D[MAX_TEXTURE_UNITS];
+	GLuint texturesCube[MAX_TEXTURE_UNITS];
+	GLuint samplers[MAX_TEXTURE_UNITS];
+	int enabled[NUM_CAPABILITIES];		// 1, 0, or UNKNOWN_FLAG
+	int depthMask;
+	GLenum blendSource, blendDestination;
+	GLenum polygonMode;
+	struct
+	{
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+	} uniformBuffers[MAX_UNIFORM_BINDINGS];
+
+	int issued, elided;					// This frame so far
+	int lastIssued, lastElided;			// The last frame
+} s_state = {
+	UNKNOWN_NAME, UNKNOWN_NAME, UNKNOWN_FLAG,
+	{ 0 }, { 0 }, { 0 },				// A new context has nothing bound to any unit
+	{ UNKNOWN_FLAG, UNKNOWN_FLAG, UNKNOWN_FLAG },
+	UNKNOWN_FLAG, UNKNOWN_ENUM, UNKNOWN_ENUM, UNKNOWN_ENUM,
+	{ { 0, 0, 0 } },
+	0, 0, 0, 0
+};
+
+// Record the new value and return true if the call needs making, count the call either way
+template <typename T> static bool Change(T &current, T value)
+{
+	if (current == value) {
+		s_state.elided++;
+		return false;
+	}
+	current = value;
+	s_state.issued++;
+	return true;
+}
+
+static int CapabilityIndex(GLenum capability)
+{
+	switch (capability) {
+	case GL_BLEND: return CAPABILITY_BLEND;
+	case GL_DEPTH_TEST: return CAPABILITY_DEPTH_TEST;
+	case GL_CULL_FACE: return CAPABILITY_CULL_FACE;
+	}
+	return -1;
+}
+
+void CGLState::UseProgram(GLuint program)
+{
+	if (Change(s_state.program, program))
+		glUseProgram(program);
+}
+
+void CGLState::BindVertexArray(GLuint vao)
+{
+	if (Change(s_state.vao, vao))
+		glBindVertexArray(vao);
+}
+
+void CGLState::ActiveTexture(int iUnit)
+{
+	if (Change(s_state.activeUnit, iUnit))
+		glActiveTexture(GL_TEXTURE0 + iUnit);
+}
+
+void CGLState::BindTexture(GLenum target, GLuint texture)
+{
+	int iUnit = s_state.activeUnit;
+	GLuint *pBound = NULL;
+	if (iUnit >= 0 && iUnit < MAX_TEXTURE_UNITS) {
+		if (target == GL_TEXTURE_2D)
+			pBound = &s_state.textures2D[iUnit];
+		else if (target == GL_TEXTURE_CUBE_MAP)
+			pBound = &s_state.texturesCube[iUnit];
+	}
+
+	if (pBound == NULL) {
+		s_state.issued++;
+		glBindTexture(target, texture);
+	} else if (Change(*pBound, texture))
+		glBindTexture(target, texture);
+}
+
+void CGLState::BindTexture(int iUnit, GLenum target, GLuint texture)
+{
+	ActiveTexture(iUnit);
+	BindTexture(target, texture);
+}
+
+void CGLState::BindSampler(int iUnit, GLuint sampler)
+{
+	if (iUnit < 0 || iUnit >= MAX_TEXTURE_UNITS) {
+		s_state.issued++;
+		glBindSampler(iUnit, sampler);
+	} else if (Change(s_state.samplers[iUnit], sampler))
+		glBindSampler(iUnit, sampler);
+}
+
+void CGLState::BindBufferRange(int iBinding, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	if (iBinding >= 0 && iBinding < MAX_UNIFORM_BINDINGS) {
+		if (s_state.uniformBuffers[iBinding].buffer == buffer && s_state.uniformBuffers[iBinding].offset == offset && 
+			s_state.uniformBuffers[iBinding].size == size) {
+			s_state.elided++;
+			return;
+		}
+		s_state.uniformBuffers[iBinding].buffer = buffer;
+		s_state.uniformBuffers[iBinding].offset = offset;
+		s_state.uniformBuffers[iBinding].size = size;
+	}
+	s_state.issued++;
+	glBindBufferRange(GL_UNIFORM_BUFFER, iBinding, buffer, offset, size);
+}
+
+void CGLState::SetEnabled(GLenum capability, bool bEnabled)
+{
+	int i = CapabilityIndex(capability);
+	if (i >= 0 && !Change(s_state.enabled[i], bEnabled ? 1 : 0))
+		return;
+	if (i < 0)
+		s_state.issued++;
+
+	if (bEnabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+}
+
+void CGLState::Enable(GLenum capability)
+{
+	SetEnabled(capability, true);
+}
+
+void CGLState::Disable(GLenum capability)
+{
+	SetEnabled(capability, false);
+}
+
+void CGLState::DepthMask(bool bWrite)
+{
+	if (Change(s_state.depthMask, bWrite ? 1 : 0))
+		glDepthMask(bWrite ? GL_TRUE : GL_FALSE);
+}
+
+// Counted as one call, as it is one to the driver
+void CGLState::BlendFunc(GLenum source, GLenum destination)
+{
+	if (s_state.blendSource == source && s_state.blendDestination == destination) {
+		s_state.elided++;
+		return;
+	}
+	s_state.blendSource = source;
+	s_state.blendDestination = destination;
+	s_state.issued++;
+	glBlendFunc(source, destination);
+}
+
+void CGLState::PolygonMode(GLenum mode)
+{
+	if (Change(s_state.polygonMode, mode))
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void CGLState::DeleteProgram(GLuint program)
+{
+	if (s_state.program == program)
+		s_state.program = UNKNOWN_NAME;
+	glDeleteProgram(program);
+}
+
+void CGLState::DeleteVertexArray(GLuint vao)
+{
+	if (s_state.vao == vao)
+		s_state.vao = UNKNOWN_NAME;
+	glDeleteVertexArrays(1, &vao);
+}
+
+void CGLState::DeleteTexture(GLuint texture)
+{
+	for (int i = 0; i < MAX_TEXTURE_UNITS; i++) {
+		if (s_state.textures2D[i] == texture)
+			s_state.textures2D[i] = UNKNOWN_NAME;
+		if (s_state.texturesCube[i] == texture)
+			s_state.texturesCube[i] = UNKNOWN_NAME;
+	}
+	glDeleteTextures(1, &texture);
+}
+
+void CGLState::DeleteSampler(GLuint sampler)
+{
+	for (int i = 0; i < MAX_TEXTURE_UNITS; i++) {
+		if (s_state.samplers[i] == sampler)
+			s_state.samplers[i] = UNKNOWN_NAME;
+	}
+	glDeleteSamplers(1, &sampler);
+}
+
+void CGLState::DeleteBuffer(GLuint buffer)
+{
+	for (int i = 0; i < MAX_UNIFORM_BINDINGS; i++) {
+		if (s_state.uniformBuffers[i].buffer == buffer)
+			s_state.uniformBuffers[i].buffer = UNKNOWN_NAME;
+	}
+	glDeleteBuffers(1, &buffer);
+}
+
+void CGLState::CountCall(bool bIssued)
+{
+	if (bIssued)
+		s_state.issued++;
+	else
+		s_state.elided++;
+}
+
+void CGLState::Invalidate()
+{
+	s_state.program = UNKNOWN_NAME;
+	s_state.vao = UNKNOWN_NAME;
+	s_state.activeUnit = UNKNOWN_FLAG;
+	for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+		s_state.textures2D[i] = s_state.texturesCube[i] = s_state.samplers[i] = UNKNOWN_NAME;
+	for (int i = 0; i < NUM_CAPABILITIES; i++)
+		s_state.enabled[i] = UNKNOWN_FLAG;
+	s_state.depthMask = UNKNOWN_FLAG;
+	s_state.blendSource = s_state.blendDestination = UNKNOWN_ENUM;
+	s_state.polygonMode = UNKNOWN_ENUM;
+	for (int i = 0; i < MAX_UNIFORM_BINDINGS; i++)
+		s_state.uniformBuffers[i].buffer = UNKNOWN_NAME;
+}
+
+void CGLState::BeginFrame()
+{
+	s_state.lastIssued = s_state.issued;
+	s_state.lastElided = s_state.elided;
+	s_state.issued = s_state.elided = 0;
+}
+
+int CGLState::GetIssuedCalls()
+{
+	return s_state.lastIssued;
+}
+
+int CGLState::GetElidedCalls()
+{
+	return s_state.lastElided;
+}
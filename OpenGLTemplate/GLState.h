@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Common.h"
+
+// Tracks the OpenGL state the engine changes most often, and skips calls that would set it to what it already is: the program, the
+// VAO, the active texture unit, the 2D and cube map textures and the sampler on each unit, blending, depth testing and face culling,
+// the depth mask, the blend function, the polygon mode and the uniform buffer range at each binding point.  Anything that changes
+// this state must do it through here, or call Invalidate afterwards, or the cache goes stale.  There is one context, used from one
+// thread, so the state is global.  Apart from the texture units, which a new context leaves empty, everything starts unknown, so the
+// first call of each kind goes to the driver
+class CGLState
+{
+public:
+	static void UseProgram(GLuint program);
+	static void BindVertexArray(GLuint vao);
+	static void ActiveTexture(int iUnit);
+	static void BindTexture(GLenum target, GLuint texture);				// On the active unit
+	static void BindTexture(int iUnit, GLenum target, GLuint texture);
+	static void BindSampler(int iUnit, GLuint sampler);
+	static void BindBufferRange(int iBinding, GLuint buffer, GLintptr offset, GLsizeiptr size);	// On GL_UNIFORM_BUFFER
+
+	static void Enable(GLenum capability);
+	static void Disable(GLenum capability);
+	static void SetEnabled(GLenum capability, bool bEnabled);
+	static void DepthMask(bool bWrite);
+	static void BlendFunc(GLenum source, GLenum destination);
+	static void PolygonMode(GLenum mode);		// For GL_FRONT_AND_BACK, the only choice in a core profile
+
+	// Delete an object, and forget it if it's bound, as its name may be reused
+	static void DeleteProgram(GLuint program);
+	static void DeleteVertexArray(GLuint vao);
+	static void DeleteTexture(GLuint texture);
+	static void DeleteSampler(GLuint sampler);
+	static void DeleteBuffer(GLuint buffer);
+
+	// Count a call for state cached somewhere else, such as a program's uniforms, as issued or elided
+	static void CountCall(bool bIssued);
+
+	// Forget everything, after changing the state some other way
+	static void Invalidate();
+
+	// Start counting a new frame's calls.  The counts are of the calls that reached the driver and those skipped, in the last frame
+	static void BeginFrame();
+	static int GetIssuedCalls();
+	static int GetElidedCalls();
+};
@@ -24,12 +24,16 @@ Source code drawn from a number of sources and examples, including contributions
 */
 
 
-#include "game.h"
+#include "Game.h"
 
 
 // Setup includes
 #include "HighResolutionTimer.h"
-#include "GameWindow.h"
+#ifdef _WIN32
+#include "Win32Window.h"
+#else
+#include "HeadlessWindow.h"
+#endif
 
 // Game includes
 #include "Camera.h"
@@ -42,6 +46,16 @@ Source code drawn from a number of sources and examples, including contributions
 #include "OpenAssetImportMesh.h"
 #include "Audio.h"
 #include "CatmullRom.h"
+#include "Frustum.h"
+#include "FrameRecorder.h"
+#include "Profiler.h"
+#include "FrameLimiter.h"
+#include "UpdateThread.h"
+#include "RenderQueue.h"
+#include "GLState.h"
+#include "UniformBuffer.h"
+#include "ProgramCache.h"
+#include "ShaderReloader.h"
 
 // For old cube creation now moved to seperate class
 //GLuint cubeVAO, cubeVBO, cubeEBO;
@@ -57,13 +71,35 @@ Game::Game()
 	m_pFtFont = NULL;
 	m_pHighResolutionTimer = NULL;
 	m_pCatmullRom = NULL;
-
-	m_dt = 0.0;
+	m_pGameWindow = NULL;
+	m_pFrameRecorder = NULL;
+	m_pProfiler = NULL;
+	m_pFrameLimiter = NULL;
+	m_pUpdateThread = NULL;
+	m_pUpdateProfiler = NULL;
+	m_pRenderQueue = NULL;
+	m_pFrameUniforms = NULL;
+	m_pLightUniforms = NULL;
+	m_skyboxMaterial = m_terrainMaterial = m_trackMaterial = 0;
+	m_renderSnapshot = 0;
+	m_benchmarkFrames = 0;
+
+	m_dt = 1000.0 / FPS;
+	m_accumulator = 0.0;
+	m_frameTime = 0.0;
+	m_targetFrameRate = FPS;
 	m_framesPerSecond = 0;
 	m_frameCount = 0;
 	m_elapsedTime = 0.0f;
 	m_currentDistance = 0.0f;
 	m_cameraSpeed = 0.01f;
+	m_appActive = true;
+	m_showProfiler = true;
+	m_pipelined = true;
+	m_shaderCache = true;
+	m_shaderReload = true;
+	m_updateCost = 0.0;
+	m_startupTime = m_shaderSetupTime = 0.0;
 }
 
 // Destructor
@@ -75,7 +111,19 @@ Game::~Game()
 	delete m_pPlanarTerrain;
 	delete m_pFtFont;
 	delete m_pCatmullRom;
-
+	delete m_pFrameRecorder;
+	delete m_pFrameLimiter;
+	delete m_pUpdateThread;
+	delete m_pRenderQueue;
+	delete m_pFrameUniforms;
+	delete m_pLightUniforms;
+#ifdef USE_PROFILER
+	if (m_pUpdateProfiler != m_pProfiler)
+		delete m_pUpdateProfiler;
+	delete m_pProfiler;
+#endif
+
+	CShaderReloader::Stop();
 	if (m_pShaderPrograms != NULL) {
 		for (unsigned int i = 0; i < m_pShaderPrograms->size(); i++)
 			delete (*m_pShaderPrograms)[i];
@@ -100,9 +148,16 @@ void Game::Initialise()
 	m_pPlanarTerrain = new CPlane;
 	m_pFtFont = new CFreeTypeFont;
 	m_pCatmullRom = new CCatmullRom();
+	m_pRenderQueue = new CRenderQueue;
+	m_pFrameUniforms = new CUniformBuffer;
+	m_pLightUniforms = new CUniformBuffer;
+#ifdef USE_PROFILER
+	m_pProfiler = new CProfiler;
+	m_pProfiler->Create();
+#endif
 
 
-	RECT dimensions = m_gameWindow.GetDimensions();
+	RECT dimensions = m_pGameWindow->GetDimensions();
 
 	int width = dimensions.right - dimensions.left;
 	int height = dimensions.bottom - dimensions.top;
@@ -110,8 +165,33 @@ void Game::Initialise()
 	// Set the orthographic and perspective projection matrices based on the image size
 	m_pCamera->SetOrthographicProjectionMatrix(width, height); 
 	m_pCamera->SetPerspectiveProjectionMatrix(45.0f, (float) width / (float) height, 0.5f, 5000.0f);
-
-	// Load shaders
+	m_pRenderQueue->SetFarDistance(5000.0f);
+
+	// Materials: full ambient reflectance for the skybox and terrain, diffuse + specular for the track
+	RenderMaterial material;
+	material.ambient = glm::vec3(1.0f);
+	material.diffuse = glm::vec3(0.0f);
+	material.specular = glm::vec3(0.0f);
+	material.shininess = 15.0f;
+	material.features = SHADER_FEATURE_SKYBOX;
+	m_skyboxMaterial = m_pRenderQueue->AddMaterial(material);
+	material.features = SHADER_FEATURE_TEXTURE;
+	m_terrainMaterial = m_pRenderQueue->AddMaterial(material);
+	material.ambient = glm::vec3(0.5f);
+	material.diffuse = glm::vec3(0.5f);
+	material.specular = glm::vec3(1.0f);
+	material.features = 0;
+	m_trackMaterial = m_pRenderQueue->AddMaterial(material);
+
+	// The blocks set once a frame, shared by every program
+	m_pFrameUniforms->Create(sizeof(FrameUniforms));
+	m_pLightUniforms->Create(sizeof(LightUniforms));
+
+	// Load shaders.  The time taken is reported with the startup time, and depends on how many programs are in the cache
+	CHighResolutionTimer shaderTimer;
+	shaderTimer.Start();
+	if (m_shaderCache)
+		CProgramCache::SetDirectory("resources/shadercache/");
 	vector<CShader> shShaders;
 	vector<string> sShaderFileNames;
 	sShaderFileNames.push_back("mainShader.vert");
@@ -128,7 +208,7 @@ void Game::Initialise()
 		else if (sExt == "tcnl") iShaderType = GL_TESS_CONTROL_SHADER;
 		else iShaderType = GL_TESS_EVALUATION_SHADER;
 		CShader shader;
-		shader.LoadShader("resources\\shaders\\"+sShaderFileNames[i], iShaderType);
+		shader.LoadShader("resources/shaders/"+sShaderFileNames[i], iShaderType);
 		shShaders.push_back(shader);
 	}
 
@@ -139,6 +219,7 @@ void Game::Initialise()
 	pMainProgram->AddShaderToProgram(&shShaders[1]);
 	pMainProgram->LinkProgram();
 	m_pShaderPrograms->push_back(pMainProgram);
+	m_pRenderQueue->PrepareVariants(pMainProgram);
 
 	// Create a shader program for fonts
 	CShaderProgram *pFontProgram = new CShaderProgram;
@@ -149,13 +230,20 @@ void Game::Initialise()
 	m_pShaderPrograms->push_back(pFontProgram);
 
 	// You can follow this pattern to load additional shaders
+	m_shaderSetupTime = shaderTimer.Elapsed();
+
+	// Rebuild the programs when their files are saved
+	if (m_shaderReload && CShaderReloader::Start("resources/shaders/")) {
+		for (int i = 0; i < (int) m_pShaderPrograms->size(); i++)
+			CShaderReloader::AddProgram((*m_pShaderPrograms)[i]);
+	}
 
 	// Create the skybox
 	// Skybox downloaded from http://www.akimbo.in/forum/viewtopic.php?f=10&t=9
 	m_pSkybox->Create(2500.0f);
 	
 	// Create the planar terrain
-	m_pPlanarTerrain->Create("resources\\textures\\", "grassfloor01.jpg", 2000.0f, 2000.0f, 50.0f); // Texture downloaded from http://www.psionicgames.com/?page_id=26 on 24 Jan 2013
+	m_pPlanarTerrain->Create("resources/textures/", "grassfloor01.jpg", 2000.0f, 2000.0f, 50.0f); // Texture downloaded from http://www.psionicgames.com/?page_id=26 on 24 Jan 2013
 
 	m_pFtFont->LoadSystemFont("arial.ttf", 32);
 	m_pFtFont->SetShaderProgram(pFontProgram);
@@ -173,22 +261,28 @@ void Game::Initialise()
 	*/
 	
 	// New path creation using better catmullrom spline implementation
+	// Use the binary track file if there is one (see ConvertTrack), otherwise the built-in control points
+	m_pCatmullRom->SetLODDistance(400.0f);
+	m_pCatmullRom->LoadTrack("resources/tracks/circuit.trk");
 	m_pCatmullRom->CreateCentreline();
 	m_pCatmullRom->CreateOffsetCurves();
 	m_pCatmullRom->CreateTrack();
 
 }
 
-// Render method runs repeatedly in a loop
-void Game::Render() 
+// Render method runs repeatedly in a loop.  It takes everything that comes from the simulation from the snapshot, as the next 
+// frame's updates may be running on another thread
+void Game::Render(const RenderSnapshot &snapshot) 
 {
+	PROFILE_SCOPE(m_pProfiler, "Render");
+
 	// Clear the buffers and enable depth testing (z-buffering)
 	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
+	CGLState::Enable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS);
 
 	//glDisable(GL_CULL_FACE);
-	glEnable(GL_CULL_FACE);
+	CGLState::Enable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
 	glFrontFace(GL_CCW);
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -197,115 +291,136 @@ void Game::Render()
 	glutil::MatrixStack modelViewMatrixStack;
 	modelViewMatrixStack.SetIdentity();
 
-	// Use the main shader program 
+	// Use each variant of the main shader program, and set the uniforms that are the same for the whole frame.  The render queue
+	// picks the variant for each material
 	CShaderProgram *pMainProgram = (*m_pShaderPrograms)[0];
-	pMainProgram->UseProgram();
-	pMainProgram->SetUniform("bUseTexture", true);
-	pMainProgram->SetUniform("sampler0", 0);
 	// Note: cubemap and non-cubemap textures should not be mixed in the same texture unit.  Setting unit 10 to be a cubemap texture.
 	int cubeMapTextureUnit = 10; 
-	pMainProgram->SetUniform("CubeMapTex", cubeMapTextureUnit);
+	for (unsigned int features = 0; features < NUM_SHADER_VARIANTS; features++) {
+		CShaderProgram *pVariant = pMainProgram->FindVariant(features);
+		if (pVariant == NULL)
+			continue;
+		pVariant->UseProgram();
+		pVariant->SetUniform("sampler0", 0);
+		pVariant->SetUniform("CubeMapTex", cubeMapTextureUnit);
+	}
 	
 
-	// Set the projection matrix
-	pMainProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+	// Set the projection and view matrices, for every program
+	FrameUniforms frame;
+	frame.projMatrix = snapshot.projectionMatrix;
+	frame.viewMatrix = snapshot.viewMatrix;
+	m_pFrameUniforms->SetBlock(0, &frame);
+	m_pFrameUniforms->Upload(1);
+	m_pFrameUniforms->Bind(UNIFORM_BLOCK_FRAME, 0);
 
-	// Call LookAt to create the view matrix and put this on the modelViewMatrix stack. 
-	// Store the view matrix and the normal matrix associated with the view matrix for later (they're useful for lighting -- since lighting is done in eye coordinates)
-	modelViewMatrixStack.LookAt(m_pCamera->GetPosition(), m_pCamera->GetView(), m_pCamera->GetUpVector());
-	glm::mat4 viewMatrix = modelViewMatrixStack.Top();
-	glm::mat3 viewNormalMatrix = m_pCamera->ComputeNormalMatrix(viewMatrix);
+	// Put the view matrix on the modelViewMatrix stack
+	modelViewMatrixStack *= snapshot.viewMatrix;
 
 	
-	// Set light and materials in main shader program
-	glm::vec4 lightPosition1 = glm::vec4(-100, 100, -100, 1); // Position of light source *in world coordinates*
-	pMainProgram->SetUniform("light1.position", viewMatrix*lightPosition1); // Position of light source *in eye coordinates*
-	pMainProgram->SetUniform("light1.La", glm::vec3(1.0f));		// Ambient colour of light
-	pMainProgram->SetUniform("light1.Ld", glm::vec3(1.0f));		// Diffuse colour of light
-	pMainProgram->SetUniform("light1.Ls", glm::vec3(1.0f));		// Specular colour of light
-	pMainProgram->SetUniform("material1.Ma", glm::vec3(1.0f));	// Ambient material reflectance
-	pMainProgram->SetUniform("material1.Md", glm::vec3(0.0f));	// Diffuse material reflectance
-	pMainProgram->SetUniform("material1.Ms", glm::vec3(0.0f));	// Specular material reflectance
-	pMainProgram->SetUniform("material1.shininess", 15.0f);		// Shininess material property
+	// Set the light, for every program.  Materials are set by the render queue
+	LightUniforms light = LightUniforms();
+	light.position = snapshot.lightPosition;	// Position of light source *in eye coordinates*
+	light.La = glm::vec3(1.0f);					// Ambient colour of light
+	light.Ld = glm::vec3(1.0f);					// Diffuse colour of light
+	light.Ls = glm::vec3(1.0f);					// Specular colour of light
+	m_pLightUniforms->SetBlock(0, &light);
+	m_pLightUniforms->Upload(1);
+	m_pLightUniforms->Bind(UNIFORM_BLOCK_LIGHTS, 0);
 		
 
-	// Render the skybox and terrain with full ambient reflectance 
+	// Submit the objects to the render queue, which draws them sorted by state.  Each object's submission is timed, and then each pass
+	// as it's drawn, so the profiler shows the CPU cost of both and the GPU cost of each pass
+	{
+	PROFILE_SCOPE(m_pProfiler, "Submit");
+	DrawPacket packet;
+	packet.pProgram = pMainProgram;
+
+	// The skybox and terrain with full ambient reflectance 
+	{
+	PROFILE_SCOPE(m_pProfiler, "Skybox");
 	modelViewMatrixStack.Push();
-		pMainProgram->SetUniform("renderSkybox", true);
 		// Translate the modelview matrix to the camera eye point so skybox stays centred around camera
-		glm::vec3 vEye = m_pCamera->GetPosition();
-		modelViewMatrixStack.Translate(vEye);
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-		m_pSkybox->Render(cubeMapTextureUnit);
-		pMainProgram->SetUniform("renderSkybox", false);
+		modelViewMatrixStack.Translate(snapshot.cameraPosition);
+		packet.material = m_skyboxMaterial;
+		packet.modelViewMatrix = modelViewMatrixStack.Top();
+		packet.normalMatrix = m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top());
+		m_pSkybox->Submit(*m_pRenderQueue, packet, cubeMapTextureUnit);
 	modelViewMatrixStack.Pop();
+	}
 
-	// Render the planar terrain
+	{
+	PROFILE_SCOPE(m_pProfiler, "Terrain");
 	modelViewMatrixStack.Push();
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-		m_pPlanarTerrain->Render();
+		packet.material = m_terrainMaterial;
+		packet.modelViewMatrix = modelViewMatrixStack.Top();
+		packet.normalMatrix = m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top());
+		m_pPlanarTerrain->Submit(*m_pRenderQueue, packet);
 	modelViewMatrixStack.Pop();
+	}
 
+	// The spline path, with diffuse + specular materials.  Only the chunks of the track the camera can see are drawn
+	{
+	PROFILE_SCOPE(m_pProfiler, "Track");
+	CFrustum frustum;
+	frustum.Set(snapshot.projectionMatrix * snapshot.viewMatrix);
+	m_pCatmullRom->CullChunks(frustum, snapshot.cameraPosition);
 
-	// Turn on diffuse + specular materials
-	pMainProgram->SetUniform("material1.Ma", glm::vec3(0.5f));	// Ambient material reflectance
-	pMainProgram->SetUniform("material1.Md", glm::vec3(0.5f));	// Diffuse material reflectance
-	pMainProgram->SetUniform("material1.Ms", glm::vec3(1.0f));	// Specular material reflectance	
-
-	// Render spline path
 	modelViewMatrixStack.Push();
-		pMainProgram->SetUniform("bUseTexture", false);
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
+		packet.material = m_trackMaterial;
+		packet.modelViewMatrix = modelViewMatrixStack.Top();
+		packet.normalMatrix = m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top());
+		m_pCatmullRom->SubmitCentreline(*m_pRenderQueue, packet);
+		m_pCatmullRom->SubmitOffsetCurves(*m_pRenderQueue, packet);
+		m_pCatmullRom->SubmitTrack(*m_pRenderQueue, packet);
 	modelViewMatrixStack.Pop();
+	}
+	}
 
-	m_pCatmullRom->RenderCentreline();
-	m_pCatmullRom->RenderOffsetCurves();
-	m_pCatmullRom->RenderTrack();
-
-
-	// Set up your transformation matrix for the cube
-	modelViewMatrixStack.Push();
-		// For example, translate the cube  to (x, y, z)
-		modelViewMatrixStack.Scale(5.0f);
-		modelViewMatrixStack.Translate(glm::vec3(0.0f, 10.0f, 0.0f));
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-
-		// Bind the cube VAO and render it
-		//glBindVertexArray(cubeVAO);
-		//glDrawArrays(GL_TRIANGLES, 0, 36); // 36 vertices cube
-		//glBindVertexArray(0);
-	modelViewMatrixStack.Pop();
+	{
+	PROFILE_SCOPE(m_pProfiler, "Draw");
+	m_pRenderQueue->Execute(m_pProfiler);
+	}
 
 	// Draw the 2D graphics after the 3D graphics
+	{
+	PROFILE_SCOPE(m_pProfiler, "Text");
 	DisplayFrameRate();
+	}
+
+	if (m_pFrameRecorder != NULL)
+		m_pFrameRecorder->EndRendering();
 
 	// Swap buffers to show the rendered image
-	SwapBuffers(m_gameWindow.Hdc());		
+	m_pGameWindow->SwapBuffers();		
 
 }
 
 // Update method runs repeatedly with the Render method
 void Game::Update() 
 {
+	PROFILE_SCOPE(m_pUpdateProfiler, "Update");
+
 	//m_pCamera->Set(glm::vec3(0, 500, 0.1), glm::vec3(0, 0, 0), m_pCamera->GetUpVector());
 	// Update the camera using the amount of time that has elapsed to avoid framerate dependent motion
-	m_pCamera->Update(m_dt);
+	if (m_pFrameRecorder == NULL) {
+		PROFILE_SCOPE(m_pUpdateProfiler, "Camera");
+		m_pCamera->Update(m_dt);
+	}
 
 	m_currentDistance += m_dt * m_cameraSpeed;
 	glm::vec3 p;
-	glm::vec3 pNext;
 
-	// Calling these transfoms given point into interpolation along sampled distance
-	m_pCatmullRom->Sample(m_currentDistance, p);
-	m_pCatmullRom->Sample(m_currentDistance + 1.0f, pNext);
+	// Look up the point and its TNB frame (tangent, normal, binormal) in the track's frame table
+	glm::vec3 T, N, B;
+	{
+	PROFILE_SCOPE(m_pUpdateProfiler, "Track");
+	m_pCatmullRom->SampleFrame(m_currentDistance, p, T, N, B);
+	}
 
-	glm::vec3 T = glm::normalize(pNext - p); // Tangent 
-	glm::vec3 N = glm::normalize(glm::cross(T, glm::vec3(0, 1, 0))); // Normal
-	glm::vec3 B = glm::normalize(glm::cross(N, T)); // Binormal
+	// The benchmark rides the camera just above the track, looking ahead along it
+	if (m_pFrameRecorder != NULL)
+		m_pCamera->Set(p + 5.0f * B, p + 5.0f * B + 10.0f * T, B);
 
 	//m_pCamera->Set(p, glm::vec3(0, 10, 0), glm::vec3(0, 1, 0));
 	//m_pCamera->Set(p+glm::vec3(0, 5.0f, 0), p + 10.0f * T, B);
@@ -332,6 +447,14 @@ void Game::Update()
 	*/	
 
 	//m_pAudio->Update();
+
+	// Stand in for a heavier simulation (see SetUpdateCost)
+	if (m_updateCost > 0.0) {
+		CHighResolutionTimer timer;
+		timer.Start();
+		while (timer.Elapsed() < m_updateCost)
+			;
+	}
 }
 
 
@@ -342,11 +465,11 @@ void Game::DisplayFrameRate()
 
 	CShaderProgram *fontProgram = (*m_pShaderPrograms)[1];
 
-	RECT dimensions = m_gameWindow.GetDimensions();
+	RECT dimensions = m_pGameWindow->GetDimensions();
 	int height = dimensions.bottom - dimensions.top;
 
 	// Increase the elapsed time and frame counter
-	m_elapsedTime += m_dt;
+	m_elapsedTime += m_frameTime;
 	m_frameCount++;
 
 	// Now we want to subtract the current time by the last time that was stored
@@ -363,70 +486,195 @@ void Game::DisplayFrameRate()
 	if (m_framesPerSecond > 0) {
 		// Use the font shader program and render the text
 		fontProgram->UseProgram();
-		glDisable(GL_DEPTH_TEST);
+		CGLState::Disable(GL_DEPTH_TEST);
 		fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
 		fontProgram->SetUniform("matrices.projMatrix", m_pCamera->GetOrthographicProjectionMatrix());
 		fontProgram->SetUniform("vColour", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
 		m_pFtFont->Render(20, height - 20, 20, "FPS: %d", m_framesPerSecond);
+
+#ifdef USE_PROFILER
+		// State changes the GL state cache passed on and skipped last frame, then scope, CPU ms, GPU ms, and the times as bars
+		if (m_showProfiler) {
+			m_pFtFont->Render(20, height - 40, 14, "GL calls: %d issued, %d elided", CGLState::GetIssuedCalls(), CGLState::GetElidedCalls());
+			m_pProfiler->Render(m_pFtFont, fontProgram, 20, height - 46);
+		}
+#endif
 	}
 }
 
-// The game loop runs repeatedly until game over
-void Game::GameLoop()
+// Run a frame's updates and write what Render needs into a snapshot, with the camera part way between the last two updates.  Runs
+// on the update thread when pipelined, so it mustn't use OpenGL
+void Game::UpdateFrame(int iNumUpdates, float fInterpolation, RenderSnapshot &snapshot)
 {
-	/*
-	// Fixed timer
-	dDt = pHighResolutionTimer->Elapsed();
-	if (dDt > 1000.0 / (double) Game::FPS) {
-		pHighResolutionTimer->Start();
+	for (int i = 0; i < iNumUpdates; i++) {
+		m_previousCamera = m_currentCamera;
 		Update();
-		Render();
+		m_currentCamera.position = m_pCamera->GetPosition();
+		m_currentCamera.view = m_pCamera->GetView();
+		m_currentCamera.upVector = m_pCamera->GetUpVector();
 	}
-	*/
-	
-	// Variable timer
-	m_pHighResolutionTimer->Start();
-	Update();
-	Render();
-	m_dt = m_pHighResolutionTimer->Elapsed();
+
+	snapshot.cameraPosition = glm::mix(m_previousCamera.position, m_currentCamera.position, fInterpolation);
+	snapshot.cameraView = glm::mix(m_previousCamera.view, m_currentCamera.view, fInterpolation);
+	snapshot.cameraUpVector = glm::normalize(glm::mix(m_previousCamera.upVector, m_currentCamera.upVector, fInterpolation));
+	snapshot.projectionMatrix = *m_pCamera->GetPerspectiveProjectionMatrix();
+	snapshot.viewMatrix = glm::lookAt(snapshot.cameraPosition, snapshot.cameraView, snapshot.cameraUpVector);
+
+	glm::vec4 lightPosition1 = glm::vec4(-100, 100, -100, 1); // Position of light source *in world coordinates*
+	snapshot.lightPosition = snapshot.viewMatrix * lightPosition1;
+}
+
+// The game loop runs repeatedly until game over.  Update runs at a fixed rate, as many times as the time since the last frame covers,
+// and the frame is drawn with the camera part way between the last two updates, by how far into the next update the time left
+// over is.  Motion is then smooth whatever the frame rate, and the simulation doesn't depend on it.  When pipelined, the updates
+// for the next frame run on the update thread while this frame is drawn from the snapshot the previous frame's updates left, so
+// the simulation's cost overlaps the drawing instead of adding to it, for one frame more latency.  The worker is always finished
+// when this returns, so the window's messages are handled with the simulation at rest
+void Game::GameLoop()
+{
+#ifdef USE_PROFILER
+	m_pProfiler->BeginFrame();
+#endif
+	CGLState::BeginFrame();
+	CShaderReloader::Update();
+
+	int iNumUpdates = 1;
+	float fInterpolation = 1.0f;
+	if (m_pFrameRecorder != NULL) {
+		// The benchmark does exactly one update per frame, so every run renders the same frames
+		m_pFrameRecorder->BeginFrame();
+		m_frameTime = m_dt;
+	} else {
+		m_frameTime = m_pHighResolutionTimer->Elapsed();
+		m_pHighResolutionTimer->Start();
+		m_accumulator += m_frameTime < MAX_FRAME_TIME ? m_frameTime : MAX_FRAME_TIME;
+		iNumUpdates = (int) (m_accumulator / m_dt);
+		m_accumulator -= iNumUpdates * m_dt;
+		fInterpolation = (float) (m_accumulator / m_dt);
+	}
+
+	if (m_pUpdateThread != NULL) {
+		m_pUpdateThread->Start(iNumUpdates, fInterpolation);
+		Render(m_snapshots[m_renderSnapshot]);
+		{
+		PROFILE_SCOPE(m_pProfiler, "Wait for update");
+		m_pUpdateThread->Finish();
+		}
+#ifdef USE_PROFILER
+		m_pProfiler->MergeCPUTimes(*m_pUpdateProfiler);
+#endif
+		m_renderSnapshot = 1 - m_renderSnapshot;
+	} else {
+		UpdateFrame(iNumUpdates, fInterpolation, m_snapshots[m_renderSnapshot]);
+		Render(m_snapshots[m_renderSnapshot]);
+	}
+
+	if (m_pFrameRecorder != NULL)
+		m_pFrameRecorder->EndFrame();
+	else
+		m_pFrameLimiter->Wait(m_appActive ? m_targetFrameRate : BACKGROUND_FPS);
+
+#ifdef USE_PROFILER
+	m_pProfiler->EndFrame();
+#endif
 }
 
 
-WPARAM Game::Execute() 
+int Game::Execute() 
 {
 	m_pHighResolutionTimer = new CHighResolutionTimer;
-	m_gameWindow.Init(m_hInstance);
-
-	if(!m_gameWindow.Hdc()) {
+	if (!m_pGameWindow->Init()) {
+		m_pGameWindow->Deinit();
 		return 1;
 	}
 
+	CHighResolutionTimer startupTimer;
+	startupTimer.Start();
 	Initialise();
+	m_startupTime = startupTimer.Elapsed();
+
+	char sStartup[256];
+	if (CProgramCache::IsEnabled())
+		sprintf_s(sStartup, "Started in %.1f ms, %.1f ms of it on shaders (%d programs from the cache, %d built)\n", m_startupTime, 
+			m_shaderSetupTime, CProgramCache::GetHits(), CProgramCache::GetMisses());
+	else
+		sprintf_s(sStartup, "Started in %.1f ms, %.1f ms of it on shaders (program cache off)\n", m_startupTime, m_shaderSetupTime);
+	OutputDebugString(sStartup);
+
+	m_pFrameLimiter = new CFrameLimiter;
+	m_currentCamera.position = m_pCamera->GetPosition();
+	m_currentCamera.view = m_pCamera->GetView();
+	m_currentCamera.upVector = m_pCamera->GetUpVector();
+	m_previousCamera = m_currentCamera;
+
+	// The first frame draws the starting position.  After that, the worker writes whichever snapshot Render isn't reading
+	UpdateFrame(0, 1.0f, m_snapshots[m_renderSnapshot]);
+	m_pUpdateProfiler = m_pProfiler;
+	if (m_pipelined) {
+		m_pUpdateThread = new CUpdateThread;
+		m_pUpdateThread->Create([this](int iNumUpdates, float fInterpolation) {
+			UpdateFrame(iNumUpdates, fInterpolation, m_snapshots[1 - m_renderSnapshot]);
+		});
+#ifdef USE_PROFILER
+		// The worker can't use the main profiler, which makes GL calls, so it has its own, and GameLoop merges its times each frame
+		m_pUpdateProfiler = new CProfiler;
+#endif
+	}
+
+	if (m_benchmarkFrames > 0) {
+		m_pFrameRecorder = new CFrameRecorder;
+		m_pFrameRecorder->Create(m_benchmarkFrames);
+		m_showProfiler = false;	// Its times would differ from run to run
+		m_currentDistance = 0.0f;
+		m_cameraSpeed = m_pCatmullRom->GetLength() / (float) (m_benchmarkFrames * m_dt);
+	}
 
 	m_pHighResolutionTimer->Start();
 
-	
-	MSG msg;
+	int exitCode = 0;
+	while (m_pGameWindow->ProcessMessages(exitCode)) {
+		if (m_pFrameRecorder != NULL && m_pFrameRecorder->GetFrameCount() == m_benchmarkFrames)
+			break;
+		GameLoop(); // Throttled to BACKGROUND_FPS if the application isn't active, unless benchmarking
+	}
 
-	while(1) {													
-		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) { 
-			if(msg.message == WM_QUIT) {
-				break;
-			}
-
-			TranslateMessage(&msg);	
-			DispatchMessage(&msg);
-		} else if (m_appActive) {
-			GameLoop();
-		} 
-		else Sleep(200); // Do not consume processor power if application isn't active
+	if (m_pFrameRecorder != NULL) {
+		RECT dimensions = m_pGameWindow->GetDimensions();
+		m_pFrameRecorder->AddInfo("renderer", (const char *) glGetString(GL_RENDERER));
+		m_pFrameRecorder->AddInfo("gl_version", (const char *) glGetString(GL_VERSION));
+		m_pFrameRecorder->AddInfo("width", (double) (dimensions.right - dimensions.left));
+		m_pFrameRecorder->AddInfo("height", (double) (dimensions.bottom - dimensions.top));
+		m_pFrameRecorder->AddInfo("dt_ms", m_dt);
+		m_pFrameRecorder->AddInfo("pipelined", m_pipelined ? 1.0 : 0.0);
+		m_pFrameRecorder->AddInfo("update_cost_ms", m_updateCost);
+		m_pFrameRecorder->AddInfo("startup_ms", m_startupTime);
+		m_pFrameRecorder->AddInfo("shader_setup_ms", m_shaderSetupTime);
+		m_pFrameRecorder->AddInfo("program_cache_hits", (double) CProgramCache::GetHits());
+		m_pFrameRecorder->AddInfo("program_cache_misses", (double) CProgramCache::GetMisses());
+		m_pFrameRecorder->AddInfo("program_cache_rejections", (double) CProgramCache::GetRejections());
+		const RenderQueueStats &stats = m_pRenderQueue->GetStats();
+		m_pFrameRecorder->AddInfo("draw_packets", (double) stats.packets);
+		m_pFrameRecorder->AddInfo("state_changes", (double) (stats.programChanges + stats.materialChanges + stats.textureChanges + 
+			stats.vaoChanges + stats.stateChanges));
+		m_pFrameRecorder->AddInfo("gl_calls_issued", (double) CGLState::GetIssuedCalls());
+		m_pFrameRecorder->AddInfo("gl_calls_elided", (double) CGLState::GetElidedCalls());
+		if (!m_pFrameRecorder->WriteReport(m_benchmarkFile))
+			exitCode = 1;
+		m_pFrameRecorder->Release();
 	}
+	if (m_pUpdateThread != NULL)
+		m_pUpdateThread->Release();
+	m_pCatmullRom->Release();
+#ifdef USE_PROFILER
+	m_pProfiler->Release();
+#endif
 
-	m_gameWindow.Deinit();
+	m_pGameWindow->Deinit();
 
-	return(msg.wParam);
+	return exitCode;
 }
 
+#ifdef _WIN32
 LRESULT Game::ProcessEvents(HWND window,UINT message, WPARAM w_param, LPARAM l_param) 
 {
 	LRESULT result = 0;
@@ -453,7 +701,7 @@ LRESULT Game::ProcessEvents(HWND window,UINT message, WPARAM w_param, LPARAM l_p
 	case WM_SIZE:
 			RECT dimensions;
 			GetClientRect(window, &dimensions);
-			m_gameWindow.SetDimensions(dimensions);
+			m_pGameWindow->SetDimensions(dimensions);
 		break;
 
 	case WM_PAINT:
@@ -481,6 +729,9 @@ LRESULT Game::ProcessEvents(HWND window,UINT message, WPARAM w_param, LPARAM l_p
 		case VK_F1:
 			m_pAudio->PlayEventSound();
 			break;
+		case VK_F2:
+			m_showProfiler = !m_showProfiler;
+			break;
 		}
 		break;
 
@@ -496,6 +747,8 @@ LRESULT Game::ProcessEvents(HWND window,UINT message, WPARAM w_param, LPARAM l_p
 	return result;
 }
 
+#endif
+
 Game& Game::GetInstance() 
 {
 	static Game instance;
@@ -503,11 +756,122 @@ Game& Game::GetInstance()
 	return instance;
 }
 
-void Game::SetHinstance(HINSTANCE hinstance) 
+void Game::SetGameWindow(GameWindow *pGameWindow) 
+{
+	m_pGameWindow = pGameWindow;
+}
+
+void Game::SetBenchmark(int iNumFrames, string reportFile) 
+{
+	m_benchmarkFrames = iNumFrames;
+	m_benchmarkFile = reportFile;
+}
+
+void Game::SetFrameRate(int iFrameRate) 
+{
+	m_targetFrameRate = iFrameRate;
+}
+
+void Game::SetPipelined(bool bPipelined) 
+{
+	m_pipelined = bPipelined;
+}
+
+void Game::SetUpdateCost(double dCost) 
+{
+	m_updateCost = dCost;
+}
+
+void Game::SetShaderCache(bool bShaderCache) 
+{
+	m_shaderCache = bShaderCache;
+}
+
+void Game::SetShaderReload(bool bShaderReload) 
+{
+	m_shaderReload = bShaderReload;
+}
+
+// Command line options, the same for both builds, with one dash or two:
+//   -benchmark report.json   render a fixed number of frames with a fixed time step and the camera riding one lap of the track, and
+//                            write frame time statistics to report.json (see CFrameRecorder)
+//   -frames 600              the number of frames to render: the benchmark's length, or when to quit headless (default: run on)
+//   -fps 144                 frame rate to hold to (default 60); 0 runs as fast as possible.  Updates stay at 60 a second
+//   -screenshot frame.ppm    headless only: write the last frame to frame.ppm
+//   -pipeline off            run the updates on the main thread, before drawing each frame (default on: on a worker, alongside it)
+//   -updatecost 10           spend 10 ms more in each update, to see what pipelining saves with a heavy simulation, e.g.
+//                              -benchmark on.json -updatecost 10    against    -benchmark off.json -updatecost 10 -pipeline off
+//   -shadercache off         build every shader program from source (default on: load them from resources/shadercache/ when they
+//                            haven't changed, see CProgramCache).  Delete the directory to time a cold start
+//   -shaderreload off        don't watch resources/shaders/ (default on: programs are rebuilt when their files are saved, see
+//                            CShaderReloader)
+//   -converttrack controlpoints.txt circuit.trk    build a binary track file and exit
+static const char *USAGE = "[-benchmark report.json] [-frames N] [-fps N] [-screenshot file.ppm] [-pipeline on|off] [-updatecost ms] [-shadercache on|off] [-shaderreload on|off] | -converttrack controlpoints.txt track.trk";
+static const int BENCHMARK_FRAMES = 1000;
+
+struct GameOptions
 {
-	m_hInstance = hinstance;
+	GameOptions() : iNumFrames(0), iFrameRate(-1), bPipelined(true), bShaderCache(true), bShaderReload(true), dUpdateCost(0.0) {}
+
+	int iNumFrames;
+	int iFrameRate;
+	bool bPipelined;
+	bool bShaderCache;
+	bool bShaderReload;
+	double dUpdateCost;
+	string benchmarkFile;
+	string screenshotFile;
+};
+
+static bool IsOption(const char *arg, const char *name)
+{
+	if (arg[0] != '-')
+		return false;
+	if (arg[1] == '-')
+		arg++;
+	return _stricmp(arg + 1, name) == 0;
+}
+
+static bool ParseOptions(int argc, char **argv, GameOptions &options)
+{
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc)
+			return false;
+		if (IsOption(argv[i], "benchmark"))
+			options.benchmarkFile = argv[++i];
+		else if (IsOption(argv[i], "frames"))
+			options.iNumFrames = atoi(argv[++i]);
+		else if (IsOption(argv[i], "fps"))
+			options.iFrameRate = atoi(argv[++i]);
+		else if (IsOption(argv[i], "screenshot"))
+			options.screenshotFile = argv[++i];
+		else if (IsOption(argv[i], "pipeline")) {
+			i++;
+			if (_stricmp(argv[i], "on") != 0 && _stricmp(argv[i], "off") != 0)
+				return false;
+			options.bPipelined = _stricmp(argv[i], "on") == 0;
+		}
+		else if (IsOption(argv[i], "updatecost"))
+			options.dUpdateCost = atof(argv[++i]);
+		else if (IsOption(argv[i], "shadercache")) {
+			i++;
+			if (_stricmp(argv[i], "on") != 0 && _stricmp(argv[i], "off") != 0)
+				return false;
+			options.bShaderCache = _stricmp(argv[i], "on") == 0;
+		}
+		else if (IsOption(argv[i], "shaderreload")) {
+			i++;
+			if (_stricmp(argv[i], "on") != 0 && _stricmp(argv[i], "off") != 0)
+				return false;
+			options.bShaderReload = _stricmp(argv[i], "on") == 0;
+		}
+		else
+			return false;
+	}
+	return true;
 }
 
+#ifdef _WIN32
 LRESULT CALLBACK WinProc(HWND window, UINT message, WPARAM w_param, LPARAM l_param)
 {
 	return Game::GetInstance().ProcessEvents(window, message, w_param, l_param);
@@ -515,8 +879,59 @@ LRESULT CALLBACK WinProc(HWND window, UINT message, WPARAM w_param, LPARAM l_par
 
 int WINAPI WinMain(HINSTANCE hinstance, HINSTANCE, PSTR, int) 
 {
+	if (__argc == 4 && IsOption(__argv[1], "converttrack"))
+		return CCatmullRom::ConvertTrack(__argv[2], __argv[3]) ? 0 : 1;
+
+	GameOptions options;
+	if (!ParseOptions(__argc, __argv, options)) {
+		MessageBox(NULL, USAGE, "Usage", MB_ICONINFORMATION);
+		return 1;
+	}
+
+	Win32Window window(hinstance);
 	Game &game = Game::GetInstance();
-	game.SetHinstance(hinstance);
+	game.SetGameWindow(&window);
+	if (options.iFrameRate >= 0)
+		game.SetFrameRate(options.iFrameRate);
+	game.SetPipelined(options.bPipelined);
+	game.SetUpdateCost(options.dUpdateCost);
+	game.SetShaderCache(options.bShaderCache);
+	game.SetShaderReload(options.bShaderReload);
+	if (options.benchmarkFile != "")
+		game.SetBenchmark(options.iNumFrames > 0 ? options.iNumFrames : BENCHMARK_FRAMES, options.benchmarkFile);
+
+	return game.Execute();
+}
+#else
+// Without Windows the game renders offscreen (see HeadlessWindow)
+int main(int argc, char **argv)
+{
+	if (argc == 4 && IsOption(argv[1], "converttrack"))
+		return CCatmullRom::ConvertTrack(argv[2], argv[3]) ? 0 : 1;
+
+	GameOptions options;
+	if (!ParseOptions(argc, argv, options)) {
+		fprintf(stderr, "Usage: %s %s\n", argv[0], USAGE);
+		return 1;
+	}
+
+	int iNumFrames = options.iNumFrames;
+	if (options.benchmarkFile != "" && iNumFrames <= 0)
+		iNumFrames = BENCHMARK_FRAMES;
 
-	return int(game.Execute());
+	HeadlessWindow window(iNumFrames);
+	window.SetScreenshotFile(options.screenshotFile);
+	Game &game = Game::GetInstance();
+	game.SetGameWindow(&window);
+	if (options.iFrameRate >= 0)
+		game.SetFrameRate(options.iFrameRate);
+	game.SetPipelined(options.bPipelined);
+	game.SetUpdateCost(options.dUpdateCost);
+	game.SetShaderCache(options.bShaderCache);
+	game.SetShaderReload(options.bShaderReload);
+	if (options.benchmarkFile != "")
+		game.SetBenchmark(iNumFrames, options.benchmarkFile);
+
+	return game.Execute();
 }
+#endif
@@ -17,13 +17,28 @@ class CHighResolutionTimer;
 class CSphere;
 class COpenAssetImportMesh;
 class CAudio;
+class CFrameRecorder;
+class CProfiler;
+class CFrameLimiter;
+class CUpdateThread;
+class CRenderQueue;
+class CUniformBuffer;
+
+// Everything Render needs from the simulation for one frame, written after the frame's updates and not changed while it is drawn
+struct RenderSnapshot
+{
+	glm::vec3 cameraPosition, cameraView, cameraUpVector;	// Interpolated between the last two updates
+	glm::mat4 projectionMatrix;
+	glm::mat4 viewMatrix;
+	glm::vec4 lightPosition;		// In eye coordinates
+};
 
 class Game {
 private:
 	// Three main methods used in the game.  Initialise runs once, while Update and Render run repeatedly in the game loop.
 	void Initialise();
 	void Update();
-	void Render();
+	void Render(const RenderSnapshot &snapshot);
 
 	// Pointers to game objects.  They will get allocated in Game::Initialise()
 	CSkybox *m_pSkybox;
@@ -37,11 +52,41 @@ private:
 	CHighResolutionTimer *m_pHighResolutionTimer;
 	CAudio *m_pAudio;
 	CCatmullRom *m_pCatmullRom;
+	CFrameRecorder *m_pFrameRecorder;
+	CProfiler *m_pProfiler;		// Only in builds with USE_PROFILER (see Profiler.h)
+	CFrameLimiter *m_pFrameLimiter;
+	CUpdateThread *m_pUpdateThread;	// NULL if updates run on the main thread
+	CRenderQueue *m_pRenderQueue;
+	CUniformBuffer *m_pFrameUniforms;	// FrameBlock
+	CUniformBuffer *m_pLightUniforms;	// LightBlock
+	CProfiler *m_pUpdateProfiler;	// m_pProfiler, or when Update runs on the worker, a CPU only profiler of its own
+
+	// The camera as it was before and after the last update, for drawing it in between
+	struct CameraState
+	{
+		glm::vec3 position, view, upVector;
+	};
+	CameraState m_previousCamera, m_currentCamera;
+
+	// Render draws one snapshot while the next frame's updates write the other (see CUpdateThread)
+	RenderSnapshot m_snapshots[2];
+	int m_renderSnapshot;
 
 	// Some other member variables
-	double m_dt;
+	double m_dt;			// The fixed update step (ms)
+	double m_accumulator;	// Time not yet simulated (ms)
+	double m_frameTime;		// How long the last frame took (ms)
+	int m_targetFrameRate;
 	int m_framesPerSecond;
 	bool m_appActive;
+	bool m_showProfiler;
+	bool m_pipelined;
+	bool m_shaderCache;
+	bool m_shaderReload;
+	int m_skyboxMaterial, m_terrainMaterial, m_trackMaterial;	// In the render queue
+	double m_updateCost;	// Extra busy time (ms) in each update
+	double m_startupTime;		// ms in Initialise
+	double m_shaderSetupTime;	// ms of it loading shaders and linking programs
 	float m_currentDistance;
 	float m_cameraSpeed;
 
@@ -50,16 +95,41 @@ public:
 	Game();
 	~Game();
 	static Game& GetInstance();
+#ifdef _WIN32
 	LRESULT ProcessEvents(HWND window,UINT message, WPARAM w_param, LPARAM l_param);
-	void SetHinstance(HINSTANCE hinstance);
-	WPARAM Execute();
+#endif
+	void SetGameWindow(GameWindow *pGameWindow);
+
+	// Benchmark mode: render iNumFrames frames with a fixed time step, riding the camera round one lap of the track instead of 
+	// reading the mouse and keyboard, and write the frame time statistics to reportFile
+	void SetBenchmark(int iNumFrames, string reportFile);
+
+	// Frames per second to render at when the window has the focus, 0 for as fast as possible
+	void SetFrameRate(int iFrameRate);
+
+	// Run the updates for the next frame on a worker thread while this frame is drawn (the default), or on the main thread before it
+	void SetPipelined(bool bPipelined);
+
+	// Spend dCost ms more in each update, busy, to stand in for a heavier simulation when benchmarking
+	void SetUpdateCost(double dCost);
+
+	// Load linked programs from the program cache, and cache the ones built (the default), or build every one from source
+	void SetShaderCache(bool bShaderCache);
+
+	// Rebuild shader programs when their files are saved (the default), or leave them as they were built at startup
+	void SetShaderReload(bool bShaderReload);
+	int Execute();
 
 private:
-	static const int FPS = 60;
+	static const int FPS = 60;				// Updates per second, and the default frame rate
+	static const int BACKGROUND_FPS = 10;	// Frame rate when the window doesn't have the focus
+	static const int MAX_FRAME_TIME = 250;	// Longest time (ms) simulated in one frame, so a stall doesn't snowball
 	void DisplayFrameRate();
 	void GameLoop();
-	GameWindow m_gameWindow;
-	HINSTANCE m_hInstance;
+	void UpdateFrame(int iNumUpdates, float fInterpolation, RenderSnapshot &snapshot);
+	GameWindow *m_pGameWindow;
+	int m_benchmarkFrames;
+	string m_benchmarkFile;
 	int m_frameCount;
 	double m_elapsedTime;
 
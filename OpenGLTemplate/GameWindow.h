@@ -3,52 +3,31 @@
 #include <windows.h>
 #include "Common.h"
 
-LRESULT CALLBACK WinProc(HWND hWnd,UINT uMsg, WPARAM wParam, LPARAM lParam);
-
+// The window (or offscreen surface) the game renders into, and the OpenGL context that goes with it.  Win32Window is a normal
+// desktop window; HeadlessWindow renders offscreen with no display, for benchmarks and automated tests on machines without one.
+// Init creates the context and makes it current, and ProcessMessages runs once per frame, returning false when the game should quit
 class GameWindow {
 public:
-	static GameWindow& GetInstance();
-	GameWindow();
+	GameWindow() {}
+	virtual ~GameWindow() {}
 
 	enum {
 		SCREEN_WIDTH = 800,
 		SCREEN_HEIGHT = 600,
 	};
 
-	HDC Init(HINSTANCE hinstance);
-	void Deinit();
+	virtual bool Init() = 0;
+	virtual void Deinit() = 0;
+	virtual bool ProcessMessages(int &exitCode) = 0;
+	virtual void SwapBuffers() = 0;
 
 	void SetDimensions(RECT dimensions) {m_dimensions = dimensions;}
 	RECT GetDimensions() {return m_dimensions;}
 
-	bool Fullscreen() const { return m_fullscreen; }
-
-	HDC Hdc() const { return m_hdc; }
-	HINSTANCE Hinstance() const { return m_hinstance; }
-	HGLRC Hrc() const { return m_hrc; }
-	HWND  Hwnd() const { return m_hwnd; }
+protected:
+	RECT  m_dimensions;
 
 private:
-	
 	GameWindow(const GameWindow&);
 	void operator=(const GameWindow&);
-
-	void CreateGameWindow(string title);
-	void InitOpenGL();
-	bool InitGLEW();
-	void RegisterSimpleOpenGLClass(HINSTANCE hInstance);
-
-	bool  m_fullscreen;
-
-	HDC   m_hdc;
-	HINSTANCE m_hinstance;
-	HGLRC m_hrc;
-	HWND  m_hwnd;
-
-	LPSTR m_class;
-	RECT  m_dimensions;
-
-	string m_appName;
-
 };
-
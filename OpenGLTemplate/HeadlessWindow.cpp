@@ -0,0 +1,199 @@
+#include "HeadlessWindow.h"
+
+HeadlessWindow::HeadlessWindow(int iNumFrames) : m_display(EGL_NO_DISPLAY), m_context(EGL_NO_CONTEXT), m_framebuffer(0), m_colourBuffer(0),
+	m_depthBuffer(0), m_numFrames(iNumFrames), m_frameCount(0)
+{
+	m_dimensions.left = 0;
+	m_dimensions.top = 0;
+	m_dimensions.right = SCREEN_WIDTH;
+	m_dimensions.bottom = SCREEN_HEIGHT;
+}
+
+// Find a display that can render without a window system
+EGLDisplay HeadlessWindow::GetDisplay()
+{
+	const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+	if (clientExtensions && eglGetPlatformDisplayEXT) {
+		if (strstr(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+			EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (display != EGL_NO_DISPLAY)
+				return display;
+		}
+
+		PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+		if (strstr(clientExtensions, "EGL_EXT_platform_device") && eglQueryDevicesEXT) {
+			EGLDeviceEXT device;
+			EGLint iNumDevices = 0;
+			if (eglQueryDevicesEXT(1, &device, &iNumDevices) && iNumDevices > 0) {
+				EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+				if (display != EGL_NO_DISPLAY)
+					return display;
+			}
+		}
+	}
+
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+// Create an OpenGL 4.0 core context with no surface, initialise GLEW, and bind the offscreen framebuffer
+bool HeadlessWindow::Init()
+{
+	int iMajorVersion = 4;
+	int iMinorVersion = 0;
+
+	m_display = GetDisplay();
+	if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, NULL, NULL)) {
+		MessageBox(NULL, "Couldn't open an EGL display", "Fatal Error", MB_ICONERROR);
+		return false;
+	}
+
+	const char *displayExtensions = eglQueryString(m_display, EGL_EXTENSIONS);
+	if (!displayExtensions || !strstr(displayExtensions, "EGL_KHR_surfaceless_context")) {
+		MessageBox(NULL, "The EGL display can't make a context current without a surface (EGL_KHR_surfaceless_context)", "Fatal Error", MB_ICONERROR);
+		return false;
+	}
+
+	// Any config that can do desktop OpenGL will do, since all drawing goes to the framebuffer object
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	if (!strstr(displayExtensions, "EGL_KHR_no_config_context")) {
+		const EGLint iConfigAttribList[] =
+		{
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_NONE
+		};
+		EGLint iNumConfigs = 0;
+		if (!eglChooseConfig(m_display, iConfigAttribList, &config, 1, &iNumConfigs) || iNumConfigs == 0) {
+			MessageBox(NULL, "The EGL display has no OpenGL configs", "Fatal Error", MB_ICONERROR);
+			return false;
+		}
+	}
+
+	const EGLint iContextAttribs[] =
+	{
+		EGL_CONTEXT_MAJOR_VERSION, iMajorVersion,
+		EGL_CONTEXT_MINOR_VERSION, iMinorVersion,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	if (eglBindAPI(EGL_OPENGL_API))
+		m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, iContextAttribs);
+	if (m_context == EGL_NO_CONTEXT || !eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context)) {
+		char sErrorMessage[255];
+		sprintf_s(sErrorMessage, "OpenGL %d.%d is not supported by the EGL display (error 0x%x)", iMajorVersion, iMinorVersion, eglGetError());
+		MessageBox(NULL, sErrorMessage, "Fatal Error", MB_ICONERROR);
+		return false;
+	}
+
+	// A GLX build of GLEW looks for an X display as well as the context, and reports that it's missing, but the GL entry points it
+	// loads are the same.  A core profile context also needs glewExperimental, since glGetString(GL_EXTENSIONS) isn't available
+	glewExperimental = GL_TRUE;
+	GLenum glewResult = glewInit();
+	if (glewResult != GLEW_OK && glewResult != GLEW_ERROR_NO_GLX_DISPLAY) {
+		MessageBox(NULL, "Couldn't initialize GLEW!", "Fatal Error", MB_ICONERROR);
+		return false;
+	}
+	glGetError();
+
+	if (!CreateFramebuffer())
+		return false;
+
+	// Park the cursor in the middle of the screen, so the camera doesn't see any mouse movement
+	SetCursorPos(SCREEN_WIDTH >> 1, SCREEN_HEIGHT >> 1);
+
+	return true;
+}
+
+// Create the colour and depth buffers the game renders into, and leave them bound
+bool HeadlessWindow::CreateFramebuffer()
+{
+	int width = m_dimensions.right - m_dimensions.left;
+	int height = m_dimensions.bottom - m_dimensions.top;
+
+	glGenRenderbuffers(1, &m_colourBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, m_colourBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &m_depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+	glGenFramebuffers(1, &m_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colourBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		MessageBox(NULL, "Couldn't create the offscreen framebuffer", "Fatal Error", MB_ICONERROR);
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+// Write the screenshot if one was asked for, and destroy the framebuffer and context
+void HeadlessWindow::Deinit()
+{
+	if (m_context != EGL_NO_CONTEXT) {
+		if (m_screenshotFile != "" && m_frameCount > 0)
+			SaveScreenshot(m_screenshotFile);
+
+		glDeleteFramebuffers(1, &m_framebuffer);
+		glDeleteRenderbuffers(1, &m_colourBuffer);
+		glDeleteRenderbuffers(1, &m_depthBuffer);
+
+		eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(m_display, m_context);
+		m_context = EGL_NO_CONTEXT;
+	}
+
+	if (m_display != EGL_NO_DISPLAY) {
+		eglTerminate(m_display);
+		m_display = EGL_NO_DISPLAY;
+	}
+}
+
+// There are no messages; the window quits once it has shown its frames (or never, if the number of frames is 0)
+bool HeadlessWindow::ProcessMessages(int &exitCode)
+{
+	exitCode = 0;
+	return m_numFrames <= 0 || m_frameCount < m_numFrames;
+}
+
+// There's nothing to show the frame on, so just wait for it to finish.  This keeps the GPU from falling frames behind, and makes the
+// time a frame takes include its rendering, as swapping on a real window would
+void HeadlessWindow::SwapBuffers()
+{
+	glFinish();
+	m_frameCount++;
+}
+
+// Read back the framebuffer and write it as a binary PPM, top row first
+bool HeadlessWindow::SaveScreenshot(string filename)
+{
+	int width = m_dimensions.right - m_dimensions.left;
+	int height = m_dimensions.bottom - m_dimensions.top;
+
+	vector<BYTE> pixels(width * height * 3);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+	FILE *fp;
+	if (fopen_s(&fp, filename.c_str(), "wb") != 0) {
+		char sErrorMessage[512];
+		sprintf_s(sErrorMessage, "Could not write %s", filename.c_str());
+		MessageBox(NULL, sErrorMessage, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	fprintf(fp, "P6\n%d %d\n255\n", width, height);
+	for (int y = height - 1; y >= 0; y--)
+		fwrite(&pixels[y * width * 3], 1, width * 3, fp);
+	fclose(fp);
+
+	return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "GameWindow.h"
+
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Offscreen rendering with no display, through EGL.  The context has no window surface: the game draws into a framebuffer object
+// of SCREEN_WIDTH x SCREEN_HEIGHT that stays bound for the whole run.  The display is Mesa's surfaceless platform where there is one
+// (which falls back to llvmpipe when there's no GPU), then the first EGL device (NVIDIA's headless driver), then the default display.
+// The window quits after a given number of frames, and can write the last frame out as a PPM image
+class HeadlessWindow : public GameWindow {
+public:
+	HeadlessWindow(int iNumFrames);
+
+	bool Init();
+	void Deinit();
+	bool ProcessMessages(int &exitCode);
+	void SwapBuffers();
+
+	// Write the last frame to this PPM file in Deinit
+	void SetScreenshotFile(string filename) {m_screenshotFile = filename;}
+	bool SaveScreenshot(string filename);
+
+	int GetFrameCount() const { return m_frameCount; }
+
+private:
+	EGLDisplay GetDisplay();
+	bool CreateFramebuffer();
+
+	EGLDisplay m_display;
+	EGLContext m_context;
+
+	GLuint m_framebuffer;
+	GLuint m_colourBuffer;
+	GLuint m_depthBuffer;
+
+	int m_numFrames;
+	int m_frameCount;
+	string m_screenshotFile;
+};
@@ -0,0 +1,217 @@
+#include "windows.h"
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+int MessageBox(HWND, LPCSTR text, LPCSTR caption, UINT)
+{
+	fprintf(stderr, "%s: %s\n", caption, text);
+	return 1;
+}
+
+void OutputDebugString(LPCSTR text)
+{
+	fputs(text, stderr);
+}
+
+void Sleep(DWORD milliseconds)
+{
+	timespec t = { (time_t) (milliseconds / 1000), (long) (milliseconds % 1000) * 1000000L };
+	nanosleep(&t, NULL);
+}
+
+// The performance counter counts nanoseconds of CLOCK_MONOTONIC
+BOOL QueryPerformanceCounter(LARGE_INTEGER *count)
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	count->QuadPart = (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+	return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+	frequency->QuadPart = 1000000000LL;
+	return TRUE;
+}
+
+// Where the cursor was last put.  Nothing else moves it
+static POINT s_cursor = { 0, 0 };
+
+BOOL GetCursorPos(POINT *point)
+{
+	*point = s_cursor;
+	return TRUE;
+}
+
+BOOL SetCursorPos(int x, int y)
+{
+	s_cursor.x = x;
+	s_cursor.y = y;
+	return TRUE;
+}
+
+short GetKeyState(int)
+{
+	return 0;
+}
+
+UINT GetWindowsDirectory(LPSTR buffer, UINT size)
+{
+	const char *directory = "/usr/share";
+	if (size <= strlen(directory))
+		return (UINT) strlen(directory) + 1;
+	strcpy(buffer, directory);
+	return (UINT) strlen(directory);
+}
+
+
+// A file or mapping handle.  A mapping keeps its own descriptor, so the file handle can be closed first
+struct LinuxHandle
+{
+	int fd;
+};
+
+// Length of each mapped view, for UnmapViewOfFile
+static std::map<const void *, size_t> s_mappedViews;
+static std::mutex s_mappedViewsLock;
+
+HANDLE CreateFileA(LPCSTR filename, DWORD, DWORD, void *, DWORD, DWORD, HANDLE)
+{
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return INVALID_HANDLE_VALUE;
+	LinuxHandle *pHandle = new LinuxHandle;
+	pHandle->fd = fd;
+	return pHandle;
+}
+
+BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER *size)
+{
+	struct stat info;
+	if (fstat(((LinuxHandle *) file)->fd, &info) != 0)
+		return FALSE;
+	size->QuadPart = (long long) info.st_size;
+	return TRUE;
+}
+
+// Linux keeps no creation time, so all three are the last write time, counted in 100ns intervals from 1601 as on Windows
+BOOL GetFileTime(HANDLE file, FILETIME *creation, FILETIME *lastAccess, FILETIME *lastWrite)
+{
+	struct stat info;
+	if (fstat(((LinuxHandle *) file)->fd, &info) != 0)
+		return FALSE;
+	unsigned long long time = 116444736000000000ull + (unsigned long long) info.st_mtim.tv_sec * 10000000ull + info.st_mtim.tv_nsec / 100;
+	FILETIME fileTime = { (DWORD) time, (DWORD) (time >> 32) };
+	if (creation != NULL)
+		*creation = fileTime;
+	if (lastAccess != NULL)
+		*lastAccess = fileTime;
+	if (lastWrite != NULL)
+		*lastWrite = fileTime;
+	return TRUE;
+}
+
+HANDLE CreateFileMappingA(HANDLE file, void *, DWORD, DWORD, DWORD, LPCSTR)
+{
+	int fd = fcntl(((LinuxHandle *) file)->fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	LinuxHandle *pHandle = new LinuxHandle;
+	pHandle->fd = fd;
+	return pHandle;
+}
+
+// Only whole-file views are supported, which is all CTrackFile asks for
+void *MapViewOfFile(HANDLE mapping, DWORD, DWORD, DWORD, size_t)
+{
+	int fd = ((LinuxHandle *) mapping)->fd;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+		return NULL;
+	void *pView = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (pView == MAP_FAILED)
+		return NULL;
+
+	std::lock_guard<std::mutex> guard(s_mappedViewsLock);
+	s_mappedViews[pView] = (size_t) info.st_size;
+	return pView;
+}
+
+BOOL UnmapViewOfFile(const void *pView)
+{
+	std::lock_guard<std::mutex> guard(s_mappedViewsLock);
+	std::map<const void *, size_t>::iterator it = s_mappedViews.find(pView);
+	if (it == s_mappedViews.end())
+		return FALSE;
+	munmap((void *) pView, it->second);
+	s_mappedViews.erase(it);
+	return TRUE;
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+	if (handle == NULL || handle == INVALID_HANDLE_VALUE)
+		return FALSE;
+	LinuxHandle *pHandle = (LinuxHandle *) handle;
+	close(pHandle->fd);
+	delete pHandle;
+	return TRUE;
+}
+
+BOOL CreateDirectoryA(LPCSTR path, void *)
+{
+	return mkdir(path, 0777) == 0;
+}
+
+// A change notification handle is an inotify descriptor.  It's signalled while it has events unread, and FindNextChangeNotification
+// reads them, as Windows resets the handle.  Subdirectories aren't watched
+HANDLE FindFirstChangeNotificationA(LPCSTR path, BOOL, DWORD filter)
+{
+	uint32_t mask = 0;
+	if (filter & FILE_NOTIFY_CHANGE_FILE_NAME)
+		mask |= IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+	if (filter & FILE_NOTIFY_CHANGE_LAST_WRITE)
+		mask |= IN_MODIFY | IN_CLOSE_WRITE;
+
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return INVALID_HANDLE_VALUE;
+	if (inotify_add_watch(fd, path, mask) < 0) {
+		close(fd);
+		return INVALID_HANDLE_VALUE;
+	}
+	LinuxHandle *pHandle = new LinuxHandle;
+	pHandle->fd = fd;
+	return pHandle;
+}
+
+BOOL FindNextChangeNotification(HANDLE handle)
+{
+	char buffer[4096];
+	ssize_t length;
+	do
+		length = read(((LinuxHandle *) handle)->fd, buffer, sizeof(buffer));
+	while (length > 0 || (length < 0 && errno == EINTR));
+	return length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+BOOL FindCloseChangeNotification(HANDLE handle)
+{
+	return CloseHandle(handle);
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+	struct pollfd request = { ((LinuxHandle *) handle)->fd, POLLIN, 0 };
+	return poll(&request, 1, milliseconds == INFINITE ? -1 : (int) milliseconds) > 0 ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+}
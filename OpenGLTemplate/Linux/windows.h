@@ -0,0 +1,123 @@
+#pragma once
+
+// The subset of the Win32 API used by the engine, for building it on Linux.  This directory goes on the include path ahead of the
+// system headers only on non-Windows builds (see CMakeLists.txt and Benchmark/CMakeLists.txt); windows.cpp implements the functions.  Message boxes
+// are written to stderr, input functions report no input, and file mapping is done with mmap
+
+#include <cstdio>
+#include <cstdarg>
+#include <cstdint>
+#include <cstddef>
+#include <strings.h>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+typedef unsigned int UINT;
+typedef char *LPSTR;
+typedef const char *LPCSTR;
+typedef char *PSTR;
+typedef uintptr_t WPARAM;
+typedef intptr_t LPARAM;
+typedef intptr_t LRESULT;
+
+typedef void *HANDLE;
+typedef void *HWND;
+typedef void *HDC;
+typedef void *HGLRC;
+typedef void *HINSTANCE;
+
+struct POINT { long x, y; };
+struct RECT { long left, top, right, bottom; };
+union LARGE_INTEGER { long long QuadPart; };
+struct FILETIME { DWORD dwLowDateTime, dwHighDateTime; };
+
+#define CALLBACK
+#define WINAPI
+#define FALSE 0
+#define TRUE 1
+
+#define MB_OK 0x0
+#define MB_ICONERROR 0x10
+#define MB_ICONINFORMATION 0x40
+
+#define VK_SPACE 0x20
+#define VK_LEFT 0x25
+#define VK_UP 0x26
+#define VK_RIGHT 0x27
+#define VK_DOWN 0x28
+#define VK_LSHIFT 0xA0
+
+// Dialogs and debug output go to stderr
+int MessageBox(HWND hWnd, LPCSTR text, LPCSTR caption, UINT type);
+void OutputDebugString(LPCSTR text);
+
+// Timing
+void Sleep(DWORD milliseconds);
+BOOL QueryPerformanceCounter(LARGE_INTEGER *count);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency);
+
+// Input: there's no window to take it from, so the cursor stays where it was last put and no keys are down
+BOOL GetCursorPos(POINT *point);
+BOOL SetCursorPos(int x, int y);
+short GetKeyState(int key);
+
+// Fonts are looked for in <directory>/Fonts/, so this returns the system font directory without the Fonts part
+UINT GetWindowsDirectory(LPSTR buffer, UINT size);
+
+// Read-only file mapping, as used by CTrackFile and CShaderPreprocessor
+#define INVALID_HANDLE_VALUE ((HANDLE) (intptr_t) -1)
+#define GENERIC_READ 0x80000000
+#define FILE_SHARE_READ 0x1
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define PAGE_READONLY 0x2
+#define FILE_MAP_READ 0x4
+
+HANDLE CreateFileA(LPCSTR filename, DWORD access, DWORD shareMode, void *security, DWORD creation, DWORD flags, HANDLE templateFile);
+BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER *size);
+BOOL GetFileTime(HANDLE file, FILETIME *creation, FILETIME *lastAccess, FILETIME *lastWrite);
+HANDLE CreateFileMappingA(HANDLE file, void *security, DWORD protect, DWORD sizeHigh, DWORD sizeLow, LPCSTR name);
+void *MapViewOfFile(HANDLE mapping, DWORD access, DWORD offsetHigh, DWORD offsetLow, size_t size);
+BOOL UnmapViewOfFile(const void *pView);
+BOOL CloseHandle(HANDLE handle);
+
+// Directories, as used by CProgramCache
+BOOL CreateDirectoryA(LPCSTR path, void *security);
+
+// Change notification, as used by CShaderReloader, done with inotify.  Subdirectories aren't watched
+#define FILE_NOTIFY_CHANGE_FILE_NAME 0x1
+#define FILE_NOTIFY_CHANGE_LAST_WRITE 0x10
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0x0
+#define WAIT_TIMEOUT 0x102
+
+HANDLE FindFirstChangeNotificationA(LPCSTR path, BOOL watchSubtree, DWORD filter);
+BOOL FindNextChangeNotification(HANDLE handle);
+BOOL FindCloseChangeNotification(HANDLE handle);
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+
+// Secure CRT functions
+template <size_t N> int sprintf_s(char (&buffer)[N], const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int iResult = vsnprintf(buffer, N, format, args);
+	va_end(args);
+	return iResult;
+}
+
+template <size_t N> int vsprintf_s(char (&buffer)[N], const char *format, va_list args)
+{
+	return vsnprintf(buffer, N, format, args);
+}
+
+inline int fopen_s(FILE **fp, const char *filename, const char *mode)
+{
+	*fp = fopen(filename, mode);
+	return *fp ? 0 : 1;
+}
+
+#define sscanf_s sscanf
+#define _stricmp strcasecmp
@@ -4,7 +4,7 @@
 
 
 #include "MatrixStack.h"
-#include "include\glm\gtc\matrix_transform.hpp"
+#include "include/glm/gtc/matrix_transform.hpp"
 
 namespace glutil
 {
@@ -18,6 +18,7 @@
 
 #include <assert.h>
 #include "OpenAssetImportMesh.h"
+#include "GLState.h"
 
 #pragma comment(lib, "lib/assimp.lib")
 
@@ -68,7 +69,7 @@ void COpenAssetImportMesh::Clear()
     for (unsigned int i = 0 ; i < m_Textures.size() ; i++) {
         SAFE_DELETE(m_Textures[i]);
     }
-	glDeleteVertexArrays(1, &m_vao);
+	CGLState::DeleteVertexArray(m_vao);
 }
 
 
@@ -98,7 +99,7 @@ bool COpenAssetImportMesh::InitFromScene(const aiScene* pScene, const std::strin
     m_Textures.resize(pScene->mNumMaterials);
 
 	glGenVertexArrays(1, &m_vao); 
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 
 
     // Initialize the meshes in the scene one by one
@@ -205,7 +206,7 @@ bool COpenAssetImportMesh::InitMaterials(const aiScene* pScene, const std::strin
 
 void COpenAssetImportMesh::Render()
 {
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 
     for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
 		glEnableVertexAttribArray(0);
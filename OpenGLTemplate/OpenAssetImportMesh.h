@@ -25,7 +25,7 @@
 #include "include/gl/glew.h"
 #include <Importer.hpp>      // C++ importer interface
 #include <scene.h>       // Output data structure
-#include <PostProcess.h> // Post processing flags
+#include <postprocess.h> // Post processing flags
 
 #include "Common.h"
 #include "Texture.h"
@@ -0,0 +1,139 @@
+#include "ParallelFor.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+int GetDefaultThreadCount()
+{
+	int iNumThreads = (int) std::thread::hardware_concurrency();
+	return iNumThreads > 0 ? iNumThreads : 1;
+}
+
+// One call to ParallelFor.  Chunks are handed out by number, to the calling thread and to any pool thread that picks the job up
+struct ParallelJob
+{
+	const std::function<void(int, int)> *pBody;
+	int iBegin, iChunkSize, iRemainder, iNumChunks;
+	std::atomic<int> nextChunk;
+	std::atomic<int> chunksLeft;
+};
+
+// Threads started on the first call that needs them and kept for the life of the process, so that a per-frame batch doesn't pay for
+// starting and joining threads.  Jobs wait in a queue; a job stays at the front until all its chunks have been handed out.  The pool is
+// never destroyed: its threads are still waiting on it when static objects are destroyed at exit, and destroying a condition variable
+// that has threads waiting on it can hang
+struct ThreadPool
+{
+	std::mutex mutex;
+	std::condition_variable workAvailable, jobFinished;
+	std::deque<ParallelJob *> jobs;
+	int numWorkers;
+};
+
+static ThreadPool &GetPool()
+{
+	static ThreadPool *pPool = new ThreadPool();
+	return *pPool;
+}
+
+// Run chunk iChunk of job.  The job may be gone as soon as the count of chunks left is decremented, so nothing of it is touched after that
+static void RunChunk(ParallelJob &job, int iChunk)
+{
+	// The first iRemainder chunks get one extra index
+	int iChunkBegin = job.iBegin + iChunk * job.iChunkSize + (iChunk < job.iRemainder ? iChunk : job.iRemainder);
+	int iChunkEnd = iChunkBegin + job.iChunkSize + (iChunk < job.iRemainder ? 1 : 0);
+	(*job.pBody)(iChunkBegin, iChunkEnd);
+	if (job.chunksLeft.fetch_sub(1) == 1) {
+		ThreadPool &pool = GetPool();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.jobFinished.notify_all();
+	}
+}
+
+// Pool threads take chunks under the lock, so that a job can't finish, and leave the queue, between being found and a chunk being taken
+static void WorkerThread()
+{
+	ThreadPool &pool = GetPool();
+	for (;;) {
+		ParallelJob *pJob;
+		int iChunk;
+		{
+			std::unique_lock<std::mutex> lock(pool.mutex);
+			pool.workAvailable.wait(lock, [&] { return !pool.jobs.empty(); });
+			pJob = pool.jobs.front();
+			iChunk = pJob->nextChunk.fetch_add(1);
+			if (iChunk >= pJob->iNumChunks) {
+				pool.jobs.pop_front();
+				continue;
+			}
+		}
+		RunChunk(*pJob, iChunk);
+	}
+}
+
+// Make sure the pool has at least iNumWorkers threads.  They are never stopped, and end with the process
+static void StartWorkers(ThreadPool &pool, int iNumWorkers)
+{
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	for (; pool.numWorkers < iNumWorkers; pool.numWorkers++)
+		std::thread(WorkerThread).detach();
+}
+
+void ParallelFor(int iBegin, int iEnd, const std::function<void(int, int)> &body, int iNumThreads, int iMinChunkSize)
+{
+	int iCount = iEnd - iBegin;
+	if (iCount <= 0)
+		return;
+
+	if (iNumThreads <= 0)
+		iNumThreads = GetDefaultThreadCount();
+
+	// Don't use other threads for tiny amounts of work
+	if (iMinChunkSize < 1)
+		iMinChunkSize = 1;
+	int iMaxThreads = (iCount + iMinChunkSize - 1) / iMinChunkSize;
+	if (iNumThreads > iMaxThreads)
+		iNumThreads = iMaxThreads;
+
+	if (iNumThreads <= 1) {
+		body(iBegin, iEnd);
+		return;
+	}
+
+	ThreadPool &pool = GetPool();
+	StartWorkers(pool, iNumThreads - 1);
+
+	ParallelJob job;
+	job.pBody = &body;
+	job.iBegin = iBegin;
+	job.iChunkSize = iCount / iNumThreads;
+	job.iRemainder = iCount % iNumThreads;
+	job.iNumChunks = iNumThreads;
+	job.nextChunk = 0;
+	job.chunksLeft = iNumThreads;
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.jobs.push_back(&job);
+	}
+	pool.workAvailable.notify_all();
+
+	// The calling thread takes chunks too, so the job finishes even if every pool thread is busy with another one
+	for (int iChunk = job.nextChunk.fetch_add(1); iChunk < job.iNumChunks; iChunk = job.nextChunk.fetch_add(1))
+		RunChunk(job, iChunk);
+
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	pool.jobFinished.wait(lock, [&] { return job.chunksLeft.load() == 0; });
+
+	// Take the job out of the queue if no pool thread has, as it lives on this thread's stack
+	for (int i = 0; i < (int) pool.jobs.size(); i++) {
+		if (pool.jobs[i] == &job) {
+			pool.jobs.erase(pool.jobs.begin() + i);
+			break;
+		}
+	}
+}
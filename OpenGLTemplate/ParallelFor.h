@@ -0,0 +1,13 @@
+#pragma once
+
+#include <functional>
+
+// Split the index range [iBegin, iEnd) into contiguous chunks and call body(iChunkBegin, iChunkEnd) for each chunk, on the calling thread 
+// and on a pool of threads that is started on first use and kept, so that calling this every frame is cheap.  iNumThreads <= 0 uses one 
+// thread per hardware core; fewer threads are used when the range holds less than iMinChunkSize indices per thread.
+// Chunk boundaries depend only on the range and the thread count, so if body writes only to the elements of its own chunk, the output 
+// is identical for any number of threads
+void ParallelFor(int iBegin, int iEnd, const std::function<void(int, int)> &body, int iNumThreads = 0, int iMinChunkSize = 1024);
+
+// Number of threads ParallelFor uses when iNumThreads <= 0
+int GetDefaultThreadCount();
@@ -1,5 +1,6 @@
 #include "Common.h"
 #include "Plane.h"
+#include "GLState.h"
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 
@@ -32,7 +33,7 @@ void CPlane::Create(string directory, string filename, float width, float height
 
 	// Use VAO to store state associated with vertices
 	glGenVertexArrays(1, &m_vao);
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 
 	// Create a VBO
 	m_vbo.Create();
@@ -91,16 +92,29 @@ void CPlane::Create(string directory, string filename, float width, float height
 // Render the plane as a triangle strip
 void CPlane::Render()
 {
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 	m_texture.Bind();
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 	
 }
 
+void CPlane::Submit(CRenderQueue &queue, DrawPacket packet)
+{
+	packet.vao = m_vao;
+	packet.texture = m_texture.GetTextureID();
+	packet.textureTarget = GL_TEXTURE_2D;
+	packet.sampler = m_texture.GetSamplerID();
+	packet.textureUnit = 0;
+	packet.mode = GL_TRIANGLE_STRIP;
+	packet.first = 0;
+	packet.count = 4;
+	queue.Submit(packet);
+}
+
 // Release resources
 void CPlane::Release()
 {
 	m_texture.Release();
-	glDeleteVertexArrays(1, &m_vao);
+	CGLState::DeleteVertexArray(m_vao);
 	m_vbo.Release();
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "Texture.h"
 #include "VertexBufferObject.h"
+#include "RenderQueue.h"
 
 // Class for generating a xz plane of a given size
 class CPlane
@@ -11,6 +12,7 @@ public:
 	~CPlane();
 	void Create(string sDirectory, string sFilename, float fWidth, float fHeight, float fTextureRepeat);
 	void Render();
+	void Submit(CRenderQueue &queue, DrawPacket packet);	// Render through a queue; packet gives the program, material and transform
 	void Release();
 private:
 	UINT m_vao;
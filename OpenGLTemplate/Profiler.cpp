@@ -0,0 +1,215 @@
+#include "Profiler.h"
+
+#ifdef USE_PROFILER
+
+#include "FreeTypeFont.h"
+#include "Shaders.h"
+
+CProfiler::CProfiler()
+{
+	m_queriesUsed[0] = m_queriesUsed[1] = 0;
+	m_queryRunning = false;
+	m_frame = 0;
+	m_created = false;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_frequency = (double) frequency.QuadPart;
+}
+
+CProfiler::~CProfiler()
+{}
+
+void CProfiler::Create()
+{
+	m_created = true;
+}
+
+void CProfiler::Release()
+{
+	for (int i = 0; i < 2; i++) {
+		if (!m_queries[i].empty())
+			glDeleteQueries((GLsizei) m_queries[i].size(), &m_queries[i][0]);
+		m_queries[i].clear();
+		m_queryScopes[i].clear();
+	}
+	m_created = false;
+}
+
+// Time in ms
+double CProfiler::Now()
+{
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return (double) count.QuadPart * 1000.0 / m_frequency;
+}
+
+// Find a scope by name and parent, adding it the first time it's seen.  Names are compared as pointers first, since they're
+// nearly always the same string literal each frame
+int CProfiler::FindScope(const char *name, int parent)
+{
+	for (int i = parent + 1; i < (int) m_scopes.size(); i++) {
+		if (m_scopes[i].parent == parent && (m_scopes[i].name == name || strcmp(m_scopes[i].name, name) == 0))
+			return i;
+	}
+
+	Scope scope;
+	scope.name = name;
+	scope.parent = parent;
+	scope.depth = parent < 0 ? 0 : m_scopes[parent].depth + 1;
+	scope.cpuStart = scope.cpuTime = 0.0;
+	scope.gpuSelfTime = scope.gpuTime = 0.0;
+	scope.cpuAverage = scope.gpuAverage = 0.0;
+
+	m_scopes.push_back(scope);
+	return (int) m_scopes.size() - 1;
+}
+
+void CProfiler::StartQuery(int iScope)
+{
+	if (!m_created)
+		return;
+
+	int iBuffer = m_frame & 1;
+	int iQuery = m_queriesUsed[iBuffer]++;
+	if (iQuery == (int) m_queries[iBuffer].size()) {
+		GLuint query;
+		glGenQueries(1, &query);
+		m_queries[iBuffer].push_back(query);
+		m_queryScopes[iBuffer].push_back(-1);
+	}
+	m_queryScopes[iBuffer][iQuery] = iScope;
+	glBeginQuery(GL_TIME_ELAPSED, m_queries[iBuffer][iQuery]);
+	m_queryRunning = true;
+}
+
+void CProfiler::BeginScope(const char *name)
+{
+	int iScope = FindScope(name, m_stack.empty() ? -1 : m_stack.back());
+
+	if (m_queryRunning) {
+		glEndQuery(GL_TIME_ELAPSED);
+		m_queryRunning = false;
+	}
+
+	m_stack.push_back(iScope);
+	m_scopes[iScope].cpuStart = Now();
+	StartQuery(iScope);
+}
+
+void CProfiler::EndScope()
+{
+	if (m_stack.empty())
+		return;
+
+	Scope &scope = m_scopes[m_stack.back()];
+	scope.cpuTime += Now() - scope.cpuStart;
+	m_stack.pop_back();
+
+	if (m_queryRunning) {
+		glEndQuery(GL_TIME_ELAPSED);
+		m_queryRunning = false;
+	}
+	if (!m_stack.empty())
+		StartQuery(m_stack.back());
+}
+
+void CProfiler::MergeCPUTimes(CProfiler &source)
+{
+	// Parents come before their children in both lists, so each scope's parent has been matched by the time the scope is
+	vector<int> matches(source.m_scopes.size());
+	for (int i = 0; i < (int) source.m_scopes.size(); i++) {
+		Scope &sourceScope = source.m_scopes[i];
+		int parent = sourceScope.parent < 0 ? (m_stack.empty() ? -1 : m_stack.back()) : matches[sourceScope.parent];
+		matches[i] = FindScope(sourceScope.name, parent);
+		m_scopes[matches[i]].cpuTime += sourceScope.cpuTime;
+		sourceScope.cpuTime = 0.0;
+	}
+}
+
+// Add up the GPU times from the queries in a buffer, if they have all finished.  Only the last query needs checking, as queries
+// finish in order
+void CProfiler::ReadQueries(int iBuffer)
+{
+	int iNumQueries = m_queriesUsed[iBuffer];
+	m_queriesUsed[iBuffer] = 0;
+	if (iNumQueries == 0)
+		return;
+
+	GLint iAvailable = 0;
+	glGetQueryObjectiv(m_queries[iBuffer][iNumQueries - 1], GL_QUERY_RESULT_AVAILABLE, &iAvailable);
+	if (!iAvailable)
+		return;
+
+	for (int i = 0; i < (int) m_scopes.size(); i++)
+		m_scopes[i].gpuSelfTime = 0.0;
+	for (int i = 0; i < iNumQueries; i++) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(m_queries[iBuffer][i], GL_QUERY_RESULT, &elapsed);
+		m_scopes[m_queryScopes[iBuffer][i]].gpuSelfTime += (double) elapsed / 1000000.0;
+	}
+
+	// Children come after their parents, so going backwards each scope's total is complete before it's added to its parent's
+	for (int i = 0; i < (int) m_scopes.size(); i++)
+		m_scopes[i].gpuTime = m_scopes[i].gpuSelfTime;
+	for (int i = (int) m_scopes.size() - 1; i >= 0; i--) {
+		if (m_scopes[i].parent >= 0)
+			m_scopes[m_scopes[i].parent].gpuTime += m_scopes[i].gpuTime;
+		m_scopes[i].gpuAverage = 0.95 * m_scopes[i].gpuAverage + 0.05 * m_scopes[i].gpuTime;
+	}
+}
+
+// The queries in this frame's buffer were made two frames ago
+void CProfiler::BeginFrame()
+{
+	if (m_created)
+		ReadQueries(m_frame & 1);
+}
+
+void CProfiler::EndFrame()
+{
+	for (int i = 0; i < (int) m_scopes.size(); i++) {
+		m_scopes[i].cpuAverage = 0.95 * m_scopes[i].cpuAverage + 0.05 * m_scopes[i].cpuTime;
+		m_scopes[i].cpuTime = 0.0;
+	}
+	m_frame++;
+}
+
+void CProfiler::Render(CFreeTypeFont *pFont, CShaderProgram *pFontProgram, int x, int y)
+{
+	for (int i = 0; i < (int) m_scopes.size(); i++) {
+		if (m_scopes[i].parent < 0)
+			RenderScope(i, pFont, pFontProgram, x, y);
+	}
+	pFontProgram->SetUniform("vColour", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+}
+
+// Draw a scope's line, then its children's below it, moving y down past them
+void CProfiler::RenderScope(int iScope, CFreeTypeFont *pFont, CShaderProgram *pFontProgram, int x, int &y)
+{
+	const int iLineHeight = 16;
+	const int iBarX = x + 260;
+	const float fPixelsPerMs = 20.0f;
+	const int iMaxBarWidth = 400;
+
+	const Scope &scope = m_scopes[iScope];
+	y -= iLineHeight;
+
+	pFontProgram->SetUniform("vColour", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+	pFont->Print(scope.name, x + 12 * scope.depth, y, 14);
+	pFont->Render(x + 150, y, 14, "%6.2f %6.2f", scope.cpuAverage, scope.gpuAverage);
+
+	int iCPUWidth = (int) (scope.cpuAverage * fPixelsPerMs);
+	int iGPUWidth = (int) (scope.gpuAverage * fPixelsPerMs);
+	pFontProgram->SetUniform("vColour", glm::vec4(1.0f, 0.6f, 0.1f, 0.8f));
+	pFont->DrawBar(iBarX, y + 6, iCPUWidth < iMaxBarWidth ? iCPUWidth : iMaxBarWidth, 5);
+	pFontProgram->SetUniform("vColour", glm::vec4(0.2f, 1.0f, 0.3f, 0.8f));
+	pFont->DrawBar(iBarX, y, iGPUWidth < iMaxBarWidth ? iGPUWidth : iMaxBarWidth, 5);
+
+	for (int i = iScope + 1; i < (int) m_scopes.size(); i++) {
+		if (m_scopes[i].parent == iScope)
+			RenderScope(i, pFont, pFontProgram, x, y);
+	}
+}
+
+#endif
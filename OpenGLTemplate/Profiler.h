@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Common.h"
+
+// The profiler is compiled into debug builds only.  Define USE_PROFILER to profile an optimised build
+#if !defined(NDEBUG) && !defined(USE_PROFILER)
+#define USE_PROFILER
+#endif
+
+#ifdef USE_PROFILER
+
+class CFreeTypeFont;
+class CShaderProgram;
+
+// Times named, nestable scopes on the CPU and GPU, and draws the times as bars.  A scope is identified by its name and the scope it
+// is in, so the same name can appear under different parents.  Only one GL_TIME_ELAPSED query can run at once, so entering a scope
+// stops its parent's query and leaving it starts a new one: a scope's GPU time is the sum of its own queries plus its children's.
+// Queries are double-buffered by frame, and read back two frames later, when they have finished; one that still hasn't is dropped
+// rather than waited for.  Times shown are smoothed over roughly the last 20 frames
+class CProfiler
+{
+public:
+	CProfiler();
+	~CProfiler();
+
+	void Create();
+	void Release();
+
+	void BeginFrame();
+	void EndFrame();
+
+	void BeginScope(const char *name);
+	void EndScope();
+
+	// Add the CPU times another profiler has gathered since the last merge to this one's, under scopes of the same names within the scope
+	// open here, and clear them there.  A thread that mustn't use OpenGL times itself with a profiler that is never created, so is CPU only, 
+	// and the main thread merges it each frame while that thread is idle
+	void MergeCPUTimes(CProfiler &source);
+
+	// Draw each scope's name, times, and CPU (orange) and GPU (green) bars, from (x, y) downwards, using a font and its shader program
+	void Render(CFreeTypeFont *pFont, CShaderProgram *pFontProgram, int x, int y);
+
+private:
+	struct Scope
+	{
+		const char *name;
+		int parent;
+		int depth;
+		double cpuStart;		// ms, while the scope is open
+		double cpuTime;			// ms this frame
+		double gpuSelfTime;		// ms in the scope's own queries, for the frame being read back
+		double gpuTime;			// ms including children, for the frame being read back
+		double cpuAverage;
+		double gpuAverage;
+	};
+
+	int FindScope(const char *name, int parent);
+	void RenderScope(int iScope, CFreeTypeFont *pFont, CShaderProgram *pFontProgram, int x, int &y);
+	void StartQuery(int iScope);
+	void ReadQueries(int iBuffer);
+	double Now();
+
+	vector<Scope> m_scopes;		// In order of first use, so parents come before their children
+	vector<int> m_stack;		// Open scopes, innermost last
+
+	// Two sets of queries, used on alternate frames, each with the scope each query was timing
+	vector<GLuint> m_queries[2];
+	vector<int> m_queryScopes[2];
+	int m_queriesUsed[2];
+	bool m_queryRunning;
+
+	int m_frame;
+	double m_frequency;
+	bool m_created;
+};
+
+// Times the rest of the enclosing block
+class CProfileScope
+{
+public:
+	CProfileScope(CProfiler *pProfiler, const char *name) : m_pProfiler(pProfiler) { if (m_pProfiler) m_pProfiler->BeginScope(name); }
+	~CProfileScope() { if (m_pProfiler) m_pProfiler->EndScope(); }
+
+private:
+	CProfiler *m_pProfiler;
+};
+
+#define PROFILE_CONCATENATE2(a, b) a##b
+#define PROFILE_CONCATENATE(a, b) PROFILE_CONCATENATE2(a, b)
+#define PROFILE_SCOPE(profiler, name) CProfileScope PROFILE_CONCATENATE(profileScope, __LINE__)(profiler, name)
+
+#else
+
+#define PROFILE_SCOPE(profiler, name)
+
+#endif
@@ -0,0 +1,159 @@
+#include "ProgramCache.h"
+#include "Shaders.h"
+#include "TrackFile.h"
+
+// A cache file is this header, then the binary
+struct ProgramCacheHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int format;		// The binary format glGetProgramBinary gave
+	unsigned int length;
+	unsigned long long key;
+};
+
+static const unsigned int PROGRAM_CACHE_MAGIC = 0x4E494250;		// "PBIN"
+static const unsigned int PROGRAM_CACHE_VERSION = 1;
+
+static string s_directory;
+static unsigned long long s_driverKey = 0;
+static int s_hits = 0, s_misses = 0, s_rejections = 0;
+
+// Keys are hashed with the track file's FNV-1a.  Strings are hashed with their terminating zero, so "ab" + "c" and "a" + "bc" differ
+static unsigned long long HashString(unsigned long long hash, const char *sText)
+{
+	if (sText == NULL)
+		sText = "";
+	return CTrackFile::Hash(sText, strlen(sText) + 1, hash);
+}
+
+static string GetFileName(unsigned long long key)
+{
+	char sName[32];
+	sprintf_s(sName, "%016llx.bin", key);
+	return s_directory + sName;
+}
+
+void CProgramCache::SetDirectory(const string &sDirectory)
+{
+	s_directory = "";
+	if (sDirectory == "")
+		return;
+
+	int iNumFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &iNumFormats);
+	if (iNumFormats <= 0)
+		return;
+
+	CreateDirectoryA(sDirectory.c_str(), NULL);
+	s_directory = sDirectory;
+	if (s_directory[s_directory.size() - 1] != '/' && s_directory[s_directory.size() - 1] != '\\')
+		s_directory += "/";
+
+	s_driverKey = CTrackFile::Hash(NULL, 0);
+	s_driverKey = HashString(s_driverKey, (const char *) glGetString(GL_VENDOR));
+	s_driverKey = HashString(s_driverKey, (const char *) glGetString(GL_RENDERER));
+	s_driverKey = HashString(s_driverKey, (const char *) glGetString(GL_VERSION));
+}
+
+bool CProgramCache::IsEnabled()
+{
+	return s_directory != "";
+}
+
+unsigned long long CProgramCache::MakeKey(const vector<CShader *> &shaders)
+{
+	unsigned long long key = s_driverKey;
+	for (int i = 0; i < (int) shaders.size(); i++) {
+		int iType = shaders[i]->GetType();
+		key = CTrackFile::Hash(&iType, sizeof(iType), key);
+		key = HashString(key, shaders[i]->GetSource().c_str());
+	}
+	return key;
+}
+
+bool CProgramCache::Load(UINT uiProgram, unsigned long long key)
+{
+	string sFile = GetFileName(key);
+	FILE *fp;
+	fopen_s(&fp, sFile.c_str(), "rb");
+	if (!fp) {
+		s_misses++;
+		return false;
+	}
+
+	ProgramCacheHeader header;
+	vector<BYTE> binary;
+	bool bRead = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == PROGRAM_CACHE_MAGIC &&
+		header.version == PROGRAM_CACHE_VERSION && header.key == key && header.length > 0;
+	if (bRead) {
+		binary.resize(header.length);
+		bRead = fread(&binary[0], 1, header.length, fp) == header.length;
+	}
+	fclose(fp);
+
+	int iLinkStatus = GL_FALSE;
+	if (bRead) {
+		glProgramBinary(uiProgram, header.format, &binary[0], header.length);
+		glGetProgramiv(uiProgram, GL_LINK_STATUS, &iLinkStatus);
+	}
+	if (iLinkStatus != GL_TRUE) {
+		remove(sFile.c_str());
+		s_rejections++;
+		s_misses++;
+		return false;
+	}
+
+	s_hits++;
+	return true;
+}
+
+void CProgramCache::Save(UINT uiProgram, unsigned long long key)
+{
+	int iLength = 0;
+	glGetProgramiv(uiProgram, GL_PROGRAM_BINARY_LENGTH, &iLength);
+	if (iLength <= 0)
+		return;
+
+	vector<BYTE> binary(iLength);
+	GLenum format = 0;
+	GLsizei iWritten = 0;
+	glGetProgramBinary(uiProgram, iLength, &iWritten, &format, &binary[0]);
+	if (iWritten <= 0)
+		return;
+
+	ProgramCacheHeader header;
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.format = format;
+	header.length = (unsigned int) iWritten;
+	header.key = key;
+
+	// Written under another name and renamed, so a game stopped part way through never leaves a truncated binary behind
+	string sFile = GetFileName(key);
+	string sTemporary = sFile + ".tmp";
+	FILE *fp;
+	fopen_s(&fp, sTemporary.c_str(), "wb");
+	if (!fp)
+		return;
+	bool bWritten = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(&binary[0], 1, iWritten, fp) == (size_t) iWritten;
+	bWritten = fclose(fp) == 0 && bWritten;
+	remove(sFile.c_str());
+	if (!bWritten || rename(sTemporary.c_str(), sFile.c_str()) != 0)
+		remove(sTemporary.c_str());
+}
+
+int CProgramCache::GetHits()
+{
+	return s_hits;
+}
+
+int CProgramCache::GetMisses()
+{
+	return s_misses;
+}
+
+int CProgramCache::GetRejections()
+{
+	return s_rejections;
+}
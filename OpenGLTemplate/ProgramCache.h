@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Common.h"
+
+class CShader;
+
+// An on-disk cache of linked programs, as glGetProgramBinary returns them, so a program whose shaders haven't changed is loaded
+// rather than compiled and linked.  The key hashes each shader's type and source after preprocessing (so with any defines in it),
+// and the driver's vendor, renderer and version strings, so an edited shader or another driver misses.  A driver may still reject
+// a binary, after an update that kept its version string, say: the file is then deleted, and the program built from source and
+// cached again.  Off until given a directory, and always off if the driver has no binary formats
+class CProgramCache
+{
+public:
+	// Cache programs in sDirectory, which is made if need be, or turn the cache off with ""
+	static void SetDirectory(const string &sDirectory);
+	static bool IsEnabled();
+
+	static unsigned long long MakeKey(const vector<CShader *> &shaders);
+
+	// Link uiProgram from its cached binary.  Returns false on a miss, or if the driver rejected the binary
+	static bool Load(UINT uiProgram, unsigned long long key);
+
+	// Cache a program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+	static void Save(UINT uiProgram, unsigned long long key);
+
+	// Programs loaded from the cache, built from source, and of those, built because a cached binary was rejected
+	static int GetHits();
+	static int GetMisses();
+	static int GetRejections();
+};
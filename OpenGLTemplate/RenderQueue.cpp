@@ -0,0 +1,320 @@
+#include "RenderQueue.h"
+
+#include "GLState.h"
+#include "Profiler.h"
+#include "Shaders.h"
+
+DrawPacket::DrawPacket()
+{
+	pass = PASS_OPAQUE;
+	pProgram = NULL;
+	material = 0;
+	texture = 0;
+	textureTarget = GL_TEXTURE_2D;
+	sampler = 0;
+	textureUnit = 0;
+	vao = 0;
+	state = STATE_DEFAULT;
+	size = 1.0f;
+
+	mode = GL_TRIANGLES;
+	first = count = 0;
+	pFirsts = NULL;
+	pCounts = NULL;
+	pOffsets = NULL;
+	pBaseVertices = NULL;
+	drawCount = 0;
+
+	modelViewMatrix = glm::mat4(1.0f);
+	normalMatrix = glm::mat3(1.0f);
+}
+
+CRenderQueue::CRenderQueue()
+{
+	m_farDistance = 5000.0f;
+	m_buffersCreated = false;
+	m_uploadedMaterials = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+CRenderQueue::~CRenderQueue()
+{}
+
+int CRenderQueue::AddMaterial(const RenderMaterial &material)
+{
+	m_materials.push_back(material);
+	return (int) m_materials.size() - 1;
+}
+
+void CRenderQueue::SetFarDistance(float fFar)
+{
+	m_farDistance = fFar;
+}
+
+// The depth is the eye space depth of the packet's origin, which is good enough to order whole objects
+unsigned long long CRenderQueue::MakeKey(const DrawPacket &packet)
+{
+	unsigned long long pass = (unsigned long long) packet.pass & 0xF;
+	unsigned long long program = packet.pProgram != NULL ? packet.pProgram->GetProgramID() & 0xFF : 0;
+	unsigned long long material = (unsigned long long) packet.material & 0xFFF;
+	unsigned long long texture = packet.texture & 0xFFF;
+	unsigned long long vao = packet.vao & 0xFFF;
+
+	float fDepth = -packet.modelViewMatrix[3][2] / m_farDistance;
+	fDepth = fDepth < 0.0f ? 0.0f : (fDepth > 1.0f ? 1.0f : fDepth);
+	unsigned long long depth = (unsigned long long) (fDepth * 65535.0f);
+
+	if (packet.pass == PASS_TRANSPARENT)
+		return (pass << 60) | ((0xFFFF - depth) << 44) | (program << 36) | (material << 24) | (texture << 12) | vao;
+	return (pass << 60) | (program << 52) | (material << 40) | (texture << 28) | (vao << 16) | depth;
+}
+
+void CRenderQueue::PrepareVariants(CShaderProgram *pProgram)
+{
+	for (int i = 0; i < (int) m_materials.size(); i++)
+		pProgram->GetVariant(m_materials[i].features);
+}
+
+void CRenderQueue::Submit(const DrawPacket &packet)
+{
+	m_packets.push_back(packet);
+	DrawPacket &queued = m_packets.back();
+	if (queued.pProgram != NULL && queued.material >= 0 && queued.material < (int) m_materials.size())
+		queued.pProgram = queued.pProgram->GetVariant(m_materials[queued.material].features);
+
+	SortEntry entry;
+	entry.key = MakeKey(queued);
+	entry.packet = (int) m_packets.size() - 1;
+	m_order.push_back(entry);
+}
+
+// Least significant digit radix sort on the keys, a byte at a time.  All eight histograms are made in one pass over the keys, and bytes
+// that are the same in every key (usually most of them) are skipped.  Each pass is stable, so equal keys keep their submission order
+void CRenderQueue::Sort()
+{
+	int iCount = (int) m_order.size();
+	if (iCount < 2)
+		return;
+
+	int histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+	for (int i = 0; i < iCount; i++) {
+		unsigned long long key = m_order[i].key;
+		for (int iByte = 0; iByte < 8; iByte++)
+			histograms[iByte][(key >> (8 * iByte)) & 0xFF]++;
+	}
+
+	m_scratch.resize(iCount);
+	for (int iByte = 0; iByte < 8; iByte++) {
+		int *histogram = histograms[iByte];
+		int iShift = 8 * iByte;
+		if (histogram[(m_order[0].key >> iShift) & 0xFF] == iCount)
+			continue;
+
+		int iOffset = 0;
+		for (int i = 0; i < 256; i++) {
+			int iBucketSize = histogram[i];
+			histogram[i] = iOffset;
+			iOffset += iBucketSize;
+		}
+		for (int i = 0; i < iCount; i++)
+			m_scratch[histogram[(m_order[i].key >> iShift) & 0xFF]++] = m_order[i];
+		m_order.swap(m_scratch);
+	}
+}
+
+// Set the render state flags that have changed
+void CRenderQueue::ApplyState(unsigned int changed, unsigned int state, bool bIssue)
+{
+	if (!bIssue)
+		return;
+	if (changed & STATE_DEPTH_TEST)
+		CGLState::SetEnabled(GL_DEPTH_TEST, (state & STATE_DEPTH_TEST) != 0);
+	if (changed & STATE_DEPTH_WRITE)
+		CGLState::DepthMask((state & STATE_DEPTH_WRITE) != 0);
+	if (changed & STATE_CULL_FACE)
+		CGLState::SetEnabled(GL_CULL_FACE, (state & STATE_CULL_FACE) != 0);
+	if (changed & STATE_WIREFRAME)
+		CGLState::PolygonMode(state & STATE_WIREFRAME ? GL_LINE : GL_FILL);
+}
+
+#ifdef USE_PROFILER
+// Profiler scope names, by RenderPass
+static const char *PASS_NAMES[] = { "Background", "Opaque", "Transparent", "Overlay" };
+#endif
+
+// Go through the packets in order, changing state only where it differs from the last packet's, and drawing if bIssue is set.  Nothing
+// is assumed about the state before the first packet.  Packets are in pass order, so each pass's profiler scope is opened at its first 
+// packet and closed at the next pass's
+void CRenderQueue::Walk(bool bIssue, CProfiler *pProfiler)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.packets = (int) m_order.size();
+
+	CShaderProgram *pProgram = NULL;
+	int material = -1;
+	GLuint vao = 0;
+	bool bVAOKnown = false;
+	unsigned int state = 0;
+	bool bStateKnown = false;
+	float fPointSize = -1.0f, fLineWidth = -1.0f;
+	GLuint textures[MAX_TEXTURE_UNITS], samplers[MAX_TEXTURE_UNITS];
+	for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+		textures[i] = samplers[i] = 0;
+
+#ifdef USE_PROFILER
+	int pass = -1;
+#else
+	(void) pProfiler;
+#endif
+	for (int i = 0; i < (int) m_order.size(); i++) {
+		const DrawPacket &packet = m_packets[m_order[i].packet];
+
+#ifdef USE_PROFILER
+		if (pProfiler != NULL && packet.pass != pass) {
+			if (pass >= 0)
+				pProfiler->EndScope();
+			pProfiler->BeginScope(PASS_NAMES[packet.pass]);
+			pass = packet.pass;
+		}
+#endif
+
+		if (packet.pProgram != pProgram) {
+			pProgram = packet.pProgram;
+			m_stats.programChanges++;
+			if (bIssue)
+				pProgram->UseProgram();
+		}
+
+		if (packet.material != material) {
+			material = packet.material;
+			m_stats.materialChanges++;
+			if (bIssue && material >= 0 && material < (int) m_materials.size())
+				m_materialBuffer.Bind(UNIFORM_BLOCK_MATERIAL, material);
+		}
+
+		int iUnit = packet.textureUnit;
+		bool bTracked = iUnit >= 0 && iUnit < MAX_TEXTURE_UNITS;
+		if (packet.texture != 0 && (!bTracked || textures[iUnit] != packet.texture || samplers[iUnit] != packet.sampler)) {
+			if (bTracked) {
+				textures[iUnit] = packet.texture;
+				samplers[iUnit] = packet.sampler;
+			}
+			m_stats.textureChanges++;
+			if (bIssue) {
+				CGLState::BindTexture(iUnit, packet.textureTarget, packet.texture);
+				CGLState::BindSampler(iUnit, packet.sampler);
+			}
+		}
+
+		if (!bVAOKnown || packet.vao != vao) {
+			vao = packet.vao;
+			bVAOKnown = true;
+			m_stats.vaoChanges++;
+			if (bIssue)
+				CGLState::BindVertexArray(vao);
+		}
+
+		if (!bStateKnown || packet.state != state) {
+			ApplyState(bStateKnown ? packet.state ^ state : ~0u, packet.state, bIssue);
+			state = packet.state;
+			bStateKnown = true;
+			m_stats.stateChanges++;
+		}
+
+		if (packet.mode == GL_POINTS && packet.size != fPointSize) {
+			fPointSize = packet.size;
+			m_stats.stateChanges++;
+			if (bIssue)
+				glPointSize(fPointSize);
+		} else if ((packet.mode == GL_LINES || packet.mode == GL_LINE_STRIP || packet.mode == GL_LINE_LOOP) && packet.size != fLineWidth) {
+			fLineWidth = packet.size;
+			m_stats.stateChanges++;
+			if (bIssue)
+				glLineWidth(fLineWidth);
+		}
+
+		if (!bIssue)
+			continue;
+
+		m_objectBuffer.Bind(UNIFORM_BLOCK_OBJECT, i);
+
+		if (packet.pCounts == NULL)
+			glDrawArrays(packet.mode, packet.first, packet.count);
+		else if (packet.pOffsets == NULL)
+			glMultiDrawArrays(packet.mode, packet.pFirsts, packet.pCounts, packet.drawCount);
+		else if (packet.pBaseVertices == NULL)
+			glMultiDrawElements(packet.mode, packet.pCounts, GL_UNSIGNED_INT, packet.pOffsets, packet.drawCount);
+		else
+			glMultiDrawElementsBaseVertex(packet.mode, (GLsizei *) packet.pCounts, GL_UNSIGNED_INT, (void **) packet.pOffsets, packet.drawCount, 
+				(GLint *) packet.pBaseVertices);
+	}
+
+	if (bIssue) {
+		if (bStateKnown)
+			ApplyState(state ^ STATE_DEFAULT, STATE_DEFAULT, true);
+		CGLState::BindVertexArray(0);
+	}
+#ifdef USE_PROFILER
+	if (pProfiler != NULL && pass >= 0)
+		pProfiler->EndScope();
+#endif
+}
+
+// Put any materials added since the last frame, and every packet's matrices in drawing order, into their uniform buffers.  The buffers
+// are made the first time, so a queue that only counts state changes needs no GL context
+void CRenderQueue::UploadUniforms()
+{
+	if (!m_buffersCreated) {
+		m_materialBuffer.Create(sizeof(MaterialUniforms));
+		m_objectBuffer.Create(sizeof(ObjectUniforms));
+		m_buffersCreated = true;
+	}
+
+	if (m_uploadedMaterials != (int) m_materials.size()) {
+		for (int i = 0; i < (int) m_materials.size(); i++) {
+			MaterialUniforms block = MaterialUniforms();
+			block.Ma = m_materials[i].ambient;
+			block.Md = m_materials[i].diffuse;
+			block.Ms = m_materials[i].specular;
+			block.shininess = m_materials[i].shininess;
+			m_materialBuffer.SetBlock(i, &block);
+		}
+		m_materialBuffer.Upload((int) m_materials.size());
+		m_uploadedMaterials = (int) m_materials.size();
+	}
+
+	for (int i = 0; i < (int) m_order.size(); i++) {
+		const DrawPacket &packet = m_packets[m_order[i].packet];
+		ObjectUniforms block;
+		block.modelViewMatrix = packet.modelViewMatrix;
+		for (int j = 0; j < 3; j++)
+			block.normalMatrix[j] = glm::vec4(packet.normalMatrix[j], 0.0f);
+		m_objectBuffer.SetBlock(i, &block);
+	}
+	m_objectBuffer.Upload((int) m_order.size());
+}
+
+void CRenderQueue::Execute(CProfiler *pProfiler)
+{
+	Sort();
+	UploadUniforms();
+	Walk(true, pProfiler);
+	m_packets.clear();
+	m_order.clear();
+}
+
+RenderQueueStats CRenderQueue::CountStateChanges(bool bSorted, vector<int> *pOrder)
+{
+	if (bSorted)
+		Sort();
+	Walk(false);
+	if (pOrder != NULL) {
+		pOrder->resize(m_order.size());
+		for (int i = 0; i < (int) m_order.size(); i++)
+			(*pOrder)[i] = m_order[i].packet;
+	}
+	m_packets.clear();
+	m_order.clear();
+	return m_stats;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Common.h"
+#include "UniformBuffer.h"
+
+class CShaderProgram;
+class CProfiler;
+
+// Render state a draw packet needs, as flags
+enum RenderStateFlags
+{
+	STATE_DEPTH_TEST = 1,
+	STATE_DEPTH_WRITE = 2,
+	STATE_CULL_FACE = 4,
+	STATE_WIREFRAME = 8,
+	STATE_DEFAULT = STATE_DEPTH_TEST | STATE_DEPTH_WRITE | STATE_CULL_FACE
+};
+
+// Passes, drawn in this order.  Opaque packets are drawn front to back within their program, material, texture and VAO; transparent
+// ones back to front, whatever their state
+enum RenderPass
+{
+	PASS_BACKGROUND,
+	PASS_OPAQUE,
+	PASS_TRANSPARENT,
+	PASS_OVERLAY
+};
+
+// A material: MaterialBlock in the shaders, and the features (ShaderFeature bits) of the program variant it's drawn with
+struct RenderMaterial
+{
+	glm::vec3 ambient, diffuse, specular;
+	float shininess;
+	unsigned int features;
+};
+
+// One draw call and everything it needs.  Objects fill in their geometry and texture, and whoever submits them the program, material
+// and transform
+struct DrawPacket
+{
+	DrawPacket();
+
+	RenderPass pass;
+	CShaderProgram *pProgram;
+	int material;					// From CRenderQueue::AddMaterial
+	GLuint texture;					// 0 for none
+	GLenum textureTarget;
+	GLuint sampler;
+	int textureUnit;
+	GLuint vao;
+	unsigned int state;				// RenderStateFlags
+	float size;						// Point size or line width, when drawing points or lines
+
+	// glDrawArrays(mode, first, count) if pCounts is NULL.  Otherwise glMultiDrawArrays(mode, pFirsts, pCounts, drawCount), or, if
+	// pOffsets isn't NULL, glMultiDrawElements with GL_UNSIGNED_INT indices at byte offsets pOffsets, added to pBaseVertices if that 
+	// isn't NULL.  The arrays must stay valid until the queue is executed
+	GLenum mode;
+	int first, count;
+	const GLint *pFirsts;
+	const GLsizei *pCounts;
+	const void *const *pOffsets;
+	const GLint *pBaseVertices;
+	int drawCount;
+
+	glm::mat4 modelViewMatrix;
+	glm::mat3 normalMatrix;
+};
+
+// What executing the queue did, for the last frame
+struct RenderQueueStats
+{
+	int packets;
+	int programChanges;
+	int materialChanges;
+	int textureChanges;
+	int vaoChanges;
+	int stateChanges;		// Render state flags, point size and line width
+};
+
+// Collects a frame's draw packets, sorts them by a 64-bit key, and draws them, changing only the state that differs from the packet
+// before.  From the top bit down, the key holds the pass (4 bits), the program (8), the material (12), the texture (12), the VAO (12)
+// and the depth (16), so the most expensive state changes least often.  Transparent packets put the depth straight after the pass,
+// reversed.  The ids in the key are truncated GL names, which only affects how well packets group: the state itself is compared in
+// full before each draw.  Packets are drawn in submission order where their keys are equal.  The materials, and each packet's matrices,
+// are kept in uniform buffers, so changing either is one glBindBufferRange
+class CRenderQueue
+{
+public:
+	CRenderQueue();
+	~CRenderQueue();
+
+	int AddMaterial(const RenderMaterial &material);
+
+	// Depth of the far plane, for quantising depths into the key
+	void SetFarDistance(float fFar);
+
+	// Build the variants of pProgram that the materials need, so none is built part way through a frame
+	void PrepareVariants(CShaderProgram *pProgram);
+
+	// Queue a packet.  It's drawn with the variant of its program that has its material's features
+	void Submit(const DrawPacket &packet);
+
+	// Sort and draw the packets submitted since the last call, then empty the queue.  The frame and light blocks must already be
+	// bound, and the samplers set in each program variant.  Leaves STATE_DEFAULT set and no VAO bound.  With a profiler, each pass 
+	// drawn is timed as a scope of its own
+	void Execute(CProfiler *pProfiler = NULL);
+
+	// Sort the packets (if bSorted), and count the changes executing them would make without drawing anything, then empty the queue.  If 
+	// pOrder isn't NULL, it's filled with the packets' indices in submission order, in the order they would be drawn
+	RenderQueueStats CountStateChanges(bool bSorted, vector<int> *pOrder = NULL);
+
+	const RenderQueueStats &GetStats() const { return m_stats; }
+
+private:
+	enum { MAX_TEXTURE_UNITS = 16 };	// Texture units tracked; packets using higher ones are bound every time
+
+	struct SortEntry
+	{
+		unsigned long long key;
+		int packet;
+	};
+
+	unsigned long long MakeKey(const DrawPacket &packet);
+	void Sort();
+	void UploadUniforms();
+	void Walk(bool bIssue, CProfiler *pProfiler = NULL);
+	void ApplyState(unsigned int changed, unsigned int state, bool bIssue);
+
+	vector<DrawPacket> m_packets;
+	vector<SortEntry> m_order;
+	vector<SortEntry> m_scratch;
+	vector<RenderMaterial> m_materials;
+	CUniformBuffer m_materialBuffer;			// A MaterialUniforms block for each material
+	CUniformBuffer m_objectBuffer;				// An ObjectUniforms block for each packet, in drawing order
+	bool m_buffersCreated;
+	int m_uploadedMaterials;					// Materials in m_materialBuffer
+	float m_farDistance;
+
+	RenderQueueStats m_stats;
+};
@@ -0,0 +1,370 @@
+#include "ShaderPreprocessor.h"
+
+#include <map>
+#include <set>
+
+static const int MAX_INCLUDE_DEPTH = 32;
+
+// A run of lines passed on as they are, or a directive the preprocessor acts on
+struct ShaderSourcePiece
+{
+	enum Type { TEXT, VERSION, GUARD, INCLUDE, INCLUDE_PART, DEFINITION_PART } type;
+	size_t uiBegin, uiEnd;		// TEXT, VERSION and GUARD: where the lines are in the file's text, line ends and all
+	string sInclude;			// INCLUDE: the file named, or "" if the directive is malformed
+	int iLine;					// The first line, counting from 1
+};
+
+struct ShaderSourceFile
+{
+	FILETIME writeTime;
+	long long size;
+	int iPass;					// The last Process call that checked the file was unchanged
+	string sText;
+	vector<ShaderSourcePiece> pieces;
+	bool bPragmaOnce;
+	string sGuard;				// The macro of an include guard wrapping the whole file, or ""
+};
+
+// What one Process call has included so far
+struct ShaderPreprocessorPass
+{
+	set<string> onceFiles;
+	set<string> guards;
+	vector<ShaderSourceStamp> *pStamps;
+};
+
+static map<string, ShaderSourceFile> s_files;
+static int s_pass = 0;
+static int s_reads = 0, s_cacheHits = 0;
+
+static bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool IsNameCharacter(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static size_t SkipSpaces(const string &sText, size_t i, size_t uiEnd)
+{
+	while (i < uiEnd && IsSpace(sText[i]))
+		i++;
+	return i;
+}
+
+// Read the name starting at i, moving i past it
+static string ReadName(const string &sText, size_t &i, size_t uiEnd)
+{
+	size_t uiStart = i;
+	while (i < uiEnd && IsNameCharacter(sText[i]))
+		i++;
+	return sText.substr(uiStart, i - uiStart);
+}
+
+// If the line is a directive, return its name, and move i past it
+static string ReadDirective(const string &sText, size_t &i, size_t uiEnd)
+{
+	i = SkipSpaces(sText, i, uiEnd);
+	if (i == uiEnd || sText[i] != '#')
+		return "";
+	i = SkipSpaces(sText, i + 1, uiEnd);
+	return ReadName(sText, i, uiEnd);
+}
+
+// If the line is "#<sDirective> NAME" and nothing else, return NAME.  Used for guards and #pragma once
+static string ReadGuardLine(const string &sText, size_t i, size_t uiEnd, const char *sDirective)
+{
+	if (ReadDirective(sText, i, uiEnd) != sDirective)
+		return "";
+	i = SkipSpaces(sText, i, uiEnd);
+	string sName = ReadName(sText, i, uiEnd);
+	return SkipSpaces(sText, i, uiEnd) == uiEnd ? sName : "";
+}
+
+static void AddPiece(ShaderSourceFile &file, ShaderSourcePiece::Type type, size_t uiBegin, size_t uiEnd, int iLine)
+{
+	// Lines passed on one after another are one piece
+	if (type == ShaderSourcePiece::TEXT && !file.pieces.empty() && file.pieces.back().type == ShaderSourcePiece::TEXT &&
+		file.pieces.back().uiEnd == uiBegin) {
+		file.pieces.back().uiEnd = uiEnd;
+		return;
+	}
+
+	ShaderSourcePiece piece;
+	piece.type = type;
+	piece.uiBegin = uiBegin;
+	piece.uiEnd = uiEnd;
+	piece.iLine = iLine;
+	file.pieces.push_back(piece);
+}
+
+// Split the file's text into pieces, and look for #pragma once and an include guard
+static void Parse(ShaderSourceFile &file)
+{
+	const string &sText = file.sText;
+	file.pieces.clear();
+	file.bPragmaOnce = false;
+	file.sGuard = "";
+
+	// Where each line starts, and where it ends without its line end
+	vector<size_t> lineBegins, lineEnds;
+	for (size_t uiBegin = 0; uiBegin < sText.size(); ) {
+		size_t uiNewLine = sText.find('\n', uiBegin);
+		lineBegins.push_back(uiBegin);
+		lineEnds.push_back(uiNewLine == string::npos ? sText.size() : uiNewLine);
+		uiBegin = uiNewLine == string::npos ? sText.size() : uiNewLine + 1;
+	}
+	int iNumLines = (int) lineBegins.size();
+
+	// An include guard is the first two and the last lines that aren't blank
+	int iGuardLines[3] = { -1, -1, -1 };
+	for (int i = 0, iFound = 0; i < iNumLines && iFound < 2; i++) {
+		if (SkipSpaces(sText, lineBegins[i], lineEnds[i]) < lineEnds[i])
+			iGuardLines[iFound++] = i;
+	}
+	for (int i = iNumLines - 1; i > iGuardLines[1] && iGuardLines[2] < 0; i--) {
+		if (SkipSpaces(sText, lineBegins[i], lineEnds[i]) < lineEnds[i])
+			iGuardLines[2] = i;
+	}
+	if (iGuardLines[2] >= 0) {
+		string sGuard = ReadGuardLine(sText, lineBegins[iGuardLines[0]], lineEnds[iGuardLines[0]], "ifndef");
+		size_t i = lineBegins[iGuardLines[2]];
+		if (sGuard != "" && ReadGuardLine(sText, lineBegins[iGuardLines[1]], lineEnds[iGuardLines[1]], "define") == sGuard &&
+			ReadDirective(sText, i, lineEnds[iGuardLines[2]]) == "endif")
+			file.sGuard = sGuard;
+	}
+
+	for (int iLine = 0; iLine < iNumLines; iLine++) {
+		size_t uiBegin = lineBegins[iLine], uiContentEnd = lineEnds[iLine];
+		size_t uiEnd = iLine + 1 < iNumLines ? lineBegins[iLine + 1] : sText.size();
+
+		size_t i = uiBegin;
+		string sDirective = ReadDirective(sText, i, uiContentEnd);
+		if (file.sGuard != "" && (iLine == iGuardLines[0] || iLine == iGuardLines[1] || iLine == iGuardLines[2]))
+			AddPiece(file, ShaderSourcePiece::GUARD, uiBegin, uiEnd, iLine + 1);
+		else if (sDirective == "include") {
+			AddPiece(file, ShaderSourcePiece::INCLUDE, uiBegin, uiEnd, iLine + 1);
+			i = SkipSpaces(sText, i, uiContentEnd);
+			size_t uiQuote = i < uiContentEnd && sText[i] == '\"' ? sText.find('\"', i + 1) : string::npos;
+			if (uiQuote < uiContentEnd && SkipSpaces(sText, uiQuote + 1, uiContentEnd) == uiContentEnd)
+				file.pieces.back().sInclude = sText.substr(i + 1, uiQuote - i - 1);
+		} else if (sDirective == "include_part")
+			AddPiece(file, ShaderSourcePiece::INCLUDE_PART, uiBegin, uiEnd, iLine + 1);
+		else if (sDirective == "definition_part")
+			AddPiece(file, ShaderSourcePiece::DEFINITION_PART, uiBegin, uiEnd, iLine + 1);
+		else if (sDirective == "version")
+			AddPiece(file, ShaderSourcePiece::VERSION, uiBegin, uiEnd, iLine + 1);
+		else if (sDirective == "pragma" && ReadGuardLine(sText, uiBegin, uiContentEnd, "pragma") == "once")
+			file.bPragmaOnce = true;
+		else
+			AddPiece(file, ShaderSourcePiece::TEXT, uiBegin, uiEnd, iLine + 1);
+	}
+}
+
+// Opens the file and finds when it was last written, and its size
+static HANDLE OpenSourceFile(const string &sFile, FILETIME &writeTime, long long &size)
+{
+	HANDLE file = CreateFileA(sFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return INVALID_HANDLE_VALUE;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileTime(file, NULL, NULL, &writeTime) || !GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return INVALID_HANDLE_VALUE;
+	}
+	size = fileSize.QuadPart;
+	return file;
+}
+
+static bool IsSameFile(const FILETIME &writeTime, long long size, const FILETIME &otherWriteTime, long long otherSize)
+{
+	return size == otherSize && writeTime.dwLowDateTime == otherWriteTime.dwLowDateTime &&
+		writeTime.dwHighDateTime == otherWriteTime.dwHighDateTime;
+}
+
+// Returns the parsed file, reading it again if it's changed since it was last read, or NULL if it can't be read.  The text is copied
+// out of the mapping rather than kept mapped, as on Windows a mapped file can't be saved over, and shaders are edited while the game runs
+static ShaderSourceFile *GetFile(const string &sFile)
+{
+	map<string, ShaderSourceFile>::iterator it = s_files.find(sFile);
+	if (it != s_files.end() && it->second.iPass == s_pass)
+		return &it->second;
+
+	FILETIME writeTime;
+	long long size;
+	HANDLE file = OpenSourceFile(sFile, writeTime, size);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (it != s_files.end() && IsSameFile(it->second.writeTime, it->second.size, writeTime, size)) {
+		CloseHandle(file);
+		it->second.iPass = s_pass;
+		s_cacheHits++;
+		return &it->second;
+	}
+
+	// An empty file can't be mapped
+	string sText;
+	if (size > 0) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		const char *pData = NULL;
+		if (mapping != NULL)
+			pData = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (pData != NULL) {
+			sText.assign(pData, (size_t) size);
+			UnmapViewOfFile(pData);
+		}
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (pData == NULL) {
+			CloseHandle(file);
+			return NULL;
+		}
+	}
+	CloseHandle(file);
+
+	ShaderSourceFile &parsed = s_files[sFile];
+	parsed.writeTime = writeTime;
+	parsed.size = size;
+	parsed.iPass = s_pass;
+	parsed.sText.swap(sText);
+	Parse(parsed);
+	s_reads++;
+	return &parsed;
+}
+
+static void AppendDefines(const vector<string> &defines, int iNextLine, string &sResult)
+{
+	if (defines.empty())
+		return;
+	for (int i = 0; i < (int) defines.size(); i++)
+		sResult += "#define " + defines[i] + "\n";
+	if (iNextLine > 0) {
+		char sLine[32];
+		sprintf_s(sLine, "#line %d\n", iNextLine);
+		sResult += sLine;
+	}
+}
+
+// Append the file to sResult, or only its include part if it's being included.  #include is followed wherever it is, as it always has been
+static bool Emit(const string &sFile, bool bIncludePart, int iDepth, const vector<string> &defines, ShaderPreprocessorPass &pass,
+	string &sResult, string &sError)
+{
+	ShaderSourceFile *pFile = GetFile(sFile);
+	if (pFile == NULL) {
+		sError = "Cannot read " + sFile;
+		return false;
+	}
+
+	if (pFile->bPragmaOnce && !pass.onceFiles.insert(sFile).second)
+		return true;
+	if (pFile->sGuard != "" && !pass.guards.insert(pFile->sGuard).second)
+		return true;
+
+	ShaderSourceStamp stamp;
+	stamp.sFile = sFile;
+	stamp.writeTime = pFile->writeTime;
+	stamp.size = pFile->size;
+	pass.pStamps->push_back(stamp);
+
+	size_t uiSlash = sFile.find_last_of("/\\");
+	string sDirectory = uiSlash == string::npos ? "" : sFile.substr(0, uiSlash + 1);
+
+	// Without a #version line, the defines go first, and the line numbers are left alone, as #line means something else before GLSL 3.30
+	bool bDefinesDone = iDepth > 0;
+	if (!bDefinesDone) {
+		bool bHasVersion = false;
+		for (int i = 0; i < (int) pFile->pieces.size() && !bHasVersion; i++)
+			bHasVersion = pFile->pieces[i].type == ShaderSourcePiece::VERSION;
+		if (!bHasVersion) {
+			AppendDefines(defines, 0, sResult);
+			bDefinesDone = true;
+		}
+	}
+
+	bool bInIncludePart = false;
+	for (int i = 0; i < (int) pFile->pieces.size(); i++) {
+		const ShaderSourcePiece &piece = pFile->pieces[i];
+		switch (piece.type) {
+		case ShaderSourcePiece::INCLUDE:
+			if (piece.sInclude == "") {
+				char sMessage[1024];
+				sprintf_s(sMessage, "Malformed #include on line %d of %s", piece.iLine, sFile.c_str());
+				sError = sMessage;
+				return false;
+			}
+			if (iDepth + 1 >= MAX_INCLUDE_DEPTH) {
+				sError = "#include nested too deeply in " + sFile;
+				return false;
+			}
+			// pFile stays good, as a file is read at most once a pass, and map entries don't move
+			if (!Emit(sDirectory + piece.sInclude, true, iDepth + 1, defines, pass, sResult, sError))
+				return false;
+			break;
+		case ShaderSourcePiece::INCLUDE_PART:
+			bInIncludePart = true;
+			break;
+		case ShaderSourcePiece::DEFINITION_PART:
+			bInIncludePart = false;
+			break;
+		default:
+			// An include guard's lines go in whatever part they're in, so the #ifndef and #endif always pair up
+			if (!bIncludePart || bInIncludePart || piece.type == ShaderSourcePiece::GUARD)
+				sResult.append(pFile->sText, piece.uiBegin, piece.uiEnd - piece.uiBegin);
+			if (piece.type == ShaderSourcePiece::VERSION && !bDefinesDone) {
+				if (sResult.empty() || sResult[sResult.size() - 1] != '\n')
+					sResult += "\n";
+				AppendDefines(defines, piece.iLine + 1, sResult);
+				bDefinesDone = true;
+			}
+			break;
+		}
+	}
+	return true;
+}
+
+bool CShaderPreprocessor::Process(const string &sFile, const vector<string> &defines, string &sResult, vector<ShaderSourceStamp> &stamps,
+	string &sError)
+{
+	s_pass++;
+	ShaderPreprocessorPass pass;
+	pass.pStamps = &stamps;
+	sResult.clear();
+	stamps.clear();
+	sError.clear();
+	return Emit(sFile, false, 0, defines, pass, sResult, sError);
+}
+
+// The files are looked at afresh, not in the cache, which another shader may have read them into since they were stamped
+bool CShaderPreprocessor::HasChanged(const vector<ShaderSourceStamp> &stamps)
+{
+	for (int i = 0; i < (int) stamps.size(); i++) {
+		FILETIME writeTime;
+		long long size;
+		HANDLE file = OpenSourceFile(stamps[i].sFile, writeTime, size);
+		if (file == INVALID_HANDLE_VALUE)
+			return true;
+		CloseHandle(file);
+		if (!IsSameFile(writeTime, size, stamps[i].writeTime, stamps[i].size))
+			return true;
+	}
+	return false;
+}
+
+void CShaderPreprocessor::ClearCache()
+{
+	s_files.clear();
+}
+
+int CShaderPreprocessor::GetReads()
+{
+	return s_reads;
+}
+
+int CShaderPreprocessor::GetCacheHits()
+{
+	return s_cacheHits;
+}
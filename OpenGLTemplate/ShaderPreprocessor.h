@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Common.h"
+
+// A file a shader was made from, as it was when read, for telling when it changes
+struct ShaderSourceStamp
+{
+	string sFile;
+	FILETIME writeTime;
+	long long size;
+};
+
+// Turns a shader file into the one string given to the compiler.  Besides GLSL's own directives, it handles
+//   #include "file"		puts in the include part of file, found relative to the including file
+//   #include_part		starts the part of a file that other files include.  The rest is only used when the file is the shader itself
+//   #definition_part	ends it
+//   #pragma once		includes the file at most once in a shader
+// A file wrapped whole in #ifndef GUARD, #define GUARD ... #endif is also included only once, and not at all once GUARD has guarded
+// another file.  Files are read through a memory mapping and kept parsed, keyed by path, so a file that many shaders include is
+// read once, and again only when its last write time or size changes
+class CShaderPreprocessor
+{
+public:
+	// Preprocess sFile into sResult, and list the files it was made from in stamps.  Each of defines ("NAME", or "NAME VALUE") goes in
+	// as a #define straight after the #version line, and a #line keeps the compiler's line numbers those of the file.  Returns false,
+	// with the reason in sError, if a file can't be read, an #include is malformed, or includes nest too deeply
+	static bool Process(const string &sFile, const vector<string> &defines, string &sResult, vector<ShaderSourceStamp> &stamps,
+		string &sError);
+
+	// Whether any of the files has been written, or gone, since it was stamped
+	static bool HasChanged(const vector<ShaderSourceStamp> &stamps);
+
+	// Forget the parsed files, so each is read again
+	static void ClearCache();
+
+	// Files read and parsed, and files found parsed and unchanged
+	static int GetReads();
+	static int GetCacheHits();
+};
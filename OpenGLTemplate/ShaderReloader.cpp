@@ -0,0 +1,90 @@
+#include "ShaderReloader.h"
+#include "Shaders.h"
+#include "HighResolutionTimer.h"
+
+static const double SETTLE_TIME = 100.0;	// Milliseconds without a change before reloading
+
+static HANDLE s_notification = INVALID_HANDLE_VALUE;
+static vector<CShaderProgram *> s_programs;
+static CHighResolutionTimer s_settleTimer;
+static bool s_bChanged = false;
+static int s_reloads = 0, s_failures = 0;
+
+bool CShaderReloader::Start(const string &sDirectory)
+{
+	if (s_notification != INVALID_HANDLE_VALUE)
+		FindCloseChangeNotification(s_notification);
+	s_notification = FindFirstChangeNotificationA(sDirectory.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	return s_notification != INVALID_HANDLE_VALUE;
+}
+
+void CShaderReloader::Stop()
+{
+	if (s_notification != INVALID_HANDLE_VALUE)
+		FindCloseChangeNotification(s_notification);
+	s_notification = INVALID_HANDLE_VALUE;
+	s_programs.clear();
+	s_bChanged = false;
+}
+
+void CShaderReloader::AddProgram(CShaderProgram *pProgram)
+{
+	s_programs.push_back(pProgram);
+}
+
+void CShaderReloader::Update()
+{
+	if (s_notification == INVALID_HANDLE_VALUE)
+		return;
+
+	// Reloads under way go first, so one started this frame doesn't take its next step until the next
+	for (int i = 0; i < (int) s_programs.size(); i++) {
+		for (unsigned int features = 0; features < NUM_SHADER_VARIANTS; features++) {
+			CShaderProgram *pProgram = s_programs[i]->FindVariant(features);
+			if (pProgram == NULL || !pProgram->IsReloading())
+				continue;
+			string sError;
+			ShaderReloadStatus status = pProgram->UpdateReload(sError);
+			if (status == SHADER_RELOAD_DONE) {
+				char sMessage[64];
+				sprintf_s(sMessage, "Shader program %d (variant %u) reloaded\n", i, features);
+				OutputDebugString(sMessage);
+				s_reloads++;
+			} else if (status == SHADER_RELOAD_FAILED) {
+				OutputDebugString(("Shader reload failed: " + sError + "\n").c_str());
+				s_failures++;
+			}
+		}
+	}
+
+	if (WaitForSingleObject(s_notification, 0) == WAIT_OBJECT_0) {
+		FindNextChangeNotification(s_notification);
+		s_settleTimer.Start();
+		s_bChanged = true;
+	}
+
+	// Which files changed isn't known, so each program checks its own
+	if (s_bChanged && s_settleTimer.Elapsed() >= SETTLE_TIME) {
+		s_bChanged = false;
+		for (int i = 0; i < (int) s_programs.size(); i++) {
+			for (unsigned int features = 0; features < NUM_SHADER_VARIANTS; features++) {
+				CShaderProgram *pProgram = s_programs[i]->FindVariant(features);
+				string sError;
+				if (pProgram != NULL && pProgram->NeedsReload() && !pProgram->StartReload(sError)) {
+					OutputDebugString(("Shader reload failed: " + sError + "\n").c_str());
+					s_failures++;
+				}
+			}
+		}
+	}
+}
+
+int CShaderReloader::GetReloads()
+{
+	return s_reloads;
+}
+
+int CShaderReloader::GetFailures()
+{
+	return s_failures;
+}
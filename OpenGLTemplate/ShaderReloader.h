@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Common.h"
+
+class CShaderProgram;
+
+// Rebuilds shader programs while the game runs, when a file they were made from is saved.  The shader directory is watched for
+// changes (with inotify on Linux), and once it has been quiet for a moment, so an editor's several writes make one reload, each
+// program whose files have changed is rebuilt in the background and swapped in if it links (see CShaderProgram::StartReload).
+// Compiler and linker errors go to the debug output, and the old program stays in use.  Off until started
+class CShaderReloader
+{
+public:
+	// Watch sDirectory.  Returns false if it can't be watched
+	static bool Start(const string &sDirectory);
+	static void Stop();
+
+	// Watch a program, and the variants of it built so far and later
+	static void AddProgram(CShaderProgram *pProgram);
+
+	// Once a frame: look for changes, and take the next step of any reload under way
+	static void Update();
+
+	// Programs swapped in, and reloads that failed
+	static int GetReloads();
+	static int GetFailures();
+};
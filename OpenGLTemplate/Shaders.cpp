@@ -1,37 +1,130 @@
 #include "Common.h"
-#include "shaders.h"
+#include "Shaders.h"
+#include "GLState.h"
+#include "UniformBuffer.h"
+#include "ProgramCache.h"
+#include "ShaderPreprocessor.h"
 
 
 
 CShader::CShader()
 {
+	m_uiShader = 0;
+	m_iType = 0;
 	m_bLoaded = false;
+	m_bCompiled = false;
 }
 CShader::~CShader()
 {}
 
-// Loads a shader, stored as a text file with filename sFile.  The shader is of type iType (vertex, fragment, geometry, etc.)
-bool CShader::LoadShader(string sFile, int iType)
+// Loads a shader, stored as a text file with filename sFile, through CShaderPreprocessor, which puts in any defines.  The shader is
+// of type iType (vertex, fragment, geometry, etc.)  It's compiled when a program using it is linked, and only if the program isn't
+// in the program cache (see CProgramCache)
+bool CShader::LoadShader(string sFile, int iType, const vector<string> &defines)
 {
-	vector<string> sLines;
-
-	if(!GetLinesFromFile(sFile, false, &sLines)) {
+	string sError;
+	if(!CShaderPreprocessor::Process(sFile, defines, m_sSource, m_stamps, sError)) {
 		char message[1024];
-		sprintf_s(message, "Cannot load shader\n%s\n", sFile.c_str());
+		sprintf_s(message, "Cannot load shader\n%s\n%s\n", sFile.c_str(), sError.c_str());
 		MessageBox(NULL, message, "Error", MB_ICONERROR);
 		return false;
 	}
 
-	const char** sProgram = new const char*[(int)sLines.size()];
-	for (int i = 0; i < (int)sLines.size(); i++) 
-		sProgram[i] = sLines[i].c_str();
-	
-	m_uiShader = glCreateShader(iType);
+	m_sFile = sFile;
+	m_defines = defines;
+	m_iType = iType;
+	m_bLoaded = true;
+	m_bCompiled = false;
+
+	return true;
+}
+
+// Preprocesses the shader's file again, with the same defines, for a reload.  A failure is reported in sError rather than a dialog,
+// and leaves the shader as it was.  The copy reloaded isn't compiled, even if the shader it was copied from was
+bool CShader::Reload(string &sError)
+{
+	string sSource;
+	vector<ShaderSourceStamp> stamps;
+	if (!CShaderPreprocessor::Process(m_sFile, m_defines, sSource, stamps, sError))
+		return false;
+
+	m_sSource.swap(sSource);
+	m_stamps.swap(stamps);
+	m_uiShader = 0;
+	m_bLoaded = true;
+	m_bCompiled = false;
+	return true;
+}
+
+// Adds a define, which goes in when the shader is next reloaded
+void CShader::AddDefine(const string &sDefine)
+{
+	m_defines.push_back(sDefine);
+}
+
+// Returns true if a file the shader was made from has changed since
+bool CShader::HasChanged()
+{
+	return CShaderPreprocessor::HasChanged(m_stamps);
+}
+
+// Whether the driver has finished compiling a shader or linking a program in the background.  Without KHR_parallel_shader_compile
+// (or the ARB one), it's taken to have, and asking for the result waits for it
+static bool IsComplete(UINT uiObject, bool bProgram)
+{
+	if (!GLEW_KHR_parallel_shader_compile && !GLEW_ARB_parallel_shader_compile)
+		return true;
+	int iComplete = GL_TRUE;
+	if (bProgram)
+		glGetProgramiv(uiObject, GL_COMPLETION_STATUS_KHR, &iComplete);
+	else
+		glGetShaderiv(uiObject, GL_COMPLETION_STATUS_KHR, &iComplete);
+	return iComplete != GL_FALSE;
+}
 
-	glShaderSource(m_uiShader, (int)sLines.size(), sProgram, NULL);
+// Compiles the shader, if it hasn't been already
+bool CShader::Compile()
+{
+	if (m_bCompiled)
+		return true;
+	if (!m_bLoaded)
+		return false;
+
+	StartCompile();
+	string sError;
+	if (!FinishCompile(sError)) {
+		MessageBox(NULL, sError.c_str(), "Error", MB_ICONERROR);
+		return false;
+	}
+	return true;
+}
+
+// Hands the source to the driver, which may compile it in the background
+void CShader::StartCompile()
+{
+	if (m_bCompiled || m_uiShader != 0 || !m_bLoaded)
+		return;
+
+	m_uiShader = glCreateShader(m_iType);
+
+	const char *sProgram = m_sSource.c_str();
+	glShaderSource(m_uiShader, 1, &sProgram, NULL);
 	glCompileShader(m_uiShader);
+}
+
+// Returns true while the driver is compiling the shader in the background
+bool CShader::IsCompiling()
+{
+	return m_uiShader != 0 && !m_bCompiled && !IsComplete(m_uiShader, false);
+}
 
-	delete[] sProgram;
+// Checks the compiler's result, waiting for it if it isn't in yet.  On failure, sError says why, and the shader is deleted
+bool CShader::FinishCompile(string &sError)
+{
+	if (m_bCompiled)
+		return true;
+	if (m_uiShader == 0)
+		return false;
 
 	int iCompilationStatus;
 	glGetShaderiv(m_uiShader, GL_COMPILE_STATUS, &iCompilationStatus);
@@ -43,110 +136,83 @@ bool CShader::LoadShader(string sFile, int iType)
 		int iLogLength;
 		glGetShaderInfoLog(m_uiShader, 1024, &iLogLength, sInfoLog);
 		char sShaderType[64];
-		if (iType == GL_VERTEX_SHADER)
+		if (m_iType == GL_VERTEX_SHADER)
 			sprintf_s(sShaderType, "vertex shader");
-		else if (iType == GL_FRAGMENT_SHADER)
+		else if (m_iType == GL_FRAGMENT_SHADER)
 			sprintf_s(sShaderType, "fragment shader");
-		else if (iType == GL_GEOMETRY_SHADER)
+		else if (m_iType == GL_GEOMETRY_SHADER)
 			sprintf_s(sShaderType, "geometry shader");
-		else if (iType == GL_TESS_CONTROL_SHADER)
+		else if (m_iType == GL_TESS_CONTROL_SHADER)
 			sprintf_s(sShaderType, "tesselation control shader");
-		else if (iType == GL_TESS_EVALUATION_SHADER)
+		else if (m_iType == GL_TESS_EVALUATION_SHADER)
 			sprintf_s(sShaderType, "tesselation evaluation shader");
 		else
 			sprintf_s(sShaderType, "unknown shader type");
 
-		sprintf_s(sFinalMessage, "Error in %s!\n%s\nShader file not compiled.  The compiler returned:\n\n%s", sShaderType, sFile.c_str(), sInfoLog);
+		sprintf_s(sFinalMessage, "Error in %s!\n%s\nShader file not compiled.  The compiler returned:\n\n%s", sShaderType, m_sFile.c_str(), sInfoLog);
 
-		MessageBox(NULL, sFinalMessage, "Error", MB_ICONERROR);
+		sError = sFinalMessage;
+		glDeleteShader(m_uiShader);
+		m_uiShader = 0;
 		return false;
 	}
-	m_iType = iType;
-	m_bLoaded = true;
-
-	return true;
-}
-
-
-// Loads a file into a vector of strings (vResult)
-bool CShader::GetLinesFromFile(string sFile, bool bIncludePart, vector<string>* vResult)
-{
-	FILE* fp;
-	fopen_s(&fp, sFile.c_str(), "rt");
-	if(!fp)return false;
-
-	string sDirectory;
-	int slashIndex = -1;
-
-	for (int i = (int)sFile.size()-1; i == 0; i--)
-	{
-		if(sFile[i] == '\\' || sFile[i] == '/')
-		{
-			slashIndex = i;
-			break;
-		}
-	}
-
-	sDirectory = sFile.substr(0, slashIndex+1);
-
-	// Get all lines from a file
-
-	char sLine[255];
-
-	bool bInIncludePart = false;
-
-	while(fgets(sLine, 255, fp))
-	{
-		stringstream ss(sLine);
-		string sFirst;
-		ss >> sFirst;
-		if(sFirst == "#include")
-		{
-			string sFileName;
-			ss >> sFileName;
-			if((int)sFileName.size() > 0 && sFileName[0] == '\"' && sFileName[(int)sFileName.size()-1] == '\"')
-			{
-				sFileName = sFileName.substr(1, (int)sFileName.size()-2);
-				GetLinesFromFile(sDirectory+sFileName, true, vResult);
-			}
-		}
-		else if(sFirst == "#include_part")
-			bInIncludePart = true;
-		else if(sFirst == "#definition_part")
-			bInIncludePart = false;
-		else if(!bIncludePart || (bIncludePart && bInIncludePart))
-			vResult->push_back(sLine);
-	}
-	fclose(fp);
+	m_bCompiled = true;
 
 	return true;
 }
 
 
-// Returns true if the shader was loaded and compiled
+// Returns true if the shader was loaded
 bool CShader::IsLoaded()
 {
 	return m_bLoaded;
 }
 
-// Returns the ID of the shader
+// Returns the ID of the shader, 0 until it's compiled
 UINT CShader::GetShaderID()
 {
 	return m_uiShader;
 }
 
+// Returns the shader's type, GL_VERTEX_SHADER, GL_FRAGMENT_SHADER...
+int CShader::GetType()
+{
+	return m_iType;
+}
+
+// Returns the source, as given to the compiler
+const string &CShader::GetSource()
+{
+	return m_sSource;
+}
+
 // Deletes the shader and frees GPU memory
 void CShader::DeleteShader()
 {
-	if(!IsLoaded())
-		return;
 	m_bLoaded = false;
+	m_bCompiled = false;
+	if(m_uiShader == 0)
+		return;
 	glDeleteShader(m_uiShader);
+	m_uiShader = 0;
 }
 
 CShaderProgram::CShaderProgram()
 {
+	m_uiProgram = 0;
 	m_bLinked = false;
+	m_uiReloadProgram = 0;
+	m_iReloadStage = RELOAD_NONE;
+	m_reloadKey = 0;
+	for (int i = 0; i < NUM_SHADER_VARIANTS; i++)
+		m_pVariants[i] = NULL;
+}
+
+// The variants' GL objects are left for DeleteProgram, as the program's are
+CShaderProgram::~CShaderProgram()
+{
+	for (int i = 0; i < NUM_SHADER_VARIANTS; i++)
+		delete m_pVariants[i];
 }
 
 // Creates a new shader program
@@ -155,53 +221,278 @@ void CShaderProgram::CreateProgram()
 	m_uiProgram = glCreateProgram();
 }
 
-// Adds a compiled shader to a program
+// Adds a shader to a program.  The shader must stay alive until the program is linked
 bool CShaderProgram::AddShaderToProgram(CShader* shShader)
 {
 	if(!shShader->IsLoaded())
 		return false;
 
-	glAttachShader(m_uiProgram, shShader->GetShaderID());
+	m_shaders.push_back(shShader);
 
 	return true;
 }
 
-// Performs final linkage of the OpenGL shader program
+// Performs final linkage of the OpenGL shader program, or loads it from the program cache if it's there.  Otherwise the shaders
+// are compiled, and the program cached once linked
 bool CShaderProgram::LinkProgram()
 {
-	glLinkProgram(m_uiProgram);
-	int iLinkStatus;
-	glGetProgramiv(m_uiProgram, GL_LINK_STATUS, &iLinkStatus);
+	vector<CShader *> shaders;
+	shaders.swap(m_shaders);
+
+	bool bCache = CProgramCache::IsEnabled();
+	unsigned long long key = bCache ? CProgramCache::MakeKey(shaders) : 0;
+	int iLinkStatus = GL_FALSE;
+	if (bCache && CProgramCache::Load(m_uiProgram, key))
+		iLinkStatus = GL_TRUE;
+	else {
+		for (int i = 0; i < (int) shaders.size(); i++) {
+			if (!shaders[i]->Compile())
+				return false;
+			glAttachShader(m_uiProgram, shaders[i]->GetShaderID());
+		}
+		if (bCache)
+			glProgramParameteri(m_uiProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
-	if (iLinkStatus == FALSE) 
-	{
-		char sInfoLog[1024];
-		char sFinalMessage[1536];
-		int iLogLength;
-		glGetProgramInfoLog(m_uiProgram, 1024, &iLogLength, sInfoLog);
-		sprintf_s(sFinalMessage, "Error! Shader program wasn't linked! The linker returned:\n\n%s", sInfoLog);
-		MessageBox(NULL, sFinalMessage, "Error", MB_ICONERROR);
-		return false;
+		glLinkProgram(m_uiProgram);
+		glGetProgramiv(m_uiProgram, GL_LINK_STATUS, &iLinkStatus);
+
+		if (iLinkStatus == FALSE) 
+		{
+			char sInfoLog[1024];
+			char sFinalMessage[1536];
+			int iLogLength;
+			glGetProgramInfoLog(m_uiProgram, 1024, &iLogLength, sInfoLog);
+			sprintf_s(sFinalMessage, "Error! Shader program wasn't linked! The linker returned:\n\n%s", sInfoLog);
+			MessageBox(NULL, sFinalMessage, "Error", MB_ICONERROR);
+			return false;
+		}
+
+		if (bCache)
+			CProgramCache::Save(m_uiProgram, key);
 	}
 
 	m_bLinked = iLinkStatus == GL_TRUE;
+	BuildUniformTable();
+	BindUniformBlocks();
+
+	m_sources.clear();
+	for (int i = 0; i < (int) shaders.size(); i++)
+		m_sources.push_back(*shaders[i]);
 	return m_bLinked;
 }
 
+// Bind the shared uniform blocks the program uses to their binding points
+void CShaderProgram::BindUniformBlocks()
+{
+	for (int i = 0; i < NUM_UNIFORM_BLOCKS; i++) {
+		GLuint uiBlock = glGetUniformBlockIndex(m_uiProgram, UNIFORM_BLOCK_NAMES[i]);
+		if (uiBlock != GL_INVALID_INDEX)
+			glUniformBlockBinding(m_uiProgram, uiBlock, i);
+	}
+}
+
+static const char *const SHADER_FEATURE_DEFINES[NUM_SHADER_FEATURES] = { "USE_TEXTURE", "RENDER_SKYBOX" };
+
+CShaderProgram *CShaderProgram::GetVariant(unsigned int features)
+{
+	if (features == 0 || features >= NUM_SHADER_VARIANTS || !m_bLinked)
+		return this;
+	if (m_pVariants[features] == NULL) {
+		CShaderProgram *pVariant = new CShaderProgram;
+		m_pVariants[features] = pVariant;
+
+		vector<CShader> shaders = m_sources;
+		string sError;
+		for (int i = 0; i < (int) shaders.size() && sError == ""; i++) {
+			for (int j = 0; j < NUM_SHADER_FEATURES; j++) {
+				if (features & (1 << j))
+					shaders[i].AddDefine(SHADER_FEATURE_DEFINES[j]);
+			}
+			shaders[i].Reload(sError);
+		}
+		if (sError != "") {
+			char message[1024];
+			sprintf_s(message, "Cannot build shader variant %u\n%s\n", features, sError.c_str());
+			MessageBox(NULL, message, "Error", MB_ICONERROR);
+			return this;
+		}
+
+		pVariant->CreateProgram();
+		for (int i = 0; i < (int) shaders.size(); i++)
+			pVariant->AddShaderToProgram(&shaders[i]);
+		pVariant->LinkProgram();
+
+		// The variant keeps copies of the shaders' sources for reloading, but not their shader objects, so delete them as FinishReload does
+		for (int i = 0; i < (int) shaders.size(); i++)
+			shaders[i].DeleteShader();
+	}
+	return m_pVariants[features]->m_bLinked ? m_pVariants[features] : this;
+}
+
+CShaderProgram *CShaderProgram::FindVariant(unsigned int features)
+{
+	if (features == 0)
+		return this;
+	if (features >= NUM_SHADER_VARIANTS || m_pVariants[features] == NULL || !m_pVariants[features]->m_bLinked)
+		return NULL;
+	return m_pVariants[features];
+}
+
+// Returns true if a file one of the program's shaders was made from has changed since it was linked
+bool CShaderProgram::NeedsReload()
+{
+	for (int i = 0; i < (int) m_sources.size(); i++) {
+		if (m_sources[i].HasChanged())
+			return true;
+	}
+	return false;
+}
+
+// Preprocess the shaders again and start building a new program from them, or load it from the program cache.  A reload already
+// under way is dropped, for the files have changed again since it started
+bool CShaderProgram::StartReload(string &sError)
+{
+	CancelReload();
+	if (!m_bLinked || m_sources.empty()) {
+		sError = "The program was never linked";
+		return false;
+	}
+
+	m_reloadShaders = m_sources;
+	vector<CShader *> shaders;
+	for (int i = 0; i < (int) m_reloadShaders.size(); i++) {
+		if (!m_reloadShaders[i].Reload(sError)) {
+			m_reloadShaders.clear();
+			return false;
+		}
+		shaders.push_back(&m_reloadShaders[i]);
+	}
+
+	m_uiReloadProgram = glCreateProgram();
+	bool bCache = CProgramCache::IsEnabled();
+	m_reloadKey = bCache ? CProgramCache::MakeKey(shaders) : 0;
+	if (bCache && CProgramCache::Load(m_uiReloadProgram, m_reloadKey)) {
+		m_iReloadStage = RELOAD_LOADED;
+		return true;
+	}
+
+	for (int i = 0; i < (int) m_reloadShaders.size(); i++)
+		m_reloadShaders[i].StartCompile();
+	m_iReloadStage = RELOAD_COMPILING;
+	return true;
+}
+
+// Take the reload's next step: link once the shaders have compiled, and use the program once it's linked.  On failure, sError says
+// why, and the old program carries on
+ShaderReloadStatus CShaderProgram::UpdateReload(string &sError)
+{
+	if (m_iReloadStage == RELOAD_COMPILING) {
+		for (int i = 0; i < (int) m_reloadShaders.size(); i++) {
+			if (m_reloadShaders[i].IsCompiling())
+				return SHADER_RELOAD_PENDING;
+		}
+		for (int i = 0; i < (int) m_reloadShaders.size(); i++) {
+			if (!m_reloadShaders[i].FinishCompile(sError)) {
+				CancelReload();
+				return SHADER_RELOAD_FAILED;
+			}
+			glAttachShader(m_uiReloadProgram, m_reloadShaders[i].GetShaderID());
+		}
+		if (CProgramCache::IsEnabled())
+			glProgramParameteri(m_uiReloadProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(m_uiReloadProgram);
+		m_iReloadStage = RELOAD_LINKING;
+		return SHADER_RELOAD_PENDING;
+	}
+
+	if (m_iReloadStage == RELOAD_LINKING) {
+		if (!IsComplete(m_uiReloadProgram, true))
+			return SHADER_RELOAD_PENDING;
+
+		int iLinkStatus = GL_FALSE;
+		glGetProgramiv(m_uiReloadProgram, GL_LINK_STATUS, &iLinkStatus);
+		if (iLinkStatus == GL_FALSE) {
+			char sInfoLog[1024];
+			char sFinalMessage[1536];
+			int iLogLength;
+			glGetProgramInfoLog(m_uiReloadProgram, 1024, &iLogLength, sInfoLog);
+			sprintf_s(sFinalMessage, "Error! Shader program wasn't linked! The linker returned:\n\n%s", sInfoLog);
+			sError = sFinalMessage;
+			CancelReload();
+			return SHADER_RELOAD_FAILED;
+		}
+		if (CProgramCache::IsEnabled())
+			CProgramCache::Save(m_uiReloadProgram, m_reloadKey);
+		FinishReload();
+		return SHADER_RELOAD_DONE;
+	}
+
+	if (m_iReloadStage == RELOAD_LOADED) {
+		FinishReload();
+		return SHADER_RELOAD_DONE;
+	}
+
+	sError = "No reload is under way";
+	return SHADER_RELOAD_FAILED;
+}
+
+bool CShaderProgram::IsReloading()
+{
+	return m_iReloadStage != RELOAD_NONE;
+}
+
+// Swap the new program in for the old, which is deleted.  The shaders go with it, and the uniforms are all set afresh
+void CShaderProgram::FinishReload()
+{
+	CGLState::DeleteProgram(m_uiProgram);
+	m_uiProgram = m_uiReloadProgram;
+	m_uiReloadProgram = 0;
+	BuildUniformTable();
+	BindUniformBlocks();
+
+	for (int i = 0; i < (int) m_reloadShaders.size(); i++)
+		m_reloadShaders[i].DeleteShader();
+	m_sources.swap(m_reloadShaders);
+	m_reloadShaders.clear();
+	m_iReloadStage = RELOAD_NONE;
+}
+
+void CShaderProgram::CancelReload()
+{
+	if (m_uiReloadProgram != 0)
+		CGLState::DeleteProgram(m_uiReloadProgram);
+	for (int i = 0; i < (int) m_reloadShaders.size(); i++)
+		m_reloadShaders[i].DeleteShader();
+	m_uiReloadProgram = 0;
+	m_reloadShaders.clear();
+	m_iReloadStage = RELOAD_NONE;
+}
+
 // Deletes the program and frees memory on the GPU
 void CShaderProgram::DeleteProgram()
 {
+	CancelReload();
+	for (int i = 0; i < NUM_SHADER_VARIANTS; i++) {
+		if (m_pVariants[i] == NULL)
+			continue;
+		m_pVariants[i]->DeleteProgram();
+		delete m_pVariants[i];
+		m_pVariants[i] = NULL;
+	}
 	if(!m_bLinked)
 		return;
 	m_bLinked = false;
-	glDeleteProgram(m_uiProgram);
+	CGLState::DeleteProgram(m_uiProgram);
+	m_uniforms.clear();
+	m_uniformSlots.clear();
+	m_shadow.clear();
 }
 
 // Instructs OpenGL to use this program
 void CShaderProgram::UseProgram()
 {
 	if(m_bLinked)
-		glUseProgram(m_uiProgram);
+		CGLState::UseProgram(m_uiProgram);
 }
 
 // Returns the OpenGL program ID
@@ -210,98 +501,248 @@ UINT CShaderProgram::GetProgramID()
 	return m_uiProgram;
 }
 
+// Bytes a value of a uniform type takes, as SetUniform is given it, or 0 for types whose values aren't kept
+static int GetUniformTypeSize(GLenum type)
+{
+	switch (type) {
+	case GL_FLOAT: case GL_INT: case GL_UNSIGNED_INT: case GL_BOOL:
+	case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE: case GL_SAMPLER_2D_SHADOW:
+		return 4;
+	case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2:
+		return 8;
+	case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3:
+		return 12;
+	case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2:
+		return 16;
+	case GL_FLOAT_MAT3:
+		return 36;
+	case GL_FLOAT_MAT4:
+		return 64;
+	}
+	return 0;
+}
+
+// Make the table of the program's uniforms, from the driver's list of active ones.  Arrays are listed once, as name[0]; they go in
+// the table by their name with and without the [0], and by the name of each element.  Uniforms in blocks have no location, and
+// are left out
+void CShaderProgram::BuildUniformTable()
+{
+	m_uniforms.clear();
+	m_uniformSlots.clear();
+	m_shadow.clear();
+
+	int iNumUniforms = 0, iMaxLength = 0;
+	glGetProgramiv(m_uiProgram, GL_ACTIVE_UNIFORMS, &iNumUniforms);
+	glGetProgramiv(m_uiProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &iMaxLength);
+	vector<char> sBuffer(iMaxLength + 1);
+	for (int i = 0; i < iNumUniforms; i++) {
+		GLint iSize = 0;
+		GLenum type = 0;
+		GLsizei iLength = 0;
+		glGetActiveUniform(m_uiProgram, i, (GLsizei) sBuffer.size(), &iLength, &iSize, &type, &sBuffer[0]);
+		string sName(&sBuffer[0], iLength);
+		int iLocation = glGetUniformLocation(m_uiProgram, sName.c_str());
+		if (iLocation < 0)
+			continue;
+
+		size_t uiBracket = sName.rfind("[0]");
+		if (uiBracket == string::npos || uiBracket + 3 != sName.size()) {
+			AddUniform(sName, iLocation, GetUniformTypeSize(type));
+			continue;
+		}
+
+		string sBase = sName.substr(0, uiBracket);
+		AddUniform(sBase, iLocation, 0);
+		AddUniform(sName, iLocation, 0);
+		for (int j = 1; j < iSize; j++) {
+			char sIndex[16];
+			sprintf_s(sIndex, "[%d]", j);
+			string sElement = sBase + sIndex;
+			int iElementLocation = glGetUniformLocation(m_uiProgram, sElement.c_str());
+			if (iElementLocation >= 0)
+				AddUniform(sElement, iElementLocation, 0);
+		}
+	}
+
+	// At most half full, so a lookup for a name that isn't there soon finds an empty slot
+	int iNumSlots = 16;
+	while (iNumSlots < 2 * (int) m_uniforms.size())
+		iNumSlots *= 2;
+	m_uniformSlots.assign(iNumSlots, -1);
+	for (int i = 0; i < (int) m_uniforms.size(); i++) {
+		unsigned int uiSlot = m_uniforms[i].uiHash & (iNumSlots - 1);
+		while (m_uniformSlots[uiSlot] >= 0)
+			uiSlot = (uiSlot + 1) & (iNumSlots - 1);
+		m_uniformSlots[uiSlot] = i;
+	}
+}
+
+// Add a uniform to the table, keeping its value if iShadowSize isn't 0
+void CShaderProgram::AddUniform(const string &sName, int iLocation, int iShadowSize)
+{
+	Uniform uniform;
+	uniform.sName = sName;
+	uniform.uiHash = CUniformName::Hash(sName.c_str());
+	uniform.iLocation = iLocation;
+	uniform.iShadowOffset = iShadowSize > 0 ? (int) m_shadow.size() : -1;
+	uniform.iShadowSize = iShadowSize;
+	uniform.bShadowValid = false;
+	m_uniforms.push_back(uniform);
+	m_shadow.resize(m_shadow.size() + iShadowSize);
+}
+
+CShaderProgram::Uniform *CShaderProgram::FindUniform(const CUniformName &name)
+{
+	if (m_uniformSlots.empty())
+		return NULL;
+
+	unsigned int uiMask = (unsigned int) m_uniformSlots.size() - 1;
+	for (unsigned int uiSlot = name.GetHash() & uiMask; ; uiSlot = (uiSlot + 1) & uiMask) {
+		int iIndex = m_uniformSlots[uiSlot];
+		if (iIndex < 0)
+			return NULL;
+		Uniform &uniform = m_uniforms[iIndex];
+		if (uniform.uiHash == name.GetHash() && strcmp(uniform.sName.c_str(), name.GetName()) == 0)
+			return &uniform;
+	}
+}
+
+int CShaderProgram::GetUniformLocation(const CUniformName &name)
+{
+	Uniform *pUniform = FindUniform(name);
+	return pUniform != NULL ? pUniform->iLocation : -1;
+}
+
+int CShaderProgram::ChangeUniform(const CUniformName &name, const void *pValue, int iSize)
+{
+	Uniform *pUniform = FindUniform(name);
+	if (pUniform == NULL)
+		return -1;
+
+	// Values that aren't kept, or are set as something else, are always passed on
+	if (pUniform->iShadowOffset < 0 || pUniform->iShadowSize != iSize) {
+		pUniform->bShadowValid = false;
+		CGLState::CountCall(true);
+		return pUniform->iLocation;
+	}
+
+	BYTE *pShadow = &m_shadow[pUniform->iShadowOffset];
+	if (pUniform->bShadowValid && memcmp(pShadow, pValue, iSize) == 0) {
+		CGLState::CountCall(false);
+		return -1;
+	}
+	memcpy(pShadow, pValue, iSize);
+	pUniform->bShadowValid = true;
+	CGLState::CountCall(true);
+	return pUniform->iLocation;
+}
+
 // A collection of functions to set uniform variables inside shaders
 
 // Setting floats
 
-void CShaderProgram::SetUniform(string sName, float* fValues, int iCount)
+void CShaderProgram::SetUniform(const CUniformName &name, float* fValues, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform1fv(iLoc, iCount, fValues);
+	int iLoc = ChangeUniform(name, fValues, iCount * (int) sizeof(float));
+	if (iLoc >= 0)
+		glUniform1fv(iLoc, iCount, fValues);
 }
 
-void CShaderProgram::SetUniform(string sName, const float fValue)
+void CShaderProgram::SetUniform(const CUniformName &name, const float fValue)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform1fv(iLoc, 1, &fValue);
+	int iLoc = ChangeUniform(name, &fValue, (int) sizeof(fValue));
+	if (iLoc >= 0)
+		glUniform1fv(iLoc, 1, &fValue);
 }
 
 // Setting vectors
 
-void CShaderProgram::SetUniform(string sName, glm::vec2* vVectors, int iCount)
+void CShaderProgram::SetUniform(const CUniformName &name, glm::vec2* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform2fv(iLoc, iCount, (GLfloat*)vVectors);
+	int iLoc = ChangeUniform(name, vVectors, iCount * (int) sizeof(glm::vec2));
+	if (iLoc >= 0)
+		glUniform2fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::vec2 vVector)
+void CShaderProgram::SetUniform(const CUniformName &name, const glm::vec2 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform2fv(iLoc, 1, (GLfloat*)&vVector);
+	int iLoc = ChangeUniform(name, &vVector, (int) sizeof(vVector));
+	if (iLoc >= 0)
+		glUniform2fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
-void CShaderProgram::SetUniform(string sName, glm::vec3* vVectors, int iCount)
+void CShaderProgram::SetUniform(const CUniformName &name, glm::vec3* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform3fv(iLoc, iCount, (GLfloat*)vVectors);
+	int iLoc = ChangeUniform(name, vVectors, iCount * (int) sizeof(glm::vec3));
+	if (iLoc >= 0)
+		glUniform3fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::vec3 vVector)
+void CShaderProgram::SetUniform(const CUniformName &name, const glm::vec3 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform3fv(iLoc, 1, (GLfloat*)&vVector);
+	int iLoc = ChangeUniform(name, &vVector, (int) sizeof(vVector));
+	if (iLoc >= 0)
+		glUniform3fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
-void CShaderProgram::SetUniform(string sName, glm::vec4* vVectors, int iCount)
+void CShaderProgram::SetUniform(const CUniformName &name, glm::vec4* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform4fv(iLoc, iCount, (GLfloat*)vVectors);
+	int iLoc = ChangeUniform(name, vVectors, iCount * (int) sizeof(glm::vec4));
+	if (iLoc >= 0)
+		glUniform4fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::vec4 vVector)
+void CShaderProgram::SetUniform(const CUniformName &name, const glm::vec4 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform4fv(iLoc, 1, (GLfloat*)&vVector);
+	int iLoc = ChangeUniform(name, &vVector, (int) sizeof(vVector));
+	if (iLoc >= 0)
+		glUniform4fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
 // Setting 3x3 matrices
 
-void CShaderProgram::SetUniform(string sName, glm::mat3* mMatrices, int iCount)
+void CShaderProgram::SetUniform(const CUniformName &name, glm::mat3* mMatrices, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniformMatrix3fv(iLoc, iCount, FALSE, (GLfloat*)mMatrices);
+	int iLoc = ChangeUniform(name, mMatrices, iCount * (int) sizeof(glm::mat3));
+	if (iLoc >= 0)
+		glUniformMatrix3fv(iLoc, iCount, FALSE, (GLfloat*)mMatrices);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::mat3 mMatrix)
+void CShaderProgram::SetUniform(const CUniformName &name, const glm::mat3 mMatrix)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniformMatrix3fv(iLoc, 1, FALSE, (GLfloat*)&mMatrix);
+	int iLoc = ChangeUniform(name, &mMatrix, (int) sizeof(mMatrix));
+	if (iLoc >= 0)
+		glUniformMatrix3fv(iLoc, 1, FALSE, (GLfloat*)&mMatrix);
 }
 
 // Setting 4x4 matrices
 
-void CShaderProgram::SetUniform(string sName, glm::mat4* mMatrices, int iCount)
+void CShaderProgram::SetUniform(const CUniformName &name, glm::mat4* mMatrices, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniformMatrix4fv(iLoc, iCount, FALSE, (GLfloat*)mMatrices);
+	int iLoc = ChangeUniform(name, mMatrices, iCount * (int) sizeof(glm::mat4));
+	if (iLoc >= 0)
+		glUniformMatrix4fv(iLoc, iCount, FALSE, (GLfloat*)mMatrices);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::mat4 mMatrix)
+void CShaderProgram::SetUniform(const CUniformName &name, const glm::mat4 mMatrix)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniformMatrix4fv(iLoc, 1, FALSE, (GLfloat*)&mMatrix);
+	int iLoc = ChangeUniform(name, &mMatrix, (int) sizeof(mMatrix));
+	if (iLoc >= 0)
+		glUniformMatrix4fv(iLoc, 1, FALSE, (GLfloat*)&mMatrix);
 }
 
 // Setting integers
 
-void CShaderProgram::SetUniform(string sName, int* iValues, int iCount)
+void CShaderProgram::SetUniform(const CUniformName &name, int* iValues, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform1iv(iLoc, iCount, iValues);
+	int iLoc = ChangeUniform(name, iValues, iCount * (int) sizeof(int));
+	if (iLoc >= 0)
+		glUniform1iv(iLoc, iCount, iValues);
 }
 
-void CShaderProgram::SetUniform(string sName, const int iValue)
+void CShaderProgram::SetUniform(const CUniformName &name, const int iValue)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
-	glUniform1i(iLoc, iValue);
-}
\ No newline at end of file
+	int iLoc = ChangeUniform(name, &iValue, (int) sizeof(iValue));
+	if (iLoc >= 0)
+		glUniform1i(iLoc, iValue);
+}
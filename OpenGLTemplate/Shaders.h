@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Common.h"
+#include "ShaderPreprocessor.h"
 
 
 // A class that provides a wrapper around an OpenGL shader
@@ -10,27 +11,106 @@ public:
 	CShader();
 	~CShader();
 
-	bool LoadShader(string sFile, int iType);
+	bool LoadShader(string sFile, int iType, const vector<string> &defines = vector<string>());
+	bool Reload(string &sError);
+	void AddDefine(const string &sDefine);
+	bool HasChanged();
+
+	bool Compile();
 	void DeleteShader();
 
-	bool GetLinesFromFile(string sFile, bool bIncludePart, vector<string>* vResult);
+	// Compiling in steps, so as not to wait for the driver: StartCompile, then FinishCompile once IsCompiling returns false
+	void StartCompile();
+	bool IsCompiling();
+	bool FinishCompile(string &sError);
 
 	bool IsLoaded();
 	UINT GetShaderID();
+	int GetType();
+	const string &GetSource();
 
 
 private:
 	UINT m_uiShader; // ID of shader
 	int m_iType; // GL_VERTEX_SHADER, GL_FRAGMENT_SHADER...
-	bool m_bLoaded; // Whether shader was loaded and compiled
+	bool m_bLoaded; // Whether shader was loaded
+	bool m_bCompiled; // Whether it was compiled
+	string m_sFile;
+	vector<string> m_defines;
+	string m_sSource;
+	vector<ShaderSourceStamp> m_stamps; // The files the source was made from
+};
+
+
+// FNV-1a hash of the first L characters of a string literal, unrolled by the template so the compiler folds it to a constant
+template <size_t L> struct UniformNameHash
+{
+	template <size_t N> static constexpr unsigned int Of(const char (&sName)[N])
+	{
+		return (UniformNameHash<L - 1>::Of(sName) ^ (unsigned char) sName[L - 1]) * 16777619u;
+	}
+};
+
+template <> struct UniformNameHash<0>
+{
+	template <size_t N> static constexpr unsigned int Of(const char (&)[N]) { return 2166136261u; }
 };
 
+// A uniform's name and a hash of it, for looking the uniform up.  Made from a string literal, as it usually is, the hash is a
+// constant, so a lookup allocates nothing and hashes nothing.  A char array is taken to be a literal, filled to its end, so pass a
+// buffer as a string.  Made from a string, it points into the string, so it's only good until the string changes
+class CUniformName
+{
+public:
+	template <size_t N> constexpr CUniformName(const char (&sName)[N]) : m_sName(sName), m_uiHash(UniformNameHash<N - 1>::Of(sName)) {}
+	CUniformName(const string &sName) : m_sName(sName.c_str()), m_uiHash(Hash(sName.c_str())) {}
+
+	const char *GetName() const { return m_sName; }
+	unsigned int GetHash() const { return m_uiHash; }
+
+	// The same hash, worked out at run time
+	static unsigned int Hash(const char *sName)
+	{
+		unsigned int uiHash = 2166136261u;
+		for (int i = 0; sName[i] != '\0'; i++)
+			uiHash = (uiHash ^ (unsigned char) sName[i]) * 16777619u;
+		return uiHash;
+	}
+
+private:
+	const char *m_sName;
+	unsigned int m_uiHash;
+};
 
-// A class the provides a wrapper around an OpenGL shader program
+
+// Features a shader program can be built with, as a bitmask.  Each is a #define in the variant of the program built with it (see
+// CShaderProgram::GetVariant), so the shaders choose what to do when they're compiled, not for every fragment
+enum ShaderFeature
+{
+	SHADER_FEATURE_TEXTURE = 1,		// USE_TEXTURE: the colour comes from sampler0, not the vertex colour
+	SHADER_FEATURE_SKYBOX = 2		// RENDER_SKYBOX: the colour comes from CubeMapTex
+};
+
+const int NUM_SHADER_FEATURES = 2;
+const int NUM_SHADER_VARIANTS = 1 << NUM_SHADER_FEATURES;
+
+enum ShaderReloadStatus
+{
+	SHADER_RELOAD_PENDING,		// Waiting for the driver
+	SHADER_RELOAD_DONE,			// The new program is in use
+	SHADER_RELOAD_FAILED		// The old one still is
+};
+
+// A class the provides a wrapper around an OpenGL shader program.  Linking it makes a table of its uniforms, with their locations,
+// so setting one doesn't ask the driver where it is.  The table also keeps the last value set for each uniform that isn't an array,
+// and a call setting the same value again is skipped.  Uniforms in the shared blocks (see UniformBuffer.h) are set through their
+// buffers instead, and aren't in the table.  Uniforms are set in the program in use, so the program must be in use to set them, as it
+// always had to be
 class CShaderProgram
 {
 public:
 	CShaderProgram();
+	~CShaderProgram();
 
 	void CreateProgram();
 	void DeleteProgram();
@@ -42,32 +122,95 @@ public:
 
 	UINT GetProgramID();
 
+	// The variant of the program with the features (ShaderFeature bits) defined in its shaders, built the first time it's asked for,
+	// from the files the program was.  The variant with none is the program itself.  One that fails to build is reported, and the
+	// program itself returned in its place
+	CShaderProgram *GetVariant(unsigned int features);
+
+	// The variant if it's been built, or NULL
+	CShaderProgram *FindVariant(unsigned int features);
+
+	// Rebuilding the program when a file it was made from changes (see CShaderReloader).  The new program is built alongside the old
+	// one, which stays in use until the new one has linked, and for good if it doesn't.  StartReload preprocesses the shaders again and
+	// starts them compiling, and each UpdateReload takes the next step, without waiting for the driver if it can compile in the
+	// background, so one call a frame holds no frame up for long
+	bool NeedsReload();
+	bool StartReload(string &sError);
+	ShaderReloadStatus UpdateReload(string &sError);
+	bool IsReloading();
+
+	// The uniform's location, or -1 if the program has no such uniform
+	int GetUniformLocation(const CUniformName &name);
+
 	// Setting vectors
-	void SetUniform(string sName, glm::vec2* vVectors, int iCount = 1);
-	void SetUniform(string sName, const glm::vec2 vVector);
-	void SetUniform(string sName, glm::vec3* vVectors, int iCount = 1);
-	void SetUniform(string sName, const glm::vec3 vVector);
-	void SetUniform(string sName, glm::vec4* vVectors, int iCount = 1);
-	void SetUniform(string sName, const glm::vec4 vVector);
+	void SetUniform(const CUniformName &name, glm::vec2* vVectors, int iCount = 1);
+	void SetUniform(const CUniformName &name, const glm::vec2 vVector);
+	void SetUniform(const CUniformName &name, glm::vec3* vVectors, int iCount = 1);
+	void SetUniform(const CUniformName &name, const glm::vec3 vVector);
+	void SetUniform(const CUniformName &name, glm::vec4* vVectors, int iCount = 1);
+	void SetUniform(const CUniformName &name, const glm::vec4 vVector);
 
 	// Setting floats
-	void SetUniform(string sName, float* fValues, int iCount = 1);
-	void SetUniform(string sName, const float fValue);
+	void SetUniform(const CUniformName &name, float* fValues, int iCount = 1);
+	void SetUniform(const CUniformName &name, const float fValue);
 
 	// Setting 3x3 matrices
-	void SetUniform(string sName, glm::mat3* mMatrices, int iCount = 1);
-	void SetUniform(string sName, const glm::mat3 mMatrix);
+	void SetUniform(const CUniformName &name, glm::mat3* mMatrices, int iCount = 1);
+	void SetUniform(const CUniformName &name, const glm::mat3 mMatrix);
 
 	// Setting 4x4 matrices
-	void SetUniform(string sName, glm::mat4* mMatrices, int iCount = 1);
-	void SetUniform(string sName, const glm::mat4 mMatrix);
+	void SetUniform(const CUniformName &name, glm::mat4* mMatrices, int iCount = 1);
+	void SetUniform(const CUniformName &name, const glm::mat4 mMatrix);
 
 	// Setting integers
-	void SetUniform(string sName, int* iValues, int iCount = 1);
-	void SetUniform(string sName, const int iValue);
+	void SetUniform(const CUniformName &name, int* iValues, int iCount = 1);
+	void SetUniform(const CUniformName &name, const int iValue);
 
 
 private:
+	// A uniform in the table.  Array elements after the first are in it too, by their own names, but their values aren't kept
+	struct Uniform
+	{
+		string sName;
+		unsigned int uiHash;
+		int iLocation;
+		int iShadowOffset;		// Into m_shadow, or -1 if the value isn't kept
+		int iShadowSize;		// Bytes
+		bool bShadowValid;		// Whether the kept value has been set since linking
+	};
+
+	enum
+	{
+		RELOAD_NONE,
+		RELOAD_COMPILING,
+		RELOAD_LINKING,
+		RELOAD_LOADED			// From the program cache
+	};
+
+	void BindUniformBlocks();
+	void FinishReload();
+	void CancelReload();
+
+	void BuildUniformTable();
+	void AddUniform(const string &sName, int iLocation, int iShadowSize);
+	Uniform *FindUniform(const CUniformName &name);
+
+	// Find the uniform, and return its location if a value of iSize bytes at pValue needs setting, or -1 if it doesn't (because it's
+	// already set, or there's no such uniform)
+	int ChangeUniform(const CUniformName &name, const void *pValue, int iSize);
+
 	UINT m_uiProgram; // ID of program
 	bool m_bLinked; // Whether program was linked and is ready to use
-};
\ No newline at end of file
+	vector<CShader *> m_shaders; // Added since the last link
+	vector<CShader> m_sources; // Copies of the shaders it was last linked from, for reloading and variants
+	CShaderProgram *m_pVariants[NUM_SHADER_VARIANTS]; // Indexed by features.  The first is unused, being this program
+
+	UINT m_uiReloadProgram;
+	vector<CShader> m_reloadShaders;
+	int m_iReloadStage;
+	unsigned long long m_reloadKey; // In the program cache
+
+	vector<Uniform> m_uniforms;
+	vector<int> m_uniformSlots;		// Open addressing hash table of indices into m_uniforms, -1 where empty.  The size is a power of 2
+	vector<BYTE> m_shadow;			// Kept values
+};
@@ -1,10 +1,16 @@
 #include "Common.h"
 
-#include "skybox.h"
+#include "Skybox.h"
+#include "GLState.h"
 
 
 CSkybox::CSkybox()
-{}
+{
+	for (int i = 0; i < 6; i++) {
+		m_faceFirsts[i] = i*4;
+		m_faceCounts[i] = 4;
+	}
+}
 
 CSkybox::~CSkybox()
 {}
@@ -14,14 +20,14 @@ CSkybox::~CSkybox()
 void CSkybox::Create(float size)
 {
 
-	m_cubemapTexture.Create("resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_rt.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_lf.jpg",
-		"resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_up.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_dn.jpg",
-		"resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_bk.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_ft.jpg");
+	m_cubemapTexture.Create("resources/skyboxes/jajdarkland1/flipped/jajdarkland1_rt.jpg", "resources/skyboxes/jajdarkland1/flipped/jajdarkland1_lf.jpg",
+		"resources/skyboxes/jajdarkland1/flipped/jajdarkland1_up.jpg", "resources/skyboxes/jajdarkland1/flipped/jajdarkland1_dn.jpg",
+		"resources/skyboxes/jajdarkland1/flipped/jajdarkland1_bk.jpg", "resources/skyboxes/jajdarkland1/flipped/jajdarkland1_ft.jpg");
 
 	
 	
 	glGenVertexArrays(1, &m_vao);
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 
 	m_vbo.Create();
 	m_vbo.Bind();
@@ -84,14 +90,31 @@ void CSkybox::Create(float size)
 // Render the skybox
 void CSkybox::Render(int textureUnit)
 {
-	glDepthMask(0);
-	glBindVertexArray(m_vao);
+	CGLState::DepthMask(false);
+	CGLState::BindVertexArray(m_vao);
 	m_cubemapTexture.Bind(textureUnit);
 	for (int i = 0; i < 6; i++) {
 		//m_textures[i].Bind();
 		glDrawArrays(GL_TRIANGLE_STRIP, i*4, 4);
 	}
-	glDepthMask(1);
+	CGLState::DepthMask(true);
+}
+
+// Submit the skybox as one packet, drawn before everything else without writing depth
+void CSkybox::Submit(CRenderQueue &queue, DrawPacket packet, int textureUnit)
+{
+	packet.pass = PASS_BACKGROUND;
+	packet.state = STATE_DEPTH_TEST | STATE_CULL_FACE;
+	packet.vao = m_vao;
+	packet.texture = m_cubemapTexture.GetTextureID();
+	packet.textureTarget = GL_TEXTURE_CUBE_MAP;
+	packet.sampler = m_cubemapTexture.GetSamplerID();
+	packet.textureUnit = textureUnit;
+	packet.mode = GL_TRIANGLE_STRIP;
+	packet.pFirsts = m_faceFirsts;
+	packet.pCounts = m_faceCounts;
+	packet.drawCount = 6;
+	queue.Submit(packet);
 }
 
 // Release the storage assocaited with the skybox
@@ -100,6 +123,6 @@ void CSkybox::Release()
 	//for (int i = 0; i < 6; i++)
 		//m_textures[i].Release();
 	m_cubemapTexture.Release();
-	glDeleteVertexArrays(1, &m_vao);
+	CGLState::DeleteVertexArray(m_vao);
 	m_vbo.Release();
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "Texture.h"
 #include "VertexBufferObject.h"
 #include "Cubemap.h"
+#include "RenderQueue.h"
 
 // This is a class for creating and rendering a skybox
 class CSkybox
@@ -12,11 +13,14 @@ public:
 	~CSkybox();
 	void Create(float size);
 	void Render(int textureUnit);
+	void Submit(CRenderQueue &queue, DrawPacket packet, int textureUnit);	// Render through a queue, in the background pass
 	void Release();
 
 private:
 	UINT m_vao;
 	CVertexBufferObject m_vbo;
 	CCubemap m_cubemapTexture;
+	GLint m_faceFirsts[6];		// A triangle strip per face, for glMultiDrawArrays
+	GLsizei m_faceCounts[6];
 	
 };
\ No newline at end of file
@@ -4,6 +4,7 @@
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 #include "Sphere.h"
+#include "GLState.h"
 #include <math.h>
 
 CSphere::CSphere()
@@ -28,7 +29,7 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 	m_texture.SetSamplerObjectParameter(GL_TEXTURE_WRAP_T, GL_REPEAT);
 	
 	glGenVertexArrays(1, &m_vao);
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 
 	m_vbo.Create();
 	m_vbo.Bind();
@@ -98,7 +99,7 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 // Render the sphere as a set of triangles
 void CSphere::Render()
 {
-	glBindVertexArray(m_vao);
+	CGLState::BindVertexArray(m_vao);
 	m_texture.Bind();
 	glDrawElements(GL_TRIANGLES, m_numTriangles*3, GL_UNSIGNED_INT, 0);
 
@@ -108,6 +109,6 @@ void CSphere::Render()
 void CSphere::Release()
 {
 	m_texture.Release();
-	glDeleteVertexArrays(1, &m_vao);
+	CGLState::DeleteVertexArray(m_vao);
 	m_vbo.Release();
 }
\ No newline at end of file
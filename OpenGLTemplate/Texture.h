@@ -7,6 +7,8 @@ public:
 	void CreateFromData(BYTE* data, int width, int height, int bpp, GLenum format, bool generateMipMaps = false);
 	bool Load(string path, bool generateMipMaps = true);
 	void Bind(int textureUnit = 0);
+	UINT GetTextureID();
+	UINT GetSamplerID();
 
 	void SetSamplerObjectParameter(GLenum parameter, GLenum value);
 	void SetSamplerObjectParameterf(GLenum parameter, float value);
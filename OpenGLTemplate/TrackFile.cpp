@@ -0,0 +1,129 @@
+#include "TrackFile.h"
+
+CTrackFile::CTrackFile()
+{
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+	m_pData = NULL;
+	m_size = 0;
+}
+
+CTrackFile::~CTrackFile()
+{
+	Close();
+}
+
+// Map a track file into memory and check its header.  Every section must lie inside the file after the header, so that GetSection can't 
+// read past the end or hand out the header as data
+bool CTrackFile::Open(const string &filename)
+{
+	Close();
+
+	m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart < (long long) sizeof(TrackFileHeader)) {
+		Close();
+		return false;
+	}
+	m_size = (size_t) size.QuadPart;
+
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping != NULL)
+		m_pData = (const unsigned char *) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_pData == NULL) {
+		Close();
+		return false;
+	}
+
+	const TrackFileHeader &header = GetHeader();
+	bool bValid = memcmp(header.magic, "TRAK", 4) == 0 && header.version == VERSION;
+	for (int i = 0; i < TRACK_NUM_SECTIONS && bValid; i++)
+		bValid = header.sectionOffset[i] % 16 == 0 && header.sectionOffset[i] >= sizeof(TrackFileHeader) 
+			&& (size_t) header.sectionOffset[i] + header.sectionSize[i] <= m_size;
+	if (!bValid) {
+		char message[1024];
+		sprintf_s(message, "%s is not a version %u track file", filename.c_str(), VERSION);
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void CTrackFile::Close()
+{
+	if (m_pData != NULL)
+		UnmapViewOfFile(m_pData);
+	if (m_mapping != NULL)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+	m_pData = NULL;
+	m_size = 0;
+}
+
+bool CTrackFile::IsOpen()
+{
+	return m_pData != NULL;
+}
+
+const TrackFileHeader &CTrackFile::GetHeader()
+{
+	return *(const TrackFileHeader *) m_pData;
+}
+
+// Write the header and then each section, padded to a 16 byte boundary
+bool CTrackFile::Write(const string &filename, unsigned long long inputHash, const void *pSections[TRACK_NUM_SECTIONS], const unsigned int sectionSizes[TRACK_NUM_SECTIONS])
+{
+	TrackFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "TRAK", 4);
+	header.version = VERSION;
+	header.inputHash = inputHash;
+
+	unsigned int iOffset = (sizeof(TrackFileHeader) + 15) & ~15u;
+	for (int i = 0; i < TRACK_NUM_SECTIONS; i++) {
+		header.sectionOffset[i] = iOffset;
+		header.sectionSize[i] = sectionSizes[i];
+		iOffset = (iOffset + sectionSizes[i] + 15) & ~15u;
+	}
+
+	FILE *fp;
+	fopen_s(&fp, filename.c_str(), "wb");
+	if (!fp) {
+		char message[1024];
+		sprintf_s(message, "Cannot write track file %s", filename.c_str());
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	static const char padding[16] = { 0 };
+	bool bOk = fwrite(&header, sizeof(header), 1, fp) == 1;
+	unsigned int iPosition = sizeof(header);
+	for (int i = 0; i < TRACK_NUM_SECTIONS && bOk; i++) {
+		bOk = fwrite(padding, 1, header.sectionOffset[i] - iPosition, fp) == header.sectionOffset[i] - iPosition;
+		if (bOk && sectionSizes[i] > 0)
+			bOk = fwrite(pSections[i], sectionSizes[i], 1, fp) == 1;
+		iPosition = header.sectionOffset[i] + sectionSizes[i];
+	}
+	fclose(fp);
+
+	return bOk;
+}
+
+unsigned long long CTrackFile::Hash(const void *pData, size_t size, unsigned long long hash)
+{
+	const unsigned char *p = (const unsigned char *) pData;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Common.h"
+
+// Sections of a binary track file.  Each holds a flat array: glm::vec3 for points and vectors, float for distances and the mesh
+enum TrackFileSection
+{
+	TRACK_CONTROL_POINTS,
+	TRACK_CONTROL_UP_VECTORS,		// Empty if the track has no up vectors
+	TRACK_CONTROL_DISTANCES,		// Cumulative arc length at each control point, plus the total length
+	TRACK_CENTRELINE_POINTS,
+	TRACK_CENTRELINE_UP_VECTORS,	// Empty if the track has no up vectors
+	TRACK_CENTRELINE_DISTANCES,
+	TRACK_CENTRELINE_TANGENTS,
+	TRACK_CENTRELINE_NORMALS,
+	TRACK_CENTRELINE_BINORMALS,
+	TRACK_LEFT_OFFSET_POINTS,
+	TRACK_RIGHT_OFFSET_POINTS,
+	TRACK_MESH,						// Optional: interleaved track vertices, exactly as uploaded to the VBO
+	TRACK_NUM_SECTIONS
+};
+
+// The header at the start of a track file.  Sections follow it, each starting on a 16 byte boundary
+struct TrackFileHeader
+{
+	char magic[4];								// "TRAK"
+	unsigned int version;
+	unsigned long long inputHash;				// Hash of everything the tables were computed from; see CCatmullRom::ComputeInputHash
+	unsigned int sectionOffset[TRACK_NUM_SECTIONS];	// In bytes, from the start of the file
+	unsigned int sectionSize[TRACK_NUM_SECTIONS];	// In bytes
+};
+
+// A binary track file, holding a track's control points together with the tables computed from them, so that large circuits needn't be
+// tessellated again at startup.  Files are memory mapped read-only, and sections are read in place
+class CTrackFile
+{
+public:
+	CTrackFile();
+	~CTrackFile();
+
+	bool Open(const string &filename);		// Returns false if the file is missing or isn't a valid track file of the current version
+	void Close();
+	bool IsOpen();
+
+	const TrackFileHeader &GetHeader();
+
+	// Point pData at a section of the mapped file, and set iCount to the number of elements of type T in it
+	template <typename T> bool GetSection(TrackFileSection section, const T *&pData, unsigned int &iCount)
+	{
+		if (m_pData == NULL || GetHeader().sectionSize[section] % sizeof(T) != 0)
+			return false;
+		pData = (const T *) (m_pData + GetHeader().sectionOffset[section]);
+		iCount = GetHeader().sectionSize[section] / sizeof(T);
+		return true;
+	}
+
+	// Write a track file.  pSections and sectionSizes give the data and size in bytes of every section
+	static bool Write(const string &filename, unsigned long long inputHash, const void *pSections[TRACK_NUM_SECTIONS], const unsigned int sectionSizes[TRACK_NUM_SECTIONS]);
+
+	// 64 bit FNV-1a hash of a block of memory; pass the previous result as hash to hash several blocks together
+	static unsigned long long Hash(const void *pData, size_t size, unsigned long long hash = 14695981039346656037ULL);
+
+	static const unsigned int VERSION = 1;
+
+private:
+	HANDLE m_file;
+	HANDLE m_mapping;
+	const unsigned char *m_pData;			// Start of the mapped view
+	size_t m_size;
+};
@@ -0,0 +1,193 @@
+#include "TrackSpatialIndex.h"
+#include <algorithm>
+#include <cfloat>
+
+CTrackSpatialIndex::CTrackSpatialIndex()
+{
+	m_cellSize = 1.0f;
+	m_numCellsX = 0;
+	m_numCellsZ = 0;
+}
+
+CTrackSpatialIndex::~CTrackSpatialIndex()
+{}
+
+// Bin the segments into cells by their (x, z) bounding boxes.  Cell lists are stored back to back in one array: a first pass counts the
+// segments in each cell, and a second fills them in
+void CTrackSpatialIndex::Build(const vector<glm::vec3> &points, float cellSize)
+{
+	m_points = points;
+	int n = (int) m_points.size();
+	m_cellStart.clear();
+	m_cellSegments.clear();
+	m_numCellsX = m_numCellsZ = 0;
+	if (n == 0)
+		return;
+
+	glm::vec2 boundsMin(m_points[0].x, m_points[0].z), boundsMax = boundsMin;
+	for (int i = 1; i < n; i++) {
+		boundsMin = glm::min(boundsMin, glm::vec2(m_points[i].x, m_points[i].z));
+		boundsMax = glm::max(boundsMax, glm::vec2(m_points[i].x, m_points[i].z));
+	}
+
+	glm::vec2 extent = boundsMax - boundsMin;
+	float fMinCellSize = sqrt(extent.x * extent.y / MAX_CELLS);
+	m_cellSize = cellSize > fMinCellSize ? cellSize : fMinCellSize;
+	m_origin = boundsMin;
+	m_numCellsX = (int) (extent.x / m_cellSize) + 1;
+	m_numCellsZ = (int) (extent.y / m_cellSize) + 1;
+
+	vector<glm::ivec4> ranges(n);
+	for (int i = 0; i < n; i++)
+		ranges[i] = GetCellRange(m_points[i], m_points[(i + 1) % n]);
+
+	m_cellStart.assign(m_numCellsX * m_numCellsZ + 1, 0);
+	for (int i = 0; i < n; i++)
+		for (int z = ranges[i].y; z <= ranges[i].w; z++)
+			for (int x = ranges[i].x; x <= ranges[i].z; x++)
+				m_cellStart[z * m_numCellsX + x + 1]++;
+	for (int c = 0; c < m_numCellsX * m_numCellsZ; c++)
+		m_cellStart[c + 1] += m_cellStart[c];
+
+	m_cellSegments.resize(m_cellStart.back());
+	vector<int> cellFill(m_cellStart.begin(), m_cellStart.end() - 1);
+	for (int i = 0; i < n; i++)
+		for (int z = ranges[i].y; z <= ranges[i].w; z++)
+			for (int x = ranges[i].x; x <= ranges[i].z; x++)
+				m_cellSegments[cellFill[z * m_numCellsX + x]++] = i;
+}
+
+glm::ivec4 CTrackSpatialIndex::GetCellRange(const glm::vec3 &a, const glm::vec3 &b) const
+{
+	return glm::ivec4((int) floor((glm::min(a.x, b.x) - m_origin.x) / m_cellSize), (int) floor((glm::min(a.z, b.z) - m_origin.y) / m_cellSize),
+					  (int) floor((glm::max(a.x, b.x) - m_origin.x) / m_cellSize), (int) floor((glm::max(a.z, b.z) - m_origin.y) / m_cellSize));
+}
+
+// Rebuild the cell lists in one pass over the cells: each list keeps its segments outside the replaced range, renumbered, and has the 
+// new segments that cover its cell merged in, so the lists stay sorted
+void CTrackSpatialIndex::Update(const vector<glm::vec3> &points, float cellSize, int iFirst, int iOldEnd, int iNewEnd)
+{
+	int n = (int) points.size();
+	int iShift = iNewEnd - iOldEnd;
+	if (m_cellStart.empty() || n != (int) m_points.size() + iShift) {
+		Build(points, cellSize);
+		return;
+	}
+
+	// (cell, segment) for each cell each new segment covers, in cell order and then segment order
+	vector<glm::ivec2> added;
+	for (int i = iFirst; i < iNewEnd; i++) {
+		glm::ivec4 range = GetCellRange(points[i], points[(i + 1) % n]);
+		if (range.x < 0 || range.y < 0 || range.z >= m_numCellsX || range.w >= m_numCellsZ) {
+			Build(points, cellSize);
+			return;
+		}
+		for (int z = range.y; z <= range.w; z++)
+			for (int x = range.x; x <= range.z; x++)
+				added.push_back(glm::ivec2(z * m_numCellsX + x, i));
+	}
+	std::sort(added.begin(), added.end(), [](const glm::ivec2 &a, const glm::ivec2 &b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+
+	int iNumCells = m_numCellsX * m_numCellsZ;
+	vector<int> cellStart(iNumCells + 1);
+	vector<int> cellSegments;
+	cellSegments.reserve(m_cellSegments.size() + added.size());
+	int a = 0;
+	for (int c = 0; c < iNumCells; c++) {
+		cellStart[c] = (int) cellSegments.size();
+		for (int k = m_cellStart[c]; k < m_cellStart[c + 1]; k++) {
+			int iSegment = m_cellSegments[k];
+			if (iSegment >= iFirst && iSegment < iOldEnd)
+				continue;
+			if (iSegment >= iOldEnd)
+				iSegment += iShift;
+			for (; a < (int) added.size() && added[a].x == c && added[a].y < iSegment; a++)
+				cellSegments.push_back(added[a].y);
+			cellSegments.push_back(iSegment);
+		}
+		for (; a < (int) added.size() && added[a].x == c; a++)
+			cellSegments.push_back(added[a].y);
+	}
+	cellStart[iNumCells] = (int) cellSegments.size();
+
+	m_points = points;
+	m_cellStart.swap(cellStart);
+	m_cellSegments.swap(cellSegments);
+}
+
+// Test the distance from p to segment iSegment, keeping it if it's the closest so far
+void CTrackSpatialIndex::TestSegment(int iSegment, const glm::vec3 &p, int &iBest, float &tBest, float &bestDistanceSquared) const
+{
+	const glm::vec3 &a = m_points[iSegment];
+	const glm::vec3 &b = m_points[(iSegment + 1) % m_points.size()];
+	glm::vec3 ab = b - a;
+	float fLengthSquared = glm::dot(ab, ab);
+	float t = fLengthSquared > 0.0f ? glm::clamp(glm::dot(p - a, ab) / fLengthSquared, 0.0f, 1.0f) : 0.0f;
+	glm::vec3 d = a + t * ab - p;
+	float fDistanceSquared = glm::dot(d, d);
+	if (fDistanceSquared < bestDistanceSquared) {
+		iBest = iSegment;
+		tBest = t;
+		bestDistanceSquared = fDistanceSquared;
+	}
+}
+
+// With a hint, the closest of the segments around it gives an upper bound d on the distance, and only the cells overlapping the square of 
+// half-width d around p can hold anything closer -- usually one to four cells.  Without one, search square rings of cells outwards from 
+// the cell holding p; once the closest segment found is nearer than any cell outside the rings searched so far, nothing further out can be
+// closer.  The grid is horizontal, so the horizontal distance to a cell is a lower bound on the true distance to the segments in it
+int CTrackSpatialIndex::FindClosestSegment(const glm::vec3 &p, float &t, float &distanceSquared, int iHint) const
+{
+	int n = (int) m_points.size();
+	int iBest = -1;
+	t = 0.0f;
+	distanceSquared = FLT_MAX;
+	if (n == 0)
+		return -1;
+
+	glm::vec2 q = (glm::vec2(p.x, p.z) - m_origin) / m_cellSize;
+
+	if (iHint >= 0 && iHint < n) {
+		for (int i = -HINT_WINDOW; i <= HINT_WINDOW; i++)
+			TestSegment((iHint + i + n) % n, p, iBest, t, distanceSquared);
+
+		float fRadius = sqrt(distanceSquared) / m_cellSize;
+		int x0 = glm::max((int) floor(q.x - fRadius), 0), x1 = glm::min((int) floor(q.x + fRadius), m_numCellsX - 1);
+		int z0 = glm::max((int) floor(q.y - fRadius), 0), z1 = glm::min((int) floor(q.y + fRadius), m_numCellsZ - 1);
+		for (int z = z0; z <= z1; z++) {
+			for (int x = x0; x <= x1; x++) {
+				int c = z * m_numCellsX + x;
+				for (int k = m_cellStart[c]; k < m_cellStart[c + 1]; k++)
+					TestSegment(m_cellSegments[k], p, iBest, t, distanceSquared);
+			}
+		}
+		return iBest;
+	}
+
+	int cx = glm::clamp((int) floor(q.x), 0, m_numCellsX - 1);
+	int cz = glm::clamp((int) floor(q.y), 0, m_numCellsZ - 1);
+	int iMaxRing = glm::max(glm::max(cx, m_numCellsX - 1 - cx), glm::max(cz, m_numCellsZ - 1 - cz));
+
+	for (int r = 0; r <= iMaxRing; r++) {
+		for (int z = cz - r; z <= cz + r; z++) {
+			if (z < 0 || z >= m_numCellsZ)
+				continue;
+			// Whole rows at the top and bottom of the ring, only the two end cells in between
+			int iStepX = (z == cz - r || z == cz + r) ? 1 : 2 * r;
+			for (int x = cx - r; x <= cx + r; x += iStepX > 0 ? iStepX : 1) {
+				if (x < 0 || x >= m_numCellsX)
+					continue;
+				int c = z * m_numCellsX + x;
+				for (int k = m_cellStart[c]; k < m_cellStart[c + 1]; k++)
+					TestSegment(m_cellSegments[k], p, iBest, t, distanceSquared);
+			}
+		}
+
+		// Distance from p to the nearest cell outside the square of rings 0..r
+		float fGap = glm::min(glm::min(q.x - (cx - r), (cx + r + 1) - q.x), glm::min(q.y - (cz - r), (cz + r + 1) - q.y)) * m_cellSize;
+		if (fGap > 0.0f && distanceSquared <= fGap * fGap)
+			break;
+	}
+
+	return iBest;
+}
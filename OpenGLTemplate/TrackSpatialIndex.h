@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Common.h"
+
+// A uniform grid over the segments of a closed polyline (the track centreline) in the horizontal (x, z) plane, used to find the segment
+// closest to a point.  Each cell lists the segments whose bounding box overlaps it
+class CTrackSpatialIndex
+{
+public:
+	CTrackSpatialIndex();
+	~CTrackSpatialIndex();
+
+	// Build the grid over the segments points[i] -> points[i + 1], with the last segment closing the loop.  The cell size is raised if
+	// needed to keep the grid within MAX_CELLS cells
+	void Build(const vector<glm::vec3> &points, float cellSize);
+
+	// After an edit replaced segments [iFirst, iOldEnd) with [iFirst, iNewEnd) and renumbered the ones after them, bring the grid up to 
+	// date with the new points.  Only the replaced and new segments are binned; the other cell lists are copied across.  If a new segment 
+	// is outside the grid, the grid is built again with cellSize
+	void Update(const vector<glm::vec3> &points, float cellSize, int iFirst, int iOldEnd, int iNewEnd);
+
+	// Find the segment closest to p, and the parameter t (0..1) of the closest point on it.  If iHint is a valid segment (such as the result
+	// for the same object last frame), the segments around it are tested first, and bound the search to the few cells around p
+	int FindClosestSegment(const glm::vec3 &p, float &t, float &distanceSquared, int iHint = -1) const;
+
+	static const int MAX_CELLS = 1 << 20;
+	static const int HINT_WINDOW = 2;		// Segments either side of the hint tested before the grid
+
+private:
+	glm::ivec4 GetCellRange(const glm::vec3 &a, const glm::vec3 &b) const;	// Cells [x0, x1] x [z0, z1] a segment's bounding box covers
+	void TestSegment(int iSegment, const glm::vec3 &p, int &iBest, float &tBest, float &bestDistanceSquared) const;
+
+	vector<glm::vec3> m_points;
+	glm::vec2 m_origin;					// (x, z) of the corner of cell (0, 0)
+	float m_cellSize;
+	int m_numCellsX;
+	int m_numCellsZ;
+	vector<int> m_cellStart;			// Segments of cell c are m_cellSegments[m_cellStart[c] .. m_cellStart[c + 1] - 1]
+	vector<int> m_cellSegments;
+};
@@ -0,0 +1,68 @@
+#include "UniformBuffer.h"
+#include "GLState.h"
+
+const char *const UNIFORM_BLOCK_NAMES[NUM_UNIFORM_BLOCKS] = { "FrameBlock", "LightBlock", "MaterialBlock", "ObjectBlock" };
+
+CUniformBuffer::CUniformBuffer()
+{
+	m_ubo = 0;
+	m_blockSize = m_stride = 0;
+	m_capacity = 0;
+}
+
+CUniformBuffer::~CUniformBuffer()
+{}
+
+void CUniformBuffer::Create(int iBlockSize)
+{
+	int iAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &iAlignment);
+	if (iAlignment < 1)
+		iAlignment = 256;
+
+	glGenBuffers(1, &m_ubo);
+	m_blockSize = iBlockSize;
+	m_stride = (iBlockSize + iAlignment - 1) / iAlignment * iAlignment;
+	m_capacity = 0;
+	m_data.clear();
+}
+
+void CUniformBuffer::Release()
+{
+	if (m_ubo == 0)
+		return;
+	CGLState::DeleteBuffer(m_ubo);
+	m_ubo = 0;
+	m_capacity = 0;
+	m_data.clear();
+}
+
+void CUniformBuffer::SetBlock(int iBlock, const void *pData)
+{
+	int iEnd = (iBlock + 1) * m_stride;
+	if ((int) m_data.size() < iEnd)
+		m_data.resize(iEnd);
+	memcpy(&m_data[iBlock * m_stride], pData, m_blockSize);
+}
+
+void CUniformBuffer::Upload(int iNumBlocks)
+{
+	int iSize = iNumBlocks * m_stride;
+	if (iSize <= 0 || iSize > (int) m_data.size())
+		return;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, m_ubo);
+	if (iSize > m_capacity) {
+		glBufferData(GL_UNIFORM_BUFFER, iSize, &m_data[0], GL_DYNAMIC_DRAW);
+		m_capacity = iSize;
+	} else {
+		glBufferData(GL_UNIFORM_BUFFER, m_capacity, NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, iSize, &m_data[0]);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void CUniformBuffer::Bind(int iBinding, int iBlock)
+{
+	CGLState::BindBufferRange(iBinding, m_ubo, iBlock * m_stride, m_blockSize);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Common.h"
+
+// Binding points of the uniform blocks the shaders share.  Linking a CShaderProgram binds any of its blocks with these names to them,
+// so every program sees the same buffers
+enum UniformBlockBinding
+{
+	UNIFORM_BLOCK_FRAME,		// FrameBlock: the projection and view matrices, set once a frame
+	UNIFORM_BLOCK_LIGHTS,		// LightBlock: light1, set once a frame
+	UNIFORM_BLOCK_MATERIAL,		// MaterialBlock: material1, one of the render queue's materials
+	UNIFORM_BLOCK_OBJECT,		// ObjectBlock: the modelview and normal matrices, one of the render queue's packets
+	NUM_UNIFORM_BLOCKS
+};
+
+extern const char *const UNIFORM_BLOCK_NAMES[NUM_UNIFORM_BLOCKS];
+
+// The blocks, laid out as std140 lays them out in the shaders: a vec3 starts on a 16 byte boundary, and a mat3 is three vec4 columns
+struct FrameUniforms
+{
+	glm::mat4 projMatrix;
+	glm::mat4 viewMatrix;
+};
+
+struct LightUniforms
+{
+	glm::vec4 position;			// In eye coordinates
+	glm::vec3 La;
+	float padding0;
+	glm::vec3 Ld;
+	float padding1;
+	glm::vec3 Ls;
+	float padding2;
+};
+
+struct MaterialUniforms
+{
+	glm::vec3 Ma;
+	float padding0;
+	glm::vec3 Md;
+	float padding1;
+	glm::vec3 Ms;
+	float shininess;
+};
+
+struct ObjectUniforms
+{
+	glm::mat4 modelViewMatrix;
+	glm::vec4 normalMatrix[3];
+};
+
+// A uniform buffer holding a number of blocks of the same size, each starting on the driver's offset alignment, so any one of them
+// can be bound with glBindBufferRange.  Blocks are set in a copy in memory, and uploaded together
+class CUniformBuffer
+{
+public:
+	CUniformBuffer();
+	~CUniformBuffer();
+
+	void Create(int iBlockSize);
+	void Release();
+
+	// Copy a block into the buffer's memory, growing it if need be
+	void SetBlock(int iBlock, const void *pData);
+
+	// Upload the first iNumBlocks blocks.  The old contents are orphaned, so a draw still using them doesn't hold the upload up
+	void Upload(int iNumBlocks);
+
+	// Bind a block to a binding point
+	void Bind(int iBinding, int iBlock);
+
+private:
+	UINT m_ubo;
+	int m_blockSize;
+	int m_stride;					// The block size rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	int m_capacity;					// Bytes allocated on the GPU
+	vector<BYTE> m_data;
+};
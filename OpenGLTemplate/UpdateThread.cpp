@@ -0,0 +1,89 @@
+#include "UpdateThread.h"
+
+CUpdateThread::CUpdateThread()
+{
+	m_numUpdates = 0;
+	m_interpolation = 1.0f;
+	m_busy = false;
+	m_quit = false;
+#ifdef _WIN32
+	m_ownerThreadId = 0;
+#endif
+}
+
+CUpdateThread::~CUpdateThread()
+{
+	Release();
+}
+
+void CUpdateThread::Create(const std::function<void(int, float)> &update)
+{
+	Release();
+
+	m_update = update;
+	m_busy = false;
+	m_quit = false;
+#ifdef _WIN32
+	m_ownerThreadId = GetCurrentThreadId();
+#endif
+	m_thread = std::thread(&CUpdateThread::Run, this);
+}
+
+void CUpdateThread::Release()
+{
+	if (!m_thread.joinable())
+		return;
+
+	Finish();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_started.notify_one();
+	m_thread.join();
+}
+
+void CUpdateThread::Start(int iNumUpdates, float fInterpolation)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_numUpdates = iNumUpdates;
+		m_interpolation = fInterpolation;
+		m_busy = true;
+	}
+	m_started.notify_one();
+}
+
+void CUpdateThread::Finish()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_finished.wait(lock, [this] { return !m_busy; });
+}
+
+void CUpdateThread::Run()
+{
+#ifdef _WIN32
+	// GetKeyState reads the calling thread's input state, so share the window thread's, or the camera would never see a key pressed
+	AttachThreadInput(GetCurrentThreadId(), m_ownerThreadId, TRUE);
+#endif
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_started.wait(lock, [this] { return m_busy || m_quit; });
+		if (m_quit)
+			break;
+
+		int iNumUpdates = m_numUpdates;
+		float fInterpolation = m_interpolation;
+		lock.unlock();
+		m_update(iNumUpdates, fInterpolation);
+		lock.lock();
+
+		m_busy = false;
+		m_finished.notify_one();
+	}
+
+#ifdef _WIN32
+	AttachThreadInput(GetCurrentThreadId(), m_ownerThreadId, FALSE);
+#endif
+}
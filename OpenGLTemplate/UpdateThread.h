@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Common.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs the game's updates on a worker thread, so that the next frame is simulated while the calling thread draws this one.  The
+// hand-off is strict: Start gives the worker a batch of updates and returns at once, and Finish blocks until the batch is done.
+// Between the two the worker owns the simulation state and the snapshot it is writing, and the caller must touch neither; after
+// Finish the caller owns everything again and the worker sleeps until the next Start.  The mutex makes everything the worker
+// wrote visible to the caller once Finish returns, and vice versa for Start
+class CUpdateThread
+{
+public:
+	CUpdateThread();
+	~CUpdateThread();
+
+	// Start the worker thread.  Each batch calls update(iNumUpdates, fInterpolation) on it
+	void Create(const std::function<void(int, float)> &update);
+	void Release();		// Finishes the current batch, if any, and stops the worker
+
+	void Start(int iNumUpdates, float fInterpolation);
+	void Finish();
+
+private:
+	void Run();
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_started;		// Signalled when a batch is handed over, or the worker should quit
+	std::condition_variable m_finished;		// Signalled when a batch is done
+	std::function<void(int, float)> m_update;
+
+	int m_numUpdates;
+	float m_interpolation;
+	bool m_busy;		// A batch has been started and not finished
+	bool m_quit;
+#ifdef _WIN32
+	DWORD m_ownerThreadId;
+#endif
+};
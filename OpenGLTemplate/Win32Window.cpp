@@ -1,4 +1,4 @@
-#include "gamewindow.h"
+#include "Win32Window.h"
 
 #include "include/gl/glew.h"
 #include "include/gl/wglew.h"
@@ -6,14 +6,7 @@
 
 #define SIMPLE_OPENGL_CLASS_NAME "simple_openGL_class_name"
 
-GameWindow& GameWindow::GetInstance() 
-{
-  static GameWindow instance;
-
-  return instance;
-}
-
-GameWindow::GameWindow() : m_fullscreen(false) 
+Win32Window::Win32Window(HINSTANCE hinstance) : m_fullscreen(false), m_hdc(NULL), m_hinstance(hinstance), m_hrc(NULL), m_hwnd(NULL), m_class(NULL)
 {
 }
 
@@ -35,7 +28,7 @@ LRESULT CALLBACK MsgHandlerSimpleOpenGLClass(HWND hWnd, UINT uiMsg, WPARAM wPara
 }
 
 // A function to register the dummy window
-void GameWindow::RegisterSimpleOpenGLClass(HINSTANCE hInstance)
+void Win32Window::RegisterSimpleOpenGLClass(HINSTANCE hInstance)
 {
 	static bool bClassRegistered = false;
 	if(bClassRegistered) return;
@@ -59,7 +52,7 @@ void GameWindow::RegisterSimpleOpenGLClass(HINSTANCE hInstance)
 }
 
 // Create a dummy window, intialise GLEW, and then delete the dummy window
-bool GameWindow::InitGLEW()
+bool Win32Window::InitGLEW()
 {
 	static bool bGlewInitialized = false;
 	if(bGlewInitialized) return true;
@@ -114,26 +107,21 @@ bool GameWindow::InitGLEW()
 }
 
 // Initialise GLEW and create the real game window
-HDC GameWindow::Init(HINSTANCE hinstance) 
+bool Win32Window::Init() 
 {
-	m_hinstance = hinstance;
 	if(!InitGLEW())
-		return NULL;
+		return false;
 
 	m_appName = "OpenGL";
 
 	CreateGameWindow("OpenGL Template");
 
 	// If we never got a valid window handle, quit the program
-	if(m_hwnd == NULL) {
-		return NULL;
-	} else {
-		return m_hdc;
-	}
+	return m_hwnd != NULL && m_hrc != NULL;
 }
 
 // Create the game window
-void GameWindow::CreateGameWindow(string sTitle) 
+void Win32Window::CreateGameWindow(string sTitle) 
 {
 	WNDCLASSEX wcex;
 	memset(&wcex, 0, sizeof(WNDCLASSEX));
@@ -190,7 +178,7 @@ void GameWindow::CreateGameWindow(string sTitle)
 }
 
 // Initialise OpenGL, including the pixel format descriptor and the OpenGL version
-void GameWindow::InitOpenGL()
+void Win32Window::InitOpenGL()
 {
 
 	m_hdc = GetDC(m_hwnd);
@@ -274,7 +262,7 @@ void GameWindow::InitOpenGL()
 }
 
 // Deinitialise the window and rendering context
-void GameWindow::Deinit()
+void Win32Window::Deinit()
 {
 	if (m_hrc) {
 		wglMakeCurrent(NULL, NULL);
@@ -292,4 +280,25 @@ void GameWindow::Deinit()
 
 	UnregisterClass(m_class, m_hinstance);
 	PostQuitMessage(0);
-}
\ No newline at end of file
+}
+
+// Dispatch any waiting messages.  Returns false once WM_QUIT arrives, with its exit code
+bool Win32Window::ProcessMessages(int &exitCode)
+{
+	MSG msg;
+	while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+		if (msg.message == WM_QUIT) {
+			exitCode = (int) msg.wParam;
+			return false;
+		}
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+	return true;
+}
+
+// Show the frame just rendered
+void Win32Window::SwapBuffers()
+{
+	::SwapBuffers(m_hdc);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "GameWindow.h"
+
+LRESULT CALLBACK WinProc(HWND hWnd,UINT uMsg, WPARAM wParam, LPARAM lParam);
+
+// A desktop window with a WGL context.  Messages go to WinProc
+class Win32Window : public GameWindow {
+public:
+	Win32Window(HINSTANCE hinstance);
+
+	bool Init();
+	void Deinit();
+	bool ProcessMessages(int &exitCode);
+	void SwapBuffers();
+
+	bool Fullscreen() const { return m_fullscreen; }
+
+	HDC Hdc() const { return m_hdc; }
+	HINSTANCE Hinstance() const { return m_hinstance; }
+	HGLRC Hrc() const { return m_hrc; }
+	HWND  Hwnd() const { return m_hwnd; }
+
+private:
+	void CreateGameWindow(string title);
+	void InitOpenGL();
+	bool InitGLEW();
+	void RegisterSimpleOpenGLClass(HINSTANCE hInstance);
+
+	bool  m_fullscreen;
+
+	HDC   m_hdc;
+	HINSTANCE m_hinstance;
+	HGLRC m_hrc;
+	HWND  m_hwnd;
+
+	LPSTR m_class;
+
+	string m_appName;
+
+};
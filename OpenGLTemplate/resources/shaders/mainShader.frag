@@ -1,5 +1,8 @@
 #version 400 core
 
+// Built in variants (see CShaderProgram::GetVariant): RENDER_SKYBOX takes the colour from the cube map, USE_TEXTURE from the
+// texture, and neither from the vertex colour
+
 in vec3 vColour;			// Interpolated colour using colour calculated in the vertex shader
 in vec2 vTexCoord;			// Interpolated texture coordinate using texture coordinate from the vertex shader
 
@@ -7,29 +10,18 @@ out vec4 vOutputColour;		// The output colour
 
 uniform sampler2D sampler0;  // The texture sampler
 uniform samplerCube CubeMapTex;
-uniform bool bUseTexture;    // A flag indicating if texture-mapping should be applied
-uniform bool renderSkybox;
 in vec3 worldPosition;
 
 
 void main()
 {
-
-
-	if (renderSkybox) {
-        vOutputColour = texture(CubeMapTex, worldPosition);
-    } else {
-        // Get the texel colour from the texture sampler
-        vec4 vTexColour = texture(sampler0, vTexCoord);
-
-        if (bUseTexture)
-            // Use the raw texture color
-            vOutputColour = vTexColour;  
-        else
-            // Or just the vertex colour if texture is off
-            vOutputColour = vec4(vColour, 1.0f);
-    }
-
-	
-	
+#if defined(RENDER_SKYBOX)
+	vOutputColour = texture(CubeMapTex, worldPosition);
+#elif defined(USE_TEXTURE)
+	// Use the raw texture color
+	vOutputColour = texture(sampler0, vTexCoord);
+#else
+	// Or just the vertex colour if texture is off
+	vOutputColour = vec4(vColour, 1.0f);
+#endif
 }
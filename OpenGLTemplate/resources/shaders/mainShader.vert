@@ -1,9 +1,15 @@
 #version 400 core
 
-// Structure for matrices
-uniform struct Matrices
+// The projection and view matrices, set once a frame
+layout (std140) uniform FrameBlock
 {
 	mat4 projMatrix;
+	mat4 viewMatrix;
+} frame;
+
+// The object's matrices
+layout (std140) uniform ObjectBlock
+{
 	mat4 modelViewMatrix; 
 	mat3 normalMatrix;
 } matrices;
@@ -26,9 +32,16 @@ struct MaterialInfo
 	float shininess;
 };
 
-// Lights and materials passed in as uniform variables from client programme
-uniform LightInfo light1; 
-uniform MaterialInfo material1; 
+// Lights and materials passed in as uniform blocks from client programme, shared by every program
+layout (std140) uniform LightBlock
+{
+	LightInfo light1;
+};
+
+layout (std140) uniform MaterialBlock
+{
+	MaterialInfo material1;
+};
 
 // Layout of vertex attributes in VBO
 layout (location = 0) in vec3 inPosition;
@@ -71,7 +84,7 @@ void main()
 	worldPosition = inPosition;
 
 	// Transform the vertex spatial position using 
-	gl_Position = matrices.projMatrix * matrices.modelViewMatrix * vec4(inPosition, 1.0f);
+	gl_Position = frame.projMatrix * matrices.modelViewMatrix * vec4(inPosition, 1.0f);
 	
 	// Get the vertex normal and vertex position in eye coordinates
 	vec3 vEyeNorm = normalize(matrices.normalMatrix * inNormal);
@@ -1,9 +1,15 @@
 #version 400 core
 
-// Structure for matrices
-uniform struct Matrices
+// The projection and view matrices, set once a frame
+layout (std140) uniform FrameBlock
 {
 	mat4 projMatrix;
+	mat4 viewMatrix;
+} frame;
+
+// The object's matrices
+layout (std140) uniform ObjectBlock
+{
 	mat4 modelViewMatrix; 
 	mat3 normalMatrix;
 } matrices;
@@ -25,8 +31,15 @@ struct MaterialInfo
 	float shininess;
 };
 
-uniform LightInfo light1; 
-uniform MaterialInfo material1; 
+layout (std140) uniform LightBlock
+{
+	LightInfo light1;
+};
+
+layout (std140) uniform MaterialBlock
+{
+	MaterialInfo material1;
+};
 
 // Layout of vertex attributes in VBO
 layout (location = 0) in vec3 inPosition;
@@ -39,12 +52,12 @@ void main()
 {	
 
 	// Normally, one would simply transform the vertex spatial position using 
-	// gl_Position = matrices.projMatrix * matrices.modelViewMatrix * vec4(inPosition, 1.0);
+	// gl_Position = frame.projMatrix * matrices.modelViewMatrix * vec4(inPosition, 1.0);
 	
 	// However in this lab we're going to play with the vertex position before this transformation
 	vec3 p = inPosition;
 
-	gl_Position = matrices.projMatrix * matrices.modelViewMatrix * vec4(p, 1.0);
+	gl_Position = frame.projMatrix * matrices.modelViewMatrix * vec4(p, 1.0);
 
 	// This code implements the Blinn-Phong reflectance model (to be discussed in Lecture 6)
 	// Code based on the OpenGL 4.0 Shading Language Cookbook, pages 92 - 93